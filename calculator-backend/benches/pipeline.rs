@@ -0,0 +1,328 @@
+// ./benches/pipeline.rs
+// Benchmarks of every stage of the calculator pipeline, from tokenization to evaluation in the C library.
+//
+// Run with `cargo bench --bench pipeline`. Arguments after `--`:
+// * `FILTER`: Only runs the benchmarks whose name contains `FILTER`.
+// * `--save-baseline NAME`: Saves the results as baseline `NAME`.
+// * `--baseline NAME`: Compares the results with baseline `NAME`.
+// * `--quick`: Takes fewer, shorter samples.
+//
+// Baselines are plain text files in `target/bench-baselines`.
+
+use std::collections::HashMap;
+use std::fs;
+use std::hint::black_box;
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+use calculator_backend::{
+    calculate_batch, calculate_batch_par, calculate_expression, calculate_expression_into, calculate_rpn, convert_rpn, infix_to_rpn,
+    set_jit_threshold, set_vector_isa, tokenize, vector_isa, CReversePolishExpression, CompiledBatch, CompiledExpression,
+    EvalContext, ExpressionCache, History, ProgramLibrary, ProgramLibraryBuilder, ResultBuf, VECTOR_ISAS,
+};
+
+/// Command line options of the benchmark harness.
+struct Options {
+    filter: Option<String>,
+    save_baseline: Option<String>,
+    baseline: Option<String>,
+    sample_count: usize,
+    sample_time: Duration,
+}
+
+impl Options {
+    fn from_args() -> Self {
+        let mut options = Options {
+            filter: None,
+            save_baseline: None,
+            baseline: None,
+            sample_count: 20,
+            sample_time: Duration::from_millis(25),
+        };
+        let mut args = std::env::args().skip(1);
+        while let Some(arg) = args.next() {
+            match arg.as_str() {
+                // Passed by `cargo bench`
+                "--bench" => {}
+                "--save-baseline" => options.save_baseline = args.next(),
+                "--baseline" => options.baseline = args.next(),
+                "--quick" => {
+                    options.sample_count = 5;
+                    options.sample_time = Duration::from_millis(5);
+                }
+                _ if arg.starts_with("--") => eprintln!("Ignoring unknown option {}", arg),
+                _ => options.filter = Some(arg),
+            }
+        }
+        options
+    }
+}
+
+/// Runs benchmarks and records their median time per iteration.
+struct Harness {
+    options: Options,
+    baseline: HashMap<String, f64>,
+    results: Vec<(String, f64)>,
+}
+
+impl Harness {
+    fn new(options: Options) -> Self {
+        let baseline = match &options.baseline {
+            Some(name) => load_baseline(name),
+            None => HashMap::new(),
+        };
+        println!("{:<44} {:>14} {:>16} {:>10}", "benchmark", "time/iter", "expressions/s", "change");
+        Harness { options, baseline, results: Vec::new() }
+    }
+
+    /// Measures `routine`, which evaluates `expressions` expressions per call.
+    fn bench<R>(&mut self, name: &str, expressions: usize, mut routine: impl FnMut() -> R) {
+        if let Some(filter) = &self.options.filter {
+            if !name.contains(filter.as_str()) {
+                return;
+            }
+        }
+
+        // Calibrate the number of iterations so a sample takes about `sample_time`
+        let mut iterations: u64 = 1;
+        loop {
+            let start = Instant::now();
+            for _ in 0..iterations {
+                black_box(routine());
+            }
+            if start.elapsed() >= self.options.sample_time / 4 || iterations >= 1 << 30 {
+                let per_iter = start.elapsed().as_secs_f64() / iterations as f64;
+                iterations = ((self.options.sample_time.as_secs_f64() / per_iter.max(1e-9)) as u64).max(1);
+                break;
+            }
+            iterations *= 2;
+        }
+
+        let mut samples: Vec<f64> = (0..self.options.sample_count)
+            .map(|_| {
+                let start = Instant::now();
+                for _ in 0..iterations {
+                    black_box(routine());
+                }
+                start.elapsed().as_nanos() as f64 / iterations as f64
+            })
+            .collect();
+        samples.sort_by(|a, b| a.partial_cmp(b).unwrap());
+        let median = samples[samples.len() / 2];
+
+        let change = match self.baseline.get(name) {
+            Some(&base) => format!("{:+.1}%", (median - base) / base * 100.0),
+            None => String::new(),
+        };
+        println!(
+            "{:<44} {:>14} {:>16.0} {:>10}",
+            name,
+            format_time(median),
+            expressions as f64 * 1e9 / median,
+            change
+        );
+        self.results.push((name.to_string(), median));
+    }
+
+    fn finish(self) {
+        if let Some(name) = &self.options.save_baseline {
+            let path = baseline_path(name);
+            fs::create_dir_all(path.parent().unwrap()).expect("Failed to create the baseline directory");
+            let contents: String = self
+                .results
+                .iter()
+                .map(|(name, nanos)| format!("{}\t{}\n", name, nanos))
+                .collect();
+            fs::write(&path, contents).expect("Failed to write the baseline");
+            println!("Saved baseline to {}", path.display());
+        }
+    }
+}
+
+fn baseline_path(name: &str) -> PathBuf {
+    PathBuf::from(env!("CARGO_MANIFEST_DIR"))
+        .join("target")
+        .join("bench-baselines")
+        .join(format!("{}.txt", name))
+}
+
+fn load_baseline(name: &str) -> HashMap<String, f64> {
+    let path = baseline_path(name);
+    let contents = match fs::read_to_string(&path) {
+        Ok(contents) => contents,
+        Err(e) => {
+            eprintln!("Failed to read baseline {}: {}", path.display(), e);
+            return HashMap::new();
+        }
+    };
+    contents
+        .lines()
+        .filter_map(|line| {
+            let (name, nanos) = line.split_once('\t')?;
+            Some((name.to_string(), nanos.parse().ok()?))
+        })
+        .collect()
+}
+
+fn format_time(nanos: f64) -> String {
+    if nanos < 1e3 {
+        format!("{:.1} ns", nanos)
+    } else if nanos < 1e6 {
+        format!("{:.2} µs", nanos / 1e3)
+    } else {
+        format!("{:.2} ms", nanos / 1e6)
+    }
+}
+
+/// The expression shapes every stage is measured on.
+fn workloads() -> Vec<(&'static str, String)> {
+    // 1 + (2 * (3 + (4 * ...))), which keeps 50 values on the evaluation stack
+    let mut deep = String::new();
+    for i in 1..50 {
+        deep.push_str(&format!("{} {} (", i, if i % 2 == 0 { "*" } else { "+" }));
+    }
+    deep.push_str("50");
+    deep.push_str(&")".repeat(49));
+
+    // 1 + 2 + ... + 400, just under the C library's token limit
+    let flat = (1..=400).map(|i| i.to_string()).collect::<Vec<String>>().join(" + ");
+
+    vec![
+        ("short", "3 * 4 - 5".to_string()),
+        ("deep_nested", deep),
+        ("long_flat", flat),
+        ("trig_log", "sin(pi / 4) * cos(pi / 3) + tan(0.5) - log(100) + ln(e) + arctan(1) + √ 16".to_string()),
+    ]
+}
+
+fn main() {
+    let mut harness = Harness::new(Options::from_args());
+    let history = History::new();
+
+    for (workload, input) in workloads() {
+        let input = input.as_str();
+        let result = calculate_expression(input, &mut History::new());
+        assert!(result.success, "Workload {} fails: {}", workload, result.message);
+
+        let rpn = infix_to_rpn(input, &history).unwrap();
+        let rpn_str = rpn.to_string();
+        let expr_ptrs = rpn.to_c_expr();
+        let c_expr = CReversePolishExpression {
+            crpn_expression: expr_ptrs.as_ptr(),
+            length: expr_ptrs.len(),
+        };
+        let program = rpn.compile().unwrap();
+        let mut cache = ExpressionCache::new(16);
+        let mut lean_history = History::last_result_only();
+        let mut out = ResultBuf::new();
+
+        harness.bench(&format!("{}/tokenize", workload), 1, || tokenize(black_box(input)).count());
+        harness.bench(&format!("{}/infix_to_rpn", workload), 1, || infix_to_rpn(black_box(input), &history));
+        harness.bench(&format!("{}/calculate_rpn", workload), 1, || unsafe { calculate_rpn(black_box(&c_expr)) });
+        harness.bench(&format!("{}/calculate_rpn_typed", workload), 1, || black_box(&rpn).calculate());
+        harness.bench(&format!("{}/evaluate_compiled", workload), 1, || program.evaluate());
+        harness.bench(&format!("{}/convert_rpn", workload), 1, || convert_rpn(black_box(rpn_str.clone())));
+        harness.bench(&format!("{}/calculate_expression", workload), 1, || {
+            // A fresh history each time, so `History` growth is not measured
+            calculate_expression(black_box(input), &mut History::new())
+        });
+        harness.bench(&format!("{}/calculate_expression_into", workload), 1, || {
+            calculate_expression_into(black_box(input), &mut lean_history, &mut out)
+        });
+        harness.bench(&format!("{}/cache_hit", workload), 1, || {
+            cache.calculate_expression(black_box(input), &mut History::new())
+        });
+    }
+
+    // Many independent expressions of every shape
+    let workloads = workloads();
+    let inputs: Vec<&str> = workloads
+        .iter()
+        .map(|(_, input)| input.as_str())
+        .cycle()
+        .take(4_000)
+        .collect();
+    harness.bench("batch/calculate_expression", inputs.len(), || {
+        let mut history = History::new();
+        inputs.iter().map(|input| calculate_expression(input, &mut history).result).sum::<f64>()
+    });
+    harness.bench("batch/calculate_batch", inputs.len(), || calculate_batch(&inputs));
+    harness.bench("batch/calculate_batch_par", inputs.len(), || calculate_batch_par(&inputs));
+
+    // One expression over many rows
+    let program = infix_to_rpn("sin(x) * cos(y) + x ^ 2 / (y + 1)", &history).unwrap().compile().unwrap();
+    let x: Vec<f64> = (0..100_000).map(|i| i as f64 * 1e-3).collect();
+    let y: Vec<f64> = (0..100_000).map(|i| i as f64 * 2e-3).collect();
+    harness.bench("columns/evaluate_columns", x.len(), || {
+        program.evaluate_columns(&[("x", &x), ("y", &y)]).unwrap()
+    });
+
+    // Square roots and checked domains over the same rows, with each kernel the CPU runs
+    let program = infix_to_rpn("sqrt(x) + ln(y) * log(x + 1) - arcsin(x / 100)", &history).unwrap().compile().unwrap();
+    let initial = vector_isa();
+    for isa in VECTOR_ISAS.into_iter().filter(|isa| isa.is_supported()) {
+        set_vector_isa(isa).unwrap();
+        harness.bench(&format!("columns/kernels_{:?}", isa).to_lowercase(), x.len(), || {
+            program.evaluate_columns(&[("x", &x), ("y", &y)]).unwrap()
+        });
+    }
+    set_vector_isa(initial).unwrap();
+
+    // Many expressions sharing subterms over the same rows, one by one and as a batch
+    let programs: Vec<CompiledExpression> = (0..200)
+        .map(|k| {
+            let input = format!("sin(x) * cos(y) * {} + sqrt(x ^ 2 + y ^ 2) / (1 + x * y) - {}", k % 7 + 1, k);
+            infix_to_rpn(&input, &history).unwrap().compile().unwrap()
+        })
+        .collect();
+    let batch = CompiledBatch::new(&programs.iter().collect::<Vec<_>>()).unwrap();
+    let (x, y) = (&x[..10_000], &y[..10_000]);
+    harness.bench("columns/formulas_each", programs.len() * x.len(), || {
+        programs.iter().map(|program| program.evaluate_columns(&[("x", x), ("y", y)]).unwrap()).collect::<Vec<_>>()
+    });
+    harness.bench("columns/formulas_shared", programs.len() * x.len(), || {
+        batch.evaluate_columns(&[("x", x), ("y", y)]).unwrap()
+    });
+
+    // Bounds of one expression over a region, from a grid of points or from intervals
+    let program = infix_to_rpn("sin(x) * cos(y) + x ^ 2 / (y + 1)", &history).unwrap().compile().unwrap();
+    let (grid_x, grid_y): (Vec<f64>, Vec<f64>) =
+        (0..100_000).map(|i| (-2.0 + (i / 250) as f64 * 0.01, (i % 250) as f64 * 0.012)).unzip();
+    harness.bench("intervals/grid_sweep", 1, || {
+        let values = program.evaluate_columns(&[("x", &grid_x), ("y", &grid_y)]).unwrap().values;
+        values.iter().fold((f64::INFINITY, f64::NEG_INFINITY), |(low, high), &value| (low.min(value), high.max(value)))
+    });
+    let region = [("x", -2.0..=2.0), ("y", 0.0..=3.0)];
+    harness.bench("intervals/evaluate_interval", 1, || program.evaluate_interval(black_box(&region)).unwrap());
+    harness.bench("intervals/bounds_256", 1, || program.bounds(black_box(&region), 256).unwrap());
+
+    // The same formulas at startup, parsed and compiled or loaded from a precompiled library
+    let formulas: Vec<(String, String)> = (0..200)
+        .map(|k| (format!("f{:03}", k), format!("sin(x) * cos(y) * {} + sqrt(x ^ 2 + y ^ 2) / (1 + x * y) - {}", k % 7 + 1, k)))
+        .collect();
+    let mut builder = ProgramLibraryBuilder::new();
+    for (name, input) in &formulas {
+        builder.add(name, input).unwrap();
+    }
+    let library = builder.to_bytes();
+    harness.bench("startup/compile_formulas", formulas.len(), || {
+        formulas
+            .iter()
+            .map(|(_, input)| infix_to_rpn(black_box(input), &history).unwrap().compile().unwrap())
+            .collect::<Vec<_>>()
+    });
+    harness.bench("startup/load_library", formulas.len(), || ProgramLibrary::from_bytes(black_box(&library)).unwrap());
+
+    // One expression of a context, re-evaluated as its variable changes
+    let mut context = EvalContext::new();
+    context.set_variable("x", 0.5).unwrap();
+    let rpn = infix_to_rpn("sin(x) * cos(x) + x ^ 2 / (x + 1) - sqrt(x * 3)", &history).unwrap();
+    for (name, threshold) in [("interpreted", u64::MAX), ("jit", 0)] {
+        // Compiled afresh, so the threshold applies from the first evaluation
+        set_jit_threshold(threshold);
+        let program = context.compile(&rpn).unwrap();
+        harness.bench(&format!("context/evaluate_{}", name), 1, || context.evaluate(black_box(&program)));
+    }
+
+    harness.finish();
+}
@@ -1,7 +1,77 @@
+use std::fmt::Write;
+use std::path::{Path, PathBuf};
+
+// The operator table, shared with the library
+#[allow(dead_code)]
+#[path = "src/operators.rs"]
+mod operators;
+
+use operators::{
+    OPERATOR_FIRST_BYTES, OPERATOR_HASH_BITS, OPERATOR_HASH_SEED, OPERATOR_MAX_LENGTH, OPERATOR_SLOTS, OPERATOR_SPECS,
+};
+
+/// Writes `operators.h`, the C view of the operator table in src/operators.rs.
+fn write_operator_header(out_dir: &Path) {
+    let mut header = String::new();
+    header.push_str("// Generated by build.rs from src/operators.rs. Do not edit.\n");
+    header.push_str("#ifndef CALCULATOR_OPERATORS_H\n#define CALCULATOR_OPERATORS_H\n\n");
+    writeln!(header, "#define OPERATOR_COUNT {}", OPERATOR_SPECS.len()).unwrap();
+    writeln!(header, "#define OPERATOR_MAX_LENGTH {}", OPERATOR_MAX_LENGTH).unwrap();
+    writeln!(header, "#define OPERATOR_HASH_BITS {}", OPERATOR_HASH_BITS).unwrap();
+    writeln!(header, "#define OPERATOR_HASH_SEED 0x{:08x}u", OPERATOR_HASH_SEED).unwrap();
+
+    header.push_str("\n// X(opcode, name, arity, precedence, right_associative) for every operator, in opcode order\n");
+    header.push_str("#define CALCULATOR_OPERATORS(X)");
+    for spec in OPERATOR_SPECS {
+        write!(
+            header,
+            " \\\n    X({}, \"{}\", {}, {}, {})",
+            spec.opcode, spec.name, spec.arity, spec.precedence, spec.right_associative as u8
+        )
+        .unwrap();
+    }
+    header.push_str("\n\n// Set of the bytes operator names start with: bit b % 64 of word b / 64 for every byte b\n");
+    header.push_str("#define OPERATOR_FIRST_BYTES {");
+    for word in OPERATOR_FIRST_BYTES {
+        write!(header, " 0x{:016x}u,", word).unwrap();
+    }
+    header.push_str(" }");
+    header.push_str("\n\n// Index into operator_table plus 1 of the operator hashed to each slot, 0 if none.\n");
+    header.push_str("// Aliases are only known to the tokenizer, so their slots are empty.\n");
+    header.push_str("#define OPERATOR_SLOTS {");
+    for (i, &entry) in OPERATOR_SLOTS.iter().enumerate() {
+        let entry = if usize::from(entry) <= OPERATOR_SPECS.len() { entry } else { 0 };
+        header.push_str(if i % 16 == 0 { " \\\n    " } else { " " });
+        write!(header, "{},", entry).unwrap();
+    }
+    header.push_str(" \\\n}\n\n#endif\n");
+
+    std::fs::write(out_dir.join("operators.h"), header).expect("Failed to write operators.h");
+}
+
 fn main() {
     println!("cargo:rerun-if-changed=c_library/calculator.c");
-    
-    cc::Build::new()
-        .file("c_library/calculator.c")
-        .compile("calculator");
-} 
\ No newline at end of file
+    println!("cargo:rerun-if-changed=src/operators.rs");
+
+    let out_dir = PathBuf::from(std::env::var_os("OUT_DIR").expect("OUT_DIR is not set"));
+    write_operator_header(&out_dir);
+
+    let mut build = cc::Build::new();
+    build.file("c_library/calculator.c");
+    build.include(&out_dir);
+
+    // The `trace` feature compiles the C library's TRACE statements in
+    if std::env::var_os("CARGO_FEATURE_TRACE").is_some() {
+        build.define("CALCULATOR_TRACE", None);
+    }
+    // The `jit` feature compiles the native code generator of `jit_compile` in
+    if std::env::var_os("CARGO_FEATURE_JIT").is_some() {
+        build.define("CALCULATOR_JIT", None);
+    }
+    // The `metrics` feature compiles the C library's evaluation counters in
+    if std::env::var_os("CARGO_FEATURE_METRICS").is_some() {
+        build.define("CALCULATOR_METRICS", None);
+    }
+
+    build.compile("calculator");
+}
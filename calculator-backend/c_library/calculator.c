@@ -3,12 +3,24 @@
 // It supports various arithmetic operations, including addition, subtraction, multiplication, division, exponentiation, and more.
 // The calculator also handles variables, error codes, and conversion between RPN and infix notation.
 
+// MAP_ANONYMOUS, used by the JIT tier, and clock_gettime, used by metrics, are only declared for
+// strict ISO C builds on request
+#if (defined(CALCULATOR_JIT) || defined(CALCULATOR_METRICS)) && !defined(_DEFAULT_SOURCE)
+#    define _DEFAULT_SOURCE
+#endif
+
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <float.h>
 #include <ctype.h>
+#include <stddef.h>
+
+// Generated by build.rs from the operator table in src/operators.rs
+#include "operators.h"
 
 // Error codes
 #define SUCCESS 0
@@ -26,11 +38,75 @@
 #define TAN_INVALID_OPERATOR 12
 #define INVALID_TRIG_OPERATOR 13
 
-// Maximum size for expression and operator arrays
-#define MAX_STACK_SIZE 100
-#define MAX_VARIABLES 100
+// Precision modes, matching `Precision` in src/lib.rs
+#define PRECISION_ROUNDED 0       //Every operation is rounded to 9 decimal places
+#define PRECISION_RAW 1           //Nothing is rounded
+#define PRECISION_ROUND_RESULT 2  //Only the final result is rounded to 9 decimal places
+
+// Size of the expression buffer of ConversionResult
 #define MAX_EXPR_LENGTH 1000
 
+// Deepest evaluation stack kept on the C stack, deeper ones come from the stack pool
+#define INLINE_STACK_SIZE 256
+
+// Number of released evaluation stacks kept for reuse
+#define STACK_POOL_SIZE 4
+
+// Largest integer exponent computed by repeated squaring: 53 bits hold the significand of a double
+#define MAX_SQUARING_EXPONENT 53
+
+// Largest argument of '!' with a finite result
+#define MAX_FACTORIAL 170
+
+// Number of rows processed together by the columnar evaluator
+#define COLUMN_BLOCK_SIZE 256
+
+// Deepest stack and longest program compiled to native code: the stack lives in the native frame
+#define JIT_MAX_DEPTH 4096
+#define JIT_MAX_LENGTH 65536
+
+// Upper bound on the machine code of one instruction, and of the prologue and epilogues together
+#define JIT_INSTRUCTION_SIZE 64
+#define JIT_FRAME_CODE_SIZE 128
+
+// Fixup target of the jumps to the error exit of native code
+#define JIT_EXIT SIZE_MAX
+
+// Missing operand or work block of a node of a compiled batch
+#define NO_NODE SIZE_MAX
+
+// Results of `evaluate_compiled_interval`, matching `IntervalStatus` in src/intervals.rs
+#define INTERVAL_SUCCEEDS 0       //No point of the intervals fails
+#define INTERVAL_MAY_FAIL 1       //Some points may fail, the bounds hold for the others
+#define INTERVAL_FAILS 2          //Every point fails
+
+// Error of libm functions other than sqrt, in units in the last place, by which interval bounds are widened
+#define LIBM_ULPS 2
+
+// Serialized compiled programs, see `save_compiled`: magic, format version, and sizes of
+// the header and of one instruction record
+#define PROGRAM_MAGIC "CPRG"
+#define PROGRAM_VERSION 1
+#define PROGRAM_HEADER_SIZE 40
+#define PROGRAM_INSTRUCTION_SIZE 24
+
+// Results of `load_compiled`, matching `LOAD_*` in src/programs.rs
+#define LOAD_SUCCESS 0
+#define LOAD_NOT_A_PROGRAM 1      //Does not start with PROGRAM_MAGIC
+#define LOAD_UNSUPPORTED 2        //Another format version, or another operator table
+#define LOAD_CORRUPT 3            //Truncated, or instructions that do not form a valid program
+#define LOAD_MEMORY_ERROR 4
+
+/* The JIT tier (the `jit` cargo feature) generates x86-64 code for the System V ABI, made
+   executable with mmap and mprotect. Elsewhere `jit_compile` always returns NULL. */
+#if defined(CALCULATOR_JIT) && defined(__x86_64__) && defined(__unix__)
+#    define JIT_SUPPORTED 1
+#    include <sys/mman.h>
+#    include <unistd.h>
+#else
+#    define JIT_SUPPORTED 0
+#endif
+
 #ifndef M_PI
 #    define M_PI 3.14159265358979323846
 #endif
@@ -39,6 +115,37 @@
 #    define M_E 2.71828182845904523536
 #endif
 
+// Trace levels, from least to most verbose
+#define TRACE_OFF 0
+#define TRACE_ERROR 1
+#define TRACE_INFO 2
+#define TRACE_DEBUG 3
+
+/**
+ * @brief Current trace level.
+ *
+ * Messages are written to stderr only if their level is at or below this value.
+ * Tracing is compiled in only when CALCULATOR_TRACE is defined (the `trace` cargo
+ * feature); otherwise TRACE expands to nothing and its arguments are never evaluated.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#    include <stdatomic.h>
+static atomic_int trace_level = TRACE_OFF;
+#else
+static volatile int trace_level = TRACE_OFF;
+#endif
+
+#ifdef CALCULATOR_TRACE
+#    define TRACE(level, ...) \
+        do { \
+            if ((level) <= trace_level) { \
+                fprintf(stderr, __VA_ARGS__); \
+            } \
+        } while (0)
+#else
+#    define TRACE(level, ...) ((void)0)
+#endif
+
 /* Represents a result of a calculation, containing both the value obtained from 
    the calculation and an associated error code. */
 typedef struct {
@@ -65,39 +172,223 @@ typedef struct {
     int error_code;
 } ConversionResult;
 
-/**
- * @brief Array to store variables.
- *
- * This static array holds the defined variables, each with a name and a value.
- * The size of the array is limited by MAX_VARIABLES.
- */
-static Variable variables[MAX_VARIABLES];
+#define OPERATOR_OPCODE(opcode, name, arity, precedence, right_associative) opcode,
 
-/**
- * @breif Counter for the number of variables stored. 
- * 
- * This static int keeps track of the number of variables stored in the 'variables' array. 
- */
-static int variable_count = 0;
+/*Opcodes of a compiled RPN program. Operators come from CALCULATOR_OPERATORS, in the same
+  order as in `operator_table`, from OP_ADD to OP_ADD + OPERATOR_COUNT - 1. */
+typedef enum {
+    OP_PUSH_NUMBER,
+    OP_PUSH_VARIABLE,
+    CALCULATOR_OPERATORS(OPERATOR_OPCODE)
+    OP_SQUARE,        //Produced by `optimize_program` only: x * x
+    OP_ADD_CONSTANT,  //Produced by `optimize_program` only: x + operand.number
+    OP_INTEGER_POWER, //Produced by `optimize_program` only: x ^ operand.exponent
+    OP_FAIL
+} Opcode;
+
+/*Represents a single instruction of a compiled RPN program: an opcode and its operand, if any. */
+typedef struct {
+    Opcode opcode;
+    union {
+        double number;  //Literal pushed by OP_PUSH_NUMBER or added by OP_ADD_CONSTANT
+        size_t slot;    //Index into 'variable_names' for OP_PUSH_VARIABLE
+        int error_code; //Error raised by OP_FAIL
+        unsigned exponent; //Exponent of OP_INTEGER_POWER, at most MAX_SQUARING_EXPONENT
+    } operand;
+    double unrounded;   //Value of operand.number without rounding, for PRECISION_RAW and PRECISION_ROUND_RESULT
+} Instruction;
+
+/*Represents one token of an RPN expression already classified by the caller, so no
+  token text is parsed. Shared with `CToken` in src/lib.rs. */
+typedef struct {
+    int opcode;         //OP_PUSH_NUMBER, OP_PUSH_VARIABLE or an operator opcode
+    union {
+        double number;  //Literal of OP_PUSH_NUMBER
+        size_t slot;    //Index into 'variable_names' for OP_PUSH_VARIABLE
+    } operand;
+} TypedToken;
+
+/*Represents an RPN expression of typed tokens, with the names of the variables they
+  refer to. Shared with `CTypedExpression` in src/lib.rs. */
+typedef struct {
+    const TypedToken* tokens;
+    size_t length;
+    const char* const* variable_names;
+    size_t variable_count;
+} TypedExpression;
+
+/*Represents a variable owned by an evaluation context. */
+typedef struct {
+    char* name;    //Interned name, owned by the context
+    double value;
+    bool defined;  //False for names referenced by a program but never assigned
+} ContextVariable;
+
+/*Represents a set of variables that outlives a single evaluation. Variables live in
+  slots that never move, and an open-addressing hash table maps each name to its slot. */
+typedef struct {
+    ContextVariable* variables;
+    size_t variable_count;
+    size_t variable_capacity;
+    size_t* table;          //Slot + 1 of the variable hashed to each bucket, 0 if empty
+    size_t table_capacity;  //Always a power of two
+    int precision;          //Precision mode of evaluations in this context, PRECISION_ROUNDED by default
+    uint64_t generation;    //Unique among all contexts, so a new context at a freed address is told apart
+} EvalContext;
+
+/*Represents a Reverse Polish Notation expression compiled into a flat instruction array.
+  Numeric literals are already parsed and operators are already classified, so evaluating
+  the program never touches the original token strings. */
+typedef struct {
+    Instruction* code;
+    size_t length;
+    size_t max_depth;            //Deepest stack the program can reach
+    char** variable_names;       //Names of the free variables referenced by OP_PUSH_VARIABLE
+    size_t variable_count;
+    const EvalContext* context;  //Context the program was compiled in, NULL if none
+    uint64_t context_generation; //Generation of 'context', 0 if none
+    size_t* context_slots;       //Context slot of each free variable, NULL if no context
+    bool borrowed;               //Whether 'code' and the names point into serialized data, see `load_compiled`
+} CompiledExpression;
+
+/*Represents the closed interval of doubles from 'low' to 'high'. */
+typedef struct {
+    double low;
+    double high;
+} Interval;
+
+/*Represents the bounds of the results of a compiled program over intervals of its variables,
+  see `evaluate_compiled_interval`. Shared with `CIntervalResult` in src/intervals.rs. */
+typedef struct {
+    double low;      //Lowest result of the points that do not fail, 0.0 if every point fails
+    double high;     //Highest result of the points that do not fail, 0.0 if every point fails
+    int error_code;  //SUCCESS, or the error of the first instruction some point may fail at
+    int status;      //INTERVAL_SUCCEEDS, INTERVAL_MAY_FAIL or INTERVAL_FAILS
+} IntervalResult;
+
+/*Represents one distinct instruction of a compiled batch, applied to the values of
+  earlier nodes, so every operand comes before the node reading it. */
+typedef struct {
+    Instruction instruction;  //OP_PUSH_VARIABLE slots index the 'variable_names' of the batch
+    size_t operands[2];       //Nodes of the operands in evaluation order, NO_NODE if fewer
+    size_t block;             //Work block holding the values, NO_NODE for variables
+} BatchNode;
+
+/*Represents several compiled programs merged into one graph of distinct instructions, so
+  an instruction computed by many programs is evaluated once per row, see `compile_batch`. */
+typedef struct {
+    BatchNode* nodes;            //In evaluation order
+    size_t length;
+    size_t* roots;               //Node of the result of each program
+    size_t* output_order;        //Programs sorted by root node, so results are written as soon as computed
+    size_t program_count;
+    char** variable_names;       //Names of the free variables of every program
+    size_t variable_count;
+    size_t block_count;          //Work blocks needed to evaluate the nodes
+    size_t source_length;        //Total number of instructions of the programs
+} CompiledBatch;
+
+/*Represents a compiled batch being built by `compile_batch`. An open-addressing table
+  maps every node to its bucket, so an instruction is added once per set of operands. */
+typedef struct {
+    CompiledBatch* batch;
+    size_t* table;          //Node + 1 hashed to each bucket, 0 if empty
+    size_t table_capacity;  //Always a power of two
+    size_t* stack;          //Nodes of the values on the stack of the program being added
+    size_t* slots;          //Batch slot of each variable of the program being added
+} BatchBuilder;
+
+/*Signature of the native code of a compiled program: reads the value of each variable slot
+  from `variables`, stores the result in `value` and returns the error code. */
+typedef int (*JitEntry)(const double* variables, double* value);
+
+/*Represents the native code generated from a compiled program by `jit_compile`. The code
+  is followed by the constants it loads, in one mapping that is executable and read-only. */
+typedef struct {
+    JitEntry entry;
+    void* memory;
+    size_t size;
+} JitProgram;
+
+/*Represents a 32-bit displacement in generated code, relative to the end of the
+  displacement, that is patched once the layout of the code is known. */
+typedef struct {
+    size_t offset;  //Position of the displacement in the code
+    size_t target;  //Index into the constant pool, or JIT_EXIT for the error exit
+} JitFixup;
+
+/*Represents native code being generated by `jit_compile`. */
+typedef struct {
+    unsigned char* code;
+    size_t length;
+    uint64_t* pool;         //Constants and helper addresses, loaded RIP-relative from after the code
+    size_t pool_length;
+    JitFixup* fixups;
+    size_t fixup_count;
+} JitBuilder;
+
+/*Represents a value on the stack of a program being optimized: where the instructions
+  computing it start, and whether they are a single OP_PUSH_NUMBER. */
+typedef struct {
+    size_t start;
+    bool constant;
+} FoldSlot;
+
+/*Represents one token of an RPN expression being converted to infix. Nodes live in a
+  single array in token order, so every child comes before its parent. */
+typedef struct {
+    const char* text;    //Token text, borrowed from the RPN expression
+    size_t text_length;
+    size_t left;         //Index of the only operand of unary operators
+    size_t right;
+    size_t length;       //Length of the infix text, excluding parentheses added by the parent
+    size_t offset;       //Position of the infix text in the output, set while serializing
+    int precedence;
+    int arity;           //0 for operands, 1 or 2 for operators
+    bool wrap_left;      //Whether 'left' is written in parentheses
+    bool wrap_right;     //Whether 'right' is written in parentheses
+} InfixNode;
+
+/*Describes an operator, see `OperatorSpec` in src/operators.rs. */
+typedef struct {
+    const char* name;
+    Opcode opcode;
+    int arity;
+    int precedence;          //Precedence in infix expressions, binary operators from 1 to 3
+    bool right_associative;
+} OperatorEntry;
+
+#define OPERATOR_ENTRY(opcode, name, arity, precedence, right_associative) \
+    {name, opcode, arity, precedence, right_associative},
+
+/*Every operator, in opcode order. */
+static const OperatorEntry operator_table[OPERATOR_COUNT] = {
+    CALCULATOR_OPERATORS(OPERATOR_ENTRY)
+};
+
+/*Perfect hash table of the operator names, see `operator_hash`. */
+static const unsigned char operator_slots[1 << OPERATOR_HASH_BITS] = OPERATOR_SLOTS;
+
+/*Bytes that can start an operator name, see `lookup_operator`. */
+static const uint64_t operator_first_bytes[4] = OPERATOR_FIRST_BYTES;
 
 /**
- * @brief Initializes default variables.
+ * @brief Default variables.
  *
- * This function initializes the `variables` array with default values,
- * such as 'pi' and 'e'. It also resets the `variable_count` to 0 before
- * adding the default variables.
+ * This read-only array holds the variables every expression can use, each with a
+ * name and a value. It is never modified, so any number of threads can evaluate
+ * expressions at the same time. Variables of their own live in an EvalContext.
  */
-static void init_default_variables() {
+static const Variable default_variables[] = {
     // Add any default variables here
-    variable_count = 0;
-    variables[variable_count++] = (Variable){"pi", M_PI};
-    variables[variable_count++] = (Variable){"e", M_E};
-}
+    {"pi", M_PI},
+    {"e", M_E},
+};
 
-/**car
+/**
  * @breif Returns the value of a variable by its name 
  * 
- * Searches the 'variables' array for the variable of given name if found it returns the value
+ * Searches the 'default_variables' array for the variable of given name if found it returns the value
  * of the variable, if not it sets the 'error_code' to 'UNDEFINED_VARIABLE' and it returns 0.0.
  * 
  * @param name       The name of the variable being retrieved 
@@ -107,488 +398,4831 @@ static void init_default_variables() {
  * @return           The value of the variable, 0.0 if not found. 
  */
 static double get_variable_value(const char* name, int* error_code) {
-    printf("Looking up variable: %s\n", name);
-    for (int i = 0; i < variable_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            printf("Found variable %s = %f\n", name, variables[i].value);
-            return variables[i].value;
+    TRACE(TRACE_DEBUG, "Looking up variable: %s\n", name);
+    for (size_t i = 0; i < sizeof(default_variables) / sizeof(default_variables[0]); i++) {
+        if (strcmp(default_variables[i].name, name) == 0) {
+            TRACE(TRACE_DEBUG, "Found variable %s = %f\n", name, default_variables[i].value);
+            return default_variables[i].value;
         }
     }
-    printf("Variable not found: %s\n", name);
+    TRACE(TRACE_DEBUG, "Variable not found: %s\n", name);
     *error_code = UNDEFINED_VARIABLE;
     return 0.0;
 }
 
 /**
- * @brief Checks if a token is a valid arithmetic operator.
+ * @brief Hashes a variable name (FNV-1a).
  *
- * Determines whether a given token represents one of the supported
- * arithmetic operators. It checks if the token matches one of the
- * allowed operators, including:
- * - Basic arithmetic: '+', '-', '*', '/', and '^' (power).
- * - Factorial: '!' (unary operator, only one operand is used).
- * - Square root: "sqrt" (unary operator).
- * - Trigonometric functions: "sin", "cos", "tan", "arcsin", "arccos", "arctan" (unary operators).
- * - Logarithmic functions:
- *   - "log" (base-10 logarithm, unary operator).
- *   - "ln" (natural logarithm, unary operator).
- * - Special constants or functions:
- *   - "ans" (refers to the result of the last calculation, unary operator).
- *
- * @param token A string representing a single token from an expression.
- *              - It is expected to be a null-terminated C-style string.
- * @return True if the token is an operator, false otherwise.
- */
-static bool is_operator(const char* token) {
-    return (
-        strcmp(token, "+") == 0 ||
-        strcmp(token, "-") == 0 ||
-        strcmp(token, "*") == 0 ||
-        strcmp(token, "/") == 0 ||
-        strcmp(token, "^") == 0 ||
-        strcmp(token, "!") == 0 ||
-        strcmp(token, "sqrt") == 0 ||
-        strcmp(token, "sin") == 0 ||
-        strcmp(token, "cos") == 0 ||
-        strcmp(token, "tan") == 0 ||
-        strcmp(token, "arcsin") == 0 ||
-        strcmp(token, "arccos") == 0 ||
-        strcmp(token, "arctan") == 0 ||
-        strcmp(token, "log") == 0 ||
-        strcmp(token, "ln") == 0 ||
-        strcmp(token, "ans") == 0
-    );
-}
-
-/**
- * @brief Checks if a token represents a valid floating point number.
- * 
- * Determines whether a given token can be interpreted as a
- * valid floating-point number. It uses the `strtod` function for the
- * conversion and checks for successful conversion. A valid number can
- * optionally be followed by a newline character ('\n')
- * 
- *@param token A char representing a single token from an expression.
- *              It is expected to be a null-terminated C-style string.
- * @return True if token is an number, false otherwise. 
+ * @param name A null-terminated variable name.
+ * @return     The hash of the name.
  */
-static bool is_number(const char* token) {
-    char* endptr;
-    strtod(token, &endptr);
-    return *endptr == '\0' || (*endptr == '\n' && endptr[1] == '\0');
+static size_t hash_name(const char* name) {
+    size_t hash = (size_t)14695981039346656037ULL;
+    for (const unsigned char* c = (const unsigned char*)name; *c; c++) {
+        hash ^= *c;
+        hash *= (size_t)1099511628211ULL;
+    }
+    return hash;
 }
 
 /**
- * @brief Computes the factorial of a non-negative integer.
+ * @brief Finds the bucket of a name in a context's hash table.
  *
- * This function calculates the factorial of a given non-negative integer `n`.
- * If `n` is negative or not an integer, the function sets the `error_code` to
- * `FACTORIAL_ERROR` and returns NaN. The factorial of 0 or 1 is 1.
+ * Probes linearly from the name's hash until it finds the name or an empty bucket.
  *
- * @param n          The number for which the factorial is to be calculated.
- *                   It must be a non-negative integer.
- * @param error_code A pointer to an integer where an error code can be stored.
- *                   - If the calculation is successful, the error code is not modified.
- *                   - If `n` is negative or not an integer, the error code is set to `FACTORIAL_ERROR`.
- * @return           The factorial of `n` if successful, or NaN if an error occurs.
+ * @param context The context to search.
+ * @param name    The variable name.
+ * @return        The index of the bucket holding the name, or of the empty bucket
+ *                where it would be inserted.
  */
-static double factorial(double n, int* error_code) {
-    if (n < 0) {
-        *error_code = FACTORIAL_ERROR; // Set error code for invalid factorial
-        printf("Factorial error: Factorial is undefined for negative numbers\n");
-        return NAN; // Return NaN to indicate an error
-    }
-    if (n != (int)n) {
-        *error_code = FACTORIAL_ERROR; // Set error code for non-integer factorial
-        printf("Factorial error: Factorial is undefined for non-integer values\n");
-        return NAN;
-    }
-    if (n == 0 || n == 1) {
-        return 1.0;
+static size_t context_find_bucket(const EvalContext* context, const char* name) {
+    size_t mask = context->table_capacity - 1;
+    size_t bucket = hash_name(name) & mask;
+    while (context->table[bucket] != 0 &&
+           strcmp(context->variables[context->table[bucket] - 1].name, name) != 0) {
+        bucket = (bucket + 1) & mask;
     }
-    double result = 1.0;
-    for (int i = 1; i <= (int)n; i++) {
-        result *= i;
-    }
-    return result;
+    return bucket;
 }
 
-
 /**
- * @brief Rounds a double to 9 decimal places.
+ * @brief Doubles a context's hash table and reinserts every variable.
  *
- * This function rounds the given double value to 9 decimal places.
- *
- * @param value The double value to be rounded.
- * @return The rounded value.
+ * @param context The context to grow.
+ * @return        True on success, false if memory allocation failed.
  */
-static double round_to_9_decimals(double value) {
-    return round(value * 1e9) / 1e9;
+static bool context_grow_table(EvalContext* context) {
+    size_t* old_table = context->table;
+    size_t old_capacity = context->table_capacity;
+
+    size_t* table = calloc(old_capacity * 2, sizeof(size_t));
+    if (!table) {
+        return false;
+    }
+    context->table = table;
+    context->table_capacity = old_capacity * 2;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_table[i] != 0) {
+            size_t bucket = context_find_bucket(context, context->variables[old_table[i] - 1].name);
+            context->table[bucket] = old_table[i];
+        }
+    }
+    free(old_table);
+    return true;
 }
 
 /**
- * @brief Applies an arithmetic operation to two operands.
- *
- * This function performs an arithmetic operation on two double-precision
- * floating-point operands (`a` and `b`) based on the specified operator (`op`).
- * It supports the following operators:
- * - Basic arithmetic: '+', '-', '*', '/', and '^' (power).
- * - Factorial: '!' (unary operator, only one operand is used).
- * - Square root: "sqrt" (unary operator).
- * - Trigonometric functions: "sin", "cos", "tan" (unary operators).
- * - Logarithmic functions:
- *   - "log" (base-10 logarithm, unary operator).
- *   - "ln" (natural logarithm, unary operator).
- * - Special constants or functions:
- *   - "ans" (refers to the result of the last calculation, unary operator).
+ * @brief Returns the slot of a variable in a context, creating an undefined one if needed.
  *
- * The result of the operation is returned. If an error occurs, the error code
- * is updated, and the function returns 0.0.
- *
- * @param op         A string representing the arithmetic operator.
- *                   Valid operators include '+', '-', '*', '/', '^', '!', "sqrt",
- *                   "sin", "cos", "tan", "log", "ln", and "ans".
- * @param a          The first operand (double). For unary operators, this is the only operand.
- * @param b          The second operand (double). Not used for unary operators.
- * @param error_code A pointer to an integer where an error code can be stored.
- *                      - If the operation is successful, the error code is not modified.
- *                      - If division by zero occurs ('a / 0'), the error code is set to
- *                        DIVISION_BY_ZERO.
- *                      - If the operator is not recognized, the error code is set to
- *                        INVALID_OPERATOR.
- *                      - If a logarithmic function is applied to a non-positive number,
- *                        the error code is set to LOG_ERROR or LN_ERROR.
- *                      - If "sqrt" is applied to a negative number, the error code is set to
- *                        SQUARE_ROOT_INVALID_OPERATOR.
- * @return           The result of the arithmetic operation (double).
- *                      - Returns the calculated result if the operation is successful.
- *                      - Returns 0.0 if an error occurs (e.g., division by zero, invalid operator).
+ * @param context The context.
+ * @param name    The variable name. It is copied into the context.
+ * @param slot    A pointer where the slot index is stored.
+ * @return        SUCCESS, or MEMORY_ERROR if memory allocation failed.
  */
-static double apply_operator(const char* op, double a, double b, int* error_code) {
-    double result;
+static int context_intern(EvalContext* context, const char* name, size_t* slot) {
+    size_t bucket = context_find_bucket(context, name);
+    if (context->table[bucket] != 0) {
+        *slot = context->table[bucket] - 1;
+        return SUCCESS;
+    }
 
-    // Handle string-based unary operator first
-    if (strcmp(op, "sqrt") == 0) {
-        if (a < 0) {
-            *error_code = SQUARE_ROOT_INVALID_OPERATOR;
-            printf("Square root error: sqrt of negative number\n");
-            return 0;
+    // Keep the load factor at or below one half
+    if ((context->variable_count + 1) * 2 > context->table_capacity) {
+        if (!context_grow_table(context)) {
+            return MEMORY_ERROR;
         }
-        result = sqrt(a);
-        result = round_to_9_decimals(result);
-        return result;
+        bucket = context_find_bucket(context, name);
     }
 
-    if (strcmp(op, "sin") == 0){
-        result = sin(a);
-        result = round_to_9_decimals(result);
-        return result;
+    if (context->variable_count == context->variable_capacity) {
+        size_t capacity = context->variable_capacity * 2;
+        ContextVariable* variables = realloc(context->variables, capacity * sizeof(ContextVariable));
+        if (!variables) {
+            return MEMORY_ERROR;
+        }
+        context->variables = variables;
+        context->variable_capacity = capacity;
     }
 
-    if (strcmp(op, "cos") == 0){
-        result = cos(a);
-        result = round_to_9_decimals(result);
-        return result;
+    char* copy = malloc(strlen(name) + 1);
+    if (!copy) {
+        return MEMORY_ERROR;
     }
+    strcpy(copy, name);
 
-    if (strcmp(op, "tan") == 0) {
-        // Check for undefined values of tan (odd multiples of π/2)
-        if (fmod(fabs(a), M_PI) == M_PI / 2) {
-            *error_code = TAN_INVALID_OPERATOR;
-            printf("Undefined value for tan at odd multiples of π/2\n");
-            return 0;
-        }
-        result = tan(a);
-        result = round_to_9_decimals(result);
-        return result;
-    }
+    *slot = context->variable_count++;
+    context->variables[*slot] = (ContextVariable){copy, 0.0, false};
+    context->table[bucket] = *slot + 1;
+    return SUCCESS;
+}
 
-    if (strcmp(op, "arcsin") == 0) {
-        if (a < -1 || a > 1) {
-            *error_code = INVALID_TRIG_OPERATOR;
-            printf("Invalid input for asin\n");
-            return 0;
-        }
-        result = asin(a);
-        result = round_to_9_decimals(result);
-        return result;
-    }
-    
-    if (strcmp(op, "arccos") == 0) {
-        if (a < -1 || a > 1) {
-            *error_code = INVALID_TRIG_OPERATOR;
-            printf("Invalid input for acos\n");
-            return 0;
-        }
-        result = acos(a);
-        result = round_to_9_decimals(result);
-        return result;
+/**
+ * @brief Releases an evaluation context and all of its variable names.
+ *
+ * Programs compiled in the context must not be evaluated in it afterwards.
+ *
+ * @param context The context returned by `context_create`. NULL is ignored.
+ */
+void context_free(EvalContext* context) {
+    if (!context) {
+        return;
     }
-    
-    if (strcmp(op, "arctan") == 0) {
-        result = atan(a);
-        result = round_to_9_decimals(result);
-        return result;
+    for (size_t i = 0; i < context->variable_count; i++) {
+        free(context->variables[i].name);
     }
+    free(context->variables);
+    free(context->table);
+    free(context);
+}
 
-    if (strcmp(op, "log") == 0) {  // Base-10 logarithm
-        if (a <= 0) {
-            *error_code = LOG_ERROR;
-            printf("Logarithm error: log of non-positive number\n");
-            return 0;
-        }
-        result = log10(a);
-        result = round_to_9_decimals(result);
-        return result;
+/**
+ * @brief Sets the value of a variable in a context, defining it if needed.
+ *
+ * The variable keeps its slot, so programs already compiled in the context see the
+ * new value on their next evaluation.
+ *
+ * @param context The context.
+ * @param name    The variable name.
+ * @param value   The new value.
+ * @return        SUCCESS, or MEMORY_ERROR if an argument is NULL or allocation failed.
+ */
+int context_set_variable(EvalContext* context, const char* name, double value) {
+    if (!context || !name) {
+        return MEMORY_ERROR;
     }
-
-    if (strcmp(op, "ln") == 0) {  // Natural logarithm
-        if (a <= 0) {
-            *error_code = LN_ERROR;
-            printf("Natural logarithm error: ln of non-positive number\n");
-            return 0;
-        }
-        result = log(a);
-        result = round_to_9_decimals(result);
-        return result;
+    size_t slot;
+    int error_code = context_intern(context, name, &slot);
+    if (error_code != SUCCESS) {
+        return error_code;
     }
-    
-    // Handle other operators with a switch
-    if (strlen(op) == 1) {
-        char c = op[0];
-        switch (c) {
-            case '+': result = a + b; break;
-            case '-': result = a - b; break;
-            case '*': result = a * b; break;
-            case '/':
-                if (b == 0) {
-                    *error_code = DIVISION_BY_ZERO;
-                    printf("Division by zero error\n");
-                    return 0;
-                }
-                result = a / b;
-                break;
-            case '^': result = pow(a, b); break;
-            case '!':
-                if (b != 0) {
-                    *error_code = INVALID_OPERATOR;
-                    printf("Factorial takes one operand only\n");
-                    return 0;
-                }
-                result = factorial(a, error_code);
-                if (*error_code != SUCCESS) return 0;
-                break;
-            default:
-                *error_code = INVALID_OPERATOR;
-                printf("Unknown operator: %c\n", c);
-                return 0;
+    context->variables[slot].value = value;
+    context->variables[slot].defined = true;
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the value of a variable in a context.
+ *
+ * @param context    The context.
+ * @param name       The variable name.
+ * @param error_code A pointer to an integer where an error code can be stored.
+ *                   -   If the variable is defined, the error code is not modified.
+ *                   -   Otherwise the error code is set to UNDEFINED_VARIABLE.
+ * @return           The value of the variable, 0.0 if it is not defined.
+ */
+double context_get_variable(const EvalContext* context, const char* name, int* error_code) {
+    if (context && name) {
+        size_t index = context->table[context_find_bucket(context, name)];
+        if (index != 0 && context->variables[index - 1].defined) {
+            return context->variables[index - 1].value;
         }
-        result = round_to_9_decimals(result);
-        return result;
     }
-
-    result = round_to_9_decimals(result);
-    *error_code = INVALID_OPERATOR;
-    printf("Invalid operator (not single char or known string): %s\n", op);
-    return 0;
+    *error_code = UNDEFINED_VARIABLE;
+    return 0.0;
 }
 
 /**
- * @brief Evaluates a Reverse Polish Notation (RPN) expression.
+ * @brief Returns the slot of a variable in a context, creating an undefined one if needed.
  *
- * This function evaluates an expression given in Reverse Polish Notation (RPN).
- * It uses a stack to store operands and intermediate results. The function
- * handles arithmetic operations, variable lookups, and error conditions
- * such as invalid expressions, stack underflow/overflow, division by zero,
- * and invalid operators.
+ * Slots never move, so the slot stays valid for `context_set_slot` and
+ * `context_unset_slot` as long as the context lives.
  *
- * @param rpn        A pointer to a ReversePolishExpression structure representing
- *                   the RPN expression to be evaluated. The structure contains the
- *                   expression as an array of string tokens and the length of the
- *                   expression.
- * @param error_code A pointer to an integer where an error code can be stored.
- *                      -   If the evaluation is successful, the result's 'value' field
- *                           holds the calculated result, and the 'error_code' field is set
- *                           to SUCCESS (0).
- *                      -   If an error occurs, the result's 'value' field is 0.0, and the
- *                          'error_code' field is set to the corresponding error code:
- *                          MEMORY_ERROR, STACK_UNDERFLOW, STACK_OVERFLOW,
- *                          DIVISION_BY_ZERO, or INVALID_OPERATOR.
- * @return           The result of the arithmetic operation (double).
- *                      -   Returns the calculated result if the operation is successful.
- *                      -   Returns 0.0 if an error occurs (division by zero or invalid operator).
+ * @param context The context.
+ * @param name    The variable name.
+ * @param slot    A pointer where the slot index is stored.
+ * @return        SUCCESS, or MEMORY_ERROR if an argument is NULL or allocation failed.
  */
-CalculationResult evaluate_rpn(const ReversePolishExpression* rpn) {
-    CalculationResult result = {0.0, SUCCESS};
-    
-    printf("Starting RPN evaluation\n");
-    
-    if (!rpn || !rpn->expression) {
-        printf("Memory error: NULL pointer received\n");
-        result.error_code = MEMORY_ERROR;
-        return result;
+int context_variable_slot(EvalContext* context, const char* name, size_t* slot) {
+    if (!context || !name || !slot) {
+        return MEMORY_ERROR;
     }
+    return context_intern(context, name, slot);
+}
 
-    printf("Expression length: %zu\n", rpn->length);
+/**
+ * @brief Sets the value of the variable in a slot, without looking up its name.
+ *
+ * @param context The context.
+ * @param slot    A slot returned by `context_variable_slot`.
+ * @param value   The new value.
+ * @return        SUCCESS, or MEMORY_ERROR if `context` is NULL or `slot` is out of range.
+ */
+int context_set_slot(EvalContext* context, size_t slot, double value) {
+    if (!context || slot >= context->variable_count) {
+        return MEMORY_ERROR;
+    }
+    context->variables[slot].value = value;
+    context->variables[slot].defined = true;
+    return SUCCESS;
+}
 
-    double stack[MAX_STACK_SIZE];
-    int stack_top = -1;
+/**
+ * @brief Makes the variable in a slot undefined again, so evaluations reading it fail with
+ *        UNDEFINED_VARIABLE until it is assigned.
+ *
+ * @param context The context.
+ * @param slot    A slot returned by `context_variable_slot`.
+ * @return        SUCCESS, or MEMORY_ERROR if `context` is NULL or `slot` is out of range.
+ */
+int context_unset_slot(EvalContext* context, size_t slot) {
+    if (!context || slot >= context->variable_count) {
+        return MEMORY_ERROR;
+    }
+    context->variables[slot].value = 0.0;
+    context->variables[slot].defined = false;
+    return SUCCESS;
+}
 
-    init_default_variables();
+/**
+ * @brief Checks that an integer is one of the PRECISION_* modes.
+ */
+static bool is_precision(int precision) {
+    return precision >= PRECISION_ROUNDED && precision <= PRECISION_ROUND_RESULT;
+}
 
-    for (size_t i = 0; i < rpn->length; i++) {
-        const char* token = rpn->expression[i];
-        printf("Processing token: %s\n", token);
-        
-        if (is_operator(token)) {
-            if (token[0] == '!' || strcmp(token, "sqrt") == 0 || strcmp(token, "sin") == 0 || strcmp(token,"cos") == 0 || strcmp(token, "tan") == 0
-            || strcmp(token, "arcsin") == 0 || strcmp(token, "arccos") == 0 || strcmp(token, "arctan") == 0 || strcmp(token, "log") == 0 || strcmp(token, "ln") == 0) { 
-                if (stack_top < 0) {
-                    printf("Operator without operand\n");
-                    result.error_code = INVALID_OPERATOR;
-                    return result;
-                }
+/**
+ * @brief Sets the precision mode of the evaluations in a context.
+ *
+ * Applies to `calculate_rpn_in_context` and `evaluate_compiled_in_context`. Programs
+ * already compiled in the context are evaluated in the new mode, without recompiling.
+ *
+ * @param context   The context.
+ * @param precision PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return          SUCCESS, or MEMORY_ERROR if `context` is NULL or `precision` is not a mode.
+ */
+int context_set_precision(EvalContext* context, int precision) {
+    if (!context || !is_precision(precision)) {
+        return MEMORY_ERROR;
+    }
+    context->precision = precision;
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the precision mode of the evaluations in a context, PRECISION_ROUNDED if `context` is NULL.
+ */
+int context_get_precision(const EvalContext* context) {
+    return context ? context->precision : PRECISION_ROUNDED;
+}
+
+/**
+ * @brief Generation of the next context created, starting at 1 since 0 marks programs without a context.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+static atomic_uint_least64_t next_context_generation = 1;
+#else
+static uint64_t next_context_generation = 1;
+#endif
+
+/**
+ * @brief Creates an evaluation context holding the default variables ('pi' and 'e').
+ *
+ * The context is initialized once and can then be reused by any number of
+ * compilations and evaluations.
+ *
+ * @return A newly allocated context that must be released with `context_free`,
+ *         or NULL if memory allocation failed.
+ */
+EvalContext* context_create(void) {
+    EvalContext* context = calloc(1, sizeof(EvalContext));
+    if (!context) {
+        return NULL;
+    }
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+    context->generation = atomic_fetch_add(&next_context_generation, 1);
+#else
+    context->generation = next_context_generation++;
+#endif
+    context->variable_capacity = 8;
+    context->table_capacity = 16;
+    context->variables = malloc(context->variable_capacity * sizeof(ContextVariable));
+    context->table = calloc(context->table_capacity, sizeof(size_t));
+    if (!context->variables || !context->table ||
+        context_set_variable(context, "pi", M_PI) != SUCCESS ||
+        context_set_variable(context, "e", M_E) != SUCCESS) {
+        context_free(context);
+        return NULL;
+    }
+    return context;
+}
+
+/**
+ * @brief Checks whether a program was compiled in a context.
+ *
+ * Compares generations as well as addresses, since a context created after the
+ * program's context was freed may be allocated at the same address.
+ *
+ * @param context A context, NULL if none.
+ * @param program A pointer to a compiled program.
+ * @return        true if `program` was compiled in `context`, or without a context if it is NULL.
+ */
+bool compiled_in_context(const EvalContext* context, const CompiledExpression* program) {
+    return program->context == context && (!context || program->context_generation == context->generation);
+}
+
+/**
+ * @brief Sets the trace level of the library.
+ *
+ * Has no visible effect unless the library was built with CALCULATOR_TRACE.
+ *
+ * @param level One of TRACE_OFF, TRACE_ERROR, TRACE_INFO or TRACE_DEBUG.
+ */
+void set_trace_level(int level) {
+    trace_level = level;
+}
+
+/**
+ * @brief Returns the trace level of the library.
+ *
+ * @return The level last passed to `set_trace_level`, TRACE_OFF by default.
+ */
+int get_trace_level(void) {
+    return trace_level;
+}
+
+// Powers of ten that are exact doubles, for the fast path of `parse_number`
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * @brief Parses a token as a floating point number, if it is one.
+ *
+ * A token is a number if `strtod` converts all of it, optionally followed by a
+ * newline character ('\n'). Plain decimal tokens with at most 19 significant digits
+ * are parsed in a single pass instead: when the digits fit in 53 bits and the
+ * decimal exponent is at most 22 in magnitude, both are exact doubles and a single
+ * multiplication or division gives the correctly rounded value (Clinger's fast
+ * path), the same one `strtod` returns. Everything else, including hexadecimal
+ * numbers, "inf" and "nan", goes through `strtod`.
+ *
+ * @param token A null-terminated C-style string holding a single token.
+ * @param value A pointer where the value is stored if the token is a number.
+ * @return      True if the token is a number, false otherwise.
+ */
+static bool parse_number(const char* token, double* value) {
+    const char* p = token;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+
+    unsigned long long mantissa = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; isdigit((unsigned char)*p); p++) {
+        significant_digits += mantissa != 0 || *p != '0';
+        mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+        digits = true;
+    }
+    if (*p == '.') {
+        for (p++; isdigit((unsigned char)*p); p++) {
+            significant_digits += mantissa != 0 || *p != '0';
+            mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+            exponent--;
+            digits = true;
+        }
+    }
+    if (digits && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negative_exponent = *q == '-';
+        if (*q == '-' || *q == '+') {
+            q++;
+        }
+        int written = 0;
+        for (; isdigit((unsigned char)*q) && written < 1000; q++) {
+            written = written * 10 + (*q - '0');
+        }
+        if (isdigit((unsigned char)q[-1])) {
+            exponent += negative_exponent ? -written : written;
+            p = q;
+        }
+    }
+    if (*p == '\n') {
+        p++;
+    }
+
+    if (digits && *p == '\0' && significant_digits <= 19 && mantissa <= (1ULL << 53) &&
+        exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / exact_powers_of_ten[-exponent] : result * exact_powers_of_ten[exponent];
+        *value = negative ? -result : result;
+        return true;
+    }
+
+    // Identifiers cannot be numbers unless they spell "inf" or "nan"
+    if (isalpha((unsigned char)token[0]) && strchr("iInN", token[0]) == NULL) {
+        return false;
+    }
+    char* endptr;
+    double result = strtod(token, &endptr);
+    if (*endptr == '\0' || (*endptr == '\n' && endptr[1] == '\0')) {
+        *value = result;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Factorials of 0 to MAX_FACTORIAL.
+ *
+ * Each entry is the product 1 * 2 * ... * n rounded after every multiplication, as a
+ * loop over the factors computes it, so from 23! on it may differ from the correctly
+ * rounded factorial in the last bits.
+ */
+static const double factorial_table[MAX_FACTORIAL + 1] = {
+    1.0, 1.0, 2.0, 6.0, 24.0, 120.0, 720.0, 5040.0, 40320.0, 362880.0, 3628800.0, 39916800.0,
+    479001600.0, 6227020800.0, 87178291200.0, 1307674368000.0, 20922789888000.0, 355687428096000.0,
+    6402373705728000.0, 1.21645100408832e+17, 2.43290200817664e+18, 5.109094217170944e+19,
+    1.1240007277776077e+21, 2.585201673888498e+22, 6.204484017332394e+23, 1.5511210043330986e+25,
+    4.0329146112660565e+26, 1.0888869450418352e+28, 3.0488834461171384e+29, 8.841761993739701e+30,
+    2.6525285981219103e+32, 8.222838654177922e+33, 2.631308369336935e+35, 8.683317618811886e+36,
+    2.9523279903960412e+38, 1.0333147966386144e+40, 3.719933267899012e+41, 1.3763753091226343e+43,
+    5.23022617466601e+44, 2.0397882081197442e+46, 8.159152832478977e+47, 3.3452526613163803e+49,
+    1.4050061177528798e+51, 6.041526306337383e+52, 2.6582715747884485e+54, 1.1962222086548019e+56,
+    5.5026221598120885e+57, 2.5862324151116818e+59, 1.2413915592536073e+61, 6.082818640342675e+62,
+    3.0414093201713376e+64, 1.5511187532873822e+66, 8.065817517094388e+67, 4.2748832840600255e+69,
+    2.308436973392414e+71, 1.2696403353658276e+73, 7.109985878048635e+74, 4.052691950487722e+76,
+    2.350561331282879e+78, 1.3868311854568986e+80, 8.320987112741392e+81, 5.075802138772248e+83,
+    3.146997326038794e+85, 1.98260831540444e+87, 1.2688693218588417e+89, 8.247650592082472e+90,
+    5.443449390774431e+92, 3.647111091818868e+94, 2.4800355424368305e+96, 1.711224524281413e+98,
+    1.197857166996989e+100, 8.504785885678622e+101, 6.123445837688608e+103,
+    4.4701154615126834e+105, 3.3078854415193856e+107, 2.480914081139539e+109,
+    1.8854947016660498e+111, 1.4518309202828584e+113, 1.1324281178206295e+115,
+    8.946182130782973e+116, 7.156945704626378e+118, 5.797126020747366e+120, 4.75364333701284e+122,
+    3.945523969720657e+124, 3.314240134565352e+126, 2.8171041143805494e+128,
+    2.4227095383672724e+130, 2.107757298379527e+132, 1.8548264225739836e+134,
+    1.6507955160908452e+136, 1.4857159644817607e+138, 1.3520015276784023e+140,
+    1.24384140546413e+142, 1.1567725070816409e+144, 1.0873661566567424e+146,
+    1.0329978488239052e+148, 9.916779348709491e+149, 9.619275968248206e+151,
+    9.426890448883242e+153, 9.33262154439441e+155, 9.33262154439441e+157, 9.425947759838354e+159,
+    9.614466715035121e+161, 9.902900716486175e+163, 1.0299016745145622e+166,
+    1.0813967582402903e+168, 1.1462805637347078e+170, 1.2265202031961373e+172,
+    1.3246418194518284e+174, 1.4438595832024928e+176, 1.5882455415227421e+178,
+    1.7629525510902437e+180, 1.9745068572210728e+182, 2.2311927486598123e+184,
+    2.543559733472186e+186, 2.925093693493014e+188, 3.3931086844518965e+190,
+    3.969937160808719e+192, 4.6845258497542883e+194, 5.574585761207603e+196,
+    6.689502913449124e+198, 8.09429852527344e+200, 9.875044200833598e+202, 1.2146304367025325e+205,
+    1.5061417415111404e+207, 1.8826771768889254e+209, 2.372173242880046e+211,
+    3.012660018457658e+213, 3.8562048236258025e+215, 4.9745042224772855e+217,
+    6.466855489220472e+219, 8.471580690878817e+221, 1.118248651196004e+224,
+    1.4872707060906852e+226, 1.992942746161518e+228, 2.6904727073180495e+230,
+    3.659042881952547e+232, 5.01288874827499e+234, 6.917786472619486e+236, 9.615723196941086e+238,
+    1.346201247571752e+241, 1.89814375907617e+243, 2.6953641378881614e+245,
+    3.8543707171800706e+247, 5.550293832739301e+249, 8.047926057471987e+251, 1.17499720439091e+254,
+    1.7272458904546376e+256, 2.5563239178728637e+258, 3.808922637630567e+260,
+    5.7133839564458505e+262, 8.627209774233235e+264, 1.3113358856834518e+267,
+    2.006343905095681e+269, 3.089769613847349e+271, 4.789142901463391e+273, 7.47106292628289e+275,
+    1.1729568794264138e+278, 1.8532718694937338e+280, 2.946702272495037e+282,
+    4.714723635992059e+284, 7.590705053947215e+286, 1.2296942187394488e+289,
+    2.0044015765453015e+291, 3.2872185855342945e+293, 5.423910666131586e+295,
+    9.003691705778433e+297, 1.5036165148649983e+300, 2.526075744973197e+302,
+    4.2690680090047027e+304, 7.257415615307994e+306
+};
+
+/**
+ * @brief Computes the factorial of a non-negative integer.
+ *
+ * This function calculates the factorial of a given non-negative integer `n`.
+ * If `n` is negative or not an integer, the function sets the `error_code` to
+ * `FACTORIAL_ERROR` and returns NaN. Factorials are read from `factorial_table`;
+ * those of integers above MAX_FACTORIAL overflow to infinity.
+ *
+ * @param n          The number for which the factorial is to be calculated.
+ *                   It must be a non-negative integer.
+ * @param error_code A pointer to an integer where an error code can be stored.
+ *                   - If the calculation is successful, the error code is not modified.
+ *                   - If `n` is negative or not an integer, the error code is set to `FACTORIAL_ERROR`.
+ * @return           The factorial of `n` if successful, or NaN if an error occurs.
+ */
+static double factorial(double n, int* error_code) {
+    if (n < 0) {
+        *error_code = FACTORIAL_ERROR; // Set error code for invalid factorial
+        TRACE(TRACE_ERROR, "Factorial error: Factorial is undefined for negative numbers\n");
+        return NAN; // Return NaN to indicate an error
+    }
+    if (n != (int)n) {
+        *error_code = FACTORIAL_ERROR; // Set error code for non-integer factorial
+        TRACE(TRACE_ERROR, "Factorial error: Factorial is undefined for non-integer values\n");
+        return NAN;
+    }
+    return n <= MAX_FACTORIAL ? factorial_table[(int)n] : INFINITY;
+}
+
+/**
+ * @brief Returns the number of significant bits of a normal double.
+ *
+ * That is the length of its significand up to the lowest set bit, from 1 for powers
+ * of two to 53. The significand is an integer of that many bits times a power of two.
+ */
+static int significant_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t significand = (bits & ((UINT64_C(1) << 52) - 1)) | (UINT64_C(1) << 52);
+
+    // The lowest set bit converts to a double exactly, and its exponent counts the trailing zeros
+    double lowest = (double)(significand & (~significand + 1));
+    memcpy(&bits, &lowest, sizeof(bits));
+    return 53 - (int)(bits >> 52) + 1023;
+}
+
+/**
+ * @brief Raises a double to a non-negative integer power by repeated squaring, if that is exact.
+ *
+ * If the significand of `base` has `k` significant bits, every power of `base` up to
+ * `exponent` fits in `k * exponent` bits. When that is at most 53 and the result is
+ * neither subnormal nor infinite, every product is exact, and so is the result: it is
+ * then bit for bit what `pow` returns. Otherwise nothing is computed and the caller
+ * falls back to `pow`.
+ *
+ * @param base     The base.
+ * @param exponent The exponent.
+ * @param result   A pointer where the power is stored if it is exact.
+ * @return         True if the power was computed.
+ */
+static bool integer_power(double base, unsigned exponent, double* result) {
+    if (base != 0 && (!isnormal(base) || (unsigned)significant_bits(base) * exponent > 53)) {
+        return false;
+    }
+
+    double power = 1.0;
+    for (;;) {
+        if (exponent & 1) {
+            power *= base;
+        }
+        exponent >>= 1;
+        if (exponent == 0) {
+            break;
+        }
+        base *= base;
+    }
+
+    // Every intermediate power lies between 1 and the result, so only the result can overflow or underflow
+    if (!isfinite(power) || (power != 0 && fabs(power) < DBL_MIN)) {
+        return false;
+    }
+    *result = power;
+    return true;
+}
+
+/**
+ * @brief Raises `base` to `exponent`, exactly as `pow` does.
+ *
+ * Small non-negative integer exponents go through `integer_power` when the result is
+ * exact; every other case is left to `pow`.
+ */
+static double power(double base, double exponent) {
+    double result;
+    if (exponent >= 0 && exponent <= MAX_SQUARING_EXPONENT && exponent == (unsigned)exponent &&
+        integer_power(base, (unsigned)exponent, &result)) {
+        return result;
+    }
+    return pow(base, exponent);
+}
+
+/**
+ * @brief Computes the kernel of OP_INTEGER_POWER: `base` to a literal integer exponent.
+ *
+ * Same result as `power`, without the checks on the exponent that compilation already made.
+ */
+static inline double literal_power(double base, unsigned exponent) {
+    double result;
+    return integer_power(base, exponent, &result) ? result : pow(base, (double)exponent);
+}
+
+
+/**
+ * @brief Rounds a double to 9 decimal places.
+ *
+ * This function rounds the given double value to 9 decimal places.
+ *
+ * @param value The double value to be rounded.
+ * @return The rounded value.
+ */
+static double round_to_9_decimals(double value) {
+    return round(value * 1e9) / 1e9;
+}
+
+/**
+ * @brief Hashes a token into a slot of `operator_slots`.
+ *
+ * FNV-1a of the token with ASCII letters lowercased, started from OPERATOR_HASH_SEED
+ * and mixed, the same function as `operator_hash` in src/operators.rs. Tokens longer than
+ * OPERATOR_MAX_LENGTH cannot be an operator and are not hashed to the end.
+ *
+ * @param token A null-terminated C-style string.
+ * @param slot  A pointer where the slot is stored.
+ * @return      False if the token is empty or longer than any operator name.
+ */
+static inline bool operator_hash(const char* token, size_t* slot) {
+    uint32_t hash = OPERATOR_HASH_SEED;
+    size_t length = 0;
+    for (; token[length] != '\0'; length++) {
+        if (length == OPERATOR_MAX_LENGTH) {
+            return false;
+        }
+        unsigned char c = (unsigned char)token[length];
+        if (c >= 'A' && c <= 'Z') {
+            c = (unsigned char)(c - 'A' + 'a');
+        }
+        hash = (hash ^ c) * 0x01000193u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    *slot = hash >> (32 - OPERATOR_HASH_BITS);
+    return length > 0;
+}
+
+/**
+ * @brief Looks up the opcode of an operator token.
+ *
+ * Tokens whose first byte starts no operator name, such as numbers, are rejected
+ * at once. Others probe the perfect hash table once and are compared with the only
+ * name they can match. "ans" is not part of the table: the evaluators reject it as
+ * a binary operator that cannot be applied.
+ *
+ * @param token  A null-terminated C-style string holding the operator.
+ * @param opcode A pointer where the opcode is stored if the token is found.
+ * @return       True if the token names a known operator, false otherwise.
+ */
+static bool lookup_operator(const char* token, Opcode* opcode) {
+    unsigned char first = (unsigned char)token[0];
+    size_t slot;
+    if (!((operator_first_bytes[first >> 6] >> (first & 63)) & 1) ||
+        !operator_hash(token, &slot) || operator_slots[slot] == 0) {
+        return false;
+    }
+    const OperatorEntry* entry = &operator_table[operator_slots[slot] - 1];
+    if (strcmp(entry->name, token) != 0) {
+        return false;
+    }
+    *opcode = entry->opcode;
+    return true;
+}
+
+/**
+ * @brief Checks if an opcode takes a single operand.
+ *
+ * @param opcode The opcode to check.
+ * @return       True for the operators of arity 1 in `operator_table`, and for the
+ *               opcodes produced by `optimize_program` except OP_FAIL.
+ */
+static bool is_unary_opcode(Opcode opcode) {
+    if (opcode >= OP_ADD && opcode < OP_ADD + OPERATOR_COUNT) {
+        return operator_table[opcode - OP_ADD].arity == 1;
+    }
+    return opcode >= OP_SQUARE && opcode <= OP_INTEGER_POWER;
+}
+
+/**
+ * @brief Applies an operation, identified by its opcode, to two operands.
+ *
+ * This is the single implementation of the operator semantics shared by the
+ * string-based evaluator and the compiled evaluator. For unary opcodes only
+ * `a` is used, except OP_ADD_CONSTANT which adds `b` and OP_INTEGER_POWER which
+ * raises `a` to `b`. The result is not rounded, see `apply_opcode`.
+ *
+ * @param opcode     The operation to perform. Must be an operator opcode.
+ * @param a          The first operand (double). For unary operators, this is the only operand.
+ * @param b          The second operand (double). Must be 0 for unary operators.
+ * @param error_code A pointer to an integer where an error code can be stored.
+ *                      - If the operation is successful, the error code is not modified.
+ *                      - If division by zero occurs ('a / 0'), the error code is set to
+ *                        DIVISION_BY_ZERO.
+ *                      - If a logarithmic function is applied to a non-positive number,
+ *                        the error code is set to LOG_ERROR or LN_ERROR.
+ *                      - If "sqrt" is applied to a negative number, the error code is set to
+ *                        SQUARE_ROOT_INVALID_OPERATOR.
+ *                      - If "tan" is applied to an odd multiple of π/2, the error code is set
+ *                        to TAN_INVALID_OPERATOR.
+ *                      - If "arcsin" or "arccos" is applied outside [-1, 1], the error code is
+ *                        set to INVALID_TRIG_OPERATOR.
+ * @return           The result of the operation, or 0.0 if an error occurs.
+ */
+static double apply_opcode_raw(Opcode opcode, double a, double b, int* error_code) {
+    double result;
+
+    switch (opcode) {
+        case OP_ADD: result = a + b; break;
+        case OP_SUBTRACT: result = a - b; break;
+        case OP_MULTIPLY: result = a * b; break;
+        case OP_DIVIDE:
+            if (b == 0) {
+                *error_code = DIVISION_BY_ZERO;
+                TRACE(TRACE_ERROR, "Division by zero error\n");
+                return 0;
+            }
+            result = a / b;
+            break;
+        case OP_POWER: result = power(a, b); break;
+        case OP_FACTORIAL:
+            if (b != 0) {
+                *error_code = INVALID_OPERATOR;
+                TRACE(TRACE_ERROR, "Factorial takes one operand only\n");
+                return 0;
+            }
+            result = factorial(a, error_code);
+            if (*error_code != SUCCESS) return 0;
+            break;
+        case OP_SQRT:
+            if (a < 0) {
+                *error_code = SQUARE_ROOT_INVALID_OPERATOR;
+                TRACE(TRACE_ERROR, "Square root error: sqrt of negative number\n");
+                return 0;
+            }
+            result = sqrt(a);
+            break;
+        case OP_SIN: result = sin(a); break;
+        case OP_COS: result = cos(a); break;
+        case OP_TAN:
+            // Check for undefined values of tan (odd multiples of π/2)
+            if (fmod(fabs(a), M_PI) == M_PI / 2) {
+                *error_code = TAN_INVALID_OPERATOR;
+                TRACE(TRACE_ERROR, "Undefined value for tan at odd multiples of π/2\n");
+                return 0;
+            }
+            result = tan(a);
+            break;
+        case OP_ARCSIN:
+            if (a < -1 || a > 1) {
+                *error_code = INVALID_TRIG_OPERATOR;
+                TRACE(TRACE_ERROR, "Invalid input for asin\n");
+                return 0;
+            }
+            result = asin(a);
+            break;
+        case OP_ARCCOS:
+            if (a < -1 || a > 1) {
+                *error_code = INVALID_TRIG_OPERATOR;
+                TRACE(TRACE_ERROR, "Invalid input for acos\n");
+                return 0;
+            }
+            result = acos(a);
+            break;
+        case OP_ARCTAN: result = atan(a); break;
+        case OP_LOG:  // Base-10 logarithm
+            if (a <= 0) {
+                *error_code = LOG_ERROR;
+                TRACE(TRACE_ERROR, "Logarithm error: log of non-positive number\n");
+                return 0;
+            }
+            result = log10(a);
+            break;
+        case OP_LN:  // Natural logarithm
+            if (a <= 0) {
+                *error_code = LN_ERROR;
+                TRACE(TRACE_ERROR, "Natural logarithm error: ln of non-positive number\n");
+                return 0;
+            }
+            result = log(a);
+            break;
+        case OP_SQUARE: result = a * a; break;
+        case OP_ADD_CONSTANT: result = a + b; break;
+        case OP_INTEGER_POWER: result = power(a, b); break;
+        default:
+            *error_code = INVALID_OPERATOR;
+            TRACE(TRACE_ERROR, "Invalid opcode: %d\n", (int)opcode);
+            return 0;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Rounds the result of an operation to 9 decimal places, unless evaluation is unrounded.
+ *
+ * @param value   The result of the operation.
+ * @param rounded False when evaluating in PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return        The result to push.
+ */
+static inline double round_operation(double value, bool rounded) {
+    return rounded ? round_to_9_decimals(value) : value;
+}
+
+/**
+ * @brief Applies an operation like `apply_opcode_raw` and rounds its result to 9 decimal places.
+ *
+ * This is the semantics of every operator with the default PRECISION_ROUNDED.
+ */
+static double apply_opcode(Opcode opcode, double a, double b, int* error_code) {
+    return round_to_9_decimals(apply_opcode_raw(opcode, a, b, error_code));
+}
+
+/**
+ * @brief Applies an arithmetic operation to two operands.
+ *
+ * This function performs an arithmetic operation on two double-precision
+ * floating-point operands (`a` and `b`) based on the specified operator (`op`).
+ * It supports the following operators:
+ * - Basic arithmetic: '+', '-', '*', '/', and '^' (power).
+ * - Factorial: '!' (unary operator, only one operand is used).
+ * - Square root: "sqrt" (unary operator).
+ * - Trigonometric functions: "sin", "cos", "tan", "arcsin", "arccos", "arctan" (unary operators).
+ * - Logarithmic functions:
+ *   - "log" (base-10 logarithm, unary operator).
+ *   - "ln" (natural logarithm, unary operator).
+ *
+ * The operator is resolved to its opcode and applied through `apply_opcode`.
+ * If an error occurs, the error code is updated, and the function returns 0.0.
+ *
+ * @param op         A string representing the arithmetic operator.
+ * @param a          The first operand (double). For unary operators, this is the only operand.
+ * @param b          The second operand (double). Not used for unary operators.
+ * @param error_code A pointer to an integer where an error code can be stored.
+ *                      - If the operation is successful, the error code is not modified.
+ *                      - If the operator is not recognized, the error code is set to
+ *                        INVALID_OPERATOR.
+ *                      - Otherwise see `apply_opcode` for the error codes of each operator.
+ * @return           The result of the arithmetic operation (double).
+ *                      - Returns the calculated result if the operation is successful.
+ *                      - Returns 0.0 if an error occurs (e.g., division by zero, invalid operator).
+ */
+static double apply_operator(const char* op, double a, double b, int* error_code) {
+    Opcode opcode;
+
+    if (!lookup_operator(op, &opcode)) {
+        *error_code = INVALID_OPERATOR;
+        if (strlen(op) == 1) {
+            TRACE(TRACE_ERROR, "Unknown operator: %c\n", op[0]);
+        } else {
+            TRACE(TRACE_ERROR, "Invalid operator (not single char or known string): %s\n", op);
+        }
+        return 0;
+    }
+
+    return apply_opcode(opcode, a, b, error_code);
+}
+
+/* Counters of the `metrics` cargo feature, in the layout `metrics_read` copies them out.
+   Shared with src/metrics.rs. */
+enum {
+    METRIC_EVALUATIONS,       //Results produced: one per expression, or one per row over columns
+    METRIC_EVALUATE_NANOS,    //Time spent in the evaluators, from their entry to their return
+    METRIC_STACK_ALLOCATIONS, //Evaluation stacks the pool could not provide
+    METRIC_OPCODES,           //Instructions run, one counter per Opcode
+    METRIC_ERRORS = METRIC_OPCODES + OP_FAIL + 1, //Results, one counter per error code
+    METRIC_COUNT = METRIC_ERRORS + INVALID_TRIG_OPERATOR + 1
+};
+
+#ifdef CALCULATOR_METRICS
+#    if !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L || defined(__STDC_NO_ATOMICS__)
+#        error "CALCULATOR_METRICS needs C11 atomics"
+#    endif
+#    include <time.h>
+
+// Sets of counters; threads beyond this many share them
+#    define METRIC_SHARDS 16
+
+/*One set of counters, updated by the threads assigned to it. Each set starts on its own
+  cache line, so threads counting at the same time do not contend for it. */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t counters[METRIC_COUNT];
+} MetricShard;
+
+static MetricShard metric_shards[METRIC_SHARDS];
+static atomic_uint next_metric_shard;
+static _Thread_local MetricShard* metric_shard;
+
+/**
+ * @brief Returns the counters of the calling thread, assigning them on its first call.
+ */
+static inline MetricShard* current_metric_shard(void) {
+    if (!metric_shard) {
+        metric_shard = &metric_shards[atomic_fetch_add(&next_metric_shard, 1) % METRIC_SHARDS];
+    }
+    return metric_shard;
+}
+
+/**
+ * @brief Returns a monotonic time in nanoseconds.
+ */
+static inline uint64_t metric_clock(void) {
+    struct timespec now;
+#    ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#    else
+    timespec_get(&now, TIME_UTC);
+#    endif
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+#    define METRIC_ADD(counter, amount) \
+        atomic_fetch_add_explicit(&current_metric_shard()->counters[counter], (uint64_t)(amount), memory_order_relaxed)
+#    define METRIC_START(name) uint64_t name = metric_clock()
+#    define METRIC_STOP(name) METRIC_ADD(METRIC_EVALUATE_NANOS, metric_clock() - (name))
+#else
+#    define METRIC_ADD(counter, amount) ((void)0)
+#    define METRIC_START(name) ((void)0)
+#    define METRIC_STOP(name) ((void)0)
+#endif
+
+// Counts `count` runs of an instruction
+#define METRIC_OPCODE(opcode, count) METRIC_ADD(METRIC_OPCODES + (size_t)(opcode), count)
+
+/**
+ * @brief Counts one evaluation and its error code.
+ */
+static inline void metric_result(int error_code) {
+    METRIC_ADD(METRIC_EVALUATIONS, 1);
+    if (error_code >= SUCCESS && error_code <= INVALID_TRIG_OPERATOR) {
+        METRIC_ADD(METRIC_ERRORS + error_code, 1);
+    }
+}
+
+/**
+ * @brief Counts the rows of an evaluation over columns and their error codes, with one
+ *        update per distinct code rather than one per row.
+ *
+ * @param error_codes The error code of each row.
+ * @param count       The number of rows.
+ */
+static inline void metric_rows(const int* error_codes, size_t count) {
+#ifdef CALCULATOR_METRICS
+    uint64_t totals[INVALID_TRIG_OPERATOR + 1] = {0};
+    for (size_t i = 0; i < count; i++) {
+        if (error_codes[i] >= SUCCESS && error_codes[i] <= INVALID_TRIG_OPERATOR) {
+            totals[error_codes[i]]++;
+        }
+    }
+    METRIC_ADD(METRIC_EVALUATIONS, count);
+    for (int code = SUCCESS; code <= INVALID_TRIG_OPERATOR; code++) {
+        if (totals[code] > 0) {
+            METRIC_ADD(METRIC_ERRORS + code, totals[code]);
+        }
+    }
+#else
+    (void)error_codes;
+    (void)count;
+#endif
+}
+
+/**
+ * @brief Copies the counters of the `metrics` feature, summed over every thread.
+ *
+ * @param values A caller-allocated array receiving the counters, indexed by METRIC_*.
+ *               Every counter is 0 unless the library was built with CALCULATOR_METRICS.
+ * @param count  The number of counters the caller expects, METRIC_COUNT.
+ * @return       SUCCESS, or MEMORY_ERROR if `values` is NULL or `count` is not METRIC_COUNT.
+ */
+int metrics_read(uint64_t* values, size_t count) {
+    if (!values || count != METRIC_COUNT) {
+        return MEMORY_ERROR;
+    }
+    for (size_t i = 0; i < METRIC_COUNT; i++) {
+        values[i] = 0;
+#ifdef CALCULATOR_METRICS
+        for (size_t shard = 0; shard < METRIC_SHARDS; shard++) {
+            values[i] += atomic_load_explicit(&metric_shards[shard].counters[i], memory_order_relaxed);
+        }
+#endif
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Sets every counter of the `metrics` feature back to 0.
+ *
+ * Evaluations running meanwhile may be counted before or after the reset.
+ */
+void metrics_reset(void) {
+#ifdef CALCULATOR_METRICS
+    for (size_t shard = 0; shard < METRIC_SHARDS; shard++) {
+        for (size_t i = 0; i < METRIC_COUNT; i++) {
+            atomic_store_explicit(&metric_shards[shard].counters[i], 0, memory_order_relaxed);
+        }
+    }
+#endif
+}
+
+/*Represents an evaluation stack too deep for the C stack, kept for reuse once released. */
+typedef struct {
+    size_t capacity;  //Number of values in 'values'
+    double values[];
+} PooledStack;
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+/**
+ * @brief Released evaluation stacks, NULL for empty slots.
+ *
+ * Slots are claimed and filled with atomic exchanges, so threads never share a stack.
+ */
+static _Atomic(PooledStack*) stack_pool[STACK_POOL_SIZE];
+
+/**
+ * @brief Returns a pooled stack of at least `capacity` values, allocating one if none fits.
+ *
+ * @return The stack, or NULL if memory allocation failed.
+ */
+static PooledStack* acquire_stack(size_t capacity) {
+    for (size_t i = 0; i < STACK_POOL_SIZE; i++) {
+        PooledStack* stack = atomic_exchange(&stack_pool[i], NULL);
+        if (stack && stack->capacity >= capacity) {
+            return stack;
+        }
+        free(stack);
+    }
+    PooledStack* stack = malloc(sizeof(PooledStack) + capacity * sizeof(double));
+    if (stack) {
+        stack->capacity = capacity;
+        METRIC_ADD(METRIC_STACK_ALLOCATIONS, 1);
+    }
+    return stack;
+}
+
+/**
+ * @brief Puts a stack returned by `acquire_stack` back into the pool, or frees it if the pool is full.
+ *
+ * @param stack The stack to release. NULL is ignored.
+ */
+static void release_stack(PooledStack* stack) {
+    for (size_t i = 0; stack && i < STACK_POOL_SIZE; i++) {
+        PooledStack* empty = NULL;
+        if (atomic_compare_exchange_strong(&stack_pool[i], &empty, stack)) {
+            return;
+        }
+    }
+    free(stack);
+}
+#else
+// Without atomics there is no pool: every deep stack is allocated and freed
+static PooledStack* acquire_stack(size_t capacity) {
+    PooledStack* stack = malloc(sizeof(PooledStack) + capacity * sizeof(double));
+    if (stack) {
+        stack->capacity = capacity;
+        METRIC_ADD(METRIC_STACK_ALLOCATIONS, 1);
+    }
+    return stack;
+}
+
+static void release_stack(PooledStack* stack) {
+    free(stack);
+}
+#endif
+
+/*Evaluates `input` using `stack`, which can hold every value the evaluation pushes. The
+  result of every operation is rounded to 9 decimal places if `rounded` is true. */
+typedef CalculationResult (*StackEvaluator)(const void* input, const void* context, bool rounded, double* stack);
+
+/**
+ * @brief Runs an evaluator with a stack of `depth` values, in a precision mode.
+ *
+ * Body of `with_stack`. The stack lives on the C stack if `depth` is at most INLINE_STACK_SIZE and comes from
+ * the stack pool otherwise, so evaluators never check for overflow while pushing. Only
+ * PRECISION_ROUNDED rounds every operation; PRECISION_ROUND_RESULT rounds the final
+ * value of a successful evaluation instead.
+ *
+ * @param depth     The deepest stack the evaluation can reach.
+ * @param evaluate  The evaluator.
+ * @param input     The expression or program passed to `evaluate`.
+ * @param context   The context passed to `evaluate`.
+ * @param precision The precision mode.
+ * @return          The result of `evaluate`, or MEMORY_ERROR if `precision` is not a mode
+ *                  or the stack cannot be allocated.
+ */
+static inline CalculationResult run_with_stack(size_t depth, StackEvaluator evaluate, const void* input,
+                                               const void* context, int precision) {
+    CalculationResult result = {0.0, MEMORY_ERROR};
+    if (!is_precision(precision)) {
+        return result;
+    }
+
+    bool rounded = precision == PRECISION_ROUNDED;
+    double inline_stack[INLINE_STACK_SIZE];
+    if (depth <= INLINE_STACK_SIZE) {
+        result = evaluate(input, context, rounded, inline_stack);
+    } else {
+        PooledStack* pooled = acquire_stack(depth);
+        if (!pooled) {
+            TRACE(TRACE_ERROR, "Memory allocation failed\n");
+            return result;
+        }
+        result = evaluate(input, context, rounded, pooled->values);
+        release_stack(pooled);
+    }
+
+    if (precision == PRECISION_ROUND_RESULT && result.error_code == SUCCESS) {
+        result.value = round_to_9_decimals(result.value);
+    }
+    return result;
+}
+
+/**
+ * @brief Same as `run_with_stack`, counting the evaluation with CALCULATOR_METRICS.
+ */
+static inline CalculationResult with_stack(size_t depth, StackEvaluator evaluate, const void* input,
+                                           const void* context, int precision) {
+    METRIC_START(start);
+    CalculationResult result = run_with_stack(depth, evaluate, input, context, precision);
+    METRIC_STOP(start);
+    metric_result(result.error_code);
+    return result;
+}
+
+/**
+ * @brief Evaluates a Reverse Polish Notation (RPN) expression on a given stack.
+ *
+ * Body of `evaluate_rpn_tokens`. Every token pushes at most one value, so a stack of
+ * `rpn->length` values never overflows.
+ *
+ * @param input   The ReversePolishExpression to be evaluated, not NULL.
+ * @param context The EvalContext holding the variables, or NULL for the default variables.
+ * @param rounded Whether the result of every operation is rounded.
+ * @param stack   A stack of at least `rpn->length` values.
+ * @return        See `evaluate_rpn`.
+ */
+static CalculationResult evaluate_rpn_on_stack(const void* input, const void* context, bool rounded, double* stack) {
+    const ReversePolishExpression* rpn = input;
+    CalculationResult result = {0.0, SUCCESS};
+    int stack_top = -1;
+
+    for (size_t i = 0; i < rpn->length; i++) {
+        const char* token = rpn->expression[i];
+        TRACE(TRACE_DEBUG, "Processing token: %s\n", token);
         
-                double a = stack[stack_top--]; // Pop one operand
+        Opcode opcode;
+        double number;
+        bool known = lookup_operator(token, &opcode);
+
+        if (known && is_unary_opcode(opcode)) {
+            METRIC_OPCODE(opcode, 1);
+            if (stack_top < 0) {
+                TRACE(TRACE_ERROR, "Operator without operand\n");
+                result.error_code = INVALID_OPERATOR;
+                return result;
+            }
+    
+            double a = stack[stack_top--]; // Pop one operand
+            int error_code = SUCCESS;
+            double op_result = round_operation(apply_opcode_raw(opcode, a, 0, &error_code), rounded); // Pass 0 as the second operand
+    
+            if (error_code != SUCCESS) {
+                result.error_code = error_code;
+                return result;
+            }
+    
+            stack_top++;
+            stack[stack_top] = op_result; // Push the result back onto the stack
+            TRACE(TRACE_DEBUG, "Pushed result: %.9f\n", stack[stack_top]);
+        } else if (known || strcmp(token, "ans") == 0) { // Handle binary operators
+            if (stack_top < 1) {
+                TRACE(TRACE_ERROR, "Stack underflow error\n");
+                result.error_code = STACK_UNDERFLOW;
+                return result;
+            }
+    
+            double b = stack[stack_top--];
+            double a = stack[stack_top--];
+            if (known) {
+                METRIC_OPCODE(opcode, 1);
+            }
+    
+            int error_code = SUCCESS;
+            // "ans" is replaced by its value before evaluation, any left over is rejected here
+            double op_result = known ? round_operation(apply_opcode_raw(opcode, a, b, &error_code), rounded)
+                                     : apply_operator(token, a, b, &error_code);
+    
+            if (error_code != SUCCESS) {
+                result.error_code = error_code;
+                return result;
+            }
+    
+            stack_top++;
+            stack[stack_top] = op_result;
+            TRACE(TRACE_DEBUG, "Pushed result: %.9f\n", stack[stack_top]);
+        } else if (parse_number(token, &number)) {
+            METRIC_OPCODE(OP_PUSH_NUMBER, 1);
+            stack_top++;
+            stack[stack_top] = number;
+            TRACE(TRACE_DEBUG, "Pushed number: %.9f\n", stack[stack_top]);
+        } else {
+            // Must be a variable
+            METRIC_OPCODE(OP_PUSH_VARIABLE, 1);
+            int error_code = SUCCESS;
+            double value = context ? context_get_variable(context, token, &error_code)
+                                   : get_variable_value(token, &error_code);
+            if (error_code != SUCCESS) {
+                result.error_code = error_code;
+                return result;
+            }
+            stack_top++;
+            stack[stack_top] = value;
+            TRACE(TRACE_DEBUG, "Pushed variable value: %.9f\n", stack[stack_top]);
+        }
+    }
+
+    if (stack_top != 0) {
+        TRACE(TRACE_ERROR, "Invalid expression: stack not empty\n");
+        result.error_code = STACK_UNDERFLOW;
+        return result;
+    }
+
+    result.value = stack[0];
+    TRACE(TRACE_DEBUG, "Final result: %.9f\n", result.value);
+    return result;
+}
+
+/**
+ * @brief Evaluates a Reverse Polish Notation (RPN) expression, looking variables up in a context.
+ *
+ * Shared implementation of `evaluate_rpn`, `calculate_rpn_in_context` and the batch
+ * API. It only reads its arguments and keeps all state on its own stack frame or in a
+ * pooled stack, so it is re-entrant.
+ *
+ * @param rpn       A pointer to a ReversePolishExpression structure representing
+ *                  the RPN expression to be evaluated.
+ * @param context   The context holding the variables, or NULL for the default variables.
+ * @param precision The precision mode, see `with_stack`.
+ * @return          See `evaluate_rpn`.
+ */
+static CalculationResult evaluate_rpn_tokens(const ReversePolishExpression* rpn, const EvalContext* context,
+                                             int precision) {
+    TRACE(TRACE_DEBUG, "Starting RPN evaluation\n");
+
+    if (!rpn || !rpn->expression) {
+        TRACE(TRACE_ERROR, "Memory error: NULL pointer received\n");
+        CalculationResult result = {0.0, MEMORY_ERROR};
+        return result;
+    }
+
+    TRACE(TRACE_DEBUG, "Expression length: %zu\n", rpn->length);
+    return with_stack(rpn->length, evaluate_rpn_on_stack, rpn, context, precision);
+}
+
+/**
+ * @brief Evaluates a Reverse Polish Notation (RPN) expression.
+ *
+ * This function evaluates an expression given in Reverse Polish Notation (RPN).
+ * It uses a stack to store operands and intermediate results. The function
+ * handles arithmetic operations, variable lookups, and error conditions
+ * such as invalid expressions, stack underflow/overflow, division by zero,
+ * and invalid operators.
+ *
+ * @param rpn        A pointer to a ReversePolishExpression structure representing
+ *                   the RPN expression to be evaluated. The structure contains the
+ *                   expression as an array of string tokens and the length of the
+ *                   expression.
+ * @param error_code A pointer to an integer where an error code can be stored.
+ *                      -   If the evaluation is successful, the result's 'value' field
+ *                           holds the calculated result, and the 'error_code' field is set
+ *                           to SUCCESS (0).
+ *                      -   If an error occurs, the result's 'value' field is 0.0, and the
+ *                          'error_code' field is set to the corresponding error code:
+ *                          MEMORY_ERROR, STACK_UNDERFLOW, STACK_OVERFLOW,
+ *                          DIVISION_BY_ZERO, or INVALID_OPERATOR.
+ * @return           The result of the arithmetic operation (double).
+ *                      -   Returns the calculated result if the operation is successful.
+ *                      -   Returns 0.0 if an error occurs (division by zero or invalid operator).
+ */
+CalculationResult evaluate_rpn(const ReversePolishExpression* rpn) {
+    return evaluate_rpn_tokens(rpn, NULL, PRECISION_ROUNDED);
+}
+
+/**
+ * @brief Foreign Function Interface (FFI) wrapper for RPN calculation.
+ * 
+ * It takes a ReversePolishExpression as input,
+ * calls the evaluate_rpn function to perform the calculation, and
+ * returns the CalculationResult. Calls and results are traced at the
+ * TRACE_INFO level.
+ * 
+ * @param rpn A pointer to a ReversePolishExpression structure representing
+ *            the RPN expression to be evaluated. The structure contains the
+ *            expression as an array of string tokens and the length of the
+ *            expression.
+ * 
+ * @return    A CalculationResult structure containing the result of the
+ *            evaluation and an error code.
+ *              -   The 'value' field holds the calculated result if the evaluation
+ *                  is successful.
+ *              -   The 'error_code' field indicates the success or failure of the
+ *                  operation.
+ */
+CalculationResult calculate_rpn(const ReversePolishExpression* rpn) {
+    TRACE(TRACE_INFO, "FFI: calculate_rpn called\n");
+    CalculationResult result = evaluate_rpn(rpn);
+    TRACE(TRACE_INFO, "FFI: returning result value=%f, error_code=%d\n", result.value, result.error_code);
+    return result;
+}
+
+/**
+ * @brief Foreign Function Interface (FFI) wrapper for RPN calculation with caller-owned variables.
+ *
+ * Like `calculate_rpn`, but variables are looked up in `context` instead of the default
+ * variables, and evaluation uses the precision mode of the context. The context is only
+ * read, so several threads may evaluate against the same context at once as long as none
+ * of them modifies it.
+ *
+ * @param context The context holding the variables.
+ * @param rpn     A pointer to a ReversePolishExpression structure representing
+ *                the RPN expression to be evaluated.
+ * @return        See `calculate_rpn`. MEMORY_ERROR if `context` is NULL.
+ */
+CalculationResult calculate_rpn_in_context(const EvalContext* context, const ReversePolishExpression* rpn) {
+    TRACE(TRACE_INFO, "FFI: calculate_rpn_in_context called\n");
+    if (!context) {
+        CalculationResult result = {0.0, MEMORY_ERROR};
+        return result;
+    }
+    CalculationResult result = evaluate_rpn_tokens(rpn, context, context->precision);
+    TRACE(TRACE_INFO, "FFI: returning result value=%f, error_code=%d\n", result.value, result.error_code);
+    return result;
+}
+
+/**
+ * @brief Checks that a typed token is a push or a valid operator opcode.
+ */
+static bool is_typed_opcode(int opcode) {
+    return opcode >= OP_PUSH_NUMBER && opcode < OP_ADD + OPERATOR_COUNT;
+}
+
+/**
+ * @brief Evaluates an RPN expression of typed tokens on a given stack.
+ *
+ * Body of `calculate_rpn_typed`.
+ *
+ * @param input   The TypedExpression to be evaluated, with its arrays checked.
+ * @param context Unused, typed expressions always read the default variables.
+ * @param rounded Whether the result of every operation is rounded.
+ * @param stack   A stack of at least `expr->length` values.
+ * @return        See `calculate_rpn_typed`.
+ */
+static CalculationResult evaluate_typed_on_stack(const void* input, const void* context, bool rounded, double* stack) {
+    (void)context;
+    const TypedExpression* expr = input;
+    CalculationResult result = {0.0, SUCCESS};
+    size_t top = 0; // Number of values on the stack
+
+    for (size_t i = 0; i < expr->length; i++) {
+        const TypedToken* token = &expr->tokens[i];
+        int error_code = SUCCESS;
+
+        if (!is_typed_opcode(token->opcode)) {
+            TRACE(TRACE_ERROR, "Invalid opcode: %d\n", token->opcode);
+            result.error_code = INVALID_OPERATOR;
+            return result;
+        }
+        METRIC_OPCODE(token->opcode, 1);
+
+        if (token->opcode == OP_PUSH_NUMBER) {
+            stack[top++] = token->operand.number;
+            continue;
+        }
+        if (token->opcode == OP_PUSH_VARIABLE) {
+            if (!expr->variable_names || token->operand.slot >= expr->variable_count) {
+                result.error_code = MEMORY_ERROR;
+                return result;
+            }
+            double value = get_variable_value(expr->variable_names[token->operand.slot], &error_code);
+            if (error_code != SUCCESS) {
+                result.error_code = error_code;
+                return result;
+            }
+            stack[top++] = value;
+            continue;
+        }
+
+        Opcode opcode = (Opcode)token->opcode;
+        if (is_unary_opcode(opcode)) {
+            if (top < 1) {
+                TRACE(TRACE_ERROR, "Operator without operand\n");
+                result.error_code = INVALID_OPERATOR;
+                return result;
+            }
+            stack[top - 1] = round_operation(apply_opcode_raw(opcode, stack[top - 1], 0, &error_code), rounded);
+        } else {
+            if (top < 2) {
+                TRACE(TRACE_ERROR, "Stack underflow error\n");
+                result.error_code = STACK_UNDERFLOW;
+                return result;
+            }
+            top--;
+            stack[top - 1] = round_operation(apply_opcode_raw(opcode, stack[top - 1], stack[top], &error_code), rounded);
+        }
+        if (error_code != SUCCESS) {
+            result.error_code = error_code;
+            return result;
+        }
+    }
+
+    if (top != 1) {
+        TRACE(TRACE_ERROR, "Invalid expression: stack not empty\n");
+        result.error_code = STACK_UNDERFLOW;
+        return result;
+    }
+
+    result.value = stack[0];
+    return result;
+}
+
+/**
+ * @brief Foreign Function Interface (FFI) entry point for evaluating an RPN expression of typed
+ *        tokens in a given precision mode.
+ *
+ * Same as `calculate_rpn_typed`, evaluated in `precision`.
+ *
+ * @param expr      A pointer to a TypedExpression structure holding the tokens.
+ * @param precision PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return          See `calculate_rpn_typed`. MEMORY_ERROR if `precision` is not a mode.
+ */
+CalculationResult calculate_rpn_typed_with_precision(const TypedExpression* expr, int precision) {
+    TRACE(TRACE_INFO, "FFI: calculate_rpn_typed called\n");
+    CalculationResult result = {0.0, SUCCESS};
+
+    if (!expr || (!expr->tokens && expr->length > 0)) {
+        result.error_code = MEMORY_ERROR;
+        return result;
+    }
+
+    result = with_stack(expr->length, evaluate_typed_on_stack, expr, NULL, precision);
+    TRACE(TRACE_INFO, "FFI: returning result value=%f, error_code=%d\n", result.value, result.error_code);
+    return result;
+}
+
+/**
+ * @brief Foreign Function Interface (FFI) entry point for evaluating an RPN expression of typed tokens.
+ *
+ * Same as `calculate_rpn` on the equivalent string tokens, but literals arrive as
+ * doubles and operators as opcodes, so no token is compared or parsed. Variables are
+ * looked up by name among the default variables when they are pushed. The stack holds
+ * one value per token, so no push can overflow it.
+ *
+ * @param expr A pointer to a TypedExpression structure holding the tokens.
+ * @return     See `calculate_rpn`. MEMORY_ERROR if `expr` or its arrays are NULL,
+ *             or a variable slot is out of range; INVALID_OPERATOR for an unknown opcode.
+ */
+CalculationResult calculate_rpn_typed(const TypedExpression* expr) {
+    return calculate_rpn_typed_with_precision(expr, PRECISION_ROUNDED);
+}
+
+
+/**
+ * @brief Foreign Function Interface (FFI) entry point for evaluating many RPN expressions
+ *        in one call, in a given precision mode.
+ *
+ * Same as `calculate_rpn_batch`, with every expression evaluated in `precision`.
+ *
+ * @param tokens             See `calculate_rpn_batch`.
+ * @param token_offsets      See `calculate_rpn_batch`.
+ * @param expression_offsets See `calculate_rpn_batch`.
+ * @param expression_count   See `calculate_rpn_batch`.
+ * @param results            See `calculate_rpn_batch`. Every entry is MEMORY_ERROR if
+ *                           `precision` is not a mode.
+ * @param precision          PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ */
+void calculate_rpn_batch_with_precision(const char* tokens, const size_t* token_offsets,
+                                        const size_t* expression_offsets, size_t expression_count,
+                                        CalculationResult* results, int precision) {
+    TRACE(TRACE_INFO, "FFI: calculate_rpn_batch called with %zu expressions\n", expression_count);
+
+    if (!results || expression_count == 0) {
+        return;
+    }
+
+    size_t token_count = expression_offsets ? expression_offsets[expression_count] : 0;
+    const char** pointers = malloc((token_count + 1) * sizeof(const char*));
+    if (!tokens || !token_offsets || !expression_offsets || !pointers) {
+        TRACE(TRACE_ERROR, "Memory error: cannot prepare batch\n");
+        for (size_t i = 0; i < expression_count; i++) {
+            results[i] = (CalculationResult){0.0, MEMORY_ERROR};
+        }
+        free(pointers);
+        return;
+    }
+
+    for (size_t i = 0; i < token_count; i++) {
+        pointers[i] = tokens + token_offsets[i];
+    }
+
+    for (size_t i = 0; i < expression_count; i++) {
+        ReversePolishExpression rpn = {
+            pointers + expression_offsets[i],
+            expression_offsets[i + 1] - expression_offsets[i]
+        };
+        results[i] = evaluate_rpn_tokens(&rpn, NULL, precision);
+    }
+
+    free(pointers);
+}
+
+/**
+ * @brief Foreign Function Interface (FFI) entry point for evaluating many RPN expressions in one call.
+ *
+ * All tokens of all expressions are passed in one flat buffer of null-terminated
+ * strings. Expression `i` consists of the tokens `expression_offsets[i]` up to (but
+ * not including) `expression_offsets[i + 1]`. A single token pointer array is
+ * allocated for the whole batch.
+ *
+ * @param tokens             A buffer holding every token, each followed by '\0'.
+ * @param token_offsets      The byte offset of each token within `tokens`.
+ * @param expression_offsets `expression_count + 1` indices into `token_offsets`
+ *                           delimiting the tokens of each expression.
+ * @param expression_count   The number of expressions in the batch.
+ * @param results            A caller-allocated array of `expression_count` results.
+ *                           Entry `i` receives the same CalculationResult that
+ *                           `calculate_rpn` would return for expression `i`, or
+ *                           MEMORY_ERROR if the token pointer array cannot be allocated.
+ */
+void calculate_rpn_batch(const char* tokens, const size_t* token_offsets, const size_t* expression_offsets,
+                         size_t expression_count, CalculationResult* results) {
+    calculate_rpn_batch_with_precision(tokens, token_offsets, expression_offsets, expression_count, results,
+                                       PRECISION_ROUNDED);
+}
+
+/**
+ * @brief Appends an OP_FAIL instruction to a program being compiled.
+ *
+ * Errors that `evaluate_rpn` detects from the shape of the expression alone (stack
+ * underflow, invalid operators) are known at compile time. They are recorded as an
+ * OP_FAIL at the position where `evaluate_rpn` would have raised them, so run-time
+ * errors of earlier instructions still win.
+ *
+ * @param program    The program being compiled.
+ * @param error_code The error code OP_FAIL raises when reached.
+ */
+static void emit_fail(CompiledExpression* program, int error_code) {
+    Instruction* instruction = &program->code[program->length++];
+    instruction->opcode = OP_FAIL;
+    instruction->operand.error_code = error_code;
+}
+
+/**
+ * @brief Returns the slot of a free variable in a program, adding it if needed.
+ *
+ * @param program The program being compiled.
+ * @param name    The name of the variable.
+ * @param slot    A pointer where the slot index is stored.
+ * @return        True on success, false if memory allocation failed.
+ */
+static bool intern_variable(CompiledExpression* program, const char* name, size_t* slot) {
+    for (size_t i = 0; i < program->variable_count; i++) {
+        if (strcmp(program->variable_names[i], name) == 0) {
+            *slot = i;
+            return true;
+        }
+    }
+
+    char* copy = malloc(strlen(name) + 1);
+    if (!copy) {
+        return false;
+    }
+    strcpy(copy, name);
+    program->variable_names[program->variable_count] = copy;
+    *slot = program->variable_count++;
+    return true;
+}
+
+/**
+ * @brief Releases a compiled RPN program.
+ *
+ * Serialized data a program was loaded from in place is not released, see `load_compiled`.
+ *
+ * @param program The program returned by `compile_rpn`. NULL is ignored.
+ */
+void free_compiled(CompiledExpression* program) {
+    if (!program) {
+        return;
+    }
+    if (!program->borrowed) {
+        for (size_t i = 0; i < program->variable_count; i++) {
+            free(program->variable_names[i]);
+        }
+        free(program->code);
+    }
+    free(program->variable_names);
+    free(program->context_slots);
+    free(program);
+}
+
+/**
+ * @brief Compiles a Reverse Polish Notation (RPN) expression into an instruction array.
+ *
+ * Shared implementation of `compile_rpn` and `compile_rpn_in_context`. Without a
+ * context the default variables are replaced by their values; with one, every
+ * identifier is resolved to its context slot instead.
+ *
+ * @param rpn     The RPN expression to be compiled.
+ * @param context The context to resolve variables in, or NULL.
+ * @return        A newly allocated program, or NULL if `rpn` is NULL or memory
+ *                allocation failed.
+ */
+static CompiledExpression* compile_program(const ReversePolishExpression* rpn, EvalContext* context) {
+    if (!rpn || !rpn->expression) {
+        return NULL;
+    }
+
+    CompiledExpression* program = calloc(1, sizeof(CompiledExpression));
+    if (!program) {
+        return NULL;
+    }
+    // Each token yields at most one instruction, plus one OP_FAIL at most
+    program->code = malloc((rpn->length + 1) * sizeof(Instruction));
+    program->variable_names = malloc((rpn->length + 1) * sizeof(char*));
+    if (context) {
+        program->context = context;
+        program->context_generation = context->generation;
+        program->context_slots = malloc((rpn->length + 1) * sizeof(size_t));
+    }
+    if (!program->code || !program->variable_names || (context && !program->context_slots)) {
+        free_compiled(program);
+        return NULL;
+    }
+
+    size_t depth = 0;
+    for (size_t i = 0; i < rpn->length; i++) {
+        const char* token = rpn->expression[i];
+        Opcode opcode;
+        double number;
+        bool is_opcode = lookup_operator(token, &opcode);
+
+        if (is_opcode || strcmp(token, "ans") == 0) {
+            if (!is_opcode) {
+                // "ans" reaches apply_operator as a binary operator and is rejected there
+                emit_fail(program, depth < 2 ? STACK_UNDERFLOW : INVALID_OPERATOR);
+                return program;
+            }
+            if (is_unary_opcode(opcode)) {
+                if (depth < 1) {
+                    emit_fail(program, INVALID_OPERATOR);
+                    return program;
+                }
+            } else {
+                if (depth < 2) {
+                    emit_fail(program, STACK_UNDERFLOW);
+                    return program;
+                }
+                depth--;
+            }
+            program->code[program->length++].opcode = opcode;
+            continue;
+        }
+
+        if (++depth > program->max_depth) {
+            program->max_depth = depth;
+        }
+
+        Instruction* instruction = &program->code[program->length];
+        if (parse_number(token, &number)) {
+            instruction->opcode = OP_PUSH_NUMBER;
+            instruction->operand.number = number;
+            instruction->unrounded = number;
+            program->length++;
+            continue;
+        }
+
+        int error_code = SUCCESS;
+        double value = context ? 0.0 : get_variable_value(token, &error_code);
+        if (!context && error_code == SUCCESS) {
+            instruction->opcode = OP_PUSH_NUMBER;
+            instruction->operand.number = value;
+            instruction->unrounded = value;
+            program->length++;
+            continue;
+        }
+
+        size_t slot;
+        size_t known = program->variable_count;
+        instruction->opcode = OP_PUSH_VARIABLE;
+        if (!intern_variable(program, token, &slot) ||
+            (context && slot == known && context_intern(context, token, &program->context_slots[slot]) != SUCCESS)) {
+            free_compiled(program);
+            return NULL;
+        }
+        instruction->operand.slot = slot;
+        program->length++;
+    }
+
+    if (depth != 1) {
+        emit_fail(program, STACK_UNDERFLOW);
+    }
+    return program;
+}
+
+/**
+ * @brief Rewrites an operation with a constant right operand into a single instruction.
+ *
+ * Only rewrites that give the same bits as the original operation, including its
+ * rounding, are made: x + k and x - k add a constant, x * 1, x / 1 and x ^ 1 add -0.0
+ * (which leaves every value unchanged, unlike +0.0 for -0.0), x ^ 2 squares, and other
+ * small non-negative integer powers skip straight to `literal_power`. Apart from
+ * adding a constant, which keeps both of its values, the constant must be the same
+ * with and without rounding, so the rewrite holds in every precision mode.
+ *
+ * @param opcode   The binary operator opcode.
+ * @param constant The OP_PUSH_NUMBER of the right operand.
+ * @param rewrite  A pointer where the replacement instruction is stored.
+ * @return         True if the operation was rewritten.
+ */
+static bool simplify_constant_operand(Opcode opcode, const Instruction* constant, Instruction* rewrite) {
+    double number = constant->operand.number;
+    if (opcode == OP_ADD || opcode == OP_SUBTRACT) {
+        rewrite->opcode = OP_ADD_CONSTANT;
+        rewrite->operand.number = opcode == OP_ADD ? number : -number;
+        rewrite->unrounded = opcode == OP_ADD ? constant->unrounded : -constant->unrounded;
+        return true;
+    }
+    if (constant->unrounded != number) {
+        return false;
+    }
+    if ((opcode == OP_MULTIPLY || opcode == OP_DIVIDE || opcode == OP_POWER) && number == 1) {
+        rewrite->opcode = OP_ADD_CONSTANT;
+        rewrite->operand.number = -0.0;
+        rewrite->unrounded = -0.0;
+        return true;
+    }
+    if (opcode != OP_POWER) {
+        return false;
+    }
+    if (number == 2) {
+        rewrite->opcode = OP_SQUARE;
+        return true;
+    }
+    if (number >= 0 && number <= MAX_SQUARING_EXPONENT && number == (unsigned)number) {
+        rewrite->opcode = OP_INTEGER_POWER;
+        rewrite->operand.exponent = (unsigned)number;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Folds constant subexpressions of a compiled program and simplifies identities.
+ *
+ * Runs once over the instructions, rewriting them in place while tracking which stack
+ * values are constants:
+ * - An operator applied to constants only is replaced by the literal it produces. The
+ *   literal comes from `apply_opcode`, so it is exactly the value evaluation would compute,
+ *   and its unrounded value from `apply_opcode_raw`, for the other precision modes.
+ * - If that operator fails, the constant subexpression is replaced by an OP_FAIL with the
+ *   same error code, and so is a division by a constant zero. Instructions before it still
+ *   run first, so their errors still win, and nothing after an OP_FAIL is kept. If only
+ *   one of the rounded and unrounded operations fails, or they fail differently, the
+ *   operator is kept for evaluation to decide.
+ * - Operations with one constant operand are rewritten by `simplify_constant_operand`
+ *   (k + x and 1 * x as well, since both operators are commutative).
+ *
+ * Programs compiled in a context keep 'pi' and 'e' as variables, since the context
+ * may reassign them; only their literals are folded. If the work buffer cannot be
+ * allocated the program is left as it is, which is still correct.
+ *
+ * @param program The program returned by `compile_program`.
+ */
+static void optimize_program(CompiledExpression* program) {
+    FoldSlot* slots = malloc((program->max_depth + 1) * sizeof(FoldSlot));
+    if (!slots) {
+        return;
+    }
+
+    Instruction* code = program->code;
+    size_t length = 0, top = 0, max_depth = 0;
+
+    for (size_t i = 0; i < program->length; i++) {
+        Instruction instruction = code[i];
+        Opcode opcode = instruction.opcode;
+        int error_code = SUCCESS;
+
+        if (opcode == OP_PUSH_NUMBER || opcode == OP_PUSH_VARIABLE) {
+            slots[top].start = length;
+            slots[top].constant = opcode == OP_PUSH_NUMBER;
+            if (++top > max_depth) {
+                max_depth = top;
+            }
+            code[length++] = instruction;
+            continue;
+        }
+        if (opcode == OP_FAIL) {
+            code[length++] = instruction;
+            break;
+        }
+
+        FoldSlot* a = &slots[is_unary_opcode(opcode) ? top - 1 : top - 2];
+        FoldSlot* b = is_unary_opcode(opcode) ? NULL : &slots[--top];
+        const Instruction* x = &code[a->start];
+        const Instruction* y = b ? &code[b->start] : NULL;
+        double value = 0.0, unrounded = 0.0;
+
+        bool foldable = a->constant && (!b || b->constant);
+        if (foldable) {
+            int raw_error_code = SUCCESS;
+            value = apply_opcode(opcode, x->operand.number, y ? y->operand.number : 0, &error_code);
+            unrounded = apply_opcode_raw(opcode, x->unrounded, y ? y->unrounded : 0, &raw_error_code);
+            foldable = error_code == raw_error_code;
+        }
+
+        if (foldable) {
+            length = a->start;
+        } else if (b && b->constant && opcode == OP_DIVIDE && y->operand.number == 0 && y->unrounded == 0) {
+            error_code = DIVISION_BY_ZERO;
+            length = b->start;
+        } else if (b && b->constant && simplify_constant_operand(opcode, y, &instruction)) {
+            length = b->start;
+            code[length++] = instruction;
+            continue;
+        } else if (b && a->constant && (opcode == OP_ADD || opcode == OP_MULTIPLY) &&
+                   simplify_constant_operand(opcode, x, &instruction)) {
+            // Drop the constant in front of the other operand
+            memmove(code + a->start, code + a->start + 1, (length - a->start - 1) * sizeof(Instruction));
+            code[length - 1] = instruction;
+            a->constant = false;
+            continue;
+        } else {
+            code[length++] = instruction;
+            a->constant = false;
+            continue;
+        }
+
+        if (error_code != SUCCESS) {
+            code[length].opcode = OP_FAIL;
+            code[length++].operand.error_code = error_code;
+            break;
+        }
+        code[length].opcode = OP_PUSH_NUMBER;
+        code[length].operand.number = value;
+        code[length++].unrounded = unrounded;
+    }
+
+    program->length = length;
+    program->max_depth = max_depth;
+    free(slots);
+}
+
+/**
+ * @brief Compiles a Reverse Polish Notation (RPN) expression into an instruction array.
+ *
+ * Every token is classified once: operators become opcodes, numbers are parsed into
+ * literals and the default variables ('pi', 'e') are replaced by their values. Any
+ * other identifier becomes a free variable slot. Constant subexpressions are then
+ * folded by `optimize_program`. Evaluating the result with `evaluate_compiled` gives
+ * the same value and error code as `evaluate_rpn` on the same expression, without any
+ * string comparison or stack bounds check.
+ *
+ * @param rpn A pointer to a ReversePolishExpression structure representing
+ *            the RPN expression to be compiled.
+ * @return    A newly allocated program that must be released with `free_compiled`,
+ *            or NULL if `rpn` is NULL or memory allocation failed.
+ */
+CompiledExpression* compile_rpn(const ReversePolishExpression* rpn) {
+    CompiledExpression* program = compile_program(rpn, NULL);
+    if (program) {
+        optimize_program(program);
+    }
+    return program;
+}
+
+/**
+ * @brief Compiles a Reverse Polish Notation (RPN) expression against an evaluation context.
+ *
+ * Like `compile_rpn`, but every identifier (including 'pi' and 'e') is resolved to its
+ * slot in `context` once, here. Names the context does not know yet get an undefined
+ * slot that can be assigned later with `context_set_variable`. The program must be
+ * evaluated with `evaluate_compiled_in_context` and the same context.
+ *
+ * @param context The context to resolve variables in.
+ * @param rpn     A pointer to a ReversePolishExpression structure representing
+ *                the RPN expression to be compiled.
+ * @return        A newly allocated program that must be released with `free_compiled`,
+ *                or NULL if an argument is NULL or memory allocation failed.
+ */
+CompiledExpression* compile_rpn_in_context(EvalContext* context, const ReversePolishExpression* rpn) {
+    if (!context) {
+        return NULL;
+    }
+    CompiledExpression* program = compile_program(rpn, context);
+    if (program) {
+        optimize_program(program);
+    }
+    return program;
+}
+
+/**
+ * @brief Runs the instructions of a compiled program on a given stack.
+ *
+ * Inlined once with rounding and once without, so neither loop tests the precision
+ * mode.
+ *
+ * @param program The program to be run.
+ * @param context The EvalContext the program was compiled in, NULL if none.
+ * @param rounded Whether the result of every operation is rounded.
+ * @param stack   A stack of at least `program->max_depth` values.
+ * @return        See `run_compiled`.
+ */
+static inline CalculationResult run_instructions(const CompiledExpression* program, const EvalContext* context,
+                                                 bool rounded, double* stack) {
+    CalculationResult result = {0.0, SUCCESS};
+    size_t top = 0; // Number of values on the stack
+    const Instruction* end = program->code + program->length;
+
+    for (const Instruction* ip = program->code; ip < end; ip++) {
+        METRIC_OPCODE(ip->opcode, 1);
+        switch (ip->opcode) {
+            case OP_PUSH_NUMBER:
+                stack[top++] = rounded ? ip->operand.number : ip->unrounded;
+                break;
+            case OP_PUSH_VARIABLE: {
+                if (!context) {
+                    result.error_code = UNDEFINED_VARIABLE;
+                    return result;
+                }
+                const ContextVariable* variable = &context->variables[program->context_slots[ip->operand.slot]];
+                if (!variable->defined) {
+                    result.error_code = UNDEFINED_VARIABLE;
+                    return result;
+                }
+                stack[top++] = variable->value;
+                break;
+            }
+            case OP_ADD:
+                top--;
+                stack[top - 1] = round_operation(stack[top - 1] + stack[top], rounded);
+                break;
+            case OP_SUBTRACT:
+                top--;
+                stack[top - 1] = round_operation(stack[top - 1] - stack[top], rounded);
+                break;
+            case OP_MULTIPLY:
+                top--;
+                stack[top - 1] = round_operation(stack[top - 1] * stack[top], rounded);
+                break;
+            case OP_DIVIDE:
+            case OP_POWER: {
+                int error_code = SUCCESS;
+                top--;
+                stack[top - 1] = round_operation(apply_opcode_raw(ip->opcode, stack[top - 1], stack[top], &error_code), rounded);
+                if (error_code != SUCCESS) {
+                    result.error_code = error_code;
+                    return result;
+                }
+                break;
+            }
+            case OP_SQUARE:
+                stack[top - 1] = round_operation(stack[top - 1] * stack[top - 1], rounded);
+                break;
+            case OP_ADD_CONSTANT:
+                stack[top - 1] = round_operation(stack[top - 1] + (rounded ? ip->operand.number : ip->unrounded), rounded);
+                break;
+            case OP_INTEGER_POWER:
+                stack[top - 1] = round_operation(literal_power(stack[top - 1], ip->operand.exponent), rounded);
+                break;
+            case OP_FAIL:
+                result.error_code = ip->operand.error_code;
+                return result;
+            default: {
+                int error_code = SUCCESS;
+                stack[top - 1] = round_operation(apply_opcode_raw(ip->opcode, stack[top - 1], 0, &error_code), rounded);
+                if (error_code != SUCCESS) {
+                    result.error_code = error_code;
+                    return result;
+                }
+                break;
+            }
+        }
+    }
+
+    result.value = stack[0];
+    return result;
+}
+
+/**
+ * @brief Runs the instructions of a compiled program on a given stack, rounding
+ * every operation.
+ *
+ * Body of `run_compiled` in PRECISION_ROUNDED mode. Each mode has its own evaluator
+ * so `with_stack` can inline it.
+ *
+ * @param input   The CompiledExpression to be run.
+ * @param context The EvalContext the program was compiled in, NULL if none.
+ * @param rounded Always true.
+ * @param stack   A stack of at least `program->max_depth` values.
+ * @return        See `run_compiled`.
+ */
+static CalculationResult run_rounded_on_stack(const void* input, const void* context, bool rounded, double* stack) {
+    (void)rounded;
+    return run_instructions(input, context, true, stack);
+}
+
+/**
+ * @brief Runs the instructions of a compiled program on a given stack, without
+ * rounding any operation.
+ *
+ * Body of `run_compiled` in the PRECISION_RAW and PRECISION_ROUND_RESULT modes.
+ *
+ * @param input   The CompiledExpression to be run.
+ * @param context The EvalContext the program was compiled in, NULL if none.
+ * @param rounded Always false.
+ * @param stack   A stack of at least `program->max_depth` values.
+ * @return        See `run_compiled`.
+ */
+static CalculationResult run_raw_on_stack(const void* input, const void* context, bool rounded, double* stack) {
+    (void)rounded;
+    return run_instructions(input, context, false, stack);
+}
+
+/**
+ * @brief Evaluates a compiled RPN program.
+ *
+ * Runs the instructions of the program in a single switch loop, on a stack sized to
+ * the depth computed during compilation. Stack depth was validated then too, so no
+ * instruction checks for overflow or underflow.
+ * Free variables are read from their context slot; without a context they have no
+ * value, so reaching an OP_PUSH_VARIABLE raises UNDEFINED_VARIABLE, as `evaluate_rpn`
+ * would for an unknown name.
+ *
+ * @param program   A pointer to a compiled program.
+ * @param context   The context the program was compiled in, NULL if none.
+ * @param precision The precision mode, see `with_stack`.
+ * @return          See `evaluate_compiled`. MEMORY_ERROR if `context` is not the one
+ *                  the program was compiled in, or if the stack cannot be allocated.
+ */
+static CalculationResult run_compiled(const CompiledExpression* program, const EvalContext* context, int precision) {
+    if (!program || !compiled_in_context(context, program)) {
+        CalculationResult result = {0.0, MEMORY_ERROR};
+        return result;
+    }
+    if (precision == PRECISION_ROUNDED) {
+        return with_stack(program->max_depth, run_rounded_on_stack, program, context, precision);
+    }
+    return with_stack(program->max_depth, run_raw_on_stack, program, context, precision);
+}
+
+/**
+ * @brief Evaluates a program returned by `compile_rpn`.
+ *
+ * Free variables have no value outside a context, so they raise UNDEFINED_VARIABLE.
+ *
+ * @param program A pointer to a program returned by `compile_rpn`.
+ * @return        A CalculationResult structure containing the result of the
+ *                evaluation and an error code.
+ *                  -   The 'value' field holds the calculated result if the evaluation
+ *                      is successful, 0.0 otherwise.
+ *                  -   The 'error_code' field is set to SUCCESS (0) or to the same error
+ *                      code `evaluate_rpn` reports for the expression.
+ */
+CalculationResult evaluate_compiled(const CompiledExpression* program) {
+    return run_compiled(program, NULL, PRECISION_ROUNDED);
+}
+
+/**
+ * @brief Evaluates a program returned by `compile_rpn_in_context`.
+ *
+ * Variables are read directly from their context slots; no name is looked up.
+ * Variables that were never assigned raise UNDEFINED_VARIABLE when reached. The
+ * program is evaluated in the precision mode of the context.
+ *
+ * @param context The context the program was compiled in.
+ * @param program A pointer to a program returned by `compile_rpn_in_context`.
+ * @return        See `evaluate_compiled`. MEMORY_ERROR if the program was compiled
+ *                in another context.
+ */
+CalculationResult evaluate_compiled_in_context(const EvalContext* context, const CompiledExpression* program) {
+    if (!context) {
+        CalculationResult result = {0.0, MEMORY_ERROR};
+        return result;
+    }
+    return run_compiled(program, context, context->precision);
+}
+
+/**
+ * @brief Evaluates a compiled program in a given precision mode.
+ *
+ * The same program serves every mode: folded constants keep both their rounded and
+ * unrounded values.
+ *
+ * @param context   The context the program was compiled in, or NULL for a program
+ *                  returned by `compile_rpn`. Its own precision mode is ignored.
+ * @param program   A pointer to a compiled program.
+ * @param precision PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return          See `evaluate_compiled`. MEMORY_ERROR if the program was compiled
+ *                  in another context or `precision` is not a mode.
+ */
+CalculationResult evaluate_compiled_with_precision(const EvalContext* context, const CompiledExpression* program,
+                                                   int precision) {
+    return run_compiled(program, context, precision);
+}
+
+/**
+ * @brief Returns the number of instructions of a compiled program, after optimization.
+ *
+ * @param program A pointer to a program returned by `compile_rpn`.
+ * @return        The number of instructions, 0 if `program` is NULL.
+ */
+size_t compiled_length(const CompiledExpression* program) {
+    return program ? program->length : 0;
+}
+
+/**
+ * @brief Returns the number of free variables of a compiled program.
+ *
+ * @param program A pointer to a program returned by `compile_rpn`.
+ * @return        The number of variable slots, 0 if `program` is NULL.
+ */
+size_t compiled_variable_count(const CompiledExpression* program) {
+    return program ? program->variable_count : 0;
+}
+
+/**
+ * @brief Returns the name of a free variable of a compiled program.
+ *
+ * @param program A pointer to a program returned by `compile_rpn`.
+ * @param slot    The variable slot, below `compiled_variable_count(program)`.
+ * @return        The null-terminated name owned by the program, or NULL if out of range.
+ */
+const char* compiled_variable_name(const CompiledExpression* program, size_t slot) {
+    if (!program || slot >= program->variable_count) {
+        return NULL;
+    }
+    return program->variable_names[slot];
+}
+
+/**
+ * @brief Gathers the values of the variables of a program compiled in a context.
+ *
+ * Fills the `variables` argument of the native code of `program`, see `jit_compile`.
+ *
+ * @param context The context the program was compiled in.
+ * @param program A pointer to a program returned by `compile_rpn_in_context`.
+ * @param values  An array of `compiled_variable_count(program)` values to fill.
+ * @return        SUCCESS, UNDEFINED_VARIABLE if a variable was never assigned, or
+ *                MEMORY_ERROR if the program was compiled in another context. Only after
+ *                SUCCESS does the native code give the result of `evaluate_compiled_in_context`.
+ */
+int compiled_context_values(const EvalContext* context, const CompiledExpression* program, double* values) {
+    if (!context || !program || !compiled_in_context(context, program)) {
+        return MEMORY_ERROR;
+    }
+    for (size_t i = 0; i < program->variable_count; i++) {
+        const ContextVariable* variable = &context->variables[program->context_slots[i]];
+        if (!variable->defined) {
+            return UNDEFINED_VARIABLE;
+        }
+        values[i] = variable->value;
+    }
+    return SUCCESS;
+}
+
+#if JIT_SUPPORTED
+
+#define JIT_EMIT(builder, ...) \
+    do { \
+        const unsigned char bytes_[] = {__VA_ARGS__}; \
+        memcpy((builder)->code + (builder)->length, bytes_, sizeof(bytes_)); \
+        (builder)->length += sizeof(bytes_); \
+    } while (0)
+
+static void jit_u32(JitBuilder* builder, uint32_t value) {
+    memcpy(builder->code + builder->length, &value, sizeof(value));
+    builder->length += sizeof(value);
+}
+
+/**
+ * @brief Emits a displacement to `target`, patched by `jit_link`.
+ */
+static void jit_fixup(JitBuilder* builder, size_t target) {
+    builder->fixups[builder->fixup_count].offset = builder->length;
+    builder->fixups[builder->fixup_count++].target = target;
+    jit_u32(builder, 0);
+}
+
+/**
+ * @brief Adds a double to the constant pool and returns its index.
+ */
+static size_t jit_constant(JitBuilder* builder, double value) {
+    memcpy(&builder->pool[builder->pool_length], &value, sizeof(value));
+    return builder->pool_length++;
+}
+
+/**
+ * @brief Emits the displacement of stack value `slot` from rsp: slots start after the error code.
+ */
+static void jit_slot(JitBuilder* builder, size_t slot) {
+    jit_u32(builder, (uint32_t)(16 + 8 * slot));
+}
+
+/**
+ * @brief Emits a jump to the error exit with `error_code` in eax.
+ */
+static void jit_fail(JitBuilder* builder, int error_code) {
+    JIT_EMIT(builder, 0xB8);                 // mov eax, error_code
+    jit_u32(builder, (uint32_t)error_code);
+    JIT_EMIT(builder, 0xE9);                 // jmp exit
+    jit_fixup(builder, JIT_EXIT);
+}
+
+/**
+ * @brief Emits a call to `apply_opcode_raw`, with xmm0 and xmm1 as operands, and a jump to
+ * the error exit if it fails.
+ */
+static void jit_apply(JitBuilder* builder, Opcode opcode, size_t apply) {
+    JIT_EMIT(builder, 0xBF);                                // mov edi, opcode
+    jit_u32(builder, (uint32_t)opcode);
+    JIT_EMIT(builder, 0x48, 0x8D, 0x74, 0x24, 0x08);        // lea rsi, [rsp + 8]
+    JIT_EMIT(builder, 0xFF, 0x15);                          // call [apply_opcode_raw]
+    jit_fixup(builder, apply);
+    JIT_EMIT(builder, 0x8B, 0x44, 0x24, 0x08, 0x85, 0xC0);  // mov eax, [rsp + 8]; test eax, eax
+    JIT_EMIT(builder, 0x0F, 0x85);                          // jnz exit
+    jit_fixup(builder, JIT_EXIT);
+}
+
+/**
+ * @brief Emits the rounding of xmm0 to 9 decimal places, if evaluation is rounded.
+ */
+static void jit_round(JitBuilder* builder, bool rounded, size_t round) {
+    if (rounded) {
+        JIT_EMIT(builder, 0xFF, 0x15);  // call [round_to_9_decimals]
+        jit_fixup(builder, round);
+    }
+}
+
+/**
+ * @brief Emits the epilogue of the native code: releases the frame and returns eax.
+ */
+static void jit_return(JitBuilder* builder, uint32_t frame) {
+    JIT_EMIT(builder, 0x48, 0x81, 0xC4);  // add rsp, frame
+    jit_u32(builder, frame);
+    JIT_EMIT(builder, 0x41, 0x5C, 0x5B, 0xC3);  // pop r12; pop rbx; ret
+}
+
+/**
+ * @brief Generates the machine code of a program into `builder`.
+ *
+ * The top of the stack lives in xmm0 and the values below it in the native frame,
+ * so that helpers, which clobber every other register, need no spilling. Division
+ * by zero, negative square roots and `OP_FAIL` jump to the error exit with their error
+ * code in eax; other failures come from `apply_opcode_raw` through the error code at
+ * [rsp + 8].
+ *
+ * @return The size of the frame below the saved registers.
+ */
+static uint32_t jit_generate(JitBuilder* builder, const CompiledExpression* program, int precision) {
+    bool rounded = precision == PRECISION_ROUNDED;
+    size_t apply = builder->pool_length++;
+    size_t round = builder->pool_length++;
+    double (*apply_function)(Opcode, double, double, int*) = apply_opcode_raw;
+    double (*round_function)(double) = round_to_9_decimals;
+    memcpy(&builder->pool[apply], &apply_function, sizeof(apply_function));
+    memcpy(&builder->pool[round], &round_function, sizeof(round_function));
+
+    // The return address and two saved registers leave rsp 16-byte aligned once the frame is odd in 8s
+    uint32_t frame = (uint32_t)(16 + 8 * program->max_depth);
+    if (frame % 16 == 0) {
+        frame += 8;
+    }
+    JIT_EMIT(builder, 0x53, 0x41, 0x54);                          // push rbx; push r12
+    JIT_EMIT(builder, 0x48, 0x81, 0xEC);                          // sub rsp, frame
+    jit_u32(builder, frame);
+    JIT_EMIT(builder, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4);        // mov rbx, rdi; mov r12, rsi
+    JIT_EMIT(builder, 0xC7, 0x44, 0x24, 0x08, 0x00, 0x00, 0x00, 0x00);  // mov dword [rsp + 8], SUCCESS
+
+    size_t top = 0;
+    bool failed = false;
+    for (size_t i = 0; i < program->length && !failed; i++) {
+        const Instruction* ip = &program->code[i];
+        switch (ip->opcode) {
+            case OP_PUSH_NUMBER:
+            case OP_PUSH_VARIABLE:
+                if (top > 0) {
+                    JIT_EMIT(builder, 0xF2, 0x0F, 0x11, 0x84, 0x24);  // movsd [rsp + slot], xmm0
+                    jit_slot(builder, top - 1);
+                }
+                if (ip->opcode == OP_PUSH_NUMBER) {
+                    JIT_EMIT(builder, 0xF2, 0x0F, 0x10, 0x05);        // movsd xmm0, [number]
+                    jit_fixup(builder, jit_constant(builder, rounded ? ip->operand.number : ip->unrounded));
+                } else {
+                    JIT_EMIT(builder, 0xF2, 0x0F, 0x10, 0x83);        // movsd xmm0, [rbx + 8 * slot]
+                    jit_u32(builder, (uint32_t)(8 * ip->operand.slot));
+                }
+                top++;
+                break;
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_POWER:
+                JIT_EMIT(builder, 0x66, 0x0F, 0x28, 0xC8);            // movapd xmm1, xmm0
+                JIT_EMIT(builder, 0xF2, 0x0F, 0x10, 0x84, 0x24);      // movsd xmm0, [rsp + slot]
+                jit_slot(builder, top - 2);
+                top--;
+                if (ip->opcode == OP_POWER) {
+                    jit_apply(builder, OP_POWER, apply);
+                } else {
+                    if (ip->opcode == OP_DIVIDE) {
+                        // xorpd xmm2, xmm2; ucomisd xmm1, xmm2; jp ok; jne ok
+                        JIT_EMIT(builder, 0x66, 0x0F, 0x57, 0xD2, 0x66, 0x0F, 0x2E, 0xCA, 0x7A, 0x0C, 0x75, 0x0A);
+                        jit_fail(builder, DIVISION_BY_ZERO);
+                    }
+                    unsigned char operation = ip->opcode == OP_ADD        ? 0x58
+                                              : ip->opcode == OP_SUBTRACT ? 0x5C
+                                              : ip->opcode == OP_MULTIPLY ? 0x59
+                                                                          : 0x5E;
+                    JIT_EMIT(builder, 0xF2, 0x0F, operation, 0xC1);    // op xmm0, xmm1
+                }
+                jit_round(builder, rounded, round);
+                break;
+            case OP_SQUARE:
+                JIT_EMIT(builder, 0xF2, 0x0F, 0x59, 0xC0);            // mulsd xmm0, xmm0
+                jit_round(builder, rounded, round);
+                break;
+            case OP_ADD_CONSTANT:
+                JIT_EMIT(builder, 0xF2, 0x0F, 0x58, 0x05);            // addsd xmm0, [number]
+                jit_fixup(builder, jit_constant(builder, rounded ? ip->operand.number : ip->unrounded));
+                jit_round(builder, rounded, round);
+                break;
+            case OP_INTEGER_POWER:
+                JIT_EMIT(builder, 0xF2, 0x0F, 0x10, 0x0D);            // movsd xmm1, [exponent]
+                jit_fixup(builder, jit_constant(builder, (double)ip->operand.exponent));
+                jit_apply(builder, OP_INTEGER_POWER, apply);
+                jit_round(builder, rounded, round);
+                break;
+            case OP_SQRT:
+                // xorpd xmm2, xmm2; ucomisd xmm2, xmm0; jbe ok (NaN included, as `a < 0` is false)
+                JIT_EMIT(builder, 0x66, 0x0F, 0x57, 0xD2, 0x66, 0x0F, 0x2E, 0xD0, 0x76, 0x0A);
+                jit_fail(builder, SQUARE_ROOT_INVALID_OPERATOR);
+                JIT_EMIT(builder, 0xF2, 0x0F, 0x51, 0xC0);            // sqrtsd xmm0, xmm0
+                jit_round(builder, rounded, round);
+                break;
+            case OP_FAIL:
+                jit_fail(builder, ip->operand.error_code);
+                failed = true;
+                break;
+            default:
+                JIT_EMIT(builder, 0x66, 0x0F, 0x57, 0xC9);            // xorpd xmm1, xmm1
+                jit_apply(builder, ip->opcode, apply);
+                jit_round(builder, rounded, round);
+                break;
+        }
+    }
+
+    if (!failed) {
+        jit_round(builder, precision == PRECISION_ROUND_RESULT, round);
+        JIT_EMIT(builder, 0xF2, 0x41, 0x0F, 0x11, 0x04, 0x24);      // movsd [r12], xmm0
+        JIT_EMIT(builder, 0x31, 0xC0);                              // xor eax, eax
+        jit_return(builder, frame);
+    }
+    return frame;
+}
+
+/**
+ * @brief Lays out generated code and its constant pool in an executable mapping.
+ *
+ * @param builder The generated code, ending with its error exit at `exit`.
+ * @param exit    The position of the error exit in the code.
+ * @return        A new JitProgram, or NULL if the mapping fails.
+ */
+static JitProgram* jit_link(JitBuilder* builder, size_t exit) {
+    size_t pool_offset = (builder->length + 7) & ~(size_t)7;
+    for (size_t i = 0; i < builder->fixup_count; i++) {
+        const JitFixup* fixup = &builder->fixups[i];
+        size_t target = fixup->target == JIT_EXIT ? exit : pool_offset + 8 * fixup->target;
+        int32_t displacement = (int32_t)((int64_t)target - (int64_t)(fixup->offset + 4));
+        memcpy(builder->code + fixup->offset, &displacement, sizeof(displacement));
+    }
+
+    JitProgram* jit = malloc(sizeof(JitProgram));
+    if (!jit) {
+        return NULL;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    jit->size = (pool_offset + 8 * builder->pool_length + page - 1) / page * page;
+    jit->memory = mmap(NULL, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->memory == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    unsigned char* memory = jit->memory;
+    memcpy(memory, builder->code, builder->length);
+    memset(memory + builder->length, 0xCC, pool_offset - builder->length);  // int3 padding
+    memcpy(memory + pool_offset, builder->pool, 8 * builder->pool_length);
+    if (mprotect(jit->memory, jit->size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit->memory, jit->size);
+        free(jit);
+        return NULL;
+    }
+    memcpy(&jit->entry, &jit->memory, sizeof(jit->entry));
+    return jit;
+}
+
+#endif
+
+/**
+ * @brief Compiles a compiled RPN program further, to native code.
+ *
+ * The native code runs the same instructions as `run_instructions`, in one precision
+ * mode, with the same helpers for everything but arithmetic and square roots, so it
+ * gives the same value and error code bit for bit. Variables are read from the array
+ * passed to the code, one value per slot of the program, instead of from a context:
+ *   - For a program compiled in a context, `compiled_context_values` fills the array;
+ *     the result is then the one of `evaluate_compiled_in_context`.
+ *   - For a program returned by `compile_rpn`, the array binds the free variables as
+ *     `evaluate_compiled_columns` does for one row. Without variables the result is
+ *     the one of `evaluate_compiled_with_precision`.
+ *
+ * Native code is only generated by builds with CALCULATOR_JIT on x86-64, and only for
+ * programs of at most JIT_MAX_LENGTH instructions and a stack of at most JIT_MAX_DEPTH.
+ *
+ * @param program   A pointer to a compiled program.
+ * @param precision PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return          A newly allocated JitProgram that must be released with `jit_free`,
+ *                  or NULL if the program or the platform is not supported, `precision`
+ *                  is not a mode or memory allocation failed. The program itself may be
+ *                  released before the JitProgram.
+ */
+JitProgram* jit_compile(const CompiledExpression* program, int precision) {
+#if JIT_SUPPORTED
+    if (!program || !is_precision(precision) || program->length > JIT_MAX_LENGTH ||
+        program->max_depth > JIT_MAX_DEPTH) {
+        return NULL;
+    }
+
+    JitBuilder builder = {0};
+    builder.code = malloc(program->length * JIT_INSTRUCTION_SIZE + JIT_FRAME_CODE_SIZE);
+    builder.pool = malloc((program->length + 2) * sizeof(uint64_t));
+    builder.fixups = malloc((4 * program->length + 1) * sizeof(JitFixup));
+    JitProgram* jit = NULL;
+    if (builder.code && builder.pool && builder.fixups) {
+        uint32_t frame = jit_generate(&builder, program, precision);
+        size_t exit = builder.length;
+        JIT_EMIT(&builder, 0x49, 0xC7, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00);  // mov qword [r12], 0
+        jit_return(&builder, frame);
+        jit = jit_link(&builder, exit);
+    }
+    TRACE(TRACE_INFO, "JIT compiled %zu instructions into %zu bytes\n", program->length, builder.length);
+    free(builder.code);
+    free(builder.pool);
+    free(builder.fixups);
+    return jit;
+#else
+    (void)program;
+    (void)precision;
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Returns the entry point of native code returned by `jit_compile`.
+ *
+ * @param jit A pointer to a JitProgram.
+ * @return    The native function, NULL if `jit` is NULL.
+ */
+JitEntry jit_entry(const JitProgram* jit) {
+    return jit ? jit->entry : NULL;
+}
+
+/**
+ * @brief Releases native code returned by `jit_compile`.
+ *
+ * @param jit The JitProgram. NULL is ignored.
+ */
+void jit_free(JitProgram* jit) {
+    if (!jit) {
+        return;
+    }
+#if JIT_SUPPORTED
+    munmap(jit->memory, jit->size);
+#endif
+    free(jit);
+}
+
+/**
+ * @brief Records an error for a row unless the row already failed.
+ *
+ * Evaluation of a row stops at its first error in `evaluate_compiled`, so only the
+ * first error is kept for each row.
+ */
+static inline int first_error(int current, int error_code) {
+    return current != SUCCESS ? current : error_code;
+}
+
+// Instruction sets of the vector kernels, matching `VectorIsa` in src/lib.rs
+#define VECTOR_ISA_SCALAR 0
+#define VECTOR_ISA_SSE2 1
+#define VECTOR_ISA_AVX2 2
+#define VECTOR_ISA_AVX512 3
+#define VECTOR_ISA_NEON 4
+
+/* The x86-64 kernels are compiled for their own target with function attributes, so the
+   rest of the library keeps the baseline instruction set and the same binary runs on every
+   x86-64 CPU. FMA is never enabled: a contracted multiply-add would change results. */
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#    define VECTOR_X86 1
+#    include <immintrin.h>
+#else
+#    define VECTOR_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#    define VECTOR_NEON 1
+#    include <arm_neon.h>
+#else
+#    define VECTOR_NEON 0
+#endif
+
+/*Kernels applied to a block of rows, one set per instruction set. Every kernel gives
+  exactly the result of the scalar code it replaces, bit for bit, in every lane. */
+typedef struct {
+    int isa;  //VECTOR_ISA_* of the kernels
+    //Rounds every value to 9 decimal places, like `round_to_9_decimals`
+    void (*round)(double* values, size_t n);
+    //Takes the square root of every value; negative values get 0.0 and SQUARE_ROOT_INVALID_OPERATOR in `codes`
+    void (*sqrt)(double* values, int* codes, size_t n);
+    //Sets `codes` to `code` for values below `low` or above `high`, SUCCESS otherwise (NaN is inside)
+    void (*outside)(const double* values, double low, double high, int code, int* codes, size_t n);
+} VectorKernels;
+
+static void round_scalar(double* values, size_t n) {
+    for (size_t i = 0; i < n; i++) values[i] = round_to_9_decimals(values[i]);
+}
+
+static void sqrt_scalar(double* values, int* codes, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        bool negative = values[i] < 0;
+        codes[i] = negative ? SQUARE_ROOT_INVALID_OPERATOR : SUCCESS;
+        values[i] = negative ? 0.0 : sqrt(values[i]);
+    }
+}
+
+static void outside_scalar(const double* values, double low, double high, int code, int* codes, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        codes[i] = values[i] < low || values[i] > high ? code : SUCCESS;
+    }
+}
+
+static const VectorKernels scalar_kernels = {VECTOR_ISA_SCALAR, round_scalar, sqrt_scalar, outside_scalar};
+
+#if VECTOR_X86
+/**
+ * @brief Rounds two values to 9 decimal places with SSE2, which has no rounding instruction.
+ *
+ * `round` rounds half away from zero: the magnitude is truncated by adding and subtracting
+ * 2^52, which rounds it to the nearest integer, and stepping back where that went up, then
+ * incremented if the dropped fraction is at least one half. Magnitudes from 2^52 on are
+ * already integers and kept as they are, like infinities and NaN.
+ */
+static inline __m128d round_sse2_lanes(__m128d value) {
+    const __m128d sign_mask = _mm_set1_pd(-0.0), one = _mm_set1_pd(1.0), half = _mm_set1_pd(0.5);
+    const __m128d two_52 = _mm_set1_pd(4503599627370496.0), scale = _mm_set1_pd(1e9);
+    __m128d scaled = _mm_mul_pd(value, scale);
+    __m128d sign = _mm_and_pd(scaled, sign_mask);
+    __m128d magnitude = _mm_andnot_pd(sign_mask, scaled);
+    __m128d nearest = _mm_sub_pd(_mm_add_pd(magnitude, two_52), two_52);
+    __m128d truncated = _mm_sub_pd(nearest, _mm_and_pd(_mm_cmpgt_pd(nearest, magnitude), one));
+    __m128d rounded = _mm_add_pd(truncated, _mm_and_pd(_mm_cmpge_pd(_mm_sub_pd(magnitude, truncated), half), one));
+    __m128d integral = _mm_cmpnlt_pd(magnitude, two_52);
+    rounded = _mm_or_pd(_mm_and_pd(integral, magnitude), _mm_andnot_pd(integral, rounded));
+    return _mm_div_pd(_mm_or_pd(rounded, sign), scale);
+}
+
+static void round_sse2(double* values, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(values + i, round_sse2_lanes(_mm_loadu_pd(values + i)));
+    round_scalar(values + i, n - i);
+}
+
+static void sqrt_sse2(double* values, int* codes, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d value = _mm_loadu_pd(values + i);
+        __m128d negative = _mm_cmplt_pd(value, _mm_setzero_pd());
+        _mm_storeu_pd(values + i, _mm_andnot_pd(negative, _mm_sqrt_pd(value)));
+        int mask = _mm_movemask_pd(negative);
+        codes[i] = mask & 1 ? SQUARE_ROOT_INVALID_OPERATOR : SUCCESS;
+        codes[i + 1] = mask & 2 ? SQUARE_ROOT_INVALID_OPERATOR : SUCCESS;
+    }
+    sqrt_scalar(values + i, codes + i, n - i);
+}
+
+static void outside_sse2(const double* values, double low, double high, int code, int* codes, size_t n) {
+    const __m128d lows = _mm_set1_pd(low), highs = _mm_set1_pd(high);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d value = _mm_loadu_pd(values + i);
+        int mask = _mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(value, lows), _mm_cmpgt_pd(value, highs)));
+        codes[i] = mask & 1 ? code : SUCCESS;
+        codes[i + 1] = mask & 2 ? code : SUCCESS;
+    }
+    outside_scalar(values + i, low, high, code, codes + i, n - i);
+}
+
+static const VectorKernels sse2_kernels = {VECTOR_ISA_SSE2, round_sse2, sqrt_sse2, outside_sse2};
+
+/**
+ * @brief Rounds four values to 9 decimal places with AVX2, see `round_sse2_lanes`.
+ */
+__attribute__((target("avx2"))) static inline __m256d round_avx2_lanes(__m256d value) {
+    const __m256d sign_mask = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0), half = _mm256_set1_pd(0.5);
+    const __m256d scale = _mm256_set1_pd(1e9);
+    __m256d scaled = _mm256_mul_pd(value, scale);
+    __m256d sign = _mm256_and_pd(scaled, sign_mask);
+    __m256d magnitude = _mm256_andnot_pd(sign_mask, scaled);
+    __m256d truncated = _mm256_round_pd(magnitude, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256d up = _mm256_cmp_pd(_mm256_sub_pd(magnitude, truncated), half, _CMP_GE_OQ);
+    __m256d rounded = _mm256_add_pd(truncated, _mm256_and_pd(up, one));
+    return _mm256_div_pd(_mm256_or_pd(rounded, sign), scale);
+}
+
+__attribute__((target("avx2"))) static void round_avx2(double* values, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(values + i, round_avx2_lanes(_mm256_loadu_pd(values + i)));
+    round_scalar(values + i, n - i);
+}
+
+/**
+ * @brief Stores one error code per lane of a comparison mask: `code` where it is set.
+ */
+__attribute__((target("avx2"))) static inline void store_codes_avx2(__m256d mask, int code, int* codes) {
+    __m128i lanes = _mm256_cvtpd_epi32(_mm256_and_pd(mask, _mm256_set1_pd(1.0)));
+    _mm_storeu_si128((__m128i*)codes, _mm_mullo_epi32(lanes, _mm_set1_epi32(code)));
+}
+
+__attribute__((target("avx2"))) static void sqrt_avx2(double* values, int* codes, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d value = _mm256_loadu_pd(values + i);
+        __m256d negative = _mm256_cmp_pd(value, _mm256_setzero_pd(), _CMP_LT_OQ);
+        _mm256_storeu_pd(values + i, _mm256_andnot_pd(negative, _mm256_sqrt_pd(value)));
+        store_codes_avx2(negative, SQUARE_ROOT_INVALID_OPERATOR, codes + i);
+    }
+    sqrt_scalar(values + i, codes + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void outside_avx2(const double* values, double low, double high, int code,
+                                                         int* codes, size_t n) {
+    const __m256d lows = _mm256_set1_pd(low), highs = _mm256_set1_pd(high);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d value = _mm256_loadu_pd(values + i);
+        __m256d outside = _mm256_or_pd(_mm256_cmp_pd(value, lows, _CMP_LT_OQ), _mm256_cmp_pd(value, highs, _CMP_GT_OQ));
+        store_codes_avx2(outside, code, codes + i);
+    }
+    outside_scalar(values + i, low, high, code, codes + i, n - i);
+}
+
+static const VectorKernels avx2_kernels = {VECTOR_ISA_AVX2, round_avx2, sqrt_avx2, outside_avx2};
+
+/**
+ * @brief Rounds eight values to 9 decimal places with AVX-512, see `round_sse2_lanes`.
+ */
+__attribute__((target("avx512f"))) static inline __m512d round_avx512_lanes(__m512d value) {
+    const __m512i sign_mask = _mm512_set1_epi64((long long)0x8000000000000000ULL);
+    const __m512d scale = _mm512_set1_pd(1e9);
+    __m512d scaled = _mm512_mul_pd(value, scale);
+    __m512i sign = _mm512_and_si512(_mm512_castpd_si512(scaled), sign_mask);
+    __m512d magnitude = _mm512_abs_pd(scaled);
+    __m512d truncated = _mm512_roundscale_pd(magnitude, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __mmask8 up = _mm512_cmp_pd_mask(_mm512_sub_pd(magnitude, truncated), _mm512_set1_pd(0.5), _CMP_GE_OQ);
+    __m512d rounded = _mm512_mask_add_pd(truncated, up, truncated, _mm512_set1_pd(1.0));
+    rounded = _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(rounded), sign));
+    return _mm512_div_pd(rounded, scale);
+}
+
+__attribute__((target("avx512f"))) static void round_avx512(double* values, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm512_storeu_pd(values + i, round_avx512_lanes(_mm512_loadu_pd(values + i)));
+    round_scalar(values + i, n - i);
+}
+
+/**
+ * @brief Stores one error code per lane of a comparison mask: `code` where it is set.
+ */
+__attribute__((target("avx512f"))) static inline void store_codes_avx512(__mmask8 mask, int code, int* codes) {
+    _mm256_storeu_si256((__m256i*)codes, _mm512_castsi512_si256(_mm512_maskz_set1_epi32(mask, code)));
+}
+
+__attribute__((target("avx512f"))) static void sqrt_avx512(double* values, int* codes, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d value = _mm512_loadu_pd(values + i);
+        __mmask8 negative = _mm512_cmp_pd_mask(value, _mm512_setzero_pd(), _CMP_LT_OQ);
+        _mm512_storeu_pd(values + i, _mm512_maskz_sqrt_pd((__mmask8)~negative, value));
+        store_codes_avx512(negative, SQUARE_ROOT_INVALID_OPERATOR, codes + i);
+    }
+    sqrt_scalar(values + i, codes + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void outside_avx512(const double* values, double low, double high,
+                                                              int code, int* codes, size_t n) {
+    const __m512d lows = _mm512_set1_pd(low), highs = _mm512_set1_pd(high);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d value = _mm512_loadu_pd(values + i);
+        __mmask8 outside = _mm512_cmp_pd_mask(value, lows, _CMP_LT_OQ) | _mm512_cmp_pd_mask(value, highs, _CMP_GT_OQ);
+        store_codes_avx512(outside, code, codes + i);
+    }
+    outside_scalar(values + i, low, high, code, codes + i, n - i);
+}
+
+static const VectorKernels avx512_kernels = {VECTOR_ISA_AVX512, round_avx512, sqrt_avx512, outside_avx512};
+#endif
+
+#if VECTOR_NEON
+// NEON rounds half away from zero itself, like `round`
+static void round_neon(double* values, size_t n) {
+    const float64x2_t scale = vdupq_n_f64(1e9);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        vst1q_f64(values + i, vdivq_f64(vrndaq_f64(vmulq_f64(vld1q_f64(values + i), scale)), scale));
+    }
+    round_scalar(values + i, n - i);
+}
+
+/**
+ * @brief Stores one error code per lane of a comparison mask: `code` where it is set.
+ */
+static inline void store_codes_neon(uint64x2_t mask, int code, int* codes) {
+    int32x2_t lanes = vreinterpret_s32_u32(vmovn_u64(mask));
+    vst1_s32(codes, vand_s32(lanes, vdup_n_s32(code)));
+}
+
+static void sqrt_neon(double* values, int* codes, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t value = vld1q_f64(values + i);
+        uint64x2_t negative = vcltq_f64(value, vdupq_n_f64(0.0));
+        uint64x2_t root = vreinterpretq_u64_f64(vsqrtq_f64(value));
+        vst1q_f64(values + i, vreinterpretq_f64_u64(vbicq_u64(root, negative)));
+        store_codes_neon(negative, SQUARE_ROOT_INVALID_OPERATOR, codes + i);
+    }
+    sqrt_scalar(values + i, codes + i, n - i);
+}
+
+static void outside_neon(const double* values, double low, double high, int code, int* codes, size_t n) {
+    const float64x2_t lows = vdupq_n_f64(low), highs = vdupq_n_f64(high);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t value = vld1q_f64(values + i);
+        store_codes_neon(vorrq_u64(vcltq_f64(value, lows), vcgtq_f64(value, highs)), code, codes + i);
+    }
+    outside_scalar(values + i, low, high, code, codes + i, n - i);
+}
+
+static const VectorKernels neon_kernels = {VECTOR_ISA_NEON, round_neon, sqrt_neon, outside_neon};
+#endif
+
+/**
+ * @brief Returns the kernels of an instruction set, if this build has them and the CPU runs them.
+ *
+ * @param isa A VECTOR_ISA_* value.
+ * @return    The kernels, or NULL.
+ */
+static const VectorKernels* kernels_for(int isa) {
+    switch (isa) {
+        case VECTOR_ISA_SCALAR: return &scalar_kernels;
+#if VECTOR_X86
+        case VECTOR_ISA_SSE2: return &sse2_kernels;  // Part of x86-64 itself
+        case VECTOR_ISA_AVX2: return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+        case VECTOR_ISA_AVX512: return __builtin_cpu_supports("avx512f") ? &avx512_kernels : NULL;
+#endif
+#if VECTOR_NEON
+        case VECTOR_ISA_NEON: return &neon_kernels;  // Part of AArch64 itself
+#endif
+        default: return NULL;
+    }
+}
+
+/**
+ * @brief Returns the kernels of the widest instruction set the CPU runs.
+ */
+static const VectorKernels* best_kernels(void) {
+    static const int preferred[] = {VECTOR_ISA_AVX512, VECTOR_ISA_AVX2, VECTOR_ISA_SSE2, VECTOR_ISA_NEON};
+    for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+        const VectorKernels* kernels = kernels_for(preferred[i]);
+        if (kernels) return kernels;
+    }
+    return &scalar_kernels;
+}
+
+/**
+ * @brief Kernels used by the columnar evaluators, NULL until the first evaluation
+ * or `set_vector_isa` picks them.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+static _Atomic(const VectorKernels*) selected_kernels;
+
+static const VectorKernels* vector_kernels(void) {
+    const VectorKernels* kernels = atomic_load(&selected_kernels);
+    if (!kernels) {
+        // Threads racing here pick the same kernels
+        kernels = best_kernels();
+        atomic_store(&selected_kernels, kernels);
+    }
+    return kernels;
+}
+
+static void select_kernels(const VectorKernels* kernels) {
+    atomic_store(&selected_kernels, kernels);
+}
+#else
+static const VectorKernels* volatile selected_kernels;
+
+static const VectorKernels* vector_kernels(void) {
+    if (!selected_kernels) selected_kernels = best_kernels();
+    return selected_kernels;
+}
+
+static void select_kernels(const VectorKernels* kernels) {
+    selected_kernels = kernels;
+}
+#endif
+
+/**
+ * @brief Returns the instruction set of the kernels the columnar evaluators use.
+ *
+ * @return A VECTOR_ISA_* value: the widest the CPU runs, unless `set_vector_isa` chose another.
+ */
+int get_vector_isa(void) {
+    return vector_kernels()->isa;
+}
+
+/**
+ * @brief Returns whether the kernels of an instruction set are built in and run on this CPU.
+ *
+ * @param isa A VECTOR_ISA_* value.
+ * @return    1 if `set_vector_isa` accepts it, 0 otherwise.
+ */
+int vector_isa_supported(int isa) {
+    return kernels_for(isa) != NULL;
+}
+
+/**
+ * @brief Chooses the kernels of the columnar evaluators.
+ *
+ * Every instruction set gives the same values and error codes, so this only changes
+ * the speed of evaluations, including those already running on other threads.
+ *
+ * @param isa A VECTOR_ISA_* value.
+ * @return    SUCCESS, or MEMORY_ERROR if `vector_isa_supported(isa)` is 0.
+ */
+int set_vector_isa(int isa) {
+    const VectorKernels* kernels = kernels_for(isa);
+    if (!kernels) {
+        return MEMORY_ERROR;
+    }
+    select_kernels(kernels);
+    return SUCCESS;
+}
+
+/**
+ * @brief Applies a function with a domain to a block of rows, checking the whole block first.
+ *
+ * Rows outside [`low`, `high`] get 0.0 and `code`, without calling `function`, like
+ * `apply_opcode_raw`.
+ */
+static void apply_checked_block(const VectorKernels* kernels, double (*function)(double), double low, double high,
+                                int code, double* restrict a, size_t n, int* restrict errors) {
+    int codes[COLUMN_BLOCK_SIZE];
+    kernels->outside(a, low, high, code, codes, n);
+    for (size_t i = 0; i < n; i++) {
+        if (codes[i] != SUCCESS) TRACE(TRACE_ERROR, "Domain error %d in row %zu of a block\n", code, i);
+        a[i] = codes[i] == SUCCESS ? function(a[i]) : 0.0;
+        errors[i] = first_error(errors[i], codes[i]);
+    }
+}
+
+/**
+ * @brief Applies an opcode to a block of rows.
+ *
+ * Arithmetic opcodes run as plain loops over contiguous arrays so the compiler can
+ * vectorize them; division by zero is handled with a per-row mask instead of a branch.
+ * Square roots and the domain checks of logarithms and inverse sines and cosines run
+ * on the vector kernels, which give every row its own error code. Other opcodes go
+ * through `apply_opcode_raw` row by row. Rounding is applied to the whole block last.
+ * Rows that fail get 0.0 and keep their first error code.
+ *
+ * @param kernels The kernels of `vector_kernels`.
+ * @param opcode  The operator opcode to apply.
+ * @param a       The first operand of each row, overwritten with the results.
+ * @param b       The second operand of each row, or NULL for unary opcodes.
+ * @param n       The number of rows in the block.
+ * @param errors  The error code of each row.
+ * @param rounded Whether each result is rounded.
+ */
+static inline void apply_opcode_block(const VectorKernels* kernels, Opcode opcode, double* restrict a,
+                                      const double* restrict b, size_t n, int* restrict errors, bool rounded) {
+    switch (opcode) {
+        case OP_ADD:
+            for (size_t i = 0; i < n; i++) a[i] = a[i] + b[i];
+            break;
+        case OP_SUBTRACT:
+            for (size_t i = 0; i < n; i++) a[i] = a[i] - b[i];
+            break;
+        case OP_MULTIPLY:
+            for (size_t i = 0; i < n; i++) a[i] = a[i] * b[i];
+            break;
+        case OP_SQUARE:
+            for (size_t i = 0; i < n; i++) a[i] = a[i] * a[i];
+            break;
+        case OP_DIVIDE:
+            for (size_t i = 0; i < n; i++) {
+                bool zero = b[i] == 0;
+                errors[i] = first_error(errors[i], zero ? DIVISION_BY_ZERO : SUCCESS);
+                a[i] = zero ? 0.0 : a[i] / b[i];
+            }
+            break;
+        case OP_SQRT: {
+            int codes[COLUMN_BLOCK_SIZE];
+            kernels->sqrt(a, codes, n);
+            for (size_t i = 0; i < n; i++) errors[i] = first_error(errors[i], codes[i]);
+            break;
+        }
+        // `a <= 0` is `a < DBL_TRUE_MIN`, the smallest positive double
+        case OP_LOG: apply_checked_block(kernels, log10, DBL_TRUE_MIN, INFINITY, LOG_ERROR, a, n, errors); break;
+        case OP_LN: apply_checked_block(kernels, log, DBL_TRUE_MIN, INFINITY, LN_ERROR, a, n, errors); break;
+        case OP_ARCSIN: apply_checked_block(kernels, asin, -1, 1, INVALID_TRIG_OPERATOR, a, n, errors); break;
+        case OP_ARCCOS: apply_checked_block(kernels, acos, -1, 1, INVALID_TRIG_OPERATOR, a, n, errors); break;
+        default:
+            for (size_t i = 0; i < n; i++) {
                 int error_code = SUCCESS;
-                double op_result = apply_operator(token, a, 0, &error_code); // Pass 0 as the second operand
-        
-                if (error_code != SUCCESS) {
-                    result.error_code = error_code;
-                    return result;
+                a[i] = apply_opcode_raw(opcode, a[i], b ? b[i] : 0, &error_code);
+                errors[i] = first_error(errors[i], error_code);
+            }
+            break;
+    }
+    if (rounded) {
+        kernels->round(a, n);
+    }
+}
+
+/**
+ * @brief Evaluates a compiled RPN program over columns in a given precision mode.
+ *
+ * See `evaluate_compiled_columns` below; each row gets the value and error code
+ * `evaluate_compiled_with_precision` would return.
+ *
+ * @param precision PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return          SUCCESS, or MEMORY_ERROR if the arguments are invalid, `precision`
+ *                  is not a mode or the block stack cannot be allocated.
+ */
+int evaluate_compiled_columns_with_precision(const CompiledExpression* program, const double* const* columns,
+                                             size_t row_count, double* values, int* error_codes, int precision) {
+    if (!program || !values || !error_codes || (program->variable_count > 0 && !columns) ||
+        !is_precision(precision)) {
+        return MEMORY_ERROR;
+    }
+    bool rounded = precision == PRECISION_ROUNDED;
+    if (row_count == 0) {
+        return SUCCESS;
+    }
+
+    METRIC_START(start_time);
+    PooledStack* pooled = acquire_stack((program->max_depth + 1) * COLUMN_BLOCK_SIZE);
+    if (!pooled) {
+        return MEMORY_ERROR;
+    }
+    double* stack = pooled->values;
+    const VectorKernels* kernels = vector_kernels();
+
+    const Instruction* end = program->code + program->length;
+
+    for (size_t start = 0; start < row_count; start += COLUMN_BLOCK_SIZE) {
+        size_t n = row_count - start < COLUMN_BLOCK_SIZE ? row_count - start : COLUMN_BLOCK_SIZE;
+        int* errors = error_codes + start;
+        size_t top = 0; // Number of blocks on the stack
+
+        for (size_t i = 0; i < n; i++) {
+            errors[i] = SUCCESS;
+        }
+
+        for (const Instruction* ip = program->code; ip < end; ip++) {
+            METRIC_OPCODE(ip->opcode, n);
+            switch (ip->opcode) {
+                case OP_PUSH_NUMBER: {
+                    double* slot = stack + top++ * COLUMN_BLOCK_SIZE;
+                    double number = rounded ? ip->operand.number : ip->unrounded;
+                    for (size_t i = 0; i < n; i++) slot[i] = number;
+                    break;
+                }
+                case OP_PUSH_VARIABLE: {
+                    double* slot = stack + top++ * COLUMN_BLOCK_SIZE;
+                    const double* column = columns[ip->operand.slot];
+                    if (column) {
+                        memcpy(slot, column + start, n * sizeof(double));
+                    } else {
+                        for (size_t i = 0; i < n; i++) {
+                            slot[i] = 0.0;
+                            errors[i] = first_error(errors[i], UNDEFINED_VARIABLE);
+                        }
+                    }
+                    break;
+                }
+                case OP_ADD_CONSTANT: {
+                    double* a = stack + (top - 1) * COLUMN_BLOCK_SIZE;
+                    double number = rounded ? ip->operand.number : ip->unrounded;
+                    for (size_t i = 0; i < n; i++) a[i] = a[i] + number;
+                    if (rounded) kernels->round(a, n);
+                    break;
+                }
+                case OP_INTEGER_POWER: {
+                    double* a = stack + (top - 1) * COLUMN_BLOCK_SIZE;
+                    for (size_t i = 0; i < n; i++) a[i] = literal_power(a[i], ip->operand.exponent);
+                    if (rounded) kernels->round(a, n);
+                    break;
+                }
+                case OP_FAIL:
+                    for (size_t i = 0; i < n; i++) {
+                        errors[i] = first_error(errors[i], ip->operand.error_code);
+                    }
+                    break;
+                default:
+                    if (is_unary_opcode(ip->opcode)) {
+                        double* a = stack + (top - 1) * COLUMN_BLOCK_SIZE;
+                        apply_opcode_block(kernels, ip->opcode, a, NULL, n, errors, rounded);
+                    } else {
+                        top--;
+                        double* a = stack + (top - 1) * COLUMN_BLOCK_SIZE;
+                        apply_opcode_block(kernels, ip->opcode, a, a + COLUMN_BLOCK_SIZE, n, errors, rounded);
+                    }
+                    break;
+            }
+            if (ip->opcode == OP_FAIL) {
+                break; // Nothing after OP_FAIL is reachable
+            }
+        }
+
+        if (precision == PRECISION_ROUND_RESULT) {
+            kernels->round(stack, n);
+        }
+        for (size_t i = 0; i < n; i++) {
+            values[start + i] = errors[i] == SUCCESS ? stack[i] : 0.0;
+        }
+    }
+
+    release_stack(pooled);
+    metric_rows(error_codes, row_count);
+    METRIC_STOP(start_time);
+    return SUCCESS;
+}
+
+/**
+ * @brief Evaluates a compiled RPN program over columns of input values.
+ *
+ * Each free variable slot of the program is bound to one column, and the program is
+ * run once per row. Rows are processed in blocks of COLUMN_BLOCK_SIZE: every
+ * instruction is applied to the whole block before moving to the next one, so the
+ * opcode dispatch is paid once per block rather than once per row. Each row gets the
+ * same value and error code `evaluate_compiled` would return with its variables
+ * replaced by that row's values.
+ *
+ * @param program     A pointer to a program returned by `compile_rpn`.
+ * @param columns     One pointer per variable slot to an array of `row_count` values,
+ *                    or NULL if the variable is not bound (UNDEFINED_VARIABLE).
+ * @param row_count   The number of rows to evaluate.
+ * @param values      A caller-allocated array receiving the result of each row
+ *                    (0.0 for rows that failed).
+ * @param error_codes A caller-allocated array receiving the error code of each row.
+ * @return            SUCCESS, or MEMORY_ERROR if the arguments are invalid or the
+ *                    block stack cannot be allocated.
+ */
+int evaluate_compiled_columns(const CompiledExpression* program, const double* const* columns,
+                              size_t row_count, double* values, int* error_codes) {
+    return evaluate_compiled_columns_with_precision(program, columns, row_count, values, error_codes,
+                                                    PRECISION_ROUNDED);
+}
+
+/**
+ * @brief Makes an interval, widening a NaN bound to the infinity on its side.
+ *
+ * Bounds are NaN when infinite operands meet, such as `inf - inf`: the points near them
+ * can then have any value.
+ */
+static inline Interval make_interval(double low, double high) {
+    Interval interval = {isnan(low) ? -INFINITY : low, isnan(high) ? INFINITY : high};
+    return interval;
+}
+
+/**
+ * @brief Makes an interval from bounds computed by libm, widened by LIBM_ULPS.
+ *
+ * Functions such as `sin` or `log` are monotonic, but their results are only within
+ * an ulp of the exact ones: a point between two bounds can round slightly outside them.
+ */
+static Interval libm_interval(double low, double high) {
+    for (int i = 0; i < LIBM_ULPS; i++) {
+        low = nextafter(low, -INFINITY);
+        high = nextafter(high, INFINITY);
+    }
+    return make_interval(low, high);
+}
+
+/**
+ * @brief Returns the smallest interval holding two intervals.
+ */
+static inline Interval interval_hull(Interval a, Interval b) {
+    Interval hull = {fmin(a.low, b.low), fmax(a.high, b.high)};
+    return hull;
+}
+
+/**
+ * @brief Returns the smallest interval holding four products or quotients of the bounds of two intervals.
+ *
+ * Rounded multiplication and division are monotonic in each operand, so over two intervals
+ * their extremes are at the bounds. NaN corners, such as `0 * inf`, are skipped by `fmin`
+ * and `fmax`, since the points near them have the values of the other corners.
+ */
+static Interval corner_interval(Opcode opcode, Interval a, Interval b) {
+    double corners[4];
+    corners[0] = opcode == OP_MULTIPLY ? a.low * b.low : a.low / b.low;
+    corners[1] = opcode == OP_MULTIPLY ? a.low * b.high : a.low / b.high;
+    corners[2] = opcode == OP_MULTIPLY ? a.high * b.low : a.high / b.low;
+    corners[3] = opcode == OP_MULTIPLY ? a.high * b.high : a.high / b.high;
+    double low = corners[0];
+    double high = corners[0];
+    for (int i = 1; i < 4; i++) {
+        low = fmin(low, corners[i]);
+        high = fmax(high, corners[i]);
+    }
+    return make_interval(low, high);
+}
+
+/**
+ * @brief Bounds `pow` over an interval of non-negative bases and an interval of exponents.
+ *
+ * For a non-negative base, `pow` is monotonic in the base for any exponent, and in the
+ * exponent for any base, so its extremes are at the bounds too.
+ */
+static Interval power_of_magnitudes(Interval base, Interval exponent) {
+    double corners[4] = {
+        power(base.low, exponent.low), power(base.low, exponent.high),
+        power(base.high, exponent.low), power(base.high, exponent.high),
+    };
+    double low = corners[0];
+    double high = corners[0];
+    for (int i = 1; i < 4; i++) {
+        low = fmin(low, corners[i]);
+        high = fmax(high, corners[i]);
+    }
+    Interval interval = libm_interval(low, high);
+    interval.low = fmax(interval.low, 0.0);
+    return interval;
+}
+
+/**
+ * @brief Bounds `power` over an interval of bases and an interval of exponents.
+ *
+ * The non-negative and negative bases are bounded apart. A negative base to an integer
+ * exponent is the power of its magnitude, with the sign of the base for odd exponents, so
+ * unless the exponent is a single integer its sign is unknown. Negative bases to fractional
+ * exponents are NaN, and are not bounded.
+ *
+ * Zero counts as a negative base too: `pow(-0.0, -1)` is `-inf`.
+ */
+static Interval power_interval(Interval base, Interval exponent) {
+    bool integer = exponent.low == exponent.high && isfinite(exponent.low) && floor(exponent.low) == exponent.low;
+    Interval result = {INFINITY, -INFINITY};
+
+    if (base.high >= 0) {
+        Interval magnitudes = {base.low > 0 ? base.low : 0.0, base.high};
+        result = power_of_magnitudes(magnitudes, exponent);
+    }
+    if (base.low <= 0) {
+        Interval magnitudes = {base.high < 0 ? fabs(base.high) : 0.0, fabs(base.low)};
+        Interval powers = power_of_magnitudes(magnitudes, exponent);
+        Interval negative = {-powers.high, powers.high};
+        if (integer && fmod(exponent.low, 2) == 0) {
+            negative = powers;
+        } else if (integer) {
+            negative.high = -powers.low;
+        }
+        result = interval_hull(result, negative);
+    }
+    return result;
+}
+
+/**
+ * @brief Returns whether `phase + k * period` lies in [low, high] for some integer `k`.
+ *
+ * The interval is first widened by the error of computing `k` at its magnitude, so the
+ * answer errs towards true: then the caller only bounds the function less tightly. Intervals
+ * at least a period wide, or unbounded, always hold such a point.
+ */
+static bool contains_phase(double low, double high, double phase, double period) {
+    double slack = (fabs(low) + fabs(high) + 1) * 8 * DBL_EPSILON;
+    low -= slack;
+    high += slack;
+    if (!(high - low < period)) {
+        return true;
+    }
+    return phase + ceil((low - phase) / period) * period <= high;
+}
+
+/**
+ * @brief Bounds `sin` or `cos` over an interval.
+ *
+ * Between a maximum and a minimum the function is monotonic, so it is bounded by its values
+ * at the bounds of the interval, or by 1 and -1 where the interval holds an extremum.
+ *
+ * @param function `sin` or `cos`.
+ * @param a        The interval.
+ * @param peak     The phase of the maxima of `function` in [0, 2π), whose minima are π further.
+ */
+static Interval periodic_interval(double (*function)(double), Interval a, double peak) {
+    double first = function(a.low);
+    double last = function(a.high);
+    Interval result = libm_interval(fmin(first, last), fmax(first, last));
+    if (contains_phase(a.low, a.high, peak, 2 * M_PI)) {
+        result.high = 1;
+    }
+    if (contains_phase(a.low, a.high, peak + M_PI, 2 * M_PI)) {
+        result.low = -1;
+    }
+    result.low = fmax(result.low, -1);
+    result.high = fmin(result.high, 1);
+    return result;
+}
+
+/**
+ * @brief Returns the factorial of a non-negative integer, without checking it.
+ */
+static inline double factorial_value(double n) {
+    return n <= MAX_FACTORIAL ? factorial_table[(int)n] : INFINITY;
+}
+
+/**
+ * @brief Bounds an operation over intervals of its operands.
+ *
+ * The bounds hold the result `apply_opcode_raw` computes for every point of the operands
+ * that does not fail, rounding included: they are computed with the same monotonic
+ * operations, or widened for libm. When the operands are single points, the operation
+ * is applied to them, with exactly the result and error of `apply_opcode_raw`.
+ *
+ * An operand that crosses the boundary of the domain of the operation, such as 0 for `/`
+ * or `ln`, fails for some of its points: the result is bounded over the others.
+ *
+ * @param opcode     An operator opcode, OP_SQUARE, OP_ADD_CONSTANT or OP_INTEGER_POWER.
+ * @param a          The interval of the first operand, replaced by the interval of the result.
+ * @param b          The interval of the second operand: the constant of OP_ADD_CONSTANT and
+ *                   the exponent of OP_INTEGER_POWER, and unused by other unary opcodes.
+ * @param every_fail Set to true if every point fails, and left unchanged otherwise.
+ * @return           SUCCESS if no point can fail, otherwise the error of the points that may.
+ */
+static int apply_opcode_interval(Opcode opcode, Interval* a, Interval b, bool* every_fail) {
+    bool unary = is_unary_opcode(opcode) && opcode != OP_ADD_CONSTANT && opcode != OP_INTEGER_POWER;
+    if (a->low == a->high && (unary || b.low == b.high)) {
+        int error_code = SUCCESS;
+        double value = apply_opcode_raw(opcode, a->low, unary ? 0 : b.low, &error_code);
+        *every_fail = error_code != SUCCESS;
+        a->low = value;
+        a->high = value;
+        return error_code;
+    }
+
+    int error_code = SUCCESS;
+    Interval x = *a;
+    switch (opcode) {
+        case OP_ADD:
+        case OP_ADD_CONSTANT:
+            *a = make_interval(x.low + b.low, x.high + b.high);
+            break;
+        case OP_SUBTRACT:
+            *a = make_interval(x.low - b.high, x.high - b.low);
+            break;
+        case OP_MULTIPLY:
+            *a = corner_interval(OP_MULTIPLY, x, b);
+            break;
+        case OP_DIVIDE: {
+            if (b.low == 0 && b.high == 0) {
+                *every_fail = true;
+                return DIVISION_BY_ZERO;
+            }
+            if (b.low > 0 || b.high < 0) {
+                *a = corner_interval(OP_DIVIDE, x, b);
+                break;
+            }
+            // The divisors that do not fail are at least the smallest positive double away from 0
+            error_code = DIVISION_BY_ZERO;
+            Interval result = {INFINITY, -INFINITY};
+            if (b.low < 0) {
+                Interval negative = {b.low, -DBL_TRUE_MIN};
+                result = corner_interval(OP_DIVIDE, x, negative);
+            }
+            if (b.high > 0) {
+                Interval positive = {DBL_TRUE_MIN, b.high};
+                result = interval_hull(result, corner_interval(OP_DIVIDE, x, positive));
+            }
+            *a = result;
+            break;
+        }
+        case OP_POWER:
+        case OP_INTEGER_POWER:
+            *a = power_interval(x, b);
+            break;
+        case OP_SQUARE:
+            if (x.low >= 0) {
+                *a = make_interval(x.low * x.low, x.high * x.high);
+            } else if (x.high <= 0) {
+                *a = make_interval(x.high * x.high, x.low * x.low);
+            } else {
+                *a = make_interval(0.0, fmax(x.low * x.low, x.high * x.high));
+            }
+            break;
+        case OP_FACTORIAL: {
+            // Only the non-negative integers of the interval do not fail, and some points of it are not
+            double first = ceil(fmax(x.low, 0.0));
+            double last = floor(x.high);
+            if (!(first <= last)) {
+                *every_fail = true;
+                return FACTORIAL_ERROR;
+            }
+            error_code = FACTORIAL_ERROR;
+            *a = make_interval(factorial_value(first), factorial_value(last));
+            break;
+        }
+        case OP_SQRT:
+            if (x.high < 0) {
+                *every_fail = true;
+                return SQUARE_ROOT_INVALID_OPERATOR;
+            }
+            if (x.low < 0) {
+                error_code = SQUARE_ROOT_INVALID_OPERATOR;
+                x.low = 0.0;
+            }
+            // Square roots are correctly rounded, so monotonic without widening
+            *a = make_interval(sqrt(x.low), sqrt(x.high));
+            break;
+        case OP_SIN:
+            *a = periodic_interval(sin, x, M_PI / 2);
+            break;
+        case OP_COS:
+            *a = periodic_interval(cos, x, 0.0);
+            break;
+        case OP_TAN:
+            // Between two poles tan is increasing; an interval around a pole reaches every value
+            if (contains_phase(x.low, x.high, M_PI / 2, M_PI)) {
+                a->low = -INFINITY;
+                a->high = INFINITY;
+                return TAN_INVALID_OPERATOR;
+            }
+            *a = libm_interval(tan(x.low), tan(x.high));
+            break;
+        case OP_ARCSIN:
+        case OP_ARCCOS:
+            if (x.high < -1 || x.low > 1) {
+                *every_fail = true;
+                return INVALID_TRIG_OPERATOR;
+            }
+            if (x.low < -1 || x.high > 1) {
+                error_code = INVALID_TRIG_OPERATOR;
+                x.low = fmax(x.low, -1);
+                x.high = fmin(x.high, 1);
+            }
+            *a = opcode == OP_ARCSIN ? libm_interval(asin(x.low), asin(x.high))
+                                     : libm_interval(acos(x.high), acos(x.low));
+            break;
+        case OP_ARCTAN:
+            *a = libm_interval(atan(x.low), atan(x.high));
+            break;
+        case OP_LOG:
+        case OP_LN: {
+            int domain_error = opcode == OP_LOG ? LOG_ERROR : LN_ERROR;
+            if (x.high <= 0) {
+                *every_fail = true;
+                return domain_error;
+            }
+            if (x.low <= 0) {
+                error_code = domain_error;
+                x.low = DBL_TRUE_MIN;
+            }
+            *a = opcode == OP_LOG ? libm_interval(log10(x.low), log10(x.high)) : libm_interval(log(x.low), log(x.high));
+            break;
+        }
+        default:
+            *every_fail = true;
+            return INVALID_OPERATOR;
+    }
+    return error_code;
+}
+
+/**
+ * @brief Bounds a compiled RPN program over intervals of its variables, in one pass.
+ *
+ * Every value on the stack is an interval holding the value of that entry for every
+ * point of the variable intervals, see `apply_opcode_interval`, so one evaluation bounds
+ * what evaluating every point with `evaluate_compiled_with_precision` would return.
+ * Rounding to 9 decimal places keeps values in order, so it is applied to the bounds.
+ *
+ * With the error of the first instruction some points may fail at, the result tells
+ * whether no point, some points or every point fails. The bounds hold the results of the
+ * points that do not fail. Results that are NaN, such as `inf - inf` or a negative number
+ * to a fractional power, are not bounded. A value that is NaN for every point, such as the
+ * constant `(-3) ^ pi`, is bounded by infinities and reported as INTERVAL_MAY_FAIL, with
+ * the error code unchanged. Bounds are not always the tightest: a variable
+ * used twice, as in `x - x`, is bounded as two independent variables. Evaluating narrower
+ * intervals tightens them, see `CompiledExpression::bounds` in src/intervals.rs.
+ *
+ * @param program   A pointer to a compiled program.
+ * @param bounds    One pointer per variable slot to its lowest and highest value, or NULL
+ *                  if the variable is not bound (UNDEFINED_VARIABLE for every point).
+ * @param precision PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @param result    A pointer where the bounds are stored.
+ * @return          SUCCESS, or MEMORY_ERROR if the arguments are invalid, the lowest value
+ *                  of a variable is above its highest or NaN, `precision` is not a mode or the
+ *                  stack cannot be allocated.
+ */
+int evaluate_compiled_interval(const CompiledExpression* program, const double* const* bounds, int precision,
+                               IntervalResult* result) {
+    if (!program || !result || (program->variable_count > 0 && !bounds) || !is_precision(precision)) {
+        return MEMORY_ERROR;
+    }
+    for (size_t slot = 0; slot < program->variable_count; slot++) {
+        if (bounds[slot] && !(bounds[slot][0] <= bounds[slot][1])) {
+            return MEMORY_ERROR;
+        }
+    }
+    bool rounded = precision == PRECISION_ROUNDED;
+
+    // Lowest values, then highest values
+    PooledStack* pooled = acquire_stack(2 * program->max_depth);
+    if (!pooled) {
+        return MEMORY_ERROR;
+    }
+    double* lows = pooled->values;
+    double* highs = lows + program->max_depth;
+
+    int error_code = SUCCESS;
+    int status = INTERVAL_SUCCEEDS;
+    size_t top = 0; // Number of intervals on the stack
+    const Instruction* end = program->code + program->length;
+
+    for (const Instruction* ip = program->code; ip < end; ip++) {
+        int failure = SUCCESS;
+        bool every_fail = false;
+        switch (ip->opcode) {
+            case OP_PUSH_NUMBER:
+                lows[top] = highs[top] = rounded ? ip->operand.number : ip->unrounded;
+                top++;
+                break;
+            case OP_PUSH_VARIABLE: {
+                const double* bound = bounds[ip->operand.slot];
+                if (!bound) {
+                    failure = UNDEFINED_VARIABLE;
+                    every_fail = true;
+                    break;
                 }
-        
-                stack_top++;
-                stack[stack_top] = op_result; // Push the result back onto the stack
-                printf("Pushed result: %.9f\n", stack[stack_top]);
-            } else { // Handle binary operators
-                if (stack_top < 1) {
-                    printf("Stack underflow error\n");
-                    result.error_code = STACK_UNDERFLOW;
-                    return result;
+                lows[top] = bound[0];
+                highs[top] = bound[1];
+                top++;
+                break;
+            }
+            case OP_FAIL:
+                failure = ip->operand.error_code;
+                every_fail = true;
+                break;
+            default: {
+                Interval b = {0.0, 0.0};
+                if (ip->opcode == OP_ADD_CONSTANT) {
+                    b.low = b.high = rounded ? ip->operand.number : ip->unrounded;
+                    if (isnan(b.low)) {
+                        // Like a NaN value on the stack, see below
+                        b.low = -INFINITY;
+                        b.high = INFINITY;
+                        status = INTERVAL_MAY_FAIL;
+                    }
+                } else if (ip->opcode == OP_INTEGER_POWER) {
+                    b.low = b.high = (double)ip->operand.exponent;
+                } else if (!is_unary_opcode(ip->opcode)) {
+                    top--;
+                    b.low = lows[top];
+                    b.high = highs[top];
                 }
-        
-                double b = stack[stack_top--];
-                double a = stack[stack_top--];
-        
-                int error_code = SUCCESS;
-                double op_result = apply_operator(token, a, b, &error_code);
-        
-                if (error_code != SUCCESS) {
-                    result.error_code = error_code;
-                    return result;
+                Interval a = {lows[top - 1], highs[top - 1]};
+                failure = apply_opcode_interval(ip->opcode, &a, b, &every_fail);
+                lows[top - 1] = round_operation(a.low, rounded);
+                highs[top - 1] = round_operation(a.high, rounded);
+                break;
+            }
+        }
+        if (failure != SUCCESS) {
+            error_code = first_error(error_code, failure);
+            status = every_fail ? INTERVAL_FAILS : INTERVAL_MAY_FAIL;
+            if (every_fail) {
+                break; // The points that have not failed yet fail here
+            }
+        }
+        if (isnan(lows[top - 1]) || isnan(highs[top - 1])) {
+            // A NaN value, such as the constant `(-3) ^ pi`, bounds nothing: later operators
+            // may still map it to numbers, as `NaN ^ 0` is 1
+            lows[top - 1] = -INFINITY;
+            highs[top - 1] = INFINITY;
+            status = INTERVAL_MAY_FAIL;
+        }
+    }
+
+    result->low = 0.0;
+    result->high = 0.0;
+    if (status != INTERVAL_FAILS) {
+        bool round_result = precision == PRECISION_ROUND_RESULT;
+        result->low = round_result ? round_to_9_decimals(lows[0]) : lows[0];
+        result->high = round_result ? round_to_9_decimals(highs[0]) : highs[0];
+    }
+    result->error_code = error_code;
+    result->status = status;
+    release_stack(pooled);
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns whether an instruction can fail for some row when its operands do not.
+ *
+ * Variables are decided per evaluation, by whether they are bound to a column.
+ */
+static bool instruction_can_fail(Opcode opcode) {
+    switch (opcode) {
+        case OP_PUSH_NUMBER:
+        case OP_PUSH_VARIABLE:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_POWER:
+        case OP_SIN:
+        case OP_COS:
+        case OP_ARCTAN:
+        case OP_SQUARE:
+        case OP_ADD_CONSTANT:
+        case OP_INTEGER_POWER:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Returns the bits that tell an instruction apart from others with the same opcode.
+ *
+ * Literals compare by their bits, so 0.0 and -0.0 stay distinct, and by both their
+ * rounded and unrounded values.
+ *
+ * @param instruction The instruction.
+ * @param bits        Receives the bits of its operand, zero for opcodes without one.
+ */
+static void instruction_operand_bits(const Instruction* instruction, uint64_t bits[2]) {
+    bits[0] = 0;
+    bits[1] = 0;
+    switch (instruction->opcode) {
+        case OP_PUSH_NUMBER:
+        case OP_ADD_CONSTANT:
+            memcpy(&bits[0], &instruction->operand.number, sizeof(double));
+            memcpy(&bits[1], &instruction->unrounded, sizeof(double));
+            break;
+        case OP_PUSH_VARIABLE: bits[0] = instruction->operand.slot; break;
+        case OP_INTEGER_POWER: bits[0] = instruction->operand.exponent; break;
+        case OP_FAIL: bits[0] = (unsigned)instruction->operand.error_code; break;
+        default: break;
+    }
+}
+
+/**
+ * @brief Hashes an instruction and its operand nodes.
+ */
+static size_t hash_batch_node(const Instruction* instruction, const size_t operands[2]) {
+    uint64_t bits[2];
+    instruction_operand_bits(instruction, bits);
+    uint64_t words[5] = {(uint64_t)instruction->opcode, bits[0], bits[1], operands[0], operands[1]};
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < 5; i++) {
+        hash = (hash ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return (size_t)hash;
+}
+
+/**
+ * @brief Returns whether a node applies the same instruction to the same operands.
+ */
+static bool batch_node_equals(const BatchNode* node, const Instruction* instruction, const size_t operands[2]) {
+    if (node->instruction.opcode != instruction->opcode || node->operands[0] != operands[0] ||
+        node->operands[1] != operands[1]) {
+        return false;
+    }
+    uint64_t a[2], b[2];
+    instruction_operand_bits(&node->instruction, a);
+    instruction_operand_bits(instruction, b);
+    return a[0] == b[0] && a[1] == b[1];
+}
+
+/**
+ * @brief Returns the node of an instruction applied to given operands, adding it if the
+ * batch has none yet.
+ *
+ * @param builder     The batch being built, with room for one more node.
+ * @param instruction The instruction, whose variable slot is already one of the batch.
+ * @param first       The node of the first operand, NO_NODE if none.
+ * @param second      The node of the second operand, NO_NODE if none.
+ * @return            The index of the node.
+ */
+static size_t batch_node(BatchBuilder* builder, const Instruction* instruction, size_t first, size_t second) {
+    CompiledBatch* batch = builder->batch;
+    size_t operands[2] = {first, second};
+    size_t mask = builder->table_capacity - 1;
+    size_t bucket = hash_batch_node(instruction, operands) & mask;
+    while (builder->table[bucket] != 0) {
+        size_t node = builder->table[bucket] - 1;
+        if (batch_node_equals(&batch->nodes[node], instruction, operands)) {
+            return node;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+
+    BatchNode* node = &batch->nodes[batch->length];
+    node->instruction = *instruction;
+    node->operands[0] = first;
+    node->operands[1] = second;
+    node->block = NO_NODE;
+    builder->table[bucket] = ++batch->length;
+    return batch->length - 1;
+}
+
+/**
+ * @brief Returns the slot of a free variable in a batch, adding it if needed.
+ *
+ * @param batch The batch being built, with room for one more variable.
+ * @param name  The name of the variable.
+ * @param slot  A pointer where the slot index is stored.
+ * @return      True on success, false if memory allocation failed.
+ */
+static bool batch_variable(CompiledBatch* batch, const char* name, size_t* slot) {
+    for (size_t i = 0; i < batch->variable_count; i++) {
+        if (strcmp(batch->variable_names[i], name) == 0) {
+            *slot = i;
+            return true;
+        }
+    }
+
+    char* copy = malloc(strlen(name) + 1);
+    if (!copy) {
+        return false;
+    }
+    strcpy(copy, name);
+    batch->variable_names[batch->variable_count] = copy;
+    *slot = batch->variable_count++;
+    return true;
+}
+
+/**
+ * @brief Adds the instructions of a compiled program to a batch.
+ *
+ * The program is replayed on a stack of nodes instead of values, so each instruction
+ * becomes the node of its opcode applied to the nodes of its operands, shared with every
+ * program computing the same. An OP_FAIL becomes a chain of OP_FAIL nodes over the values
+ * still on the stack, which keeps their errors ahead of its own, as in `evaluate_compiled`.
+ *
+ * @param builder The batch being built.
+ * @param program The program, compiled with or without a context.
+ * @param stack   A stack of at least `program->max_depth` nodes.
+ * @param slots   An array of at least `program->variable_count` slots.
+ * @param root    A pointer where the node of the result is stored.
+ * @return        True on success, false if memory allocation failed.
+ */
+static bool add_batch_program(BatchBuilder* builder, const CompiledExpression* program, size_t* stack,
+                              size_t* slots, size_t* root) {
+    for (size_t i = 0; i < program->variable_count; i++) {
+        if (!batch_variable(builder->batch, program->variable_names[i], &slots[i])) {
+            return false;
+        }
+    }
+
+    size_t top = 0; // Number of nodes on the stack
+    for (size_t i = 0; i < program->length; i++) {
+        Instruction instruction = program->code[i];
+        Opcode opcode = instruction.opcode;
+        if (opcode == OP_PUSH_VARIABLE) {
+            instruction.operand.slot = slots[instruction.operand.slot];
+        }
+
+        if (opcode == OP_PUSH_NUMBER || opcode == OP_PUSH_VARIABLE) {
+            stack[top++] = batch_node(builder, &instruction, NO_NODE, NO_NODE);
+        } else if (opcode == OP_FAIL) {
+            size_t node = batch_node(builder, &instruction, top > 0 ? stack[top - 1] : NO_NODE, NO_NODE);
+            while (top > 1) {
+                node = batch_node(builder, &instruction, stack[--top - 1], node);
+            }
+            *root = node;
+            return true;
+        } else if (is_unary_opcode(opcode)) {
+            stack[top - 1] = batch_node(builder, &instruction, stack[top - 1], NO_NODE);
+        } else {
+            top--;
+            stack[top - 1] = batch_node(builder, &instruction, stack[top - 1], stack[top]);
+        }
+    }
+
+    // Programs without an OP_FAIL leave exactly their result on the stack
+    *root = stack[0];
+    return true;
+}
+
+/**
+ * @brief Assigns a work block to every node of a batch.
+ *
+ * Literals get a block of their own, filled once per evaluation, and variables read
+ * their column directly. Other nodes reuse the blocks of nodes no longer read, and write
+ * over their first operand in place when they are its last reader.
+ *
+ * @param batch The batch, with every node added.
+ * @return      True on success, false if memory allocation failed.
+ */
+static bool assign_batch_blocks(CompiledBatch* batch) {
+    size_t* last_reader = malloc((batch->length + 1) * sizeof(size_t));
+    size_t* free_blocks = malloc((batch->length + 1) * sizeof(size_t));
+    if (!last_reader || !free_blocks) {
+        free(last_reader);
+        free(free_blocks);
+        return false;
+    }
+
+    for (size_t i = 0; i < batch->length; i++) {
+        last_reader[i] = NO_NODE;
+    }
+    for (size_t i = 0; i < batch->length; i++) {
+        for (size_t k = 0; k < 2; k++) {
+            if (batch->nodes[i].operands[k] != NO_NODE) {
+                last_reader[batch->nodes[i].operands[k]] = i;
+            }
+        }
+    }
+
+    size_t free_count = 0;
+    for (size_t i = 0; i < batch->length; i++) {
+        BatchNode* node = &batch->nodes[i];
+        Opcode opcode = node->instruction.opcode;
+        if (opcode == OP_PUSH_VARIABLE) {
+            continue;
+        }
+        if (opcode == OP_PUSH_NUMBER) {
+            node->block = batch->block_count++;
+            continue;
+        }
+
+        // A block is released once its last reader is computed
+        bool released[2] = {false, false};
+        for (size_t k = 0; k < 2; k++) {
+            size_t operand = node->operands[k];
+            released[k] = operand != NO_NODE && last_reader[operand] == i && batch->nodes[operand].block != NO_NODE &&
+                          batch->nodes[operand].instruction.opcode != OP_PUSH_NUMBER &&
+                          (k == 0 || operand != node->operands[0]);
+        }
+        if (released[0] && node->operands[0] != node->operands[1]) {
+            node->block = batch->nodes[node->operands[0]].block;
+            released[0] = false;
+        } else {
+            node->block = free_count > 0 ? free_blocks[--free_count] : batch->block_count++;
+        }
+        for (size_t k = 0; k < 2; k++) {
+            if (released[k]) {
+                free_blocks[free_count++] = batch->nodes[node->operands[k]].block;
+            }
+        }
+        // Results nothing reads are written out as soon as they are computed
+        if (last_reader[i] == NO_NODE) {
+            free_blocks[free_count++] = node->block;
+        }
+    }
+
+    free(last_reader);
+    free(free_blocks);
+    return true;
+}
+
+/**
+ * @brief Merges compiled programs and orders the results, see `compile_batch`.
+ *
+ * @return True on success, false if memory allocation failed.
+ */
+static bool build_batch(BatchBuilder* builder, const CompiledExpression* const* programs, size_t count) {
+    CompiledBatch* batch = builder->batch;
+    size_t node_capacity = 1, variable_capacity = 1, max_depth = 1, max_variables = 1;
+    for (size_t p = 0; p < count; p++) {
+        if (!programs[p]) {
+            return false;
+        }
+        // An OP_FAIL adds one node per value still on the stack
+        node_capacity += programs[p]->length + programs[p]->max_depth;
+        variable_capacity += programs[p]->variable_count;
+        max_depth = programs[p]->max_depth > max_depth ? programs[p]->max_depth : max_depth;
+        max_variables = programs[p]->variable_count > max_variables ? programs[p]->variable_count : max_variables;
+        batch->source_length += programs[p]->length;
+    }
+
+    builder->table_capacity = 16;
+    while (builder->table_capacity < node_capacity * 2) {
+        builder->table_capacity *= 2;
+    }
+    builder->table = calloc(builder->table_capacity, sizeof(size_t));
+    builder->stack = malloc(max_depth * sizeof(size_t));
+    builder->slots = malloc(max_variables * sizeof(size_t));
+    batch->nodes = malloc(node_capacity * sizeof(BatchNode));
+    batch->variable_names = malloc(variable_capacity * sizeof(char*));
+    batch->roots = malloc((count + 1) * sizeof(size_t));
+    batch->output_order = malloc((count + 1) * sizeof(size_t));
+    if (!builder->table || !builder->stack || !builder->slots || !batch->nodes || !batch->variable_names ||
+        !batch->roots || !batch->output_order) {
+        return false;
+    }
+
+    for (size_t p = 0; p < count; p++) {
+        if (!add_batch_program(builder, programs[p], builder->stack, builder->slots, &batch->roots[p])) {
+            return false;
+        }
+        batch->program_count++;
+    }
+
+    // Programs in order of their roots, stable so programs with the same result keep their order
+    for (size_t p = 0; p < count; p++) {
+        size_t position = p;
+        while (position > 0 && batch->roots[batch->output_order[position - 1]] > batch->roots[p]) {
+            batch->output_order[position] = batch->output_order[position - 1];
+            position--;
+        }
+        batch->output_order[position] = p;
+    }
+    return assign_batch_blocks(batch);
+}
+
+/**
+ * @brief Releases a compiled batch.
+ *
+ * @param batch The batch returned by `compile_batch`. NULL is ignored.
+ */
+void free_compiled_batch(CompiledBatch* batch) {
+    if (!batch) {
+        return;
+    }
+    for (size_t i = 0; i < batch->variable_count; i++) {
+        free(batch->variable_names[i]);
+    }
+    free(batch->variable_names);
+    free(batch->nodes);
+    free(batch->roots);
+    free(batch->output_order);
+    free(batch);
+}
+
+/**
+ * @brief Merges compiled programs into a batch that evaluates each distinct instruction once.
+ *
+ * The programs are hash-consed into one graph: an instruction applied to the same operands
+ * as an instruction of another program, such as the `sin(x) * cos(y)` both `sin(x) *
+ * cos(y) + 1` and `sqrt(sin(x) * cos(y))` start with, becomes a single node. Variables are
+ * merged by name. Evaluating the batch with `evaluate_compiled_batch_columns` gives every
+ * program the same values and error codes `evaluate_compiled_columns` would, including
+ * which error comes first, since every node keeps its operands in evaluation order.
+ *
+ * @param programs The programs, compiled by `compile_rpn` or `compile_rpn_in_context`.
+ *                 The batch copies what it needs, so they may be released afterwards.
+ * @param count    The number of programs.
+ * @return         A newly allocated batch that must be released with `free_compiled_batch`,
+ *                 or NULL if a program is NULL or memory allocation failed.
+ */
+CompiledBatch* compile_batch(const CompiledExpression* const* programs, size_t count) {
+    if (!programs && count > 0) {
+        return NULL;
+    }
+    CompiledBatch* batch = calloc(1, sizeof(CompiledBatch));
+    if (!batch) {
+        return NULL;
+    }
+
+    BatchBuilder builder = {0};
+    builder.batch = batch;
+    bool built = build_batch(&builder, programs, count);
+    free(builder.table);
+    free(builder.stack);
+    free(builder.slots);
+    if (!built) {
+        free_compiled_batch(batch);
+        return NULL;
+    }
+    TRACE(TRACE_INFO, "Compiled %zu programs of %zu instructions into %zu nodes\n", count, batch->source_length,
+          batch->length);
+    return batch;
+}
+
+/**
+ * @brief Returns the number of distinct instructions of a compiled batch.
+ *
+ * @param batch A pointer to a batch returned by `compile_batch`.
+ * @return      The number of nodes, 0 if `batch` is NULL.
+ */
+size_t compiled_batch_length(const CompiledBatch* batch) {
+    return batch ? batch->length : 0;
+}
+
+/**
+ * @brief Returns the number of instructions of the programs of a compiled batch, together.
+ *
+ * @param batch A pointer to a batch returned by `compile_batch`.
+ * @return      The total length of the programs, 0 if `batch` is NULL.
+ */
+size_t compiled_batch_source_length(const CompiledBatch* batch) {
+    return batch ? batch->source_length : 0;
+}
+
+/**
+ * @brief Returns the number of free variables of a compiled batch.
+ *
+ * @param batch A pointer to a batch returned by `compile_batch`.
+ * @return      The number of variable slots, 0 if `batch` is NULL.
+ */
+size_t compiled_batch_variable_count(const CompiledBatch* batch) {
+    return batch ? batch->variable_count : 0;
+}
+
+/**
+ * @brief Returns the name of a free variable of a compiled batch.
+ *
+ * @param batch A pointer to a batch returned by `compile_batch`.
+ * @param slot  The variable slot, below `compiled_batch_variable_count(batch)`.
+ * @return      The null-terminated name owned by the batch, or NULL if out of range.
+ */
+const char* compiled_batch_variable_name(const CompiledBatch* batch, size_t slot) {
+    if (!batch || slot >= batch->variable_count) {
+        return NULL;
+    }
+    return batch->variable_names[slot];
+}
+
+/**
+ * @brief Applies a non-literal instruction of a compiled batch to a block of rows.
+ *
+ * See `apply_opcode_block`, which this extends with the instructions only
+ * `optimize_program` produces.
+ */
+static inline void apply_instruction_block(const VectorKernels* kernels, const Instruction* ip, double* restrict a,
+                                           const double* restrict b, size_t n, int* restrict errors, bool rounded) {
+    switch (ip->opcode) {
+        case OP_ADD_CONSTANT: {
+            double number = rounded ? ip->operand.number : ip->unrounded;
+            for (size_t i = 0; i < n; i++) a[i] = a[i] + number;
+            break;
+        }
+        case OP_INTEGER_POWER:
+            for (size_t i = 0; i < n; i++) a[i] = literal_power(a[i], ip->operand.exponent);
+            break;
+        default:
+            apply_opcode_block(kernels, ip->opcode, a, b, n, errors, rounded);
+            return;
+    }
+    if (rounded) {
+        kernels->round(a, n);
+    }
+}
+
+/**
+ * @brief Evaluates a compiled batch over columns of input values, in a given precision mode.
+ *
+ * Rows are processed in blocks of COLUMN_BLOCK_SIZE, like `evaluate_compiled_columns`,
+ * with every node applied once per block however many programs read it. Error codes
+ * are only tracked for nodes that can fail, given which variables are bound, and the
+ * result of every program is written out as soon as its node is computed.
+ *
+ * @param batch       A pointer to a batch returned by `compile_batch`.
+ * @param columns     One pointer per variable slot of the batch to an array of
+ *                    `row_count` values, or NULL if the variable is not bound
+ *                    (UNDEFINED_VARIABLE).
+ * @param row_count   The number of rows to evaluate.
+ * @param values      One caller-allocated array per program receiving the result of
+ *                    each row (0.0 for rows that failed).
+ * @param error_codes One caller-allocated array per program receiving the error code
+ *                    of each row.
+ * @param precision   PRECISION_ROUNDED, PRECISION_RAW or PRECISION_ROUND_RESULT.
+ * @return            SUCCESS, or MEMORY_ERROR if the arguments are invalid, `precision`
+ *                    is not a mode or the work blocks cannot be allocated.
+ */
+int evaluate_compiled_batch_columns(const CompiledBatch* batch, const double* const* columns, size_t row_count,
+                                    double* const* values, int* const* error_codes, int precision) {
+    if (!batch || (batch->program_count > 0 && (!values || !error_codes)) ||
+        (batch->variable_count > 0 && !columns) || !is_precision(precision)) {
+        return MEMORY_ERROR;
+    }
+    bool rounded = precision == PRECISION_ROUNDED;
+    if (row_count == 0 || batch->program_count == 0) {
+        return SUCCESS;
+    }
+
+    METRIC_START(start_time);
+    // The work blocks, then zeros and UNDEFINED_VARIABLE for unbound variables, then errors nothing reads
+    size_t block_count = batch->block_count;
+    double* blocks = malloc((block_count + 1) * COLUMN_BLOCK_SIZE * sizeof(double));
+    int* block_errors = malloc((block_count + 2) * COLUMN_BLOCK_SIZE * sizeof(int));
+    const double** node_values = malloc((batch->length + 1) * sizeof(double*));
+    const int** node_errors = malloc((batch->length + 1) * sizeof(int*));
+    bool* fallible = malloc((batch->length + 1) * sizeof(bool));
+    if (!blocks || !block_errors || !node_values || !node_errors || !fallible) {
+        free(blocks);
+        free(block_errors);
+        free(node_values);
+        free(node_errors);
+        free(fallible);
+        return MEMORY_ERROR;
+    }
+    const VectorKernels* kernels = vector_kernels();
+    const double* zeros = blocks + block_count * COLUMN_BLOCK_SIZE;
+    const int* undefined = block_errors + block_count * COLUMN_BLOCK_SIZE;
+    int* ignored = block_errors + (block_count + 1) * COLUMN_BLOCK_SIZE;
+    for (size_t i = 0; i < COLUMN_BLOCK_SIZE; i++) {
+        blocks[block_count * COLUMN_BLOCK_SIZE + i] = 0.0;
+        block_errors[block_count * COLUMN_BLOCK_SIZE + i] = UNDEFINED_VARIABLE;
+        ignored[i] = SUCCESS;
+    }
+
+    // Which nodes can fail for these columns, and literals, which are the same in every block
+    for (size_t i = 0; i < batch->length; i++) {
+        const BatchNode* node = &batch->nodes[i];
+        const Instruction* ip = &node->instruction;
+        if (ip->opcode == OP_PUSH_VARIABLE) {
+            fallible[i] = columns[ip->operand.slot] == NULL;
+            continue;
+        }
+        fallible[i] = instruction_can_fail(ip->opcode) ||
+                      (node->operands[0] != NO_NODE && fallible[node->operands[0]]) ||
+                      (node->operands[1] != NO_NODE && fallible[node->operands[1]]);
+        if (ip->opcode == OP_PUSH_NUMBER) {
+            double* block = blocks + node->block * COLUMN_BLOCK_SIZE;
+            double number = rounded ? ip->operand.number : ip->unrounded;
+            for (size_t row = 0; row < COLUMN_BLOCK_SIZE; row++) block[row] = number;
+            node_values[i] = block;
+            node_errors[i] = NULL;
+        }
+    }
+
+    for (size_t start = 0; start < row_count; start += COLUMN_BLOCK_SIZE) {
+        size_t n = row_count - start < COLUMN_BLOCK_SIZE ? row_count - start : COLUMN_BLOCK_SIZE;
+        size_t next_output = 0;
+
+        for (size_t i = 0; i < batch->length; i++) {
+            const BatchNode* node = &batch->nodes[i];
+            const Instruction* ip = &node->instruction;
+            size_t first = node->operands[0], second = node->operands[1];
+            METRIC_OPCODE(ip->opcode, n);
+
+            if (ip->opcode == OP_PUSH_VARIABLE) {
+                const double* column = columns[ip->operand.slot];
+                node_values[i] = column ? column + start : zeros;
+                node_errors[i] = column ? NULL : undefined;
+            } else if (ip->opcode != OP_PUSH_NUMBER) {
+                double* out = blocks + node->block * COLUMN_BLOCK_SIZE;
+                int* errors = fallible[i] ? block_errors + node->block * COLUMN_BLOCK_SIZE : ignored;
+
+                // Errors of the first operand come first, then those of the second, then its own
+                if (fallible[i]) {
+                    const int* first_errors = first != NO_NODE ? node_errors[first] : NULL;
+                    const int* second_errors = second != NO_NODE ? node_errors[second] : NULL;
+                    if (first_errors) {
+                        if (first_errors != errors) memcpy(errors, first_errors, n * sizeof(int));
+                    } else {
+                        for (size_t row = 0; row < n; row++) errors[row] = SUCCESS;
+                    }
+                    if (second_errors) {
+                        for (size_t row = 0; row < n; row++) errors[row] = first_error(errors[row], second_errors[row]);
+                    }
                 }
-        
-                stack_top++;
-                stack[stack_top] = op_result;
-                printf("Pushed result: %.9f\n", stack[stack_top]);
+
+                if (ip->opcode == OP_FAIL) {
+                    for (size_t row = 0; row < n; row++) errors[row] = first_error(errors[row], ip->operand.error_code);
+                    node_values[i] = zeros;
+                } else {
+                    if (node_values[first] != out) {
+                        memcpy(out, node_values[first], n * sizeof(double));
+                    }
+                    const double* b = second != NO_NODE ? node_values[second] : NULL;
+                    apply_instruction_block(kernels, ip, out, b, n, errors, rounded);
+                    node_values[i] = out;
+                }
+                node_errors[i] = fallible[i] ? errors : NULL;
+            }
+
+            for (; next_output < batch->program_count && batch->roots[batch->output_order[next_output]] == i;
+                 next_output++) {
+                size_t program = batch->output_order[next_output];
+                const int* result_errors = node_errors[i];
+                double* result = values[program] + start;
+                // Other nodes may still read the node, so the program's own values are rounded
+                memcpy(result, node_values[i], n * sizeof(double));
+                if (precision == PRECISION_ROUND_RESULT) {
+                    kernels->round(result, n);
+                }
+                for (size_t row = 0; row < n; row++) {
+                    int error_code = result_errors ? result_errors[row] : SUCCESS;
+                    error_codes[program][start + row] = error_code;
+                    if (error_code != SUCCESS) result[row] = 0.0;
+                }
+            }
+        }
+    }
+
+    free(blocks);
+    free(block_errors);
+    free(node_values);
+    free(node_errors);
+    free(fallible);
+    for (size_t program = 0; program < batch->program_count; program++) {
+        metric_rows(error_codes[program], row_count);
+    }
+    METRIC_STOP(start_time);
+    return SUCCESS;
+}
+
+/**
+ * @brief Stores an unsigned integer of `size` bytes in little-endian byte order.
+ */
+static void store_le(unsigned char* bytes, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+/**
+ * @brief Reads an unsigned integer of `size` bytes in little-endian byte order.
+ */
+static uint64_t load_le(const unsigned char* bytes, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Rounds a size up to a multiple of 8 bytes, the alignment of every part of a
+ * serialized program.
+ */
+static size_t align_to_8(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+/**
+ * @brief Returns a fingerprint of the operator table.
+ *
+ * Operator opcodes follow the order of `operator_table`, so a saved program is only
+ * valid with the same operators, in the same order and with the same arities. FNV-1a
+ * of every name and arity.
+ */
+static uint32_t operator_fingerprint(void) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < OPERATOR_COUNT; i++) {
+        for (const char* c = operator_table[i].name; ; c++) {
+            hash = (hash ^ (unsigned char)*c) * 16777619u;
+            if (*c == '\0') break;
+        }
+        hash = (hash ^ (unsigned)operator_table[i].arity) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Returns whether serialized instruction records have the layout of Instruction,
+ * so a program can be evaluated from them in place.
+ *
+ * Records hold the opcode in 4 bytes, 4 bytes of zeros, the operand in 8 bytes (the
+ * error code and exponent in the low 4) and the unrounded value, all little-endian,
+ * which is the layout of Instruction on 64-bit little-endian targets.
+ */
+static bool instruction_layout_matches(void) {
+    const uint16_t probe = 1;
+    return *(const unsigned char*)&probe == 1 && sizeof(Instruction) == PROGRAM_INSTRUCTION_SIZE &&
+           sizeof(Opcode) == 4 && sizeof(size_t) == 8 && offsetof(Instruction, operand) == 8 &&
+           offsetof(Instruction, unrounded) == 16;
+}
+
+/**
+ * @brief Serializes a compiled program into a caller-provided buffer.
+ *
+ * The format is versioned and every value in it is little-endian:
+ * - A header of PROGRAM_HEADER_SIZE bytes: PROGRAM_MAGIC, the format version (2 bytes),
+ *   PROGRAM_INSTRUCTION_SIZE (2), `operator_fingerprint` (4), the number of variables (4),
+ *   of instructions (8), the maximum stack depth (8) and the total size in bytes (8).
+ * - One record of PROGRAM_INSTRUCTION_SIZE bytes per instruction, see
+ *   `instruction_layout_matches`.
+ * - The offset of each variable name from the start of the program (4 bytes each), then
+ *   the null-terminated names.
+ * Every part starts at a multiple of 8 bytes and the size is one too, so programs can be
+ * stored back to back. The context of the program, if any, is not saved. Like
+ * `convert_rpn_to_infix_into`, the required size is always reported.
+ *
+ * @param program  A pointer to a compiled program.
+ * @param buffer   The buffer receiving the program. It is left untouched if it cannot
+ *                 hold the whole program.
+ * @param capacity The size of 'buffer' in bytes. May be 0, in which case 'buffer' may
+ *                 be NULL.
+ * @param length   Receives the size of the serialized program.
+ * @return         SUCCESS, or MEMORY_ERROR if `program` is NULL or has more variables
+ *                 than the format holds.
+ */
+int save_compiled(const CompiledExpression* program, unsigned char* buffer, size_t capacity, size_t* length) {
+    *length = 0;
+    if (!program || program->variable_count > UINT32_MAX) {
+        return MEMORY_ERROR;
+    }
+
+    size_t names_offset = PROGRAM_HEADER_SIZE + program->length * PROGRAM_INSTRUCTION_SIZE;
+    size_t size = names_offset + align_to_8(program->variable_count * 4);
+    for (size_t i = 0; i < program->variable_count; i++) {
+        size += strlen(program->variable_names[i]) + 1;
+    }
+    size = align_to_8(size);
+    if (size > UINT32_MAX) {
+        return MEMORY_ERROR;  // Name offsets are 4 bytes
+    }
+    *length = size;
+    if (!buffer || capacity < size) {
+        return SUCCESS;
+    }
+
+    memset(buffer, 0, size);
+    memcpy(buffer, PROGRAM_MAGIC, 4);
+    store_le(buffer + 4, PROGRAM_VERSION, 2);
+    store_le(buffer + 6, PROGRAM_INSTRUCTION_SIZE, 2);
+    store_le(buffer + 8, operator_fingerprint(), 4);
+    store_le(buffer + 12, program->variable_count, 4);
+    store_le(buffer + 16, program->length, 8);
+    store_le(buffer + 24, program->max_depth, 8);
+    store_le(buffer + 32, size, 8);
+
+    for (size_t i = 0; i < program->length; i++) {
+        unsigned char* record = buffer + PROGRAM_HEADER_SIZE + i * PROGRAM_INSTRUCTION_SIZE;
+        uint64_t bits[2];
+        instruction_operand_bits(&program->code[i], bits);
+        store_le(record, (uint32_t)program->code[i].opcode, 4);
+        store_le(record + 8, bits[0], 8);
+        store_le(record + 16, bits[1], 8);
+    }
+
+    size_t name = names_offset + align_to_8(program->variable_count * 4);
+    for (size_t i = 0; i < program->variable_count; i++) {
+        size_t name_length = strlen(program->variable_names[i]) + 1;
+        store_le(buffer + names_offset + i * 4, name, 4);
+        memcpy(buffer + name, program->variable_names[i], name_length);
+        name += name_length;
+    }
+
+    TRACE(TRACE_INFO, "Saved a program of %zu instructions in %zu bytes\n", program->length, size);
+    return SUCCESS;
+}
+
+/**
+ * @brief Checks the instruction records of a serialized program.
+ *
+ * Evaluation trusts compiled programs, so a loaded one must be exactly what the compiler
+ * could produce: known opcodes, variable slots in range, exponents `literal_power` takes,
+ * error codes of OP_FAIL, which only ends a program, enough operands for every operator,
+ * one value left and a stack no deeper than `max_depth`.
+ *
+ * @param code           The instruction records.
+ * @param length         The number of records.
+ * @param variable_count The number of variable slots.
+ * @param max_depth      The maximum stack depth of the header.
+ * @return               True if the program is valid.
+ */
+static bool valid_program_code(const unsigned char* code, size_t length, size_t variable_count, size_t max_depth) {
+    size_t depth = 0;
+    for (size_t i = 0; i < length; i++) {
+        const unsigned char* record = code + i * PROGRAM_INSTRUCTION_SIZE;
+        uint64_t opcode = load_le(record, 4), operand = load_le(record + 8, 8);
+        if (load_le(record + 4, 4) != 0 || opcode > OP_FAIL) {
+            return false;
+        }
+        switch (opcode) {
+            case OP_PUSH_VARIABLE:
+                if (operand >= variable_count) return false;
+                // fall through
+            case OP_PUSH_NUMBER:
+                if (++depth > max_depth) return false;
+                continue;
+            case OP_INTEGER_POWER:
+                if (operand > MAX_SQUARING_EXPONENT) return false;
+                break;
+            case OP_FAIL:
+                return i == length - 1 && operand > SUCCESS && operand <= INVALID_TRIG_OPERATOR;
+            default:
+                break;
+        }
+        if (is_unary_opcode((Opcode)opcode)) {
+            if (depth < 1) return false;
+        } else {
+            if (depth < 2) return false;
+            depth--;
+        }
+    }
+    return depth == 1;
+}
+
+/**
+ * @brief Loads a program serialized by `save_compiled`.
+ *
+ * The program is checked, not parsed: no token is read and no literal converted. In
+ * place, and if the records have the layout of Instruction and `data` is aligned to 8
+ * bytes, the program evaluates its instructions and reads its variable names straight
+ * from `data`, which must then outlive it; only the program itself and its table of
+ * names are allocated. Otherwise the instructions and names are copied.
+ *
+ * @param data     The serialized program.
+ * @param size     The number of bytes of `data`, at least the size of the program.
+ * @param context  The context to resolve the variables in, like `compile_rpn_in_context`,
+ *                 or NULL for a program evaluated like one returned by `compile_rpn`.
+ * @param in_place Whether the program may point into `data`.
+ * @param program  Receives the program, which must be released with `free_compiled`,
+ *                 or NULL if loading fails.
+ * @return         LOAD_SUCCESS, LOAD_NOT_A_PROGRAM, LOAD_UNSUPPORTED, LOAD_CORRUPT or
+ *                 LOAD_MEMORY_ERROR.
+ */
+int load_compiled(const unsigned char* data, size_t size, EvalContext* context, bool in_place,
+                  CompiledExpression** program) {
+    *program = NULL;
+    if (!data || size < 4 || memcmp(data, PROGRAM_MAGIC, 4) != 0) {
+        return LOAD_NOT_A_PROGRAM;
+    }
+    if (size < PROGRAM_HEADER_SIZE) {
+        return LOAD_CORRUPT;
+    }
+    if (load_le(data + 4, 2) != PROGRAM_VERSION || load_le(data + 6, 2) != PROGRAM_INSTRUCTION_SIZE ||
+        load_le(data + 8, 4) != operator_fingerprint()) {
+        return LOAD_UNSUPPORTED;
+    }
+
+    uint64_t variable_count = load_le(data + 12, 4), length = load_le(data + 16, 8);
+    // Folding constants can leave the depth of the source expression above what the instructions reach,
+    // but not so high that the stacks of the evaluators overflow their sizes
+    uint64_t max_depth = load_le(data + 24, 8), total = load_le(data + 32, 8);
+    if (total > size || total % 8 != 0 || total < PROGRAM_HEADER_SIZE ||
+        length > (total - PROGRAM_HEADER_SIZE) / PROGRAM_INSTRUCTION_SIZE ||
+        max_depth >= SIZE_MAX / (COLUMN_BLOCK_SIZE * sizeof(double))) {
+        return LOAD_CORRUPT;
+    }
+    const unsigned char* code = data + PROGRAM_HEADER_SIZE;
+    size_t names_offset = PROGRAM_HEADER_SIZE + length * PROGRAM_INSTRUCTION_SIZE;
+    if (variable_count > (total - names_offset) / 4 ||
+        !valid_program_code(code, length, variable_count, max_depth)) {
+        return LOAD_CORRUPT;
+    }
+    // Names must lie between the offset table and the end of the program, null-terminated and distinct
+    size_t names_start = names_offset + align_to_8(variable_count * 4);
+    for (size_t i = 0; i < variable_count; i++) {
+        uint64_t name = load_le(data + names_offset + i * 4, 4);
+        if (name < names_start || name >= total || data[name] == '\0' ||
+            !memchr(data + name, '\0', total - name)) {
+            return LOAD_CORRUPT;
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp((const char*)data + name, (const char*)data + load_le(data + names_offset + j * 4, 4)) == 0) {
+                return LOAD_CORRUPT;
             }
-        } else if (is_number(token)) {
-            stack_top++;
-            if (stack_top >= MAX_STACK_SIZE) {
-                printf("Stack overflow error\n");
-                result.error_code = STACK_MAXIMUM;
-                return result;
+        }
+    }
+
+    CompiledExpression* loaded = calloc(1, sizeof(CompiledExpression));
+    if (!loaded) {
+        return LOAD_MEMORY_ERROR;
+    }
+    loaded->borrowed = in_place && instruction_layout_matches() && (uintptr_t)data % 8 == 0;
+    loaded->variable_names = malloc((variable_count + 1) * sizeof(char*));
+    if (context) {
+        loaded->context = context;
+        loaded->context_generation = context->generation;
+        loaded->context_slots = malloc((variable_count + 1) * sizeof(size_t));
+    }
+    if (!loaded->borrowed) {
+        loaded->code = malloc((length + 1) * sizeof(Instruction));
+    }
+    if (!loaded->variable_names || (context && !loaded->context_slots) || (!loaded->borrowed && !loaded->code)) {
+        free_compiled(loaded);
+        return LOAD_MEMORY_ERROR;
+    }
+
+    if (loaded->borrowed) {
+        loaded->code = (Instruction*)(void*)code;
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            const unsigned char* record = code + i * PROGRAM_INSTRUCTION_SIZE;
+            Instruction* instruction = &loaded->code[i];
+            uint64_t operand = load_le(record + 8, 8), unrounded = load_le(record + 16, 8);
+            instruction->opcode = (Opcode)load_le(record, 4);
+            switch (instruction->opcode) {
+                case OP_PUSH_NUMBER:
+                case OP_ADD_CONSTANT: memcpy(&instruction->operand.number, &operand, sizeof(double)); break;
+                case OP_PUSH_VARIABLE: instruction->operand.slot = (size_t)operand; break;
+                case OP_INTEGER_POWER: instruction->operand.exponent = (unsigned)operand; break;
+                case OP_FAIL: instruction->operand.error_code = (int)operand; break;
+                default: break;
             }
-            stack[stack_top] = atof(token);
-            printf("Pushed number: %.9f\n", stack[stack_top]);
+            memcpy(&instruction->unrounded, &unrounded, sizeof(double));
+        }
+    }
+    loaded->length = length;
+    loaded->max_depth = max_depth;
 
-            if (rpn->length > MAX_EXPR_LENGTH) {
-                printf("Expression length exceeded\n");
-                result.error_code = EXPR_LENGHT_MAXIMUM;
-                return result;
+    for (size_t i = 0; i < variable_count; i++) {
+        const char* name = (const char*)data + load_le(data + names_offset + i * 4, 4);
+        if (loaded->borrowed) {
+            loaded->variable_names[i] = (char*)name;
+            loaded->variable_count++;
+        } else {
+            size_t slot;
+            if (!intern_variable(loaded, name, &slot)) {
+                free_compiled(loaded);
+                return LOAD_MEMORY_ERROR;
             }
+        }
+        if (context && context_intern(context, name, &loaded->context_slots[i]) != SUCCESS) {
+            free_compiled(loaded);
+            return LOAD_MEMORY_ERROR;
+        }
+    }
+
+    TRACE(TRACE_INFO, "Loaded a program of %zu instructions%s\n", loaded->length, loaded->borrowed ? " in place" : "");
+    *program = loaded;
+    return LOAD_SUCCESS;
+}
+
+/**
+ * @brief Returns whether a program evaluates serialized data in place, see `load_compiled`.
+ *
+ * @param program A pointer to a compiled program.
+ * @return        1 if it points into the data it was loaded from, 0 otherwise.
+ */
+int compiled_is_borrowed(const CompiledExpression* program) {
+    return program && program->borrowed;
+}
+
+// Precedence of infix nodes, from loosest to tightest binding
+#define INFIX_ADDITIVE 1
+#define INFIX_MULTIPLICATIVE 2
+#define INFIX_POWER 3
+#define INFIX_POSTFIX 4
+#define INFIX_ATOM 5
+
+/**
+ * @brief Returns the infix precedence of an operator.
+ *
+ * Binary operators keep their precedence from `operator_table`, INFIX_ADDITIVE to
+ * INFIX_POWER. Functions such as 'sin' are written as 'sin(x)' and bind as tightly
+ * as operands.
+ */
+static int infix_precedence(Opcode opcode) {
+    const OperatorEntry* entry = &operator_table[opcode - OP_ADD];
+    if (entry->arity == 2) {
+        return entry->precedence;
+    }
+    return opcode == OP_FACTORIAL ? INFIX_POSTFIX : INFIX_ATOM;
+}
+
+/**
+ * @brief Returns whether a node is a negative literal such as '-2'.
+ *
+ * The sign of a literal is read as a negation, which binds looser than '*', '/', '^'
+ * and '!', so such a literal is written in parentheses where the negation would
+ * apply to more than the literal: '(-2) ^ 2', 'x * (-2)' or '(-2)!'. Only the left
+ * operand of '*' and '/' is written as is, since '-2 * x' has the same value either way.
+ */
+static bool is_negative_literal(const InfixNode* node) {
+    return node->arity == 0 && node->text_length > 1 && node->text[0] == '-';
+}
+
+/**
+ * @brief Adds the node of one token to an expression tree being built.
+ *
+ * The parentheses and the infix length of the node are decided from the precedence
+ * of its children, without looking at their text again.
+ *
+ * @param nodes       The node array, the new node going to index `index`.
+ * @param stack       The operand stack of node indices.
+ * @param depth       The number of entries on `stack`, updated.
+ * @param index       The position of the token in the expression.
+ * @param text        The text written for the node, which must outlive the tree.
+ * @param text_length The length of `text`.
+ * @param opcode      The opcode of an operator token, or NULL for an operand.
+ * @return            SUCCESS, or STACK_UNDERFLOW if the operator lacks operands.
+ */
+static int add_infix_node(InfixNode* nodes, size_t* stack, size_t* depth, size_t index,
+                          const char* text, size_t text_length, const Opcode* opcode) {
+    InfixNode* node = &nodes[index];
+    node->text = text;
+    node->text_length = text_length;
+
+    if (!opcode) {
+        // Push operand or variable
+        node->arity = 0;
+        node->precedence = INFIX_ATOM;
+        node->length = node->text_length;
+        stack[(*depth)++] = index;
+        return SUCCESS;
+    }
+
+    node->precedence = infix_precedence(*opcode);
+    if (is_unary_opcode(*opcode)) {
+        if (*depth < 1) {
+            TRACE(TRACE_ERROR, "Stack underflow - no operand for operator %.*s\n", (int)text_length, text);
+            return STACK_UNDERFLOW;
+        }
+        const InfixNode* operand = &nodes[stack[*depth - 1]];
+        node->arity = 1;
+        node->left = stack[*depth - 1];
+        if (*opcode == OP_FACTORIAL) {
+            // x!, with functions in parentheses since 'ln(9)!' reads as 'ln(9!)'
+            node->wrap_left = operand->precedence < INFIX_POSTFIX || is_negative_literal(operand) ||
+                              (operand->arity == 1 && operand->precedence == INFIX_ATOM);
+            node->length = operand->length + (node->wrap_left ? 2 : 0) + node->text_length;
         } else {
-            // Must be a variable
-            int error_code = SUCCESS;
-            double value = get_variable_value(token, &error_code);
-            if (error_code != SUCCESS) {
-                result.error_code = error_code;
-                return result;
+            // name(x)
+            node->wrap_left = true;
+            node->length = node->text_length + operand->length + 2;
+        }
+        stack[*depth - 1] = index;
+        return SUCCESS;
+    }
+
+    if (*depth < 2) {
+        TRACE(TRACE_ERROR, "Stack underflow - not enough operands for operator %.*s\n", (int)text_length, text);
+        return STACK_UNDERFLOW;
+    }
+    const InfixNode* a = &nodes[stack[*depth - 2]];
+    const InfixNode* b = &nodes[stack[*depth - 1]];
+    bool associative = *opcode == OP_ADD || *opcode == OP_MULTIPLY;
+
+    node->arity = 2;
+    node->left = stack[*depth - 2];
+    node->right = stack[*depth - 1];
+    // '^' groups to the right, every other operator to the left
+    node->wrap_left = a->precedence < node->precedence ||
+                      (a->precedence == node->precedence && *opcode == OP_POWER) ||
+                      (is_negative_literal(a) && *opcode == OP_POWER);
+    node->wrap_right = b->precedence < node->precedence ||
+                       (b->precedence == node->precedence && !associative && *opcode != OP_POWER) ||
+                       (is_negative_literal(b) && node->precedence >= INFIX_MULTIPLICATIVE);
+    // a op b
+    node->length = a->length + (node->wrap_left ? 2 : 0) + node->text_length + 2 +
+                   b->length + (node->wrap_right ? 2 : 0);
+    (*depth)--;
+    stack[*depth - 1] = index;
+    return SUCCESS;
+}
+
+/**
+ * @brief Checks that an expression tree reduced to a single value.
+ */
+static int finish_infix_tree(size_t depth) {
+    if (depth != 1) {
+        TRACE(TRACE_ERROR, "Invalid expression: %zu values left on the stack\n", depth);
+        return STACK_UNDERFLOW;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Builds the expression tree of an RPN expression in a preallocated node array.
+ *
+ * Each token becomes exactly one node, so the array never grows.
+ *
+ * @param rpn   The RPN expression to convert.
+ * @param nodes An array of 'rpn->length' nodes.
+ * @param stack An array of 'rpn->length' node indices used as the operand stack.
+ * @return      SUCCESS, or STACK_UNDERFLOW if the expression does not reduce to a
+ *              single value.
+ */
+static int build_infix_tree(const ReversePolishExpression* rpn, InfixNode* nodes, size_t* stack) {
+    size_t depth = 0;
+
+    for (size_t i = 0; i < rpn->length; i++) {
+        const char* token = rpn->expression[i];
+        Opcode opcode;
+        TRACE(TRACE_DEBUG, "Processing token: %s\n", token);
+
+        bool is_opcode = lookup_operator(token, &opcode);
+        int error_code = add_infix_node(nodes, stack, &depth, i, token, strlen(token), is_opcode ? &opcode : NULL);
+        if (error_code != SUCCESS) {
+            return error_code;
+        }
+    }
+    return finish_infix_tree(depth);
+}
+
+// Room for the shortest round-trip text of any double, such as "-2.2250738585072014e-308"
+#define NUMBER_TEXT_SIZE 32
+
+/**
+ * @brief Writes the shortest text that reads back as exactly `value`.
+ *
+ * @return The length of the text.
+ */
+static size_t format_number(double value, char* text) {
+    int length = 0;
+    for (int precision = 1; precision <= 17; precision++) {
+        length = snprintf(text, NUMBER_TEXT_SIZE, "%.*g", precision, value);
+        if (strtod(text, NULL) == value || isnan(value)) {
+            break;
+        }
+    }
+    return (size_t)length;
+}
+
+/**
+ * @brief Builds the expression tree of a typed RPN expression in a preallocated node array.
+ *
+ * Like `build_infix_tree`. Operators are written with their name from `operator_table`,
+ * variables with their name from the expression, and literals are formatted into
+ * `numbers`, which must hold NUMBER_TEXT_SIZE characters per token.
+ *
+ * @return SUCCESS, STACK_UNDERFLOW if the expression does not reduce to a single value,
+ *         MEMORY_ERROR for a variable slot out of range, or INVALID_OPERATOR for an
+ *         unknown opcode.
+ */
+static int build_typed_infix_tree(const TypedExpression* expr, InfixNode* nodes, size_t* stack, char* numbers) {
+    size_t depth = 0;
+
+    for (size_t i = 0; i < expr->length; i++) {
+        const TypedToken* token = &expr->tokens[i];
+        const char* text;
+        size_t text_length;
+        Opcode opcode = (Opcode)token->opcode;
+        bool is_opcode = false;
+
+        if (!is_typed_opcode(token->opcode)) {
+            return INVALID_OPERATOR;
+        } else if (token->opcode == OP_PUSH_NUMBER) {
+            text = numbers + i * NUMBER_TEXT_SIZE;
+            text_length = format_number(token->operand.number, numbers + i * NUMBER_TEXT_SIZE);
+        } else if (token->opcode == OP_PUSH_VARIABLE) {
+            if (!expr->variable_names || token->operand.slot >= expr->variable_count) {
+                return MEMORY_ERROR;
             }
-            stack_top++;
-            stack[stack_top] = value;
-            printf("Pushed variable value: %.9f\n", stack[stack_top]);
+            text = expr->variable_names[token->operand.slot];
+            text_length = strlen(text);
+        } else {
+            // The table lists the operators in opcode order
+            text = operator_table[token->opcode - OP_ADD].name;
+            text_length = strlen(text);
+            is_opcode = true;
+        }
+
+        int error_code = add_infix_node(nodes, stack, &depth, i, text, text_length, is_opcode ? &opcode : NULL);
+        if (error_code != SUCCESS) {
+            return error_code;
         }
     }
+    return finish_infix_tree(depth);
+}
 
-    if (stack_top != 0) {
-        printf("Invalid expression: stack not empty\n");
-        result.error_code = STACK_UNDERFLOW;
-        return result;
+/**
+ * @brief Writes a child node's parentheses and sets its offset.
+ *
+ * @return The position right after the child, including its parentheses.
+ */
+static size_t place_child(char* output, InfixNode* child, size_t offset, bool wrap) {
+    if (wrap) {
+        output[offset++] = '(';
+    }
+    child->offset = offset;
+    offset += child->length;
+    if (wrap) {
+        output[offset++] = ')';
     }
+    return offset;
+}
 
-    result.value = stack[0];
-    printf("Final result: %.9f\n", result.value);
-    return result;
+/**
+ * @brief Writes the infix text of a tree built by `build_infix_tree`.
+ *
+ * Parents come after their children in the node array, so a single backward pass
+ * reaches every node after its offset has been set by its parent. Each node writes
+ * its own text and its children's parentheses, which fills 'output' exactly once.
+ *
+ * @param nodes  The nodes of the tree, the root being the last one.
+ * @param count  The number of nodes.
+ * @param output A buffer of at least 'nodes[count - 1].length + 1' characters.
+ */
+static void serialize_infix_tree(InfixNode* nodes, size_t count, char* output) {
+    nodes[count - 1].offset = 0;
+
+    for (size_t i = count; i-- > 0;) {
+        InfixNode* node = &nodes[i];
+        size_t offset = node->offset;
+
+        switch (node->arity) {
+            case 0:
+                memcpy(output + offset, node->text, node->text_length);
+                break;
+            case 1:
+                if (node->text[0] == '!') {
+                    offset = place_child(output, &nodes[node->left], offset, node->wrap_left);
+                    memcpy(output + offset, node->text, node->text_length);
+                } else {
+                    memcpy(output + offset, node->text, node->text_length);
+                    place_child(output, &nodes[node->left], offset + node->text_length, true);
+                }
+                break;
+            default:
+                offset = place_child(output, &nodes[node->left], offset, node->wrap_left);
+                output[offset++] = ' ';
+                memcpy(output + offset, node->text, node->text_length);
+                offset += node->text_length;
+                output[offset++] = ' ';
+                place_child(output, &nodes[node->right], offset, node->wrap_right);
+                break;
+        }
+    }
+    output[nodes[count - 1].length] = '\0';
 }
 
 /**
- * @brief Foreign Function Interface (FFI) wrapper for RPN calculation.
- * 
- * It takes a ReversePolishExpression as input,
- * calls the evaluate_rpn function to perform the calculation, and
- * returns the CalculationResult. It also includes logging via printf
- * statements for debugging and tracing purposes.
- * 
- * @param rpn A pointer to a ReversePolishExpression structure representing
- *            the RPN expression to be evaluated. The structure contains the
- *            expression as an array of string tokens and the length of the
- *            expression.
- * 
- * @return    A CalculationResult structure containing the result of the
- *            evaluation and an error code.
- *              -   The 'value' field holds the calculated result if the evaluation
- *                  is successful.
- *              -   The 'error_code' field indicates the success or failure of the
- *                  operation.
+ * @brief Converts a Reverse Polish Notation (RPN) expression to Infix notation into a
+ *        caller-provided buffer.
+ *
+ * The expression tree is built in one allocation holding a node per token, and the
+ * result is written in a single linear pass. Parentheses are only added where the
+ * precedence or associativity of the operators requires them. Like 'snprintf', the
+ * required length is always reported, so a caller can retry with a larger buffer.
+ *
+ * @param rpn      A pointer to a ReversePolishExpression structure representing
+ *                 the RPN expression to be converted.
+ * @param buffer   The buffer receiving the null-terminated infix expression. It is
+ *                 left untouched if it cannot hold the whole expression.
+ * @param capacity The size of 'buffer' in bytes, terminator included. May be 0,
+ *                 in which case 'buffer' may be NULL.
+ * @param length   Receives the length of the infix expression, terminator excluded.
+ * @return         SUCCESS, MEMORY_ERROR or STACK_UNDERFLOW.
  */
-CalculationResult calculate_rpn(const ReversePolishExpression* rpn) {
-    printf("FFI: calculate_rpn called\n");
-    CalculationResult result = evaluate_rpn(rpn);
-    printf("FFI: returning result value=%f, error_code=%d\n", result.value, result.error_code);
-    return result;
+int convert_rpn_to_infix_into(const ReversePolishExpression* rpn, char* buffer, size_t capacity, size_t* length) {
+    *length = 0;
+    if (!rpn || !rpn->expression) {
+        return MEMORY_ERROR;
+    }
+    if (rpn->length == 0) {
+        return STACK_UNDERFLOW;
+    }
+
+    TRACE(TRACE_DEBUG, "Starting RPN to infix conversion\n");
+    TRACE(TRACE_DEBUG, "Input expression length: %zu\n", rpn->length);
+
+    // Nodes and operand stack share one allocation
+    InfixNode* nodes = malloc(rpn->length * (sizeof(InfixNode) + sizeof(size_t)));
+    if (!nodes) {
+        TRACE(TRACE_ERROR, "Memory allocation failed\n");
+        return MEMORY_ERROR;
+    }
+    size_t* stack = (size_t*)(nodes + rpn->length);
+
+    int error_code = build_infix_tree(rpn, nodes, stack);
+    if (error_code == SUCCESS) {
+        *length = nodes[rpn->length - 1].length;
+        if (buffer && capacity > *length) {
+            serialize_infix_tree(nodes, rpn->length, buffer);
+            TRACE(TRACE_DEBUG, "Final expression: %s\n", buffer);
+        }
+    }
+
+    free(nodes);
+    return error_code;
 }
 
 /**
- * @brief Determines if parentheses are needed around an expression.
+ * @brief Foreign Function Interface (FFI) entry point for converting a typed RPN expression
+ *        to Infix notation into a caller-provided buffer.
  *
- * Checks if an expression requires parentheses based on the
- * given operator's precedence. It checks for existing parentheses at the
- * beginning and end of the expression and then iterates through the
- * expression to identify operators with lower precedence.
+ * Same as `convert_rpn_to_infix_into` on the equivalent string tokens, except that
+ * literals are written with the shortest text that reads back as the same double
+ * (so "2.50" comes out as "2.5").
  *
- * @param expr The expression string to check. It is expected to be a
- *             null-terminated C-style string.
- * @param op   The operator character to consider for precedence.
- * @return     True if parentheses are needed, False otherwise.
- *                  -   False if the expression's length is less than or equal to 1.
- *                  -   False if the expression is already enclosed in parentheses.
- *                  -   True if the expression contains operators of lower precedence
- *                  based on the given operator.
+ * @param expr     A pointer to a TypedExpression structure holding the tokens.
+ * @param buffer   See `convert_rpn_to_infix_into`.
+ * @param capacity See `convert_rpn_to_infix_into`.
+ * @param length   See `convert_rpn_to_infix_into`.
+ * @return         SUCCESS, MEMORY_ERROR, STACK_UNDERFLOW, or INVALID_OPERATOR for an
+ *                 unknown opcode.
  */
-static bool needs_parentheses(const char* expr, char op) {
-    if (strlen(expr) <= 1) return false;
-    
-    // Check first and last characters for existing parentheses
-    if (expr[0] == '(' && expr[strlen(expr)-1] == ')') return false;
-    
-    // Check if the expression contains operators of lower precedence
-    for (size_t i = 0; i < strlen(expr); i++) {
-        char c = expr[i];
-        if (op == '!' || op == '√') return true;
-        if ((op == '*' || op == '/') && (c == '+' || c == '-')) return true;
-        if (op == '^' && (c == '*' || c == '/')) return true;
+int convert_rpn_to_infix_typed(const TypedExpression* expr, char* buffer, size_t capacity, size_t* length) {
+    TRACE(TRACE_INFO, "FFI: convert_rpn_to_infix_typed called\n");
+    *length = 0;
+    if (!expr || !expr->tokens) {
+        return MEMORY_ERROR;
     }
-    
-    return false;
+    if (expr->length == 0) {
+        return STACK_UNDERFLOW;
+    }
+
+    // Nodes, operand stack and literal texts share one allocation
+    InfixNode* nodes = malloc(expr->length * (sizeof(InfixNode) + sizeof(size_t) + NUMBER_TEXT_SIZE));
+    if (!nodes) {
+        TRACE(TRACE_ERROR, "Memory allocation failed\n");
+        return MEMORY_ERROR;
+    }
+    size_t* stack = (size_t*)(nodes + expr->length);
+    char* numbers = (char*)(stack + expr->length);
+
+    int error_code = build_typed_infix_tree(expr, nodes, stack, numbers);
+    if (error_code == SUCCESS) {
+        *length = nodes[expr->length - 1].length;
+        if (buffer && capacity > *length) {
+            serialize_infix_tree(nodes, expr->length, buffer);
+        }
+    }
+
+    free(nodes);
+    return error_code;
 }
+
 /**
  * @brief Converts a Reverse Polish Notation (RPN) expression to Infix notation.
  * 
  * It takes a ReversePolishExpression as input, calls the internal
  * conversion logic, and returns the result as a ConversionResult structure.
- * It also handles memory management for the resulting infix expression.
  * 
  * @param rpn A pointer to a ReversePolishExpression structure representing
  *            the RPN expression to be converted. The structure contains the
@@ -597,115 +5231,32 @@ static bool needs_parentheses(const char* expr, char op) {
  * @return    A ConversionResult structure containing the converted infix
  *            expression and an error code.
  *              -   If the conversion is successful, the 'expression' field holds
- *                  the converted infix expression, and the 'error_code' field is
- *                  set to SUCCESS (0). The caller is responsible for freeing the
- *                  memory allocated for the 'expression' field.
- *              -   If an error occurs, the 'expression' field may contain a partial
- *                  result or an empty string, and the 'error_code' field is set to
- *                  the corresponding error code: MEMORY_ERROR or STACK_UNDERFLOW.
+ *                  the converted infix expression, truncated to MAX_EXPR_LENGTH - 1
+ *                  characters, and the 'error_code' field is set to SUCCESS (0).
+ *                  Use `convert_rpn_to_infix_into` for longer expressions.
+ *              -   If an error occurs, the 'expression' field holds an empty string,
+ *                  and the 'error_code' field is set to the corresponding error code:
+ *                  MEMORY_ERROR or STACK_UNDERFLOW.
  */
 ConversionResult rpn_to_infix(const ReversePolishExpression* rpn) {
     ConversionResult result = {"", SUCCESS};
-    
-    if (!rpn || !rpn->expression) {
-        result.error_code = MEMORY_ERROR;
+    size_t length;
+
+    result.error_code = convert_rpn_to_infix_into(rpn, result.expression, MAX_EXPR_LENGTH, &length);
+    if (result.error_code != SUCCESS || length < MAX_EXPR_LENGTH) {
         return result;
     }
 
-    printf("Starting RPN to infix conversion\n");
-    printf("Input expression length: %zu\n", rpn->length);
-
-    char* stack[MAX_STACK_SIZE];
-    int stack_top = -1;
-    
-    for (size_t i = 0; i < rpn->length; i++) {
-        const char* token = rpn->expression[i];
-        printf("Processing token: %s\n", token);
-        
-        if (!is_operator(token)) {
-            // Push operand or variable
-            char* expr = malloc(strlen(token) + 1);
-            if (!expr) {
-                printf("Memory allocation failed\n");
-                result.error_code = MEMORY_ERROR;
-                // Clean up stack
-                while (stack_top >= 0) {
-                    free(stack[stack_top--]);
-                }
-                return result;
-            }
-            strcpy(expr, token);
-            stack[++stack_top] = expr;
-            printf("Pushed operand/variable: %s\n", expr);
-        } else {
-            // Process operator
-            if (stack_top < 1) {
-                printf("Stack underflow - not enough operands for operator %s\n", token);
-                result.error_code = STACK_UNDERFLOW;
-                // Clean up stack
-                while (stack_top >= 0) {
-                    free(stack[stack_top--]);
-                }
-                return result;
-            }
-            
-            char* b = stack[stack_top--];
-            char* a = stack[stack_top--];
-            
-            printf("Combining: %s %c %s\n", a, token[0], b);
-            
-            // Allocate space for new expression
-            size_t new_len = strlen(a) + strlen(b) + 10; // Extra space for operators and parentheses
-            char* expr = malloc(new_len);
-            if (!expr) {
-                printf("Memory allocation failed\n");
-                free(a);
-                free(b);
-                result.error_code = MEMORY_ERROR;
-                // Clean up stack
-                while (stack_top >= 0) {
-                    free(stack[stack_top--]);
-                }
-                return result;
-            }
-            
-            // Check if operands need parentheses
-            bool need_parens_a = needs_parentheses(a, token[0]);
-            bool need_parens_b = needs_parentheses(b, token[0]);
-            
-            snprintf(expr, new_len, "%s%s%s %c %s%s%s",
-                    need_parens_a ? "(" : "",
-                    a,
-                    need_parens_a ? ")" : "",
-                    token[0],
-                    need_parens_b ? "(" : "",
-                    b,
-                    need_parens_b ? ")" : "");
-            
-            printf("Created expression: %s\n", expr);
-            
-            free(a);
-            free(b);
-            stack[++stack_top] = expr;
-        }
-    }
-    
-    if (stack_top != 0) {
-        printf("Invalid expression: stack not empty (stack_top = %d)\n", stack_top);
-        result.error_code = STACK_UNDERFLOW;
-        // Clean up stack
-        while (stack_top >= 0) {
-            free(stack[stack_top--]);
-        }
+    // Too long for the fixed buffer: convert into a temporary one and keep the beginning
+    char* expression = malloc(length + 1);
+    if (!expression) {
+        result.error_code = MEMORY_ERROR;
         return result;
     }
-    
-    // Copy final expression to result
-    strncpy(result.expression, stack[0], MAX_EXPR_LENGTH - 1);
+    result.error_code = convert_rpn_to_infix_into(rpn, expression, length + 1, &length);
+    memcpy(result.expression, expression, MAX_EXPR_LENGTH - 1);
     result.expression[MAX_EXPR_LENGTH - 1] = '\0';
-    printf("Final expression: %s\n", result.expression);
-    free(stack[0]);
-    
+    free(expression);
     return result;
 }
 
@@ -732,8 +5283,8 @@ ConversionResult rpn_to_infix(const ReversePolishExpression* rpn) {
  *                  the corresponding error code: MEMORY_ERROR or STACK_UNDERFLOW.
  */
 ConversionResult convert_rpn_to_infix(const ReversePolishExpression* rpn) {
-    printf("FFI: convert_rpn_to_infix called\n");
+    TRACE(TRACE_INFO, "FFI: convert_rpn_to_infix called\n");
     ConversionResult result = rpn_to_infix(rpn);
-    printf("FFI: returning expression='%s', error_code=%d\n", result.expression, result.error_code);
+    TRACE(TRACE_INFO, "FFI: returning expression='%s', error_code=%d\n", result.expression, result.error_code);
     return result;
 }
\ No newline at end of file
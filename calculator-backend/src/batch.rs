@@ -0,0 +1,220 @@
+//! ./src/batch.rs
+//! Compiled batches: many compiled expressions merged so that their common subexpressions are evaluated once.
+//!
+//! The C library's `compile_batch` hash-conses the instructions of every program into one graph, where an
+//! instruction applied to the same operands is a single node however many programs compute it. Evaluating
+//! the batch over columns applies each node once per block of rows and writes every program's results, so
+//! formulas that share a prefix such as `sin(x) * cos(y)` only pay for it once.
+
+use std::ffi::{c_char, CStr};
+use std::os::raw::{c_double, c_int};
+
+use super::metrics::{self, Stage};
+use super::{
+    get_error_message, CCalculationResult, CCompiledExpression, ColumnResult, CompiledExpression, EvalContext,
+    Precision, MEMORY_ERROR, SUCCESS,
+};
+
+/// Opaque handle to a compiled batch allocated by the C library.
+#[repr(C)]
+pub struct CCompiledBatch {
+    _private: [u8; 0],
+}
+
+// ## `compile_batch` / `free_compiled_batch`
+// Merge compiled programs into a batch (a null pointer if memory allocation fails), and release it.
+// The batch copies what it needs from the programs.
+//
+// ## `compiled_batch_length` / `compiled_batch_source_length`
+// Return the number of distinct instructions of a batch, and the number of instructions of its programs.
+//
+// ## `compiled_batch_variable_count` / `compiled_batch_variable_name`
+// Return the number of free variable slots of a batch, merged by name, and the name bound to each slot.
+//
+// ## `evaluate_compiled_batch_columns`
+// Evaluates every program of a batch once per row, reading each variable slot from its own column of
+// `row_count` doubles (null if unbound). Writes one value and one error code per row into the arrays of each
+// program and returns `SUCCESS` or `MEMORY_ERROR`.
+extern "C" {
+    fn compile_batch(programs: *const *const CCompiledExpression, count: usize) -> *mut CCompiledBatch;
+    fn free_compiled_batch(batch: *mut CCompiledBatch);
+    fn compiled_batch_length(batch: *const CCompiledBatch) -> usize;
+    fn compiled_batch_source_length(batch: *const CCompiledBatch) -> usize;
+    fn compiled_batch_variable_count(batch: *const CCompiledBatch) -> usize;
+    fn compiled_batch_variable_name(batch: *const CCompiledBatch, slot: usize) -> *const c_char;
+    fn evaluate_compiled_batch_columns(
+        batch: *const CCompiledBatch,
+        columns: *const *const c_double,
+        row_count: usize,
+        values: *const *mut c_double,
+        error_codes: *const *mut c_int,
+        precision: c_int,
+    ) -> c_int;
+}
+
+/// Several compiled expressions evaluated together, each distinct subexpression once per row.
+///
+/// Every program gets exactly the value and error code it would get on its own, from
+/// `CompiledExpression::evaluate_columns` or `EvalContext::evaluate`, in every precision mode.
+///
+/// # Fields
+///
+/// * `batch`: A pointer (`*mut CCompiledBatch`) to the batch owned by this value.
+/// * `len`: The number of programs of the batch.
+pub struct CompiledBatch {
+    batch: *mut CCompiledBatch,
+    len: usize,
+}
+
+impl CompiledBatch {
+    /// Merges compiled expressions into a batch.
+    ///
+    /// # Arguments
+    ///
+    /// * `programs`: The expressions, compiled with `ReversePolish::compile` or `EvalContext::compile`. The batch
+    ///   keeps its own copy of them, and their variables are merged by name.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if memory allocation fails.
+    pub fn new(programs: &[&CompiledExpression]) -> Result<Self, String> {
+        let pointers: Vec<*const CCompiledExpression> = programs.iter().map(|program| program.program as *const _).collect();
+        let batch = metrics::timed(Stage::Compile, || unsafe { compile_batch(pointers.as_ptr(), pointers.len()) });
+        if batch.is_null() {
+            return Err(get_error_message(MEMORY_ERROR).to_string());
+        }
+        Ok(CompiledBatch { batch, len: programs.len() })
+    }
+
+    /// Returns the number of programs of the batch.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Returns `true` if the batch has no program.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Returns the number of distinct instructions of the batch, evaluated once per row.
+    pub fn instruction_count(&self) -> usize {
+        unsafe { compiled_batch_length(self.batch) }
+    }
+
+    /// Returns the number of instructions of the programs together, which evaluating them one by one would run
+    /// per row.
+    pub fn source_instruction_count(&self) -> usize {
+        unsafe { compiled_batch_source_length(self.batch) }
+    }
+
+    /// Returns the names of the free variables of every program, in slot order.
+    pub fn variable_names(&self) -> Vec<String> {
+        let count = unsafe { compiled_batch_variable_count(self.batch) };
+        (0..count)
+            .map(|slot| unsafe {
+                CStr::from_ptr(compiled_batch_variable_name(self.batch, slot))
+                    .to_string_lossy()
+                    .into_owned()
+            })
+            .collect()
+    }
+
+    /// Evaluates every program once per row, with variables bound to columns of values.
+    ///
+    /// # Arguments
+    ///
+    /// * `bindings`: See `CompiledExpression::evaluate_columns`.
+    ///
+    /// # Returns
+    ///
+    /// One `ColumnResult` per program, in the order given to `new`.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if no column is bound, the columns differ in length, or the C library fails
+    /// to allocate its work blocks.
+    pub fn evaluate_columns(&self, bindings: &[(&str, &[f64])]) -> Result<Vec<ColumnResult>, String> {
+        self.evaluate_columns_with_precision(bindings, Precision::Rounded)
+    }
+
+    /// Same as `evaluate_columns`, in the given precision mode.
+    ///
+    /// # Errors
+    ///
+    /// See `evaluate_columns`.
+    pub fn evaluate_columns_with_precision(
+        &self,
+        bindings: &[(&str, &[f64])],
+        precision: Precision,
+    ) -> Result<Vec<ColumnResult>, String> {
+        let row_count = match bindings.first() {
+            Some((_, column)) => column.len(),
+            None => return Err("No columns bound".to_string()),
+        };
+        if bindings.iter().any(|(_, column)| column.len() != row_count) {
+            return Err("Columns have different lengths".to_string());
+        }
+
+        let columns: Vec<*const c_double> = self
+            .variable_names()
+            .iter()
+            .map(|name| {
+                bindings
+                    .iter()
+                    .find(|(bound, _)| bound == name)
+                    .map_or(std::ptr::null(), |(_, column)| column.as_ptr())
+            })
+            .collect();
+        self.evaluate(&columns, row_count, precision)
+    }
+
+    /// Evaluates every program once with the current values of a context, see `EvalContext::evaluate_batch`.
+    pub(crate) fn evaluate_in(&self, context: &EvalContext) -> Vec<CCalculationResult> {
+        let values: Vec<Option<f64>> = self.variable_names().iter().map(|name| context.get_variable(name)).collect();
+        let columns: Vec<*const c_double> = values
+            .iter()
+            .map(|value| value.as_ref().map_or(std::ptr::null(), |value| value as *const f64))
+            .collect();
+        match self.evaluate(&columns, 1, context.precision()) {
+            Ok(results) => results
+                .into_iter()
+                .map(|result| CCalculationResult { result_value: result.values[0], error_code: result.error_codes[0] })
+                .collect(),
+            Err(_) => vec![CCalculationResult { result_value: 0.0, error_code: MEMORY_ERROR }; self.len],
+        }
+    }
+
+    /// Evaluates every program over `row_count` rows of one column per variable slot, null if unbound.
+    fn evaluate(&self, columns: &[*const c_double], row_count: usize, precision: Precision) -> Result<Vec<ColumnResult>, String> {
+        let mut results: Vec<ColumnResult> = (0..self.len)
+            .map(|_| ColumnResult { values: vec![0.0; row_count], error_codes: vec![SUCCESS; row_count] })
+            .collect();
+        let values: Vec<*mut c_double> = results.iter_mut().map(|result| result.values.as_mut_ptr()).collect();
+        let error_codes: Vec<*mut c_int> = results.iter_mut().map(|result| result.error_codes.as_mut_ptr()).collect();
+        let error_code = metrics::timed(Stage::Evaluate, || unsafe {
+            evaluate_compiled_batch_columns(
+                self.batch,
+                columns.as_ptr(),
+                row_count,
+                values.as_ptr(),
+                error_codes.as_ptr(),
+                precision as c_int,
+            )
+        });
+        if error_code != SUCCESS {
+            return Err(get_error_message(error_code).to_string());
+        }
+        Ok(results)
+    }
+}
+
+impl Drop for CompiledBatch {
+    fn drop(&mut self) {
+        unsafe { free_compiled_batch(self.batch) }
+    }
+}
+
+// Like a compiled program, a batch is never modified after `compile_batch` returns, and evaluating it only
+// reads it, so it can be moved to and shared between threads.
+unsafe impl Send for CompiledBatch {}
+unsafe impl Sync for CompiledBatch {}
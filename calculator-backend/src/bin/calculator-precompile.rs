@@ -0,0 +1,116 @@
+//! ./src/bin/calculator-precompile.rs
+//! Compiles a library of named formulas ahead of time, for `calculator_backend::ProgramLibrary::open`.
+//!
+//! Usage: `calculator-precompile --output FILE [FILE...]`
+//!
+//! Reads one `name = expression` formula per line from each FILE, or from stdin if no FILE or `-` is given.
+//! Blank lines and lines starting with `#` are skipped. Nothing is written if any formula fails to compile.
+
+use std::fs::File;
+use std::io::{self, BufRead, BufReader, Read};
+use std::process::ExitCode;
+
+use calculator_backend::ProgramLibraryBuilder;
+
+const USAGE: &str = "Usage: calculator-precompile --output FILE [FILE...]
+
+Compiles one `name = expression` formula per line from each FILE, or from stdin if no FILE or `-` is given,
+into a program library. Blank lines and lines starting with `#` are skipped.
+
+Options:
+  --output FILE     The library file to write
+  --help            Print this message";
+
+/// Command line options.
+///
+/// # Fields
+///
+/// * `output`: The library file to write.
+/// * `paths`: The formula files to read in order, `-` for stdin.
+struct Options {
+    output: String,
+    paths: Vec<String>,
+}
+
+impl Options {
+    /// Parses the arguments after the program name.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` describing the first invalid argument.
+    fn parse(mut args: impl Iterator<Item = String>) -> Result<Options, String> {
+        let mut output = None;
+        let mut paths = Vec::new();
+        while let Some(arg) = args.next() {
+            match arg.as_str() {
+                "--output" => output = Some(args.next().ok_or_else(|| "--output expects a file".to_string())?),
+                _ if arg.starts_with("--") => return Err(format!("Unknown option {}", arg)),
+                _ => paths.push(arg),
+            }
+        }
+        if paths.is_empty() {
+            paths.push("-".to_string());
+        }
+        let output = output.ok_or_else(|| "Missing --output".to_string())?;
+        Ok(Options { output, paths })
+    }
+}
+
+/// Adds every formula of `reader` to `library`.
+///
+/// # Errors
+///
+/// Returns an `Err(String)` naming the line of the first formula that cannot be read or compiled.
+fn add_formulas(library: &mut ProgramLibraryBuilder, path: &str, reader: impl Read) -> Result<(), String> {
+    for (number, line) in BufReader::new(reader).lines().enumerate() {
+        let line = line.map_err(|e| format!("{}: {}", path, e))?;
+        let line = line.trim();
+        if line.is_empty() || line.starts_with('#') {
+            continue;
+        }
+        let (name, expression) = line
+            .split_once('=')
+            .ok_or_else(|| format!("{}:{}: Expected `name = expression`", path, number + 1))?;
+        library
+            .add(name.trim(), expression.trim())
+            .map_err(|e| format!("{}:{}: {}", path, number + 1, e))?;
+    }
+    Ok(())
+}
+
+fn run(options: Options) -> Result<(), String> {
+    let mut library = ProgramLibraryBuilder::new();
+    for path in &options.paths {
+        if path == "-" {
+            add_formulas(&mut library, "<stdin>", io::stdin().lock())?;
+        } else {
+            let file = File::open(path).map_err(|e| format!("{}: {}", path, e))?;
+            add_formulas(&mut library, path, file)?;
+        }
+    }
+    library.write(&options.output)?;
+    eprintln!("Compiled {} formulas into {}", library.len(), options.output);
+    Ok(())
+}
+
+fn main() -> ExitCode {
+    let args: Vec<String> = std::env::args().skip(1).collect();
+    if args.iter().any(|arg| arg == "--help" || arg == "-h") {
+        println!("{}", USAGE);
+        return ExitCode::SUCCESS;
+    }
+    let options = match Options::parse(args.into_iter()) {
+        Ok(options) => options,
+        Err(e) => {
+            eprintln!("{}\n\n{}", e, USAGE);
+            return ExitCode::from(2);
+        }
+    };
+    match run(options) {
+        Ok(()) => ExitCode::SUCCESS,
+        Err(e) => {
+            eprintln!("calculator-precompile: {}", e);
+            ExitCode::FAILURE
+        }
+    }
+}
@@ -0,0 +1,103 @@
+//! ./src/bin/calculator-server.rs
+//! HTTP front end of `calculator_backend::server`.
+//!
+//! Usage: `calculator-server [--listen ADDRESS] [--workers N] [--max-batch N] [--max-delay-us MICROS]
+//!                           [--queue N] [--cache N] [--precision rounded|raw|round-result]`
+
+use std::process::ExitCode;
+use std::time::Duration;
+
+use calculator_backend::server::{serve, Evaluator, ServerConfig};
+use calculator_backend::Precision;
+use tokio::net::TcpListener;
+
+const USAGE: &str = "Usage: calculator-server [OPTIONS]
+
+Evaluates expressions over HTTP: POST one expression per line to /evaluate for one JSON object per line,
+GET /metrics for Prometheus metrics.
+
+Options:
+  --listen ADDRESS      Address to listen on (default 127.0.0.1:8080)
+  --workers N           Worker threads evaluating batches (default: one per core)
+  --max-batch N         Maximum expressions per batch (default 256)
+  --max-delay-us MICROS Time a batch waits for more expressions (default 0)
+  --queue N             Maximum queued expressions (default 65536)
+  --cache N             Maximum cached compiled expressions, 0 to disable (default 4096)
+  --precision MODE      `rounded` (the default), `raw` or `round-result`
+  --help                Print this message";
+
+/// Command line options.
+///
+/// # Fields
+///
+/// * `listen`: The address to listen on.
+/// * `config`: The settings of the evaluator.
+struct Options {
+    listen: String,
+    config: ServerConfig,
+}
+
+impl Options {
+    /// Parses the arguments after the program name.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` describing the first invalid argument.
+    fn parse(mut args: impl Iterator<Item = String>) -> Result<Options, String> {
+        let mut options = Options { listen: "127.0.0.1:8080".to_string(), config: ServerConfig::default() };
+        while let Some(arg) = args.next() {
+            let mut number = |min: usize| {
+                args.next()
+                    .and_then(|value| value.parse::<usize>().ok())
+                    .filter(|&value| value >= min)
+                    .ok_or_else(|| format!("{} expects a number of at least {}", arg, min))
+            };
+            match arg.as_str() {
+                "--workers" => options.config.workers = number(1)?,
+                "--max-batch" => options.config.max_batch_size = number(1)?,
+                "--max-delay-us" => options.config.max_batch_delay = Duration::from_micros(number(0)? as u64),
+                "--queue" => options.config.queue_capacity = number(1)?,
+                "--cache" => options.config.cache_capacity = number(0)?,
+                "--listen" => options.listen = args.next().ok_or("--listen expects an address")?,
+                "--precision" => {
+                    options.config.precision = match args.next().as_deref() {
+                        Some("rounded") => Precision::Rounded,
+                        Some("raw") => Precision::Raw,
+                        Some("round-result") => Precision::RoundResult,
+                        other => return Err(format!("Unknown precision {:?}", other.unwrap_or(""))),
+                    }
+                }
+                _ => return Err(format!("Unknown option {}", arg)),
+            }
+        }
+        Ok(options)
+    }
+}
+
+#[tokio::main]
+async fn main() -> ExitCode {
+    let args: Vec<String> = std::env::args().skip(1).collect();
+    if args.iter().any(|arg| arg == "--help" || arg == "-h") {
+        println!("{}", USAGE);
+        return ExitCode::SUCCESS;
+    }
+    let options = match Options::parse(args.into_iter()) {
+        Ok(options) => options,
+        Err(e) => {
+            eprintln!("{}\n\n{}", e, USAGE);
+            return ExitCode::from(2);
+        }
+    };
+    let listener = match TcpListener::bind(&options.listen).await {
+        Ok(listener) => listener,
+        Err(e) => {
+            eprintln!("calculator-server: {}: {}", options.listen, e);
+            return ExitCode::FAILURE;
+        }
+    };
+    if let Ok(address) = listener.local_addr() {
+        eprintln!("calculator-server: listening on http://{}", address);
+    }
+    serve(listener, Evaluator::start(options.config)).await;
+    ExitCode::SUCCESS
+}
@@ -0,0 +1,312 @@
+//! ./src/cache.rs
+//! A bounded least-recently-used cache of compiled expressions, keyed by the raw input string.
+//! Repeated expressions skip tokenization, RPN conversion and compilation and go straight to evaluation.
+
+use std::collections::HashMap;
+
+use super::metrics;
+use super::{
+    calculate_with_context, conversion_failure, finish_calculation, parse_failure, CalculationResult,
+    CompiledExpression, EvalContext, History, Precision, ReversePolish, ANS_VARIABLE,
+};
+
+// Marks the end of the recency list
+const NIL: usize = usize::MAX;
+
+/// A value of an `LruMap`, linked into its recency list.
+///
+/// # Fields
+///
+/// * `key`: The string the value is stored under.
+/// * `value`: The stored value.
+/// * `prev`, `next`: The neighbouring entries in the recency list, `NIL` at either end.
+struct LruEntry<V> {
+    key: String,
+    value: V,
+    prev: usize,
+    next: usize,
+}
+
+/// A bounded map from strings to values that evicts the least recently used entry when it is full.
+///
+/// Values are addressed by their position, which stays valid until the entry is evicted or the map is
+/// cleared.
+///
+/// # Fields
+///
+/// * `capacity`: The maximum number of entries. A capacity of `0` keeps no entry.
+/// * `index`: Maps a key to its position in `entries`.
+/// * `entries`: The stored values.
+/// * `head`, `tail`: The most and least recently used entries, `NIL` if the map is empty.
+pub(crate) struct LruMap<V> {
+    capacity: usize,
+    index: HashMap<String, usize>,
+    entries: Vec<LruEntry<V>>,
+    head: usize,
+    tail: usize,
+}
+
+impl<V> LruMap<V> {
+    /// Creates an empty map holding at most `capacity` entries.
+    pub(crate) fn new(capacity: usize) -> Self {
+        LruMap {
+            capacity,
+            index: HashMap::with_capacity(capacity),
+            entries: Vec::with_capacity(capacity),
+            head: NIL,
+            tail: NIL,
+        }
+    }
+
+    /// Returns the position of the value stored under `key` and marks it as the most recently used, or
+    /// `None` if there is no such value.
+    pub(crate) fn find(&mut self, key: &str) -> Option<usize> {
+        let position = *self.index.get(key)?;
+        self.touch(position);
+        Some(position)
+    }
+
+    /// Returns the value at `position`.
+    pub(crate) fn at(&self, position: usize) -> &V {
+        &self.entries[position].value
+    }
+
+    /// Stores `value` under `key` as the most recently used entry. A value already stored under `key` is
+    /// replaced, otherwise the least recently used entry is evicted if the map is full.
+    ///
+    /// # Returns
+    ///
+    /// The position of the value, or `None` if the capacity is `0`.
+    pub(crate) fn insert(&mut self, key: &str, value: V) -> Option<usize> {
+        if let Some(position) = self.find(key) {
+            self.entries[position].value = value;
+            return Some(position);
+        }
+        if self.capacity == 0 {
+            return None;
+        }
+
+        let entry = LruEntry { key: key.to_string(), value, prev: NIL, next: NIL };
+        let position = if self.entries.len() < self.capacity {
+            self.entries.push(entry);
+            self.entries.len() - 1
+        } else {
+            // Reuse the slot of the least recently used entry
+            let position = self.tail;
+            self.unlink(position);
+            self.index.remove(&self.entries[position].key);
+            self.entries[position] = entry;
+            position
+        };
+        self.index.insert(key.to_string(), position);
+        self.push_front(position);
+        Some(position)
+    }
+
+    /// Returns the number of entries.
+    pub(crate) fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns the maximum number of entries.
+    pub(crate) fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// Removes every entry.
+    pub(crate) fn clear(&mut self) {
+        self.index.clear();
+        self.entries.clear();
+        self.head = NIL;
+        self.tail = NIL;
+    }
+
+    /// Marks an entry as the most recently used.
+    fn touch(&mut self, position: usize) {
+        if self.head != position {
+            self.unlink(position);
+            self.push_front(position);
+        }
+    }
+
+    /// Removes an entry from the recency list.
+    fn unlink(&mut self, position: usize) {
+        let (prev, next) = (self.entries[position].prev, self.entries[position].next);
+        if prev == NIL { self.head = next; } else { self.entries[prev].next = next; }
+        if next == NIL { self.tail = prev; } else { self.entries[next].prev = prev; }
+    }
+
+    /// Inserts an unlinked entry at the front of the recency list.
+    fn push_front(&mut self, position: usize) {
+        self.entries[position].prev = NIL;
+        self.entries[position].next = self.head;
+        if self.head == NIL { self.tail = position; } else { self.entries[self.head].prev = position; }
+        self.head = position;
+    }
+}
+
+/// A cached expression.
+///
+/// # Fields
+///
+/// * `rpn`: The RPN expression, with `ans` kept as the variable `ANS_VARIABLE`.
+/// * `program`: `rpn` compiled in the context of the cache.
+/// * `uses_ans`: Whether `rpn` refers to `ans`.
+struct CacheEntry {
+    rpn: ReversePolish,
+    program: CompiledExpression,
+    uses_ans: bool,
+}
+
+/// Returns the RPN string `calculate_expression` reports for `rpn`, with `ans` replaced by `ans_value`.
+fn rpn_string(rpn: &ReversePolish, ans_value: f64) -> String {
+    let ans = ans_value.to_string();
+    rpn.tokens()
+        .map(|token| if token == ANS_VARIABLE { ans.as_str() } else { token })
+        .collect::<Vec<&str>>()
+        .join(" ")
+}
+
+/// A bounded cache mapping input strings to their compiled RPN programs.
+///
+/// Programs are compiled against a context owned by the cache, with `ans` kept as a variable that is
+/// assigned the last result of the given `History` before every evaluation. Variables are looked up in
+/// the same context, so entries that use `ans` or variables always see the current values.
+/// When the cache is full, the least recently used entry is evicted.
+///
+/// Variable names are interned in the context for as long as the cache lives, even after the entries
+/// using them are evicted.
+///
+/// # Fields
+///
+/// * `context`: The context every entry is compiled in.
+/// * `entries`: The cached expressions by input string. A capacity of `0` disables caching.
+/// * `hits`, `misses`: The number of lookups that found, or did not find, a cached entry.
+pub struct ExpressionCache {
+    context: EvalContext,
+    entries: LruMap<CacheEntry>,
+    hits: u64,
+    misses: u64,
+}
+
+impl ExpressionCache {
+    /// Creates an empty cache holding at most `capacity` expressions, with the default variables `pi` and `e`.
+    pub fn new(capacity: usize) -> Self {
+        ExpressionCache { context: EvalContext::new(), entries: LruMap::new(capacity), hits: 0, misses: 0 }
+    }
+
+    /// Assigns a variable for every expression evaluated through this cache, including cached ones.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if the name contains a null byte or memory allocation fails.
+    pub fn set_variable(&mut self, name: &str, value: f64) -> Result<(), String> {
+        self.context.set_variable(name, value)
+    }
+
+    /// Returns the value of a variable, or `None` if it was never assigned.
+    pub fn get_variable(&self, name: &str) -> Option<f64> {
+        self.context.get_variable(name)
+    }
+
+    /// Sets the precision mode of every expression evaluated through this cache. Cached programs are
+    /// kept, since every mode evaluates the same program.
+    pub fn set_precision(&mut self, precision: Precision) {
+        self.context.set_precision(precision)
+    }
+
+    /// Same as `calculate_expression`, but the compiled program of `input` is reused if it is cached,
+    /// and variables are looked up in this cache.
+    ///
+    /// Expressions that fail to convert to RPN are never cached.
+    pub fn calculate_expression(&mut self, input: &str, history: &mut History) -> CalculationResult {
+        let input = input.trim_matches('"');
+
+        let position = match self.entries.find(input) {
+            Some(position) => {
+                self.hits += 1;
+                metrics::count_cache_lookup(true);
+                position
+            }
+            None => {
+                self.misses += 1;
+                metrics::count_cache_lookup(false);
+                match self.insert(input, history) {
+                    Ok(position) => position,
+                    Err(result) => return result,
+                }
+            }
+        };
+
+        let ans_value = history.get_last_result().unwrap_or(0.0);
+        let entry = self.entries.at(position);
+        let rpn_str = if entry.uses_ans { rpn_string(&entry.rpn, ans_value) } else { entry.rpn.to_string() };
+        if entry.uses_ans {
+            if let Err(e) = self.context.set_variable(ANS_VARIABLE, ans_value) {
+                return conversion_failure(input, rpn_str, e, history);
+            }
+        }
+        let result = self.context.evaluate(&entry.program);
+        finish_calculation(input, rpn_str, result, history)
+    }
+
+    /// Returns the number of lookups that found a cached entry.
+    pub fn hits(&self) -> u64 {
+        self.hits
+    }
+
+    /// Returns the number of lookups that did not find a cached entry.
+    pub fn misses(&self) -> u64 {
+        self.misses
+    }
+
+    /// Returns the number of cached expressions.
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns `true` if no expression is cached.
+    pub fn is_empty(&self) -> bool {
+        self.entries.len() == 0
+    }
+
+    /// Returns the maximum number of cached expressions.
+    pub fn capacity(&self) -> usize {
+        self.entries.capacity()
+    }
+
+    /// Removes every cached expression. Variables and the hit and miss counters are kept.
+    pub fn clear(&mut self) {
+        self.entries.clear();
+    }
+
+    /// Compiles `input` and stores it as the most recently used entry, evicting the least recently used
+    /// one if the cache is full.
+    ///
+    /// # Returns
+    ///
+    /// * `Ok(usize)`: The position of the new entry.
+    /// * `Err(CalculationResult)`: The final result, if `input` was evaluated without being cached.
+    fn insert(&mut self, input: &str, history: &mut History) -> Result<usize, CalculationResult> {
+        let mut rpn = ReversePolish::new();
+        if let Err(e) = rpn.write_infix(input, None) {
+            return Err(parse_failure(input, e, history));
+        }
+        let uses_ans = rpn.tokens().any(|token| token == ANS_VARIABLE);
+
+        if self.entries.capacity() == 0 {
+            return Err(calculate_with_context(input, history, Some(&self.context), Precision::default()));
+        }
+
+        let program = match self.context.compile(&rpn) {
+            Ok(program) => program,
+            Err(e) => {
+                let rpn_str = rpn_string(&rpn, history.get_last_result().unwrap_or(0.0));
+                return Err(conversion_failure(input, rpn_str, e, history));
+            }
+        };
+
+        // The capacity is not 0, so the entry is stored
+        Ok(self.entries.insert(input, CacheEntry { rpn, program, uses_ans }).unwrap())
+    }
+}
@@ -0,0 +1,321 @@
+//! ./src/formulas.rs
+//! Named formulas of an `EvalContext`, recomputed incrementally when the variables they read change.
+//!
+//! A formula is an expression compiled in its context whose value is stored in the variable of its name,
+//! so other formulas, and any expression evaluated in the context, read it like any other variable.
+//! Formulas and the names they read form a dependency graph without cycles. When variables change, only
+//! the formulas downstream of them are evaluated again, level by level in topological order. The formulas
+//! of one level never read each other, so large levels are split across threads.
+
+use std::collections::HashMap;
+
+use super::{
+    context_set_slot, context_unset_slot, context_variable_slot, get_error_message, infix_to_rpn, tokenize,
+    variable_key, CCalculationResult, CompiledExpression, EvalContext, History, Token, SUCCESS,
+};
+
+// Levels with at least this many formulas are evaluated on several threads
+const PARALLEL_LEVEL: usize = 256;
+
+/// A formula of a context.
+///
+/// # Fields
+///
+/// * `name`: The name of the formula, which is also the variable holding its value.
+/// * `program`: The expression, compiled in the context.
+/// * `reads`: The names of the variables the expression reads, formulas or not.
+/// * `slot`: The context slot of the variable `name`.
+/// * `result`: The value and error code of the last evaluation.
+struct Formula {
+    name: String,
+    program: CompiledExpression,
+    reads: Vec<String>,
+    slot: usize,
+    result: CCalculationResult,
+}
+
+/// The formulas of a context and their dependency graph.
+///
+/// # Fields
+///
+/// * `formulas`: The formulas, indexed by id. Ids of removed formulas are `None` until reused.
+/// * `free`: The ids of removed formulas.
+/// * `index`: Maps the name of each formula to its id.
+/// * `readers`: Maps a variable name to the ids of the formulas reading it.
+/// * `marks`: For each id, the traversal that last reached it.
+/// * `indegrees`: For each id reached by the current traversal, how many of the formulas it reads are yet
+///   to be recomputed.
+/// * `traversal`: The number of traversals so far.
+/// * `recomputed`: The number of formulas evaluated by the last change.
+#[derive(Default)]
+pub(crate) struct Formulas {
+    formulas: Vec<Option<Formula>>,
+    free: Vec<usize>,
+    index: HashMap<String, usize>,
+    readers: HashMap<String, Vec<usize>>,
+    marks: Vec<u64>,
+    indegrees: Vec<usize>,
+    traversal: u64,
+    recomputed: usize,
+}
+
+/// Returns the variable name `name` is compiled to, or an error if it would not be read as a variable.
+fn formula_name(name: &str) -> Result<String, String> {
+    let mut tokens = tokenize(name);
+    match (tokens.next(), tokens.next()) {
+        (Some(Token::Variable(text)), None) if text == name => Ok(variable_key(name)),
+        _ => Err(format!("Invalid formula name '{}'", name)),
+    }
+}
+
+impl Formulas {
+    /// Returns `true` if no formula is defined.
+    pub(crate) fn is_empty(&self) -> bool {
+        self.index.is_empty()
+    }
+
+    /// Returns whether `name` is a formula.
+    pub(crate) fn contains(&self, name: &str) -> bool {
+        self.index.contains_key(name)
+    }
+
+    /// Returns the last result of a formula, or `None` if there is no such formula.
+    pub(crate) fn result(&self, name: &str) -> Option<CCalculationResult> {
+        let name = formula_name(name).ok()?;
+        self.index.get(&name).map(|&id| self.formula(id).result)
+    }
+
+    /// Returns the number of formulas evaluated by the last change.
+    pub(crate) fn recomputed(&self) -> usize {
+        self.recomputed
+    }
+
+    fn formula(&self, id: usize) -> &Formula {
+        self.formulas[id].as_ref().expect("formula ids in the graph are defined")
+    }
+
+    /// Defines or replaces a formula and recomputes it with every formula downstream of it, see
+    /// `EvalContext::define_formula`.
+    pub(crate) fn define(
+        &mut self,
+        context: &mut EvalContext,
+        name: &str,
+        input: &str,
+        history: &History,
+    ) -> Result<CCalculationResult, String> {
+        let name = formula_name(name)?;
+        let rpn = infix_to_rpn(input.trim_matches('"'), history)?;
+        let program = context.compile(&rpn)?;
+        let reads = program.variable_names();
+        if let Some(read) = reads.iter().find(|read| self.reaches(read, &name)) {
+            return Err(format!("Circular reference: formula '{}' depends on itself through '{}'", name, read));
+        }
+        let slot = variable_slot(context, &name)?;
+
+        let result = CCalculationResult { result_value: 0.0, error_code: SUCCESS };
+        let formula = Formula { name: name.clone(), program, reads, slot, result };
+        let id = match self.index.get(&name) {
+            Some(&id) => {
+                self.unlink(id);
+                id
+            }
+            None => match self.free.pop() {
+                Some(id) => id,
+                None => {
+                    self.formulas.push(None);
+                    self.marks.push(0);
+                    self.indegrees.push(0);
+                    self.formulas.len() - 1
+                }
+            },
+        };
+        for read in &formula.reads {
+            self.readers.entry(read.clone()).or_default().push(id);
+        }
+        self.formulas[id] = Some(formula);
+        self.index.insert(name, id);
+
+        self.recompute(context, &[id]);
+        Ok(self.formula(id).result)
+    }
+
+    /// Removes a formula. Its variable becomes undefined and the formulas reading it are recomputed.
+    ///
+    /// # Returns
+    ///
+    /// `true` if there was such a formula.
+    pub(crate) fn remove(&mut self, context: &mut EvalContext, name: &str) -> bool {
+        let Some(id) = formula_name(name).ok().and_then(|name| self.index.remove(&name)) else {
+            return false;
+        };
+        self.unlink(id);
+        if let Some(formula) = self.formulas[id].take() {
+            unsafe { context_unset_slot(context.context, formula.slot) };
+            let readers = self.readers.get(&formula.name).cloned().unwrap_or_default();
+            self.recompute(context, &readers);
+        }
+        self.free.push(id);
+        true
+    }
+
+    /// Assigns input variables and recomputes the formulas downstream of any of them, each once.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)`, before assigning anything, if a name is a formula, contains a null byte,
+    /// or memory allocation fails.
+    pub(crate) fn assign(&mut self, context: &mut EvalContext, assignments: &[(&str, f64)]) -> Result<(), String> {
+        // Names are read case-insensitively, like the variables formulas read
+        let names: Vec<String> = assignments.iter().map(|(name, _)| variable_key(name)).collect();
+        if let Some(name) = names.iter().find(|name| self.contains(name)) {
+            return Err(format!("Cannot assign formula '{}', remove it first", name));
+        }
+        let slots = names.iter().map(|name| variable_slot(context, name)).collect::<Result<Vec<usize>, String>>()?;
+        let mut seeds = Vec::new();
+        for ((&slot, name), &(_, value)) in slots.iter().zip(&names).zip(assignments) {
+            unsafe { context_set_slot(context.context, slot, value) };
+            seeds.extend(self.readers.get(name).into_iter().flatten());
+        }
+        self.recompute(context, &seeds);
+        Ok(())
+    }
+
+    /// Recomputes every formula, e.g. after the precision mode changed.
+    pub(crate) fn recompute_all(&mut self, context: &mut EvalContext) {
+        let ids: Vec<usize> = self.index.values().copied().collect();
+        self.recompute(context, &ids);
+    }
+
+    /// Returns whether the formula `target`, once defined, would be read when evaluating `name`.
+    fn reaches(&self, name: &str, target: &str) -> bool {
+        let mut stack = vec![name];
+        let mut visited = std::collections::HashSet::new();
+        while let Some(name) = stack.pop() {
+            if name == target {
+                return true;
+            }
+            if let Some(&id) = self.index.get(name) {
+                if visited.insert(id) {
+                    stack.extend(self.formula(id).reads.iter().map(String::as_str));
+                }
+            }
+        }
+        false
+    }
+
+    /// Removes a formula from the lists of readers of the names it reads.
+    fn unlink(&mut self, id: usize) {
+        let Some(formula) = &self.formulas[id] else {
+            return;
+        };
+        for read in &formula.reads {
+            if let Some(readers) = self.readers.get_mut(read) {
+                readers.retain(|&reader| reader != id);
+                if readers.is_empty() {
+                    self.readers.remove(read);
+                }
+            }
+        }
+    }
+
+    /// Evaluates the formulas `seeds` and every formula downstream of them, in topological order, and
+    /// stores their values in the context.
+    fn recompute(&mut self, context: &mut EvalContext, seeds: &[usize]) {
+        // Everything reachable from the seeds through the readers of each formula
+        self.traversal += 1;
+        let traversal = self.traversal;
+        let mut affected = Vec::new();
+        let mut stack = seeds.to_vec();
+        while let Some(id) = stack.pop() {
+            if self.marks[id] == traversal {
+                continue;
+            }
+            self.marks[id] = traversal;
+            affected.push(id);
+            if let Some(readers) = self.readers.get(&self.formula(id).name) {
+                stack.extend(readers);
+            }
+        }
+        self.recomputed = affected.len();
+
+        // A formula is ready once every affected formula it reads is recomputed
+        let mut level = Vec::new();
+        for &id in &affected {
+            let formula = self.formula(id);
+            let indegree = formula
+                .reads
+                .iter()
+                .filter(|read| self.index.get(read.as_str()).is_some_and(|&read| self.marks[read] == traversal))
+                .count();
+            self.indegrees[id] = indegree;
+            if indegree == 0 {
+                level.push(id);
+            }
+        }
+
+        while !level.is_empty() {
+            let results = self.evaluate_level(context, &level);
+            let mut next = Vec::new();
+            for (&id, result) in level.iter().zip(results) {
+                let formula = self.formulas[id].as_mut().expect("formula ids in the graph are defined");
+                formula.result = result;
+                unsafe {
+                    if result.error_code == SUCCESS {
+                        context_set_slot(context.context, formula.slot, result.result_value);
+                    } else {
+                        context_unset_slot(context.context, formula.slot);
+                    }
+                }
+                for &reader in self.readers.get(&formula.name).into_iter().flatten() {
+                    if self.marks[reader] == traversal {
+                        self.indegrees[reader] -= 1;
+                        if self.indegrees[reader] == 0 {
+                            next.push(reader);
+                        }
+                    }
+                }
+            }
+            level = next;
+        }
+    }
+
+    /// Evaluates formulas that do not read each other, on several threads if there are many.
+    fn evaluate_level(&self, context: &EvalContext, level: &[usize]) -> Vec<CCalculationResult> {
+        let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+        if threads == 1 || level.len() < PARALLEL_LEVEL {
+            return level.iter().map(|&id| self.evaluate(context, id)).collect();
+        }
+        let chunk_size = level.len().div_ceil(threads);
+        std::thread::scope(|scope| {
+            let handles: Vec<_> = level
+                .chunks(chunk_size)
+                .map(|chunk| {
+                    scope.spawn(move || chunk.iter().map(|&id| self.evaluate(context, id)).collect::<Vec<_>>())
+                })
+                .collect();
+            handles.into_iter().flat_map(|handle| handle.join().expect("formula evaluation panicked")).collect()
+        })
+    }
+
+    /// Evaluates a formula whose dependencies are up to date. A formula reading a failed formula fails
+    /// with the same error code, that of the first failed one in the order of `reads`.
+    fn evaluate(&self, context: &EvalContext, id: usize) -> CCalculationResult {
+        let formula = self.formula(id);
+        let failed = formula.reads.iter().find_map(|read| {
+            let &dependency = self.index.get(read)?;
+            let result = self.formula(dependency).result;
+            (result.error_code != SUCCESS).then_some(result)
+        });
+        failed.unwrap_or_else(|| context.evaluate(&formula.program))
+    }
+}
+
+/// Returns the context slot of a variable, creating it if needed.
+fn variable_slot(context: &mut EvalContext, name: &str) -> Result<usize, String> {
+    let c_name = std::ffi::CString::new(name).map_err(|_| "Failed to convert variable name to CString".to_string())?;
+    let mut slot = 0;
+    match unsafe { context_variable_slot(context.context, c_name.as_ptr(), &mut slot) } {
+        SUCCESS => Ok(slot),
+        error_code => Err(get_error_message(error_code).to_string()),
+    }
+}
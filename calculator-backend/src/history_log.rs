@@ -0,0 +1,512 @@
+//! ./src/history_log.rs
+//! A persistent, append-only log of calculations.
+//!
+//! The log is stored in two files: `path` holds a small header followed by fixed-width records, and
+//! `path.blob` holds the text of every input (and failure message) back to back. Both files are
+//! memory-mapped for reading, so looking up an entry decodes only that entry's record and text.
+//! Appended entries are buffered and written in groups, with one `fdatasync` per group.
+
+use std::collections::HashMap;
+use std::fmt;
+use std::fs::{File, OpenOptions};
+use std::io::Write;
+use std::ops::Range;
+use std::os::raw::c_int;
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::time::{SystemTime, UNIX_EPOCH};
+
+const MAGIC: &[u8; 8] = b"CALCLOG1";
+const HEADER_SIZE: usize = 16;
+const RECORD_SIZE: usize = 48;
+
+// Number of entries buffered before they are committed, unless changed with `set_group_size`
+const DEFAULT_GROUP_SIZE: usize = 64;
+
+// Values of `Record::status`
+const STATUS_VALUE: u32 = 0;
+const STATUS_ERROR: u32 = 1;
+const STATUS_FAILURE: u32 = 2;
+
+/// One fixed-width record of the log file, in little-endian byte order.
+///
+/// # Fields
+///
+/// * `timestamp_ms`: When the entry was appended, in milliseconds since the Unix epoch. Never decreases.
+/// * `value`: The result, `0.0` unless `status` is `STATUS_VALUE`.
+/// * `blob_offset`: Position of the input text in the blob file, followed by the failure message if any.
+/// * `input_hash`: FNV-1a hash of the input text.
+/// * `input_length`, `message_length`: Lengths of the input text and of the failure message.
+/// * `error_code`: The C library error code if `status` is `STATUS_ERROR`.
+/// * `status`: `STATUS_VALUE`, `STATUS_ERROR` or `STATUS_FAILURE`.
+#[derive(Debug, Clone, Copy)]
+struct Record {
+    timestamp_ms: u64,
+    value: f64,
+    blob_offset: u64,
+    input_hash: u64,
+    input_length: u32,
+    message_length: u32,
+    error_code: i32,
+    status: u32,
+}
+
+impl Record {
+    fn encode(&self, out: &mut Vec<u8>) {
+        out.extend_from_slice(&self.timestamp_ms.to_le_bytes());
+        out.extend_from_slice(&self.value.to_le_bytes());
+        out.extend_from_slice(&self.blob_offset.to_le_bytes());
+        out.extend_from_slice(&self.input_hash.to_le_bytes());
+        out.extend_from_slice(&self.input_length.to_le_bytes());
+        out.extend_from_slice(&self.message_length.to_le_bytes());
+        out.extend_from_slice(&self.error_code.to_le_bytes());
+        out.extend_from_slice(&self.status.to_le_bytes());
+    }
+
+    fn decode(bytes: &[u8]) -> Record {
+        let u64_at = |at: usize| u64::from_le_bytes(bytes[at..at + 8].try_into().unwrap());
+        let u32_at = |at: usize| u32::from_le_bytes(bytes[at..at + 4].try_into().unwrap());
+        Record {
+            timestamp_ms: u64_at(0),
+            value: f64::from_bits(u64_at(8)),
+            blob_offset: u64_at(16),
+            input_hash: u64_at(24),
+            input_length: u32_at(32),
+            message_length: u32_at(36),
+            error_code: u32_at(40) as i32,
+            status: u32_at(44),
+        }
+    }
+
+    /// Returns the end of this record's text in the blob file, or `None` if it overflows.
+    fn blob_end(&self) -> Option<u64> {
+        self.blob_offset.checked_add(self.input_length as u64 + self.message_length as u64)
+    }
+}
+
+/// A read-only memory mapping of the committed part of a file.
+struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mapping {
+    /// Maps the first `len` bytes of `file`. An empty mapping is represented without calling `mmap`.
+    fn new(file: &File, len: usize) -> Result<Mapping, String> {
+        if len == 0 {
+            return Ok(Mapping { ptr: std::ptr::null_mut(), len: 0 });
+        }
+        let ptr = unsafe {
+            libc::mmap(std::ptr::null_mut(), len, libc::PROT_READ, libc::MAP_SHARED, file.as_raw_fd(), 0)
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(format!("Failed to map history log: {}", std::io::Error::last_os_error()));
+        }
+        Ok(Mapping { ptr, len })
+    }
+
+    fn bytes(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+        unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe { libc::munmap(self.ptr, self.len) };
+        }
+    }
+}
+
+/// FNV-1a hash of an input string, the same function `calculator.c` uses for variable names.
+fn hash_input(input: &str) -> u64 {
+    input.bytes().fold(0xcbf29ce484222325, |hash, byte| (hash ^ byte as u64).wrapping_mul(0x100000001b3))
+}
+
+/// An entry read back from a `HistoryLog`.
+///
+/// # Fields
+///
+/// * `index`: The position of the entry in the log, starting at `0`.
+/// * `timestamp_ms`: When the entry was appended, in milliseconds since the Unix epoch.
+/// * `input`: The original mathematical expression provided by the user.
+/// * `result`: The calculated result, or `None` if there was an error.
+/// * `error_code`: The error code reported by the C library, or `None`.
+/// * `error_message`: The error message if the calculation failed, or `None` if there was no error.
+#[derive(Debug, Clone, PartialEq)]
+pub struct LoggedEntry<'a> {
+    pub index: u64,
+    pub timestamp_ms: u64,
+    pub input: &'a str,
+    pub result: Option<f64>,
+    pub error_code: Option<c_int>,
+    pub error_message: Option<&'a str>,
+}
+
+/// A persistent, append-only log of calculations with indexed lookups.
+///
+/// Entries are appended with `append` or `append_failure` and become durable when they are committed,
+/// either explicitly with `commit`, automatically once `group_size` entries are pending, or when the log
+/// is dropped. Queries see pending entries as well as committed ones.
+///
+/// Opening a log reads every record once, to check where its text is and build the lookup index, and checks
+/// that the text is valid UTF-8; queries never scan the files afterwards. A torn write at the end of either
+/// file, left by a crash during a commit, is discarded when the log is opened.
+///
+/// # Fields
+///
+/// * `path`: The path of the record file. The blob file is at the same path with `.blob` appended.
+/// * `records`, `blob`: The two files, opened for appending.
+/// * `records_map`, `blob_map`: Mappings of the committed part of each file.
+/// * `committed`: The number of committed records.
+/// * `blob_length`: The committed length of the blob file.
+/// * `pending_records`, `pending_blob`: Encoded entries that are not committed yet.
+/// * `by_input`: Maps the hash of an input to the indices of the entries with that hash.
+/// * `last_timestamp_ms`: The timestamp of the last entry, so timestamps never decrease.
+/// * `group_size`: The number of pending entries that triggers a commit.
+pub struct HistoryLog {
+    path: PathBuf,
+    records: File,
+    blob: File,
+    records_map: Mapping,
+    blob_map: Mapping,
+    committed: u64,
+    blob_length: u64,
+    pending_records: Vec<Record>,
+    pending_blob: Vec<u8>,
+    by_input: HashMap<u64, Vec<u64>>,
+    last_timestamp_ms: u64,
+    group_size: usize,
+}
+
+impl HistoryLog {
+    /// Opens the log at `path`, creating it if it does not exist.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if a file cannot be opened, read, repaired or mapped, if `path` is not
+    /// a history log, or if a record's text does not follow the previous one's or is not valid UTF-8.
+    pub fn open(path: impl AsRef<Path>) -> Result<HistoryLog, String> {
+        let path = path.as_ref().to_path_buf();
+        let mut blob_path = path.clone().into_os_string();
+        blob_path.push(".blob");
+
+        let open = |path: &Path| {
+            OpenOptions::new()
+                .read(true)
+                .append(true)
+                .create(true)
+                .open(path)
+                .map_err(|e| format!("Failed to open history log {}: {}", path.display(), e))
+        };
+        let mut records = open(&path)?;
+        let blob = open(Path::new(&blob_path))?;
+        let file_length = |file: &File| {
+            file.metadata()
+                .map(|metadata| metadata.len())
+                .map_err(|e| format!("Failed to read history log: {}", e))
+        };
+
+        // Write the header of a new log, or check the header of an existing one
+        let mut records_length = file_length(&records)?;
+        if records_length < HEADER_SIZE as u64 {
+            records.set_len(0).map_err(|e| format!("Failed to write history log: {}", e))?;
+            let mut header = Vec::with_capacity(HEADER_SIZE);
+            header.extend_from_slice(MAGIC);
+            header.extend_from_slice(&1u32.to_le_bytes());
+            header.extend_from_slice(&(RECORD_SIZE as u32).to_le_bytes());
+            records
+                .write_all(&header)
+                .and_then(|_| records.sync_data())
+                .map_err(|e| format!("Failed to write history log: {}", e))?;
+            records_length = HEADER_SIZE as u64;
+        }
+        let header = Mapping::new(&records, HEADER_SIZE)?;
+        if &header.bytes()[..8] != MAGIC
+            || u32::from_le_bytes(header.bytes()[12..16].try_into().unwrap()) != RECORD_SIZE as u32 {
+            return Err(format!("{} is not a history log", path.display()));
+        }
+        drop(header);
+
+        // Drop a partially written record, and records whose text was not completely written
+        let blob_length = file_length(&blob)?;
+        let mut committed = (records_length - HEADER_SIZE as u64) / RECORD_SIZE as u64;
+        let records_map = Mapping::new(&records, HEADER_SIZE + committed as usize * RECORD_SIZE)?;
+        let record_at = |index: u64| {
+            let start = HEADER_SIZE + index as usize * RECORD_SIZE;
+            Record::decode(&records_map.bytes()[start..start + RECORD_SIZE])
+        };
+        while committed > 0 && record_at(committed - 1).blob_end().is_none_or(|end| end > blob_length) {
+            committed -= 1;
+        }
+
+        // The text of every record directly follows the text of the previous one
+        let corrupt = || format!("Corrupt history log {}", path.display());
+        let mut blob_length = 0;
+        let mut by_input: HashMap<u64, Vec<u64>> = HashMap::new();
+        for index in 0..committed {
+            let record = record_at(index);
+            if record.blob_offset != blob_length {
+                return Err(corrupt());
+            }
+            blob_length = record.blob_end().ok_or_else(corrupt)?;
+            by_input.entry(record.input_hash).or_default().push(index);
+        }
+        let last_timestamp_ms = if committed > 0 { record_at(committed - 1).timestamp_ms } else { 0 };
+        drop(records_map);
+
+        let repair = |file: &File, length: u64, committed_length: u64| {
+            if length > committed_length {
+                file.set_len(committed_length).map_err(|e| format!("Failed to repair history log: {}", e))?;
+            }
+            Ok::<(), String>(())
+        };
+        repair(&records, records_length, HEADER_SIZE as u64 + committed * RECORD_SIZE as u64)?;
+        repair(&blob, file_length(&blob)?, blob_length)?;
+
+        let log = HistoryLog {
+            records_map: Mapping::new(&records, HEADER_SIZE + committed as usize * RECORD_SIZE)?,
+            blob_map: Mapping::new(&blob, blob_length as usize)?,
+            path,
+            records,
+            blob,
+            committed,
+            blob_length,
+            pending_records: Vec::new(),
+            pending_blob: Vec::new(),
+            by_input,
+            last_timestamp_ms,
+            group_size: DEFAULT_GROUP_SIZE,
+        };
+        if (0..committed).any(|index| log.texts(&log.record(index).unwrap()).is_none()) {
+            return Err(format!("Corrupt history log {}", log.path.display()));
+        }
+        Ok(log)
+    }
+
+    /// Sets the number of pending entries that triggers a commit. `1` commits every entry on its own.
+    pub fn set_group_size(&mut self, group_size: usize) {
+        self.group_size = group_size.max(1);
+    }
+
+    /// Appends the result of a calculation, or the error code returned by the C library.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if this append triggers a commit that fails.
+    pub fn append(&mut self, input: &str, result: Result<f64, c_int>) -> Result<(), String> {
+        match result {
+            Ok(value) => self.push(input, "", value, 0, STATUS_VALUE),
+            Err(error_code) => self.push(input, "", 0.0, error_code, STATUS_ERROR),
+        }
+    }
+
+    /// Appends an expression that could not be passed to the C library, with its error message.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if this append triggers a commit that fails.
+    pub fn append_failure(&mut self, input: &str, message: &str) -> Result<(), String> {
+        self.push(input, message, 0.0, 0, STATUS_FAILURE)
+    }
+
+    fn push(&mut self, input: &str, message: &str, value: f64, error_code: c_int, status: u32) -> Result<(), String> {
+        let now_ms = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |elapsed| elapsed.as_millis() as u64);
+        self.last_timestamp_ms = self.last_timestamp_ms.max(now_ms);
+
+        let record = Record {
+            timestamp_ms: self.last_timestamp_ms,
+            value,
+            blob_offset: self.blob_length + self.pending_blob.len() as u64,
+            input_hash: hash_input(input),
+            input_length: input.len() as u32,
+            message_length: message.len() as u32,
+            error_code,
+            status,
+        };
+        self.pending_blob.extend_from_slice(input.as_bytes());
+        self.pending_blob.extend_from_slice(message.as_bytes());
+        let index = self.len();
+        self.by_input.entry(record.input_hash).or_default().push(index);
+        self.pending_records.push(record);
+
+        if self.pending_records.len() >= self.group_size {
+            self.commit()?;
+        }
+        Ok(())
+    }
+
+    /// Writes every pending entry and waits until it is durable.
+    ///
+    /// The text is synced before the records that refer to it, so a crash never leaves a record
+    /// pointing past the end of the blob file.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if writing, syncing or remapping a file fails. If writing or syncing
+    /// fails, both files are truncated back to their committed length and the entries are kept pending,
+    /// so a later commit writes them again at the same offsets.
+    pub fn commit(&mut self) -> Result<(), String> {
+        if self.pending_records.is_empty() {
+            return Ok(());
+        }
+        let mut encoded = Vec::with_capacity(self.pending_records.len() * RECORD_SIZE);
+        for record in &self.pending_records {
+            record.encode(&mut encoded);
+        }
+
+        let written = self
+            .blob
+            .write_all(&self.pending_blob)
+            .and_then(|_| self.blob.sync_data())
+            .and_then(|_| self.records.write_all(&encoded))
+            .and_then(|_| self.records.sync_data());
+        if let Err(e) = written {
+            // The pending records refer to offsets past the committed text, drop whatever part was written
+            let records_length = HEADER_SIZE as u64 + self.committed * RECORD_SIZE as u64;
+            return Err(match self.blob.set_len(self.blob_length).and_then(|_| self.records.set_len(records_length)) {
+                Ok(()) => format!("Failed to commit history log: {}", e),
+                Err(repair) => format!("Failed to commit history log: {}, and to repair it: {}", e, repair),
+            });
+        }
+
+        self.committed += self.pending_records.len() as u64;
+        self.blob_length += self.pending_blob.len() as u64;
+        self.pending_records.clear();
+        self.pending_blob.clear();
+
+        self.records_map = Mapping::new(&self.records, HEADER_SIZE + self.committed as usize * RECORD_SIZE)?;
+        self.blob_map = Mapping::new(&self.blob, self.blob_length as usize)?;
+        Ok(())
+    }
+
+    /// Returns the path of the record file.
+    pub fn path(&self) -> &Path {
+        &self.path
+    }
+
+    /// Returns the number of entries, committed or not.
+    pub fn len(&self) -> u64 {
+        self.committed + self.pending_records.len() as u64
+    }
+
+    /// Returns `true` if the log has no entries.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the number of entries that are not committed yet.
+    pub fn pending(&self) -> usize {
+        self.pending_records.len()
+    }
+
+    /// Returns the entry at `index`, or `None` if there is no such entry.
+    pub fn get(&self, index: u64) -> Option<LoggedEntry<'_>> {
+        let record = self.record(index)?;
+        // Checked when the log was opened or the entry appended
+        let (input, message) = self.texts(&record)?;
+        let (result, error_code, error_message) = match record.status {
+            STATUS_VALUE => (Some(record.value), None, None),
+            STATUS_ERROR => (None, Some(record.error_code), Some(super::get_error_message(record.error_code))),
+            _ => (None, None, Some(message)),
+        };
+        Some(LoggedEntry {
+            index,
+            timestamp_ms: record.timestamp_ms,
+            input,
+            result,
+            error_code,
+            error_message,
+        })
+    }
+
+    /// Returns the entries whose index is in `range`, oldest first.
+    pub fn range(&self, range: Range<u64>) -> impl Iterator<Item = LoggedEntry<'_>> + '_ {
+        let end = range.end.min(self.len());
+        (range.start.min(end)..end).filter_map(move |index| self.get(index))
+    }
+
+    /// Returns the `count` most recent entries, oldest first.
+    pub fn last(&self, count: u64) -> impl Iterator<Item = LoggedEntry<'_>> + '_ {
+        self.range(self.len().saturating_sub(count)..self.len())
+    }
+
+    /// Returns the entries with exactly this input, oldest first.
+    pub fn matching<'a>(&'a self, input: &'a str) -> impl Iterator<Item = LoggedEntry<'a>> + 'a {
+        self.by_input
+            .get(&hash_input(input))
+            .into_iter()
+            .flatten()
+            .filter_map(move |&index| self.get(index))
+            .filter(move |entry| entry.input == input)
+    }
+
+    /// Returns the entries appended between `from_ms` (inclusive) and `to_ms` (exclusive), in milliseconds
+    /// since the Unix epoch, oldest first. Timestamps never decrease, so both ends are found by binary search.
+    pub fn between(&self, from_ms: u64, to_ms: u64) -> impl Iterator<Item = LoggedEntry<'_>> + '_ {
+        let first_at_or_after = |timestamp_ms: u64| {
+            let (mut low, mut high) = (0, self.len());
+            while low < high {
+                let middle = low + (high - low) / 2;
+                match self.record(middle) {
+                    Some(record) if record.timestamp_ms < timestamp_ms => low = middle + 1,
+                    _ => high = middle,
+                }
+            }
+            low
+        };
+        self.range(first_at_or_after(from_ms)..first_at_or_after(to_ms.max(from_ms)))
+    }
+
+    /// Returns the input text and failure message of a record, committed or pending, or `None` if they are
+    /// not within the text of the log or are not valid UTF-8.
+    fn texts(&self, record: &Record) -> Option<(&str, &str)> {
+        let text = |start: u64, length: u32| {
+            let bytes = if start < self.blob_length {
+                self.blob_map.bytes().get(start as usize..start.checked_add(length as u64)? as usize)?
+            } else {
+                let start = (start - self.blob_length) as usize;
+                &self.pending_blob[start..start + length as usize]
+            };
+            std::str::from_utf8(bytes).ok()
+        };
+        let input = text(record.blob_offset, record.input_length)?;
+        Some((input, text(record.blob_offset + record.input_length as u64, record.message_length)?))
+    }
+
+    /// Returns the record at `index`, committed or pending.
+    fn record(&self, index: u64) -> Option<Record> {
+        if index < self.committed {
+            let start = HEADER_SIZE + index as usize * RECORD_SIZE;
+            Some(Record::decode(&self.records_map.bytes()[start..start + RECORD_SIZE]))
+        } else {
+            self.pending_records.get((index - self.committed) as usize).copied()
+        }
+    }
+}
+
+impl Drop for HistoryLog {
+    fn drop(&mut self) {
+        // Errors cannot be reported from here, call `commit` before dropping the log to see them
+        let _ = self.commit();
+    }
+}
+
+impl fmt::Debug for HistoryLog {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("HistoryLog")
+            .field("path", &self.path)
+            .field("len", &self.len())
+            .field("pending", &self.pending())
+            .finish()
+    }
+}
+
+// The mappings are read-only and owned by the log, and every method that changes them takes `&mut self`.
+unsafe impl Send for HistoryLog {}
+unsafe impl Sync for HistoryLog {}
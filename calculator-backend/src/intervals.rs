@@ -0,0 +1,266 @@
+//! ./src/intervals.rs
+//! Interval evaluation: bounds of a compiled expression over ranges of its variables, in one pass.
+//!
+//! The C library's `evaluate_compiled_interval` runs the instructions of a compiled program on a stack of
+//! intervals instead of numbers. Each result holds the value every point of the ranges would get from
+//! `CompiledExpression::evaluate_columns`, so the minimum and maximum of a formula over a region take one
+//! evaluation rather than one per point of a grid. Operators that are not monotonic, such as `sin`, `^` or
+//! `/`, are bounded piece by piece, and a range that crosses the boundary of a domain, such as 0 for `ln`,
+//! reports that the points beyond it fail.
+//!
+//! Bounds are not always the tightest, see `IntervalResult`. `CompiledExpression::bounds` tightens them by
+//! splitting the ranges where the lowest and highest bounds are set, and evaluating every part.
+
+use std::ops::RangeInclusive;
+use std::os::raw::{c_double, c_int};
+
+use super::{get_error_message, CCompiledExpression, CompiledExpression, Precision, SUCCESS};
+
+// Results of `evaluate_compiled_interval`, matching `INTERVAL_*` in calculator.c
+const INTERVAL_SUCCEEDS: c_int = 0;
+const INTERVAL_MAY_FAIL: c_int = 1;
+
+/// Bounds of a program as returned by the C library (`IntervalResult` in calculator.c).
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+struct CIntervalResult {
+    low: c_double,
+    high: c_double,
+    error_code: c_int,
+    status: c_int,
+}
+
+// ## `evaluate_compiled_interval`
+// Bounds a compiled program over intervals of its variables, reading the lowest and highest value of each
+// variable slot from its own pair of doubles (null if unbound). Stores the bounds and returns `SUCCESS` or
+// `MEMORY_ERROR`.
+extern "C" {
+    fn evaluate_compiled_interval(
+        program: *const CCompiledExpression,
+        bounds: *const *const c_double,
+        precision: c_int,
+        result: *mut CIntervalResult,
+    ) -> c_int;
+}
+
+/// Whether the points of the variable ranges of an interval evaluation fail.
+///
+/// * `Succeeds`: No point fails.
+/// * `MayFail`: Some points may fail, for instance when a range crosses 0 and is divided by. The bounds
+///   hold for the points that do not. Also reported, without an error code, for bounds that cannot be
+///   known because a value is NaN, as with the constant `(-3) ^ pi`; they are then infinite.
+/// * `Fails`: Every point fails, and there are no bounds.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum IntervalStatus {
+    Succeeds,
+    MayFail,
+    Fails,
+}
+
+/// Bounds of a compiled expression over ranges of its variables.
+///
+/// Every point of the ranges that does not fail gets a value from `low` to `high` from
+/// `CompiledExpression::evaluate_columns`, in the same precision mode, except NaN values such as
+/// `inf - inf`. The bounds may be wider than the values actually reached: a variable used twice, as in
+/// `x - x`, is bounded as if each use could take a different value of its range.
+///
+/// # Fields
+///
+/// * `low`: The lowest value of the points that do not fail, `0.0` if every point fails.
+/// * `high`: The highest value of the points that do not fail, `0.0` if every point fails.
+/// * `error_code`: `0` if no point fails, otherwise the error code of the first instruction some points
+///   may fail at, see `get_error_message`.
+/// * `status`: Whether no point, some points or every point fails.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct IntervalResult {
+    pub low: f64,
+    pub high: f64,
+    pub error_code: c_int,
+    pub status: IntervalStatus,
+}
+
+impl IntervalResult {
+    /// Returns `true` if no point of the ranges fails.
+    pub fn succeeds(&self) -> bool {
+        self.status == IntervalStatus::Succeeds
+    }
+
+    /// Returns the distance between the bounds, `0.0` if every point fails.
+    pub fn width(&self) -> f64 {
+        self.high - self.low
+    }
+
+    /// Bounds the union of the points of two results, for ranges that together cover a region.
+    fn union(self, other: IntervalResult) -> IntervalResult {
+        let (low, high) = match (self.status, other.status) {
+            (IntervalStatus::Fails, _) => (other.low, other.high),
+            (_, IntervalStatus::Fails) => (self.low, self.high),
+            _ => (self.low.min(other.low), self.high.max(other.high)),
+        };
+        IntervalResult {
+            low,
+            high,
+            error_code: if self.error_code != SUCCESS { self.error_code } else { other.error_code },
+            status: if self.status == other.status { self.status } else { IntervalStatus::MayFail },
+        }
+    }
+}
+
+/// One part of the ranges of `CompiledExpression::bounds`, with its bounds.
+struct Region {
+    ranges: Vec<Option<[f64; 2]>>,
+    result: IntervalResult,
+}
+
+impl CompiledExpression {
+    /// Bounds the program over ranges of its variables, with a single evaluation.
+    ///
+    /// # Arguments
+    ///
+    /// * `bindings`: Pairs of a variable name (lowercase, as produced by the tokenizer) and the range of its
+    ///   values. Names the program does not use are ignored, and variables without a range fail with
+    ///   `UNDEFINED_VARIABLE`. A range of a single value, such as `2.0..=2.0`, binds the variable to it.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if a range is empty or has a NaN bound, or the C library fails to allocate
+    /// its working stack.
+    pub fn evaluate_interval(&self, bindings: &[(&str, RangeInclusive<f64>)]) -> Result<IntervalResult, String> {
+        self.evaluate_interval_with_precision(bindings, Precision::Rounded)
+    }
+
+    /// Same as `evaluate_interval`, in the given precision mode.
+    ///
+    /// # Errors
+    ///
+    /// See `evaluate_interval`.
+    pub fn evaluate_interval_with_precision(
+        &self,
+        bindings: &[(&str, RangeInclusive<f64>)],
+        precision: Precision,
+    ) -> Result<IntervalResult, String> {
+        self.interval(&self.interval_ranges(bindings)?, precision)
+    }
+
+    /// Bounds the program over ranges of its variables, tighter than `evaluate_interval`.
+    ///
+    /// The ranges are split in halves, one variable at a time, where the lowest and highest bounds are set, until
+    /// there are `max_regions` parts or those parts cannot be split any further. Each part is evaluated on its own and the result
+    /// bounds their union, so the bounds only get tighter as `max_regions` grows, and parts where every point
+    /// fails, such as the negative half of `sqrt(x)`, do not widen them.
+    ///
+    /// # Arguments
+    ///
+    /// * `bindings`: See `evaluate_interval`.
+    /// * `max_regions`: The number of parts to evaluate at most; `1` is the same as `evaluate_interval`.
+    ///
+    /// # Errors
+    ///
+    /// See `evaluate_interval`.
+    pub fn bounds(&self, bindings: &[(&str, RangeInclusive<f64>)], max_regions: usize) -> Result<IntervalResult, String> {
+        self.bounds_with_precision(bindings, max_regions, Precision::Rounded)
+    }
+
+    /// Same as `bounds`, in the given precision mode.
+    ///
+    /// # Errors
+    ///
+    /// See `evaluate_interval`.
+    pub fn bounds_with_precision(
+        &self,
+        bindings: &[(&str, RangeInclusive<f64>)],
+        max_regions: usize,
+        precision: Precision,
+    ) -> Result<IntervalResult, String> {
+        let ranges = self.interval_ranges(bindings)?;
+        let result = self.interval(&ranges, precision)?;
+        // Kept in the order of their ranges, so the first error code is that of the lowest values
+        let mut regions = vec![Region { ranges: ranges.clone(), result }];
+
+        // Alternately the parts that set the lowest and the highest bound of the union, until neither can be split
+        let mut settled = [false, false];
+        let mut side = 0;
+        while regions.len() < max_regions && settled != [true, true] {
+            if settled[side] {
+                side = 1 - side;
+            }
+            let bound = |region: &Region| if side == 0 { -region.result.low } else { region.result.high };
+            let split = regions
+                .iter()
+                .enumerate()
+                .filter(|(_, region)| region.result.status != IntervalStatus::Fails)
+                .max_by(|(a, first), (b, second)| bound(first).total_cmp(&bound(second)).then(b.cmp(a)))
+                .filter(|(_, region)| region.result.width() > 0.0)
+                .and_then(|(i, region)| Some((i, split_slot(&region.ranges, &ranges)?)));
+            let Some((i, slot)) = split else {
+                settled[side] = true;
+                continue;
+            };
+            side = 1 - side;
+
+            let [low, high] = regions[i].ranges[slot].unwrap();
+            let middle = low / 2.0 + high / 2.0;
+            let mut upper = regions[i].ranges.clone();
+            upper[slot] = Some([middle, high]);
+            regions[i].ranges[slot] = Some([low, middle]);
+            regions[i].result = self.interval(&regions[i].ranges, precision)?;
+            let result = self.interval(&upper, precision)?;
+            regions.insert(i + 1, Region { ranges: upper, result });
+        }
+
+        Ok(regions.into_iter().map(|region| region.result).reduce(IntervalResult::union).unwrap())
+    }
+
+    /// Resolves the ranges of `bindings` to the variable slots of the program, `None` for unbound variables.
+    fn interval_ranges(&self, bindings: &[(&str, RangeInclusive<f64>)]) -> Result<Vec<Option<[f64; 2]>>, String> {
+        if let Some((name, _)) = bindings.iter().find(|(_, range)| range.is_empty()) {
+            return Err(format!("Invalid range for {}", name));
+        }
+        Ok(self
+            .variable_names()
+            .iter()
+            .map(|name| {
+                bindings
+                    .iter()
+                    .find(|(bound, _)| bound == name)
+                    .map(|(_, range)| [*range.start(), *range.end()])
+            })
+            .collect())
+    }
+
+    /// Evaluates the program over ranges resolved by `interval_ranges`.
+    fn interval(&self, ranges: &[Option<[f64; 2]>], precision: Precision) -> Result<IntervalResult, String> {
+        let bounds: Vec<*const c_double> =
+            ranges.iter().map(|range| range.as_ref().map_or(std::ptr::null(), |range| range.as_ptr())).collect();
+        let mut result = CIntervalResult { low: 0.0, high: 0.0, error_code: SUCCESS, status: INTERVAL_SUCCEEDS };
+        let error_code = unsafe { evaluate_compiled_interval(self.program, bounds.as_ptr(), precision as c_int, &mut result) };
+        if error_code != SUCCESS {
+            return Err(get_error_message(error_code).to_string());
+        }
+        let status = match result.status {
+            INTERVAL_SUCCEEDS => IntervalStatus::Succeeds,
+            INTERVAL_MAY_FAIL => IntervalStatus::MayFail,
+            _ => IntervalStatus::Fails,
+        };
+        Ok(IntervalResult { low: result.low, high: result.high, error_code: result.error_code, status })
+    }
+}
+
+/// Returns the variable slot to split a part of `CompiledExpression::bounds` at: the one whose range is the
+/// widest relative to its range in the whole region, or `None` if no range can be halved any further.
+fn split_slot(ranges: &[Option<[f64; 2]>], whole: &[Option<[f64; 2]>]) -> Option<usize> {
+    // Half the width, which is finite for finite bounds
+    let half_width = |range: Option<[f64; 2]>| range.map_or(0.0, |[low, high]| high / 2.0 - low / 2.0);
+    ranges
+        .iter()
+        .enumerate()
+        .filter_map(|(slot, range)| {
+            let [low, high] = (*range)?;
+            let middle = low / 2.0 + high / 2.0;
+            // Infinite ranges, and ranges of adjacent doubles, have no middle to split at
+            (middle.is_finite() && low < middle && middle < high)
+                .then(|| (slot, half_width(*range) / half_width(whole[slot])))
+        })
+        .max_by(|(_, a), (_, b)| a.total_cmp(b))
+        .map(|(slot, _)| slot)
+}
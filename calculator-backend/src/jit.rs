@@ -0,0 +1,206 @@
+//! ./src/jit.rs
+//! The native tier of compiled expressions.
+//!
+//! With the `jit` cargo feature, a `CompiledExpression` counts its evaluations, and once it has been
+//! evaluated `jit_threshold()` times the C library's `jit_compile` lowers it to x86-64 machine code. Later
+//! evaluations call that code directly. It runs the same instructions with the same helpers as the
+//! interpreter, so values and error codes do not change. Programs that cannot be compiled, and every
+//! program on other targets or without the feature, stay in the interpreter.
+
+use std::os::raw::{c_double, c_int};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::OnceLock;
+
+use super::metrics::{self, Stage};
+use super::{CCalculationResult, CCompiledExpression, CEvalContext, Precision};
+
+/// Opaque handle to native code generated by the C library.
+#[repr(C)]
+pub struct CJitProgram {
+    _private: [u8; 0],
+}
+
+// Native code of a program: reads one value per variable slot, writes the result, returns the error code
+type JitEntry = unsafe extern "C" fn(variables: *const c_double, value: *mut c_double) -> c_int;
+
+// ## `jit_compile` / `jit_entry` / `jit_free`
+// Generate native code for a compiled program in one precision mode (a null pointer if the program, the
+// precision or the platform is not supported), return its entry point, and release it.
+//
+// ## `compiled_context_values`
+// Fills one value per variable slot of a program compiled in a context. Returns `SUCCESS`,
+// `UNDEFINED_VARIABLE` if a variable was never assigned, or `MEMORY_ERROR` for another context.
+//
+// ## `compiled_in_context`
+// Whether a program was compiled in a context, comparing its generation so that a new context allocated
+// at the address of a freed one is told apart.
+extern "C" {
+    fn jit_compile(program: *const CCompiledExpression, precision: c_int) -> *mut CJitProgram;
+    fn jit_entry(jit: *const CJitProgram) -> Option<JitEntry>;
+    fn jit_free(jit: *mut CJitProgram);
+    pub(crate) fn compiled_context_values(
+        context: *const CEvalContext,
+        program: *const CCompiledExpression,
+        values: *mut c_double,
+    ) -> c_int;
+    pub(crate) fn compiled_in_context(context: *const CEvalContext, program: *const CCompiledExpression) -> bool;
+}
+
+/// The number of interpreted evaluations after which a program is compiled to native code by default.
+pub const DEFAULT_JIT_THRESHOLD: u64 = 1000;
+
+static JIT_THRESHOLD: AtomicU64 = AtomicU64::new(DEFAULT_JIT_THRESHOLD);
+
+/// Sets after how many interpreted evaluations a compiled expression is compiled to native code.
+///
+/// Only has an effect with the `jit` cargo feature. Programs already promoted stay native.
+///
+/// # Arguments
+///
+/// * `calls`: The number of evaluations, in any precision mode, before promotion. `0` promotes on the first
+///   evaluation, `u64::MAX` never promotes.
+pub fn set_jit_threshold(calls: u64) {
+    JIT_THRESHOLD.store(calls, Ordering::Relaxed);
+}
+
+/// Returns the current promotion threshold, see `set_jit_threshold`.
+pub fn jit_threshold() -> u64 {
+    JIT_THRESHOLD.load(Ordering::Relaxed)
+}
+
+/// Native code of a compiled expression in one precision mode, see `CompiledExpression::jit`.
+///
+/// # Fields
+///
+/// * `jit`: The code owned by this value.
+/// * `entry`: Its entry point.
+/// * `variable_count`: The number of variable slots of the program.
+pub struct JitFunction {
+    jit: *mut CJitProgram,
+    entry: JitEntry,
+    variable_count: usize,
+}
+
+impl JitFunction {
+    /// Generates native code for `program`, or returns `None` if the C library cannot.
+    pub(crate) fn compile(
+        program: *const CCompiledExpression,
+        precision: Precision,
+        variable_count: usize,
+    ) -> Option<JitFunction> {
+        let jit = unsafe { jit_compile(program, precision as c_int) };
+        if jit.is_null() {
+            return None;
+        }
+        let entry = unsafe { jit_entry(jit) }?;
+        Some(JitFunction { jit, entry, variable_count })
+    }
+
+    /// Returns the number of variable values `call` reads.
+    pub fn variable_count(&self) -> usize {
+        self.variable_count
+    }
+
+    /// Runs the native code.
+    ///
+    /// # Arguments
+    ///
+    /// * `variables`: The value of each variable slot, in the order of `CompiledExpression::variable_names`.
+    ///
+    /// # Returns
+    ///
+    /// The value (`0.0` on failure) and the error code (`0` on success). For a program compiled in an
+    /// `EvalContext`, they are what `EvalContext::evaluate` returns with these variable values. For other
+    /// programs they are what `evaluate_columns` returns for a row of these values, and without variables
+    /// what `evaluate` returns.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `variables` holds fewer than `variable_count()` values.
+    pub fn call(&self, variables: &[f64]) -> (f64, c_int) {
+        assert!(
+            variables.len() >= self.variable_count,
+            "Expected {} variable values, got {}",
+            self.variable_count,
+            variables.len()
+        );
+        let mut value = 0.0;
+        let error_code = metrics::timed(Stage::Native, || unsafe { (self.entry)(variables.as_ptr(), &mut value) });
+        metrics::count_native(error_code);
+        (value, error_code)
+    }
+
+    /// Same as `call`, as a `CCalculationResult`.
+    #[inline]
+    pub(crate) fn evaluate(&self, variables: &[f64]) -> CCalculationResult {
+        let (result_value, error_code) = self.call(variables);
+        CCalculationResult { result_value, error_code }
+    }
+}
+
+impl Drop for JitFunction {
+    fn drop(&mut self) {
+        unsafe { jit_free(self.jit) }
+    }
+}
+
+// The code is read-only once generated and keeps no state between calls
+unsafe impl Send for JitFunction {}
+unsafe impl Sync for JitFunction {}
+
+/// The evaluation count and native code of one compiled expression.
+///
+/// # Fields
+///
+/// * `calls`: The number of evaluations counted towards promotion.
+/// * `functions`: The native code of each precision mode, `None` inside if it could not be generated.
+pub(crate) struct JitTier {
+    calls: AtomicU64,
+    functions: [OnceLock<Option<JitFunction>>; 3],
+}
+
+impl JitTier {
+    pub(crate) fn new() -> Self {
+        JitTier { calls: AtomicU64::new(0), functions: [OnceLock::new(), OnceLock::new(), OnceLock::new()] }
+    }
+
+    /// Counts an evaluation and returns the native code to run it with, once the program is promoted.
+    ///
+    /// Without the `jit` feature this always returns `None` and counts nothing.
+    #[inline]
+    pub(crate) fn promoted(
+        &self,
+        program: *const CCompiledExpression,
+        precision: Precision,
+        variable_count: usize,
+    ) -> Option<&JitFunction> {
+        if !cfg!(feature = "jit") {
+            return None;
+        }
+        let function = &self.functions[precision as usize];
+        if let Some(function) = function.get() {
+            return function.as_ref();
+        }
+        if self.calls.fetch_add(1, Ordering::Relaxed) < jit_threshold() {
+            return None;
+        }
+        self.function(program, precision, variable_count)
+    }
+
+    /// Returns the native code of `program` in `precision`, generating it if needed.
+    pub(crate) fn function(
+        &self,
+        program: *const CCompiledExpression,
+        precision: Precision,
+        variable_count: usize,
+    ) -> Option<&JitFunction> {
+        self.functions[precision as usize]
+            .get_or_init(|| JitFunction::compile(program, precision, variable_count))
+            .as_ref()
+    }
+
+    /// Returns whether native code was generated for `precision`.
+    pub(crate) fn is_promoted(&self, precision: Precision) -> bool {
+        matches!(self.functions[precision as usize].get(), Some(Some(_)))
+    }
+}
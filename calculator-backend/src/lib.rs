@@ -1,11 +1,41 @@
-///./src/lib.rs 
-/// This file contains the main logic for a calculator library that supports Reverse Polish Notation (RPN) and infix expressions.
-/// It includes functions for tokenization, conversion between infix and RPN, and evaluation of expressions.
-/// The library is designed to be used with a C library for evaluation, and it provides a C-compatible interface for integration.
+//! ./src/lib.rs
+//! This file contains the main logic for a calculator library that supports Reverse Polish Notation (RPN) and infix expressions.
+//! It includes functions for tokenization, conversion between infix and RPN, and evaluation of expressions.
+//! The library is designed to be used with a C library for evaluation, and it provides a C-compatible interface for integration.
 
 //use serde::{Serialize, Deserialize};
+use std::collections::{HashSet, VecDeque};
 use std::ffi::{CString, CStr, c_char};
+use std::fmt::Write;
 use std::os::raw::{c_double, c_int};
+use std::sync::Arc;
+use std::sync::atomic::{AtomicI32, Ordering};
+
+mod batch;
+pub use batch::CompiledBatch;
+mod cache;
+pub use cache::ExpressionCache;
+mod formulas;
+use formulas::Formulas;
+#[cfg(unix)]
+mod history_log;
+mod intervals;
+pub use intervals::{IntervalResult, IntervalStatus};
+mod jit;
+mod metrics;
+pub use metrics::{metrics_snapshot, reset_metrics, CountingAllocator, PipelineMetrics, Stage, StageMetrics, STAGES};
+pub use jit::{jit_threshold, set_jit_threshold, JitFunction, DEFAULT_JIT_THRESHOLD};
+use jit::{compiled_context_values, compiled_in_context, JitTier};
+mod operators;
+use operators::{lookup_operator, OPERATOR_SPECS};
+mod preview;
+pub use preview::{LivePreview, Preview, PreviewWorker};
+mod programs;
+pub use programs::{ProgramLibrary, ProgramLibraryBuilder};
+#[cfg(feature = "server")]
+pub mod server;
+#[cfg(unix)]
+pub use history_log::{HistoryLog, LoggedEntry};
 
 // Error codes matching C
 const SUCCESS: c_int = 0;
@@ -23,6 +53,128 @@ const LN_ERROR: c_int = 11;
 const TAN_INVALID_OPERATOR: c_int = 12;
 const INVALID_TRIG_OPERATOR: c_int = 13;
 
+/// Verbosity of the diagnostic tracing shared by the C library and the Rust wrapper.
+///
+/// Tracing is only compiled in with the `trace` cargo feature. Without it every level
+/// behaves like `Off` and trace statements cost nothing.
+///
+/// * `Off`: No output (the default).
+/// * `Error`: Reasons why an evaluation or conversion failed.
+/// * `Info`: FFI calls and their results.
+/// * `Debug`: Every token, stack push and intermediate result.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum TraceLevel {
+    Off = 0,
+    Error = 1,
+    Info = 2,
+    Debug = 3,
+}
+
+static TRACE_LEVEL: AtomicI32 = AtomicI32::new(TraceLevel::Off as i32);
+
+/// Sets the trace level of both the Rust wrapper and the C library.
+///
+/// # Arguments
+///
+/// * `level`: The most verbose `TraceLevel` that is written to stderr.
+pub fn set_trace_level(level: TraceLevel) {
+    TRACE_LEVEL.store(level as i32, Ordering::Relaxed);
+    unsafe { c_set_trace_level(level as c_int) }
+}
+
+/// Returns the current trace level.
+pub fn trace_level() -> TraceLevel {
+    match TRACE_LEVEL.load(Ordering::Relaxed) {
+        1 => TraceLevel::Error,
+        2 => TraceLevel::Info,
+        3 => TraceLevel::Debug,
+        _ => TraceLevel::Off,
+    }
+}
+
+/// Writes a message to stderr if tracing is compiled in and `$level` is enabled.
+///
+/// `cfg!` folds to `false` without the `trace` feature, so the whole statement,
+/// including the formatting of its arguments, is removed by the compiler.
+macro_rules! trace {
+    ($level:expr, $($arg:tt)*) => {
+        if cfg!(feature = "trace") && $level <= trace_level() {
+            eprintln!($($arg)*);
+        }
+    };
+}
+
+/// How the C library rounds the results of an evaluation (`PRECISION_*` in calculator.c).
+///
+/// Every mode evaluates the same compiled program; folded constants keep both their rounded and
+/// unrounded values.
+///
+/// * `Rounded`: Every operation is rounded to 9 decimals, as if typed into a calculator (the default).
+/// * `Raw`: Plain IEEE 754 double arithmetic, without any rounding.
+/// * `RoundResult`: Raw arithmetic with only the final result rounded to 9 decimals.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum Precision {
+    #[default]
+    Rounded = 0,
+    Raw = 1,
+    RoundResult = 2,
+}
+
+/// The instruction set of the kernels that evaluate columns and batches (`VECTOR_ISA_*` in calculator.c).
+///
+/// The kernels round to 9 decimals, take square roots, and check the domains of `log`, `ln`, `arcsin` and
+/// `arccos` over several rows at once, each row getting its own error code. Every instruction set gives the
+/// same values and error codes, bit for bit; the widest one the CPU runs is chosen on first use.
+///
+/// * `Scalar`: One row at a time, on every target.
+/// * `Sse2`: Two rows at a time, on every x86-64 CPU.
+/// * `Avx2`: Four rows at a time, on x86-64 CPUs with AVX2.
+/// * `Avx512`: Eight rows at a time, on x86-64 CPUs with AVX-512F.
+/// * `Neon`: Two rows at a time, on every AArch64 CPU.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum VectorIsa {
+    Scalar = 0,
+    Sse2 = 1,
+    Avx2 = 2,
+    Avx512 = 3,
+    Neon = 4,
+}
+
+/// Every `VectorIsa`, from the narrowest.
+pub const VECTOR_ISAS: [VectorIsa; 5] = [VectorIsa::Scalar, VectorIsa::Sse2, VectorIsa::Avx2, VectorIsa::Avx512, VectorIsa::Neon];
+
+impl VectorIsa {
+    /// Returns `true` if this build has the kernels and the CPU runs them.
+    pub fn is_supported(self) -> bool {
+        unsafe { vector_isa_supported(self as c_int) != 0 }
+    }
+}
+
+/// Returns the instruction set the columnar evaluators use.
+pub fn vector_isa() -> VectorIsa {
+    let isa = unsafe { get_vector_isa() };
+    VECTOR_ISAS.into_iter().find(|candidate| *candidate as c_int == isa).unwrap_or(VectorIsa::Scalar)
+}
+
+/// Chooses the instruction set of the columnar evaluators, for every thread.
+///
+/// # Arguments
+///
+/// * `isa`: The instruction set, which only changes the speed of evaluations.
+///
+/// # Errors
+///
+/// Returns an `Err(String)` if `isa.is_supported()` is `false`.
+pub fn set_vector_isa(isa: VectorIsa) -> Result<(), String> {
+    match unsafe { c_set_vector_isa(isa as c_int) } {
+        SUCCESS => Ok(()),
+        _ => Err(format!("{:?} kernels are not supported on this CPU", isa)),
+    }
+}
+
 /// Stores the result of the calculation
 /// S
 /// # Fields
@@ -32,7 +184,7 @@ const INVALID_TRIG_OPERATOR: c_int = 13;
 ///     * `0` represents success.
 ///     * Other values indicate specific errors.
 #[repr(C)]
-#[derive(Debug)]
+#[derive(Debug, Clone, Copy)]
 pub struct CCalculationResult {
     pub result_value: c_double,
     pub error_code: c_int,
@@ -59,8 +211,8 @@ pub struct CCalculationResult {
 /// * `3` (`STACK_UNDERFLOW`): "Stack underflow - invalid expression"
 /// * `4` (`MEMORY_ERROR`): "Memory error"
 /// * `5` (`UNDEFINED_VARIABLE`): "Undefined variable in expression"
-/// * `6` (`STACK_MAXIMUM`): "Stack maximum exceeded"
-/// * `7` (`EXPR_LENGHT_MAXIMUM`): "Expression length maximum exceeded"
+/// * `6` (`STACK_MAXIMUM`): "Stack maximum exceeded", no longer returned since the stack grows as needed
+/// * `7` (`EXPR_LENGHT_MAXIMUM`): "Expression length maximum exceeded", no longer returned either
 /// * `8` (`FACTORIAL_ERROR`): "Factorial error"
 /// * `9` (`SQUARE_ROOT_ERROR`): "Square root error"
 /// * `10` (`LOG_ERROR`): "Log error"
@@ -86,18 +238,101 @@ pub struct CReversePolishExpression {
     pub length: usize,
 }
 
-/// Represents the result of converting an infix expression to Reverse Polish Notation (RPN) in a C-compatible format.
+// Opcodes of `TypedToken` in calculator.c, followed by one opcode per `Operator`
+const OP_PUSH_NUMBER: c_int = 0;
+const OP_PUSH_VARIABLE: c_int = 1;
+const OP_ADD: c_int = 2;
+
+/// One token of an RPN expression, classified on the Rust side so the C library parses no text
+/// (`TypedToken` in calculator.c).
 /// 
 /// # Fields
 /// 
-/// * `result_expression`: A fixed-size array of C-style characters (`c_char`) representing the converted RPN expression.
-/// * `error_code`: An integer error code (`c_int`) indicating the success or failure of the conversion.
-///     * `0` represents success.
-///     * Other values indicate specific errors.
+/// * `opcode`: Pushes a number, pushes a variable, or applies an operator (see `Operator::opcode`).
+/// * `operand`: The literal pushed as a number, or the slot of the variable in the names of the expression.
 #[repr(C)]
-pub struct CConversionResult {
-    result_expression: [c_char; 1000],  // MAX_EXPR_LENGTH from C
-    error_code: c_int,
+#[derive(Clone, Copy)]
+pub struct CToken {
+    opcode: c_int,
+    operand: CTokenOperand,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+union CTokenOperand {
+    number: c_double,
+    slot: usize,
+}
+
+impl CToken {
+    /// Returns a token pushing a literal.
+    pub fn number(value: f64) -> Self {
+        CToken { opcode: OP_PUSH_NUMBER, operand: CTokenOperand { number: value } }
+    }
+
+    /// Returns a token pushing the variable at `slot` in the names of the expression.
+    pub fn variable(slot: usize) -> Self {
+        CToken { opcode: OP_PUSH_VARIABLE, operand: CTokenOperand { slot } }
+    }
+
+    /// Returns a token applying an operator.
+    pub fn operator(op: Operator) -> Self {
+        CToken { opcode: op.opcode(), operand: CTokenOperand { slot: 0 } }
+    }
+
+    /// Returns the literal of a number token, or `None`.
+    pub fn as_number(&self) -> Option<f64> {
+        if self.opcode == OP_PUSH_NUMBER { Some(unsafe { self.operand.number }) } else { None }
+    }
+
+    /// Returns the slot of a variable token, or `None`.
+    pub fn as_variable(&self) -> Option<usize> {
+        if self.opcode == OP_PUSH_VARIABLE { Some(unsafe { self.operand.slot }) } else { None }
+    }
+
+    /// Returns the operator of an operator token, or `None`.
+    pub fn as_operator(&self) -> Option<Operator> {
+        OPERATORS.get(usize::try_from(self.opcode - OP_ADD).ok()?).copied()
+    }
+}
+
+impl std::fmt::Debug for CToken {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match (self.as_number(), self.as_variable(), self.as_operator()) {
+            (Some(value), _, _) => write!(f, "Number({})", value),
+            (_, Some(slot), _) => write!(f, "Variable({})", slot),
+            (_, _, Some(op)) => write!(f, "Operator({:?})", op),
+            _ => write!(f, "Invalid({})", self.opcode),
+        }
+    }
+}
+
+impl PartialEq for CToken {
+    fn eq(&self, other: &Self) -> bool {
+        self.opcode == other.opcode
+            && match self.opcode {
+                OP_PUSH_NUMBER => self.as_number().map(f64::to_bits) == other.as_number().map(f64::to_bits),
+                OP_PUSH_VARIABLE => self.as_variable() == other.as_variable(),
+                _ => true,
+            }
+    }
+}
+
+/// An RPN expression of typed tokens as the C library reads it (`TypedExpression` in calculator.c).
+/// 
+/// # Fields
+/// 
+/// * `tokens`: A pointer to `length` tokens.
+/// * `length`: The number of tokens.
+/// * `variable_names`: A pointer to `variable_count` null-terminated names, indexed by variable slot.
+/// * `variable_count`: The number of names.
+#[repr(C)]
+#[derive(Debug)]
+pub struct CTypedExpression {
+    pub tokens: *const CToken,
+    pub length: usize,
+    pub variable_names: *const *const c_char,
+    pub variable_count: usize,
 }
 
 // Externally defined C functions for Reverse Polish Notation (RPN) calculations and conversions.
@@ -119,18 +354,83 @@ pub struct CConversionResult {
 //     * `0` (`SUCCESS`) indicates success.
 //     * Other values indicate specific errors (e.g., `DIVISION_BY_ZERO`, `INVALID_OPERATOR`).
 // 
-// ## `convert_rpn_to_infix`
-// Converts a Reverse Polish Notation (RPN) expression to an infix expression.
+// ## `convert_rpn_to_infix_into`
+// Converts a Reverse Polish Notation (RPN) expression to an infix expression of any length.
 // 
 // ### Arguments
 // * `expr`: A pointer to a `CReversePolishExpression` struct, which contains the RPN expression to be converted.
+// * `buffer`, `capacity`: A caller-owned buffer receiving the null-terminated infix expression. It is left
+//     untouched if `capacity` is not larger than the expression.
+// * `length`: Receives the length of the infix expression, without the null terminator.
 // 
 // ### Returns
-// A `CConversionResult` struct containing:
-// * `result_expression`: A fixed-size array of `c_char` representing the converted infix expression.
-// * `error_code`: An integer (`c_int`) indicating the success or failure of the conversion.
-//     * `0` (`SUCCESS`) indicates success.
-//     * Other values indicate specific errors.
+// An error code (`c_int`): `SUCCESS`, `MEMORY_ERROR` or `STACK_UNDERFLOW`.
+// 
+// ## `calculate_rpn_typed`
+// Same as `calculate_rpn`, for an expression of `CToken`s: literals arrive as doubles and operators as
+// opcodes, so the C library compares and parses no text.
+// 
+// ## `convert_rpn_to_infix_typed`
+// Same as `convert_rpn_to_infix_into`, for an expression of `CToken`s. Literals are written with the
+// shortest text that reads back as the same double.
+// 
+// ## `compile_rpn`
+// Compiles a Reverse Polish Notation (RPN) expression into an opcode array with parsed literals.
+// 
+// ### Arguments
+// * `expr`: A pointer to a `CReversePolishExpression` struct, which contains the RPN expression to be compiled.
+// 
+// ### Returns
+// A pointer to a `CCompiledExpression` owned by the caller, or a null pointer if memory allocation failed.
+// 
+// ## `evaluate_compiled`
+// Evaluates a program returned by `compile_rpn`. Returns the same `CCalculationResult` as `calculate_rpn`
+// would for the original expression.
+// 
+// ## `free_compiled`
+// Releases a program returned by `compile_rpn`.
+// 
+// ## `calculate_rpn_in_context`
+// Same as `calculate_rpn`, but variables are looked up in the given context instead of the defaults.
+// 
+// ## `context_create` / `context_free`
+// Create an evaluation context holding `pi` and `e`, and release it.
+// 
+// ## `context_set_variable` / `context_get_variable`
+// Assign a variable of a context, or read it back (`UNDEFINED_VARIABLE` if it was never assigned).
+//
+// ## `context_variable_slot` / `context_set_slot` / `context_unset_slot`
+// Return the slot of a variable, creating it undefined if needed, and assign it or make it undefined again
+// through that slot without looking up its name.
+//
+// ## `compile_rpn_in_context` / `evaluate_compiled_in_context`
+// Compile an RPN expression with every identifier resolved to its context slot, and evaluate it by reading
+// those slots directly.
+// 
+// ## `compiled_length`
+// Returns the number of instructions of a compiled program, after constant folding.
+// 
+// ## `compiled_variable_count` / `compiled_variable_name`
+// Return the number of free variable slots of a compiled program and the name bound to each slot.
+// 
+// ## `evaluate_compiled_columns`
+// Evaluates a compiled program once per row, reading each variable slot from its own column of
+// `row_count` doubles. Writes one value and one error code per row and returns `SUCCESS` or `MEMORY_ERROR`.
+// 
+// ## `calculate_rpn_batch`
+// Evaluates many RPN expressions in one call. `tokens` holds every token followed by a null byte,
+// `token_offsets` the byte offset of each token, and `expression_offsets` (`expression_count + 1` entries)
+// the range of tokens that belongs to each expression. One `CCalculationResult` per expression is written
+// to the caller-allocated `results` array.
+// 
+// ## `*_with_precision`, `context_set_precision` / `context_get_precision`
+// Same as the functions above in a given `Precision` mode, passed as its `c_int` value. The precision of a
+// context applies to `calculate_rpn_in_context` and `evaluate_compiled_in_context`, and an invalid mode
+// fails with `MEMORY_ERROR`.
+// 
+// ## `get_vector_isa` / `set_vector_isa` / `vector_isa_supported`
+// Return and choose the `VectorIsa` of the columnar evaluators, passed as its `c_int` value. Choosing one
+// that is not built in or that the CPU does not run fails with `MEMORY_ERROR`.
 // 
 // # Safety
 // 
@@ -138,107 +438,798 @@ pub struct CConversionResult {
 // Ensure that the pointers passed to these functions are valid and properly aligned.
 extern "C" {
     pub fn calculate_rpn(expr: *const CReversePolishExpression) -> CCalculationResult;
-    fn convert_rpn_to_infix(expr: *const CReversePolishExpression) -> CConversionResult;
+    fn convert_rpn_to_infix_into(
+        expr: *const CReversePolishExpression,
+        buffer: *mut c_char,
+        capacity: usize,
+        length: *mut usize,
+    ) -> c_int;
+    pub fn calculate_rpn_typed(expr: *const CTypedExpression) -> CCalculationResult;
+    fn calculate_rpn_typed_with_precision(expr: *const CTypedExpression, precision: c_int) -> CCalculationResult;
+    fn convert_rpn_to_infix_typed(
+        expr: *const CTypedExpression,
+        buffer: *mut c_char,
+        capacity: usize,
+        length: *mut usize,
+    ) -> c_int;
+    fn compile_rpn(expr: *const CReversePolishExpression) -> *mut CCompiledExpression;
+    fn evaluate_compiled(program: *const CCompiledExpression) -> CCalculationResult;
+    fn evaluate_compiled_with_precision(
+        context: *const CEvalContext,
+        program: *const CCompiledExpression,
+        precision: c_int,
+    ) -> CCalculationResult;
+    fn free_compiled(program: *mut CCompiledExpression);
+    fn calculate_rpn_in_context(context: *const CEvalContext, expr: *const CReversePolishExpression) -> CCalculationResult;
+    fn context_create() -> *mut CEvalContext;
+    fn context_free(context: *mut CEvalContext);
+    fn context_set_variable(context: *mut CEvalContext, name: *const c_char, value: c_double) -> c_int;
+    fn context_get_variable(context: *const CEvalContext, name: *const c_char, error_code: *mut c_int) -> c_double;
+    fn context_variable_slot(context: *mut CEvalContext, name: *const c_char, slot: *mut usize) -> c_int;
+    fn context_set_slot(context: *mut CEvalContext, slot: usize, value: c_double) -> c_int;
+    fn context_unset_slot(context: *mut CEvalContext, slot: usize) -> c_int;
+    fn context_set_precision(context: *mut CEvalContext, precision: c_int) -> c_int;
+    fn context_get_precision(context: *const CEvalContext) -> c_int;
+    fn compile_rpn_in_context(context: *mut CEvalContext, expr: *const CReversePolishExpression) -> *mut CCompiledExpression;
+    fn evaluate_compiled_in_context(context: *const CEvalContext, program: *const CCompiledExpression) -> CCalculationResult;
+    fn compiled_length(program: *const CCompiledExpression) -> usize;
+    fn compiled_variable_count(program: *const CCompiledExpression) -> usize;
+    fn compiled_variable_name(program: *const CCompiledExpression, slot: usize) -> *const c_char;
+    fn evaluate_compiled_columns_with_precision(
+        program: *const CCompiledExpression,
+        columns: *const *const c_double,
+        row_count: usize,
+        values: *mut c_double,
+        error_codes: *mut c_int,
+        precision: c_int,
+    ) -> c_int;
+    fn calculate_rpn_batch_with_precision(
+        tokens: *const c_char,
+        token_offsets: *const usize,
+        expression_offsets: *const usize,
+        expression_count: usize,
+        results: *mut CCalculationResult,
+        precision: c_int,
+    );
+    #[link_name = "set_trace_level"]
+    fn c_set_trace_level(level: c_int);
+    fn get_vector_isa() -> c_int;
+    #[link_name = "set_vector_isa"]
+    fn c_set_vector_isa(isa: c_int) -> c_int;
+    fn vector_isa_supported(isa: c_int) -> c_int;
 }
 
-/// Represents a history entry for a mathematical expression and its result.
-///  # Fields
+/// Opaque handle to a compiled RPN program allocated by the C library.
+#[repr(C)]
+pub struct CCompiledExpression {
+    _private: [u8; 0],
+}
+
+/// A Reverse Polish Notation (RPN) expression compiled once by the C library and evaluated many times.
 /// 
-/// * `input`: A string containing the original mathematical expression provided by the user. 
-/// * `result`: An optional floating-point number (`Option<f64>`) representing the calculated result.
-/// * `error_message`: An optional string (`Option<String>`) containing an error message if the calculation failed.
-/// * `None` if there was no error.
+/// Compilation classifies every token and parses every numeric literal, so `evaluate` runs a tight
+/// opcode loop without any string handling. Constant subexpressions such as `2 * pi` are folded into
+/// a single literal, and operations with a constant operand such as `x * 1` or `x ^ 2` become a single
+/// cheaper instruction, without changing any result or error code. The program is released when the
+/// value is dropped.
 /// 
-///  This struct is used to log the history of calculations performed by the calculator.
-#[derive(Debug, Clone)]
-pub struct HistoryEntry {
-    pub input: String,
-    pub result: Option<f64>, // `None` if there was an error
-    pub error_message: Option<String>, // `None` if there was no error
+/// With the `jit` feature, programs evaluated more than `jit_threshold()` times are compiled further to
+/// native code, with the same results, see `set_jit_threshold`.
+/// 
+/// # Fields
+/// 
+/// * `program`: A pointer (`*mut CCompiledExpression`) to the program owned by this value.
+/// * `context`: The context the program was compiled in, null if none.
+/// * `variable_count`: The number of free variable slots of the program.
+/// * `jit`: The evaluation count and native code of the program.
+pub struct CompiledExpression {
+    program: *mut CCompiledExpression,
+    context: *const CEvalContext,
+    variable_count: usize,
+    jit: JitTier,
 }
 
-/// Represents the history of calculations performed by the calculator.
+/// Results of evaluating a compiled expression over columns of inputs.
 /// 
 /// # Fields
 /// 
-/// * `entries`: A vector of `HistoryEntry` structs, each representing a single calculation.
-/// * `last_result`: An optional floating-point number (`Option<f64>`) representing the result of the most recent successful calculation.
+/// * `values`: The result of each row, `0.0` for rows that failed.
+/// * `error_codes`: The error code of each row (`0` on success), see `get_error_message`.
+#[derive(Debug, Clone, PartialEq)]
+pub struct ColumnResult {
+    pub values: Vec<f64>,
+    pub error_codes: Vec<c_int>,
+}
+
+impl CompiledExpression {
+    /// Takes ownership of a program returned by the C library, compiled in `context` (null if none).
+    fn new(program: *mut CCompiledExpression, context: *const CEvalContext) -> Self {
+        let variable_count = unsafe { compiled_variable_count(program) };
+        CompiledExpression { program, context, variable_count, jit: JitTier::new() }
+    }
+
+    /// Evaluates the compiled program.
+    /// 
+    /// # Returns
+    /// 
+    /// A `CCalculationResult` with the same value and error code `calculate_rpn` returns for the source expression.
+    pub fn evaluate(&self) -> CCalculationResult {
+        if let Some(function) = self.promoted(Precision::Rounded) {
+            return function.evaluate(&[]);
+        }
+        metrics::timed(Stage::Evaluate, || unsafe { evaluate_compiled(self.program) })
+    }
+
+    /// Same as `evaluate`, in the given precision mode.
+    /// 
+    /// # Returns
+    /// 
+    /// A `CCalculationResult` with the value and error code. The error code is `MEMORY_ERROR` if the
+    /// program was compiled in an `EvalContext`, see `EvalContext::evaluate_with_precision`.
+    pub fn evaluate_with_precision(&self, precision: Precision) -> CCalculationResult {
+        if let Some(function) = self.promoted(precision) {
+            return function.evaluate(&[]);
+        }
+        metrics::timed(Stage::Evaluate, || unsafe {
+            evaluate_compiled_with_precision(std::ptr::null(), self.program, precision as c_int)
+        })
+    }
+
+    /// Counts a context-free evaluation and returns the native code to run it with, once promoted.
+    /// 
+    /// Free variables of a program without a context have no value, so such programs stay interpreted.
+    #[inline]
+    fn promoted(&self, precision: Precision) -> Option<&JitFunction> {
+        if !self.context.is_null() || self.variable_count != 0 {
+            return None;
+        }
+        self.jit.promoted(self.program, precision, self.variable_count)
+    }
+
+    /// Returns the native code of the program in a precision mode, generating it now if needed.
+    /// 
+    /// # Returns
+    /// 
+    /// The `JitFunction`, kept with the program and used by later evaluations, or `None` without the `jit`
+    /// feature, on targets other than x86-64 Unix, or for programs too long for native code.
+    pub fn jit(&self, precision: Precision) -> Option<&JitFunction> {
+        self.jit.function(self.program, precision, self.variable_count)
+    }
+
+    /// Returns whether evaluations in a precision mode run native code, see `set_jit_threshold`.
+    pub fn is_jit_compiled(&self, precision: Precision) -> bool {
+        self.jit.is_promoted(precision)
+    }
+
+    /// Returns the number of instructions of the program, after constant folding.
+    pub fn instruction_count(&self) -> usize {
+        unsafe { compiled_length(self.program) }
+    }
+
+    /// Returns the names of the free variables of the program, in slot order.
+    /// 
+    /// The constants `pi` and `e` are resolved during compilation and are never listed.
+    pub fn variable_names(&self) -> Vec<String> {
+        let count = unsafe { compiled_variable_count(self.program) };
+        (0..count)
+            .map(|slot| unsafe {
+                CStr::from_ptr(compiled_variable_name(self.program, slot))
+                    .to_string_lossy()
+                    .into_owned()
+            })
+            .collect()
+    }
+
+    /// Evaluates the program once per row, with variables bound to columns of values.
+    /// 
+    /// The C library processes the rows in blocks, applying each instruction to a whole block at a time.
+    /// Each row gets the same value and error code `evaluate` would return if its variables were replaced
+    /// by that row's values.
+    /// 
+    /// # Arguments
+    /// 
+    /// * `bindings`: Pairs of a variable name (lowercase, as produced by the tokenizer) and its column.
+    ///   All columns must have the same length. Names the program does not use are ignored, and variables
+    ///   without a column fail with `UNDEFINED_VARIABLE`.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)` if no column is bound, the columns differ in length, or the C library fails
+    /// to allocate its working stack.
+    pub fn evaluate_columns(&self, bindings: &[(&str, &[f64])]) -> Result<ColumnResult, String> {
+        self.evaluate_columns_with_precision(bindings, Precision::Rounded)
+    }
+
+    /// Same as `evaluate_columns`, in the given precision mode.
+    /// 
+    /// # Errors
+    /// 
+    /// See `evaluate_columns`.
+    pub fn evaluate_columns_with_precision(
+        &self,
+        bindings: &[(&str, &[f64])],
+        precision: Precision,
+    ) -> Result<ColumnResult, String> {
+        let row_count = match bindings.first() {
+            Some((_, column)) => column.len(),
+            None => return Err("No columns bound".to_string()),
+        };
+        if bindings.iter().any(|(_, column)| column.len() != row_count) {
+            return Err("Columns have different lengths".to_string());
+        }
+
+        let columns: Vec<*const c_double> = self
+            .variable_names()
+            .iter()
+            .map(|name| {
+                bindings
+                    .iter()
+                    .find(|(bound, _)| bound == name)
+                    .map_or(std::ptr::null(), |(_, column)| column.as_ptr())
+            })
+            .collect();
+
+        let mut result = ColumnResult {
+            values: vec![0.0; row_count],
+            error_codes: vec![SUCCESS; row_count],
+        };
+        let error_code = metrics::timed(Stage::Evaluate, || unsafe {
+            evaluate_compiled_columns_with_precision(
+                self.program,
+                columns.as_ptr(),
+                row_count,
+                result.values.as_mut_ptr(),
+                result.error_codes.as_mut_ptr(),
+                precision as c_int,
+            )
+        });
+        if error_code != SUCCESS {
+            return Err(get_error_message(error_code).to_string());
+        }
+        Ok(result)
+    }
+}
+
+impl Drop for CompiledExpression {
+    fn drop(&mut self) {
+        unsafe { free_compiled(self.program) }
+    }
+}
+
+// A compiled program is never modified after `compile_rpn` returns, and evaluating it only reads it,
+// so it can be moved to and shared between threads.
+unsafe impl Send for CompiledExpression {}
+unsafe impl Sync for CompiledExpression {}
+
+/// Returns the name a variable is read under: the tokenizer lowercases identifiers, so `X` in an expression
+/// reads the variable `x`.
+pub(crate) fn variable_key(name: &str) -> String {
+    name.chars().flat_map(char::to_lowercase).collect()
+}
+
+/// Opaque handle to an evaluation context allocated by the C library.
+#[repr(C)]
+pub struct CEvalContext {
+    _private: [u8; 0],
+}
+
+/// A reusable set of variables for compiled expressions.
 /// 
-/// # Methods
+/// The context owns a hash table of interned variable names. Expressions compiled with `compile` resolve
+/// every identifier to a context slot once, so `evaluate` reads values directly without looking up names.
+/// `pi` and `e` are defined when the context is created and are never reinitialized afterwards.
 /// 
-/// ## `new`
-/// Creates a new, empty `History` instance.
+/// A context can also hold named formulas, see `define_formula`, whose values are kept up to date as the
+/// variables they read change.
 /// 
-/// ## `add_entry`
-/// Adds a new entry to the history.
+/// # Fields
 /// 
-/// ### Arguments
-/// * `input`: A string representing the mathematical expression provided by the user.
-/// * `result`: An optional floating-point number representing the result of the calculation. Use `None` if the calculation failed.
-/// * `error_message`: An optional string containing an error message if the calculation failed. Use `None` if there was no error.
+/// * `context`: A pointer (`*mut CEvalContext`) to the context owned by this value.
+/// * `formulas`: The named formulas and their dependency graph.
+pub struct EvalContext {
+    context: *mut CEvalContext,
+    formulas: Formulas,
+}
+
+impl EvalContext {
+    /// Creates a context holding the default variables `pi` and `e`.
+    /// 
+    /// # Panics
+    /// 
+    /// Panics if the C library cannot allocate the context.
+    pub fn new() -> Self {
+        let context = unsafe { context_create() };
+        assert!(!context.is_null(), "{}", get_error_message(MEMORY_ERROR));
+        EvalContext { context, formulas: Formulas::default() }
+    }
+
+    /// Assigns a variable, defining it if needed. Expressions already compiled in this context see the
+    /// new value on their next evaluation, and the formulas reading it are recomputed. Names are read
+    /// case-insensitively, like variables in expressions.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)` if the name contains a null byte, is a formula, or memory allocation fails.
+    pub fn set_variable(&mut self, name: &str, value: f64) -> Result<(), String> {
+        if !self.formulas.is_empty() {
+            return self.set_variables(&[(name, value)]);
+        }
+        let name = CString::new(variable_key(name)).map_err(|_| "Failed to convert variable name to CString".to_string())?;
+        match unsafe { context_set_variable(self.context, name.as_ptr(), value) } {
+            SUCCESS => Ok(()),
+            error_code => Err(get_error_message(error_code).to_string()),
+        }
+    }
+
+    /// Assigns several variables at once. Formulas downstream of more than one of them are recomputed once.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)`, before assigning anything, if a name contains a null byte or is a formula,
+    /// or if memory allocation fails.
+    pub fn set_variables(&mut self, assignments: &[(&str, f64)]) -> Result<(), String> {
+        self.with_formulas(|formulas, context| formulas.assign(context, assignments))
+    }
+
+    /// Defines a named formula, or replaces the formula of that name.
+    /// 
+    /// The value of the formula is stored in the variable `name`, so other formulas and every expression
+    /// evaluated in this context can read it. Whenever a variable it reads changes, through
+    /// `set_variable`, `set_variables` or another formula, the formula is recomputed. Only the formulas
+    /// downstream of a change are evaluated, in topological order, with formulas that do not depend on each
+    /// other evaluated in parallel when there are many.
+    /// 
+    /// A formula that fails leaves its variable undefined, and the formulas reading it fail with its error
+    /// code.
+    /// 
+    /// # Arguments
+    /// 
+    /// * `name`: The name of the formula, an identifier such as `a` or `total2`. It is read case-insensitively,
+    ///   like variables in expressions.
+    /// * `input`: The infix expression of the formula, e.g. `sqrt(a) + ans`.
+    /// * `history`: The history `ans` is read from, once, when the formula is defined.
+    /// 
+    /// # Returns
+    /// 
+    /// The value and error code of the formula.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)`, leaving every formula unchanged, if `name` is not an identifier, if the
+    /// formula would depend on itself, or if the expression cannot be converted or compiled.
+    pub fn define_formula(&mut self, name: &str, input: &str, history: &History) -> Result<CCalculationResult, String> {
+        self.with_formulas(|formulas, context| formulas.define(context, name, input, history))
+    }
+
+    /// Removes a formula. Its variable becomes undefined, and the formulas reading it are recomputed.
+    /// 
+    /// # Returns
+    /// 
+    /// `true` if there was a formula of that name.
+    pub fn remove_formula(&mut self, name: &str) -> bool {
+        self.with_formulas(|formulas, context| formulas.remove(context, name))
+    }
+
+    /// Returns the value and error code of a formula as last recomputed, or `None` if there is no formula
+    /// of that name.
+    pub fn formula_result(&self, name: &str) -> Option<CCalculationResult> {
+        self.formulas.result(name)
+    }
+
+    /// Returns the number of formulas evaluated by the last definition, removal or assignment.
+    pub fn recomputed_formulas(&self) -> usize {
+        self.formulas.recomputed()
+    }
+
+    /// Runs `change` on the formulas with the context available mutably.
+    fn with_formulas<R>(&mut self, change: impl FnOnce(&mut Formulas, &mut EvalContext) -> R) -> R {
+        let mut formulas = std::mem::take(&mut self.formulas);
+        let result = change(&mut formulas, self);
+        self.formulas = formulas;
+        result
+    }
+
+    /// Returns the value of a variable, or `None` if it was never assigned. Names are read case-insensitively.
+    pub fn get_variable(&self, name: &str) -> Option<f64> {
+        let name = CString::new(variable_key(name)).ok()?;
+        let mut error_code = SUCCESS;
+        let value = unsafe { context_get_variable(self.context, name.as_ptr(), &mut error_code) };
+        if error_code == SUCCESS { Some(value) } else { None }
+    }
+
+    /// Sets the precision mode of `calculate_expression` and `evaluate` on this context.
+    /// Expressions already compiled in this context are evaluated in the new mode, and formulas are recomputed.
+    pub fn set_precision(&mut self, precision: Precision) {
+        // Every `Precision` is a valid mode, so this cannot fail
+        unsafe { context_set_precision(self.context, precision as c_int) };
+        if !self.formulas.is_empty() {
+            self.with_formulas(|formulas, context| formulas.recompute_all(context));
+        }
+    }
+
+    /// Returns the precision mode of this context, `Precision::Rounded` unless `set_precision` changed it.
+    pub fn precision(&self) -> Precision {
+        match unsafe { context_get_precision(self.context) } {
+            1 => Precision::Raw,
+            2 => Precision::RoundResult,
+            _ => Precision::Rounded,
+        }
+    }
+
+    /// Compiles an expression with its variables resolved to slots of this context.
+    /// 
+    /// Names the context does not define yet are accepted; evaluating them fails with `UNDEFINED_VARIABLE`
+    /// until they are assigned with `set_variable`.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)` if memory allocation fails.
+    pub fn compile(&mut self, rpn: &ReversePolish) -> Result<CompiledExpression, String> {
+        let expr_ptrs = rpn.to_c_expr();
+        let c_expr = CReversePolishExpression {
+            crpn_expression: expr_ptrs.as_ptr(),
+            length: expr_ptrs.len(),
+        };
+
+        let program = metrics::timed(Stage::Compile, || unsafe { compile_rpn_in_context(self.context, &c_expr) });
+        if program.is_null() {
+            return Err(get_error_message(MEMORY_ERROR).to_string());
+        }
+        Ok(CompiledExpression::new(program, self.context))
+    }
+
+    /// Same as `calculate_expression`, but variables are looked up in this context.
+    /// 
+    /// Several threads may call this on the same context at once, each with its own `History`.
+    pub fn calculate_expression(&self, input: &str, history: &mut History) -> CalculationResult {
+        calculate_with_context(input, history, Some(self), Precision::default())
+    }
+
+    /// Evaluates an expression compiled with `compile` against the current values of this context.
+    /// 
+    /// # Returns
+    /// 
+    /// A `CCalculationResult` with the value and error code. The error code is `MEMORY_ERROR` if the
+    /// program was not compiled in this context.
+    pub fn evaluate(&self, program: &CompiledExpression) -> CCalculationResult {
+        if cfg!(feature = "jit") {
+            if let Some(result) = self.evaluate_native(program, self.precision()) {
+                return result;
+            }
+        }
+        metrics::timed(Stage::Evaluate, || unsafe { evaluate_compiled_in_context(self.context, program.program) })
+    }
+
+    /// Evaluates every expression of a batch against the current values of this context, in its precision mode.
+    /// 
+    /// Variables are read by name, so the expressions may be compiled in this context or without one.
+    /// 
+    /// # Returns
+    /// 
+    /// One `CCalculationResult` per expression of the batch, in order. For expressions compiled in this context
+    /// it is what `evaluate` returns for them, native code aside.
+    pub fn evaluate_batch(&self, batch: &CompiledBatch) -> Vec<CCalculationResult> {
+        batch.evaluate_in(self)
+    }
+
+    /// Same as `evaluate`, in the given precision mode instead of the one of this context.
+    pub fn evaluate_with_precision(&self, program: &CompiledExpression, precision: Precision) -> CCalculationResult {
+        if let Some(result) = self.evaluate_native(program, precision) {
+            return result;
+        }
+        metrics::timed(Stage::Evaluate, || unsafe {
+            evaluate_compiled_with_precision(self.context, program.program, precision as c_int)
+        })
+    }
+
+    /// Counts an evaluation of `program` and runs its native code with the current variable values, once
+    /// promoted.
+    /// 
+    /// # Returns
+    /// 
+    /// `None` if the interpreter must evaluate the program: before promotion, for programs of other
+    /// contexts, and while a variable is undefined, so that the interpreter decides which error comes first.
+    #[inline]
+    fn evaluate_native(&self, program: &CompiledExpression, precision: Precision) -> Option<CCalculationResult> {
+        if !unsafe { compiled_in_context(self.context, program.program) } {
+            return None;
+        }
+        let function = program.jit.promoted(program.program, precision, program.variable_count)?;
+        let mut inline_values = [0.0; 16];
+        let mut heap_values = Vec::new();
+        let values = if program.variable_count <= inline_values.len() {
+            &mut inline_values[..program.variable_count]
+        } else {
+            heap_values.resize(program.variable_count, 0.0);
+            &mut heap_values[..]
+        };
+        if unsafe { compiled_context_values(self.context, program.program, values.as_mut_ptr()) } != SUCCESS {
+            return None;
+        }
+        Some(function.evaluate(values))
+    }
+}
+
+impl Default for EvalContext {
+    fn default() -> Self {
+        EvalContext::new()
+    }
+}
+
+impl Drop for EvalContext {
+    fn drop(&mut self) {
+        unsafe { context_free(self.context) }
+    }
+}
+
+// Only `set_variable`, `set_precision`, `compile` and the formula methods modify the context, and all take
+// `&mut self`. Every `&self` method only reads it, so shared references can be used from several threads at once.
+unsafe impl Send for EvalContext {}
+unsafe impl Sync for EvalContext {}
+
+/// The outcome of a calculation stored in the history.
 /// 
-/// ## `get_history`
-/// Returns a reference to the vector of `HistoryEntry` structs.
+/// * `Value`: The calculation succeeded with this result.
+/// * `Error`: The C library failed with this error code, see `get_error_message`.
+/// * `Failure`: The expression could not be passed to the C library, with an interned message.
+#[derive(Debug, Clone)]
+enum Outcome {
+    Value(f64),
+    Error(c_int),
+    Failure(Arc<str>),
+}
+
+/// Represents a history entry for a mathematical expression and its result.
 /// 
-/// ## `get_last_result`
-/// Returns the result of the most recent successful calculation, or `None` if no successful calculation has been performed.
-#[derive(Debug)]
-pub struct History {
-    pub entries: Vec<HistoryEntry>,
-    pub last_result: Option<f64>,
+/// Entries are compact: the input text is shared with every other entry of the same history that has the
+/// same input, and errors are stored as error codes rather than as formatted messages.
+/// 
+///  # Fields
+/// 
+/// * `input`: The original mathematical expression provided by the user, interned by the history.
+/// * `outcome`: The result of the calculation, or why it failed.
+/// 
+///  This struct is used to log the history of calculations performed by the calculator.
+#[derive(Debug, Clone)]
+pub struct HistoryEntry {
+    input: Arc<str>,
+    outcome: Outcome,
+}
+
+impl HistoryEntry {
+    /// Returns the original mathematical expression provided by the user.
+    pub fn input(&self) -> &str {
+        &self.input
+    }
+
+    /// Returns the calculated result, or `None` if there was an error.
+    pub fn result(&self) -> Option<f64> {
+        match self.outcome {
+            Outcome::Value(value) => Some(value),
+            _ => None,
+        }
+    }
+
+    /// Returns the error code reported by the C library, or `None` if there was no error or the
+    /// expression never reached the C library.
+    pub fn error_code(&self) -> Option<c_int> {
+        match self.outcome {
+            Outcome::Error(error_code) => Some(error_code),
+            _ => None,
+        }
+    }
+
+    /// Returns the error message if the calculation failed, or `None` if there was no error.
+    pub fn error_message(&self) -> Option<&str> {
+        match &self.outcome {
+            Outcome::Value(_) => None,
+            Outcome::Error(error_code) => Some(get_error_message(*error_code)),
+            Outcome::Failure(message) => Some(message),
+        }
+    }
 }
 
 /// Represents the history of calculations performed by the calculator.
 /// 
+/// A history keeps either every entry, only the most recent ones in a ring buffer, or no entries at all.
+/// The last result, used for `ans`, is always kept.
+/// 
 /// # Fields
 /// 
-/// * `entries`: A vector of `HistoryEntry` structs, each representing a single calculation.
+/// * `entries`: The stored entries, oldest first.
+/// * `capacity`: The maximum number of stored entries, `None` if unbounded.
+/// * `strings`: The interned inputs and failure messages of the stored entries.
 /// * `last_result`: An optional floating-point number (`Option<f64>`) representing the result of the most recent successful calculation.
 /// 
 /// # Methods
 /// 
 /// ## `new`
-/// Creates a new, empty `History` instance.
+/// Creates a new, empty `History` instance that keeps every entry.
+/// 
+/// ## `with_capacity`
+/// Creates a new, empty `History` instance that keeps only the `capacity` most recent entries.
+/// 
+/// ## `last_result_only`
+/// Creates a new, empty `History` instance that keeps no entries, only the last result.
 /// 
 /// ## `add_entry`
 /// Adds a new entry to the history.
 /// 
 /// ### Arguments
 /// * `input`: A string representing the mathematical expression provided by the user.
-/// * `result`: An optional floating-point number representing the result of the calculation. Use `None` if the calculation failed.
-/// * `error_message`: An optional string containing an error message if the calculation failed. Use `None` if there was no error.
+/// * `result`: The result of the calculation, or the error code returned by the C library.
+/// 
+/// ## `add_failure`
+/// Adds an entry for an expression that could not be passed to the C library.
+/// 
+/// ### Arguments
+/// * `input`: A string representing the mathematical expression provided by the user.
+/// * `message`: The error message.
+/// 
+/// ## `with_log` (Unix only)
+/// Attaches a `HistoryLog` that every new entry is also appended to, whatever the capacity.
+/// The last result is restored from the log.
+/// 
+/// ## `log`, `log_mut` (Unix only)
+/// Return the attached log, or `None`.
 /// 
 /// ## `get_history`
-/// Returns a reference to the vector of `HistoryEntry` structs.
+/// Returns the stored entries, oldest first.
 /// 
 /// ## `get_last_result`
 /// Returns the result of the most recent successful calculation, or `None` if no successful calculation has been performed.
+/// 
+/// ## `clear`
+/// Removes every stored entry. The last result and the attached log are kept.
+#[derive(Debug)]
+pub struct History {
+    entries: VecDeque<HistoryEntry>,
+    capacity: Option<usize>,
+    strings: HashSet<Arc<str>>,
+    last_result: Option<f64>,
+    #[cfg(unix)]
+    log: Option<HistoryLog>,
+}
+
 impl History {
     pub fn new() -> Self {
         History {
-            entries: Vec::new(),
+            entries: VecDeque::new(),
+            capacity: None,
+            strings: HashSet::new(),
             last_result: None,
+            #[cfg(unix)]
+            log: None,
         }
     }
 
-    pub fn add_entry(&mut self, input: String, result: Option<f64>, error_message: Option<String>) {
-        if let Some(res) = result {
-            self.last_result = Some(res); // Update the last result
+    pub fn with_capacity(capacity: usize) -> Self {
+        History {
+            entries: VecDeque::with_capacity(capacity),
+            capacity: Some(capacity),
+            ..History::new()
         }
-        self.entries.push(HistoryEntry {
-            input,
-            result,
-            error_message,
-        });
     }
 
-    pub fn get_history(&self) -> &Vec<HistoryEntry> {
+    pub fn last_result_only() -> Self {
+        History::with_capacity(0)
+    }
+
+    #[cfg(unix)]
+    pub fn with_log(mut self, log: HistoryLog) -> Self {
+        if let Some(value) = (0..log.len()).rev().find_map(|index| log.get(index).and_then(|entry| entry.result)) {
+            self.last_result = Some(value);
+        }
+        self.log = Some(log);
+        self
+    }
+
+    #[cfg(unix)]
+    pub fn log(&self) -> Option<&HistoryLog> {
+        self.log.as_ref()
+    }
+
+    #[cfg(unix)]
+    pub fn log_mut(&mut self) -> Option<&mut HistoryLog> {
+        self.log.as_mut()
+    }
+
+    pub fn add_entry(&mut self, input: &str, result: Result<f64, c_int>) {
+        #[cfg(unix)]
+        if let Some(log) = &mut self.log {
+            if let Err(e) = log.append(input, result) {
+                trace!(TraceLevel::Error, "Warning: {}", e);
+            }
+        }
+        let outcome = match result {
+            Ok(value) => {
+                self.last_result = Some(value); // Update the last result
+                Outcome::Value(value)
+            }
+            Err(error_code) => Outcome::Error(error_code),
+        };
+        self.push(input, outcome);
+    }
+
+    pub fn add_failure(&mut self, input: &str, message: &str) {
+        #[cfg(unix)]
+        if let Some(log) = &mut self.log {
+            if let Err(e) = log.append_failure(input, message) {
+                trace!(TraceLevel::Error, "Warning: {}", e);
+            }
+        }
+        if self.capacity != Some(0) {
+            let message = self.intern(message);
+            self.push(input, Outcome::Failure(message));
+        }
+    }
+
+    pub fn get_history(&self) -> &VecDeque<HistoryEntry> {
         &self.entries
     }
 
     pub fn get_last_result(&self) -> Option<f64> {
         self.last_result
     }
+
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+
+    pub fn capacity(&self) -> Option<usize> {
+        self.capacity
+    }
+
+    pub fn clear(&mut self) {
+        self.entries.clear();
+        self.strings.clear();
+    }
+
+    /// Stores an entry, evicting the oldest one if the history is full.
+    fn push(&mut self, input: &str, outcome: Outcome) {
+        match self.capacity {
+            Some(0) => return,
+            Some(capacity) if self.entries.len() == capacity => {
+                if let Some(evicted) = self.entries.pop_front() {
+                    self.release(evicted.input);
+                    if let Outcome::Failure(message) = evicted.outcome {
+                        self.release(message);
+                    }
+                }
+            }
+            _ => {}
+        }
+        let input = self.intern(input);
+        self.entries.push_back(HistoryEntry { input, outcome });
+    }
+
+    /// Returns the shared copy of `text`, adding it if no stored entry uses it yet.
+    fn intern(&mut self, text: &str) -> Arc<str> {
+        if let Some(interned) = self.strings.get(text) {
+            return Arc::clone(interned);
+        }
+        let interned: Arc<str> = Arc::from(text);
+        self.strings.insert(Arc::clone(&interned));
+        interned
+    }
+
+    /// Drops a reference to an interned string, forgetting the string once no stored entry uses it.
+    fn release(&mut self, text: Arc<str>) {
+        // One reference is held by `strings` and one by `text`
+        if Arc::strong_count(&text) == 2 {
+            self.strings.remove(&text);
+        }
+    }
+}
+
+impl Default for History {
+    fn default() -> Self {
+        History::new()
+    }
 }
 
 /// Displays the history of calculations in a human-readable format.
@@ -249,52 +1240,388 @@ impl History {
 pub fn display_history(history: &History) {
     for (i, entry) in history.get_history().iter().enumerate() {
         println!("Entry {}:", i + 1);
-        println!("  Input: {}", entry.input);
-        match &entry.result {
+        println!("  Input: {}", entry.input());
+        match entry.result() {
             Some(result) => println!("  Result: {}", result),
-            None => println!("  Error: {}", entry.error_message.as_ref().unwrap()),
+            None => println!("  Error: {}", entry.error_message().unwrap_or_default()),
         }
     }
 }
 
 
-/// Reverse Polish Notation (RPN) expression represented as a vector of strings
+/// Reverse Polish Notation (RPN) expression stored in a single reusable buffer.
 /// 
 /// # Fields
 /// 
-/// * `rp_expression`: A vector of strings (`Vec<String>`) representing the expression in Reverse Polish Notation (RPN).
-///     * Each string in the vector is a single token of the RPN expression (e.g., "2", "3", "+").
+/// * `buffer`: The tokens of the expression (e.g. "2", "3", "+"), each followed by a null byte, so the C
+///   library can read them in place.
+/// * `length`: The number of tokens in `buffer`.
+/// * `typed`: The same tokens already classified, with literals parsed, for `calculate_rpn_typed`.
+/// * `variables`: The position in `buffer` of the name of each variable slot used by `typed`.
+/// * `pending`: The operator stack of the shunting-yard algorithm, kept between calls to `parse_infix` so
+///   reusing a `ReversePolish` does not allocate.
 pub struct ReversePolish {
-    rp_expression: Vec<String>
+    buffer: String,
+    length: usize,
+    typed: Vec<CToken>,
+    variables: Vec<usize>,
+    pending: Vec<Pending>,
+}
+
+/// Result of the calculations done through the C Library.
+/// 
+/// # Fields
+/// 
+/// * `success`: A boolean indicating whether the calculation was successful.
+/// * `expression`: The original mathematical expression provided by the user.
+/// * `rpn_expression`: The corresponding expression in Reverse Polish Notation (RPN).
+/// * `result`: The numerical result of the calculation.
+/// * `message`: An additional message providing details about the calculation outcome, 
+///   such as errors or warnings.
+impl ReversePolish {
+    /// Creates an empty expression.
+    pub fn new() -> Self {
+        ReversePolish {
+            buffer: String::new(),
+            length: 0,
+            typed: Vec::new(),
+            variables: Vec::new(),
+            pending: Vec::new(),
+        }
+    }
+
+    /// Builds an expression from tokens that are already in RPN order.
+    /// 
+    /// Tokens spelled exactly like an operator in RPN become that operator, tokens that parse as a number
+    /// become literals, and every other token is a variable.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)` if a token contains a null byte.
+    fn from_tokens<'t>(tokens: impl Iterator<Item = &'t str>) -> Result<Self, String> {
+        let mut rpn = ReversePolish::new();
+        for token in tokens {
+            if token.contains('\0') {
+                return Err("Failed to convert expression to CString".to_string());
+            }
+            match Operator::from_name(token).filter(|op| op.name() == token) {
+                Some(op) => rpn.push_operator(op),
+                None => {
+                    let start = rpn.buffer.len();
+                    rpn.push_token(token);
+                    rpn.end_typed_operand(start);
+                }
+            }
+        }
+        Ok(rpn)
+    }
+
+    /// Converts an infix expression to RPN, replacing the previous contents. `ans` resolves to the last
+    /// result of `history`, or `0` if there is none.
+    /// 
+    /// Once the buffers have grown to fit the expressions they are reused for, this does not allocate.
+    /// 
+    /// # Errors
+    /// 
+    /// See `infix_to_rpn`.
+    pub fn parse_infix(&mut self, input: &str, history: &History) -> Result<(), String> {
+        self.write_infix(input, Some(history.get_last_result().unwrap_or(0.0)))
+    }
+
+    /// Shared implementation of `parse_infix`, ordering the tokens of `input` with the shunting-yard algorithm.
+    /// 
+    /// `ans` is written as the number `ans` if one is given. Otherwise it is written as the variable
+    /// `ANS_VARIABLE`, so the expression stays valid whatever the last result is.
+    fn write_infix(&mut self, input: &str, ans: Option<f64>) -> Result<(), String> {
+        metrics::timed(Stage::Parse, || {
+            self.clear();
+            let mut tokens = 0;
+            for token in tokenize(input) {
+                self.push_infix(token, ans);
+                tokens += 1;
+            }
+            self.finish_infix();
+            metrics::count_tokens(tokens);
+        });
+        Ok(())
+    }
+
+    /// Removes every token, keeping the buffers.
+    pub(crate) fn clear(&mut self) {
+        self.buffer.clear();
+        self.length = 0;
+        self.typed.clear();
+        self.variables.clear();
+        self.pending.clear();
+    }
+
+    /// Feeds one infix token to the shunting-yard algorithm, see `write_infix`.
+    pub(crate) fn push_infix(&mut self, token: Token<'_>, ans: Option<f64>) {
+        match token {
+            Token::Number(text) | Token::Variable(text) => {
+                let start = self.buffer.len();
+                self.push_lowercase(text);
+                self.end_typed_operand(start);
+                self.end_operand();
+            }
+            Token::Ans => {
+                match ans {
+                    Some(last_result) => self.push_value(last_result),
+                    None => {
+                        let start = self.buffer.len();
+                        self.push_token(ANS_VARIABLE);
+                        self.end_typed_operand(start);
+                    }
+                }
+                self.end_operand();
+            }
+            Token::Operator(op) => {
+                if op.is_prefix_unary() {
+                    // Delay adding to output until we see the operand
+                    self.pending.push(Pending::Operator(op));
+                } else {
+                    while let Some(&Pending::Operator(top)) = self.pending.last() {
+                        if op.precedence() > top.precedence()
+                            || (op.precedence() == top.precedence() && op.is_right_associative()) {
+                            break;
+                        }
+                        self.pending.pop();
+                        self.push_operator(top);
+                    }
+                    self.pending.push(Pending::Operator(op));
+                }
+            }
+            Token::LeftBracket => self.pending.push(Pending::Bracket),
+            Token::RightBracket => {
+                while let Some(Pending::Operator(op)) = self.pending.pop() {
+                    self.push_operator(op);
+                }
+            }
+        }
+    }
+
+    /// Outputs the operators and brackets still pending once every infix token has been fed.
+    pub(crate) fn finish_infix(&mut self) {
+        while let Some(pending) = self.pending.pop() {
+            match pending {
+                Pending::Operator(op) => self.push_operator(op),
+                Pending::Bracket => {
+                    let start = self.buffer.len();
+                    self.push_token("(");
+                    self.end_typed_operand(start);
+                }
+            }
+        }
+    }
+
+    /// Appends a literal that is already a value, written as Rust formats it.
+    pub(crate) fn push_value(&mut self, value: f64) {
+        // Writing into a `String` cannot fail
+        let _ = write!(self.buffer, "{}", value);
+        self.end_token();
+        self.typed.push(CToken::number(value));
+    }
+
+    /// Outputs a pending prefix operator once its operand has been written.
+    fn end_operand(&mut self) {
+        if let Some(&Pending::Operator(op)) = self.pending.last() {
+            if op.is_prefix_unary() {
+                self.pending.pop();
+                self.push_operator(op);
+            }
+        }
+    }
+
+    /// Appends an operator.
+    fn push_operator(&mut self, op: Operator) {
+        self.push_token(op.name());
+        self.typed.push(CToken::operator(op));
+    }
+
+    /// Adds the typed form of the operand token written at `start`: a literal if it is a number, as the C
+    /// library would read it, or a new variable slot otherwise.
+    fn end_typed_operand(&mut self, start: usize) {
+        let text = &self.buffer[start..self.buffer.len() - 1];
+        let token = match text.parse::<f64>() {
+            Ok(value) => CToken::number(value),
+            Err(_) => {
+                self.variables.push(start);
+                CToken::variable(self.variables.len() - 1)
+            }
+        };
+        self.typed.push(token);
+    }
+
+    /// Appends a token.
+    fn push_token(&mut self, token: &str) {
+        self.buffer.push_str(token);
+        self.end_token();
+    }
+
+    /// Appends a token converted to lowercase.
+    fn push_lowercase(&mut self, token: &str) {
+        if token.is_ascii() {
+            let start = self.buffer.len();
+            self.buffer.push_str(token);
+            self.buffer[start..].make_ascii_lowercase();
+        } else {
+            self.buffer.extend(token.chars().flat_map(char::to_lowercase));
+        }
+        self.end_token();
+    }
+
+    /// Terminates the token written at the end of the buffer.
+    fn end_token(&mut self) {
+        self.buffer.push('\0');
+        self.length += 1;
+    }
+
+    /// Returns the tokens of the expression.
+    pub fn tokens(&self) -> impl Iterator<Item = &str> {
+        self.buffer.split_terminator('\0')
+    }
+
+    /// Returns the number of tokens.
+    pub fn len(&self) -> usize {
+        self.length
+    }
+
+    /// Returns `true` if the expression has no tokens.
+    pub fn is_empty(&self) -> bool {
+        self.length == 0
+    }
+
+
+    /// Returns pointers to the null-terminated tokens, which stay valid as long as the expression is not modified.
+    pub fn to_c_expr(&self) -> Vec<*const c_char> {
+        metrics::timed(Stage::ToCExpr, || {
+            let mut expr_ptrs = Vec::with_capacity(self.length);
+            let mut start = 0;
+            for (i, byte) in self.buffer.bytes().enumerate() {
+                if byte == 0 {
+                    expr_ptrs.push(self.buffer[start..].as_ptr() as *const c_char);
+                    start = i + 1;
+                }
+            }
+            expr_ptrs
+        })
+    }
+
+    /// Returns the tokens of the expression in the typed form passed to `calculate_rpn_typed`.
+    pub fn typed_tokens(&self) -> &[CToken] {
+        &self.typed
+    }
+
+    /// Returns the name of a variable slot of `typed_tokens`, or `None` if there is no such slot.
+    pub fn variable_name(&self, slot: usize) -> Option<&str> {
+        let start = *self.variables.get(slot)?;
+        self.buffer[start..].split('\0').next()
+    }
+
+    /// Calls the C library with the typed form of the expression. Variable names are passed in place, and
+    /// the array of their pointers only goes to the heap for expressions with many variables.
+    fn with_typed_expr<R>(&self, call: impl FnOnce(&CTypedExpression) -> R) -> R {
+        const INLINE_VARIABLES: usize = 8;
+        let name = |&start: &usize| self.buffer[start..].as_ptr() as *const c_char;
+        let mut inline = [std::ptr::null(); INLINE_VARIABLES];
+        let heap: Vec<*const c_char>;
+        let names: &[*const c_char] = if self.variables.len() <= INLINE_VARIABLES {
+            for (slot, start) in inline.iter_mut().zip(&self.variables) {
+                *slot = name(start);
+            }
+            &inline[..self.variables.len()]
+        } else {
+            heap = self.variables.iter().map(name).collect();
+            &heap
+        };
+        let expr = CTypedExpression {
+            tokens: self.typed.as_ptr(),
+            length: self.typed.len(),
+            variable_names: names.as_ptr(),
+            variable_count: names.len(),
+        };
+        call(&expr)
+    }
+
+    /// Evaluates the expression through `calculate_rpn_typed`.
+    /// 
+    /// # Returns
+    /// 
+    /// The same `CCalculationResult` as `calculate_rpn` on the string tokens of the expression.
+    pub fn calculate(&self) -> CCalculationResult {
+        metrics::timed(Stage::Evaluate, || self.with_typed_expr(|expr| unsafe { calculate_rpn_typed(expr) }))
+    }
+
+    /// Same as `calculate`, in the given precision mode.
+    pub fn calculate_with_precision(&self, precision: Precision) -> CCalculationResult {
+        metrics::timed(Stage::Evaluate, || {
+            self.with_typed_expr(|expr| unsafe { calculate_rpn_typed_with_precision(expr, precision as c_int) })
+        })
+    }
+
+    /// Converts the expression to infix notation through `convert_rpn_to_infix_typed`.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)` with the message of the C library's error code if the expression does not
+    /// reduce to a single value.
+    pub fn to_infix(&self) -> Result<String, String> {
+        // Operands and operators, plus room for the spaces and a few parentheses
+        let mut buffer: Vec<u8> = Vec::with_capacity(2 * self.buffer.len() + 1);
+        let mut length = 0;
+        let mut error_code = self.with_typed_expr(|expr| unsafe {
+            convert_rpn_to_infix_typed(expr, buffer.as_mut_ptr() as *mut c_char, buffer.capacity(), &mut length)
+        });
+        if error_code == SUCCESS && length >= buffer.capacity() {
+            buffer.reserve_exact(length + 1);
+            error_code = self.with_typed_expr(|expr| unsafe {
+                convert_rpn_to_infix_typed(expr, buffer.as_mut_ptr() as *mut c_char, buffer.capacity(), &mut length)
+            });
+        }
+        if error_code != SUCCESS {
+            return Err(get_error_message(error_code).to_string());
+        }
+        // The C library wrote `length` bytes and a null terminator
+        unsafe { buffer.set_len(length) };
+        String::from_utf8(buffer).map_err(|_| "Invalid UTF-8 in result".to_string())
+    }
+
+    /// Compiles the expression into a `CompiledExpression` that can be evaluated repeatedly.
+    /// 
+    /// # Errors
+    /// 
+    /// Returns an `Err(String)` if the C library fails to allocate the program.
+    pub fn compile(&self) -> Result<CompiledExpression, String> {
+        let expr_ptrs = self.to_c_expr();
+        let c_expr = CReversePolishExpression {
+            crpn_expression: expr_ptrs.as_ptr(),
+            length: expr_ptrs.len(),
+        };
+
+        let program = metrics::timed(Stage::Compile, || unsafe { compile_rpn(&c_expr) });
+        if program.is_null() {
+            return Err(get_error_message(MEMORY_ERROR).to_string());
+        }
+        Ok(CompiledExpression::new(program, std::ptr::null()))
+    }
 }
 
-/// Result of the calculations done through the C Library.
-/// 
-/// # Fields
-/// 
-/// * `success`: A boolean indicating whether the calculation was successful.
-/// * `expression`: The original mathematical expression provided by the user.
-/// * `rpn_expression`: The corresponding expression in Reverse Polish Notation (RPN).
-/// * `result`: The numerical result of the calculation.
-/// * `message`: An additional message providing details about the calculation outcome, 
-///              such as errors or warnings.
-impl ReversePolish {
-    pub fn to_string(&self) -> String {
-        self.rp_expression.join(" ")
+impl Default for ReversePolish {
+    fn default() -> Self {
+        ReversePolish::new()
     }
+}
 
-    pub fn to_c_expr(&self) -> Result<(Vec<CString>, Vec<*const c_char>), String> {
-        let mut expr_cstrings = Vec::with_capacity(self.rp_expression.len());
-        let mut expr_ptrs = Vec::with_capacity(self.rp_expression.len());
-        
-        for s in &self.rp_expression {
-            let cstring = CString::new(s.as_str())
-                .map_err(|_| "Failed to convert expression to CString".to_string())?;
-            expr_ptrs.push(cstring.as_ptr());
-            expr_cstrings.push(cstring);
+/// Writes the tokens separated by spaces, the form `CalculationResult::rpn_expression` holds.
+impl std::fmt::Display for ReversePolish {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        for (i, token) in self.tokens().enumerate() {
+            if i > 0 {
+                f.write_str(" ")?;
+            }
+            f.write_str(token)?;
         }
-
-        Ok((expr_cstrings, expr_ptrs))
+        Ok(())
     }
 }
 
@@ -307,7 +1634,7 @@ impl ReversePolish {
 /// * `rpn_expression`: The corresponding expression in Reverse Polish Notation (RPN).
 /// * `result`: The numerical result of the calculation.
 /// * `message`: A string containing additional details about the calculation outcome, 
-///              such as errors or warnings.
+///   such as errors or warnings.
 pub struct CalculationResult {
     pub success: bool,
     pub expression: String,
@@ -346,83 +1673,107 @@ pub fn get_error_message(error_code: c_int) -> &'static str {
     }
 }
 
-/// Token types for the tokenization process.
-///
-/// * `Operator`: Represents mathematical operators such as `+`, `-`, `*`, `/`, `^`, `!`, and `√`.
-///     - Trigonometric functions: "sin", "cos", "tan", "arcsin", "arccos", "arctan"
-///     - Square root: "sqrt", "√"
-///     - Logarithmic functions: "log" (base-10 logarithm), "ln" (natural logarithm)
-///     - Special constants or functions: "ans"
-/// * `Operand`: Represents numeric values, including integers and floating-point numbers.
-///     * Example values: "2", "3.14", "10", "0"
-/// * `Variable`: Represents alphanumeric symbols used as variables or identifiers.
-///     * Example values: "x", "y", "result", "my_variable"
-/// * `Bracket`: Represents parentheses used to group expressions.
-///     * Example values: "(", ")"
-#[derive(Debug, Clone, PartialEq)]
-pub enum TokenType {
-    Operator,
-    Operand,
-    Variable,
-    Bracket,
-    Function
-}
-
-/// Represents a single token produced during the tokenization process.
+/// Operators recognized by the tokenizer.
 ///
-/// Each `Token` consists of a string `value` and its corresponding `TokenType`, which categorizes the token.
+/// * Arithmetic: `+`, `-`, `*`, `/`, `^` and the postfix factorial `!`.
+/// * Square root: "sqrt", "√"
+/// * Trigonometric functions: "sin", "cos", "tan", "arcsin", "arccos", "arctan"
+/// * Logarithmic functions: "log" (base-10 logarithm), "ln" (natural logarithm)
 ///
-/// # Fields
-///
-/// * `token_value`: A string containing the actual content of the token.
-/// * `token_type`: The type of the token, as defined by the `TokenType` enum.
-#[derive(Debug, Clone)]
-pub struct Token {
-    token_value: String,
-    token_type: TokenType,
+/// The variants are declared in the order of their opcodes in calculator.c.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Operator {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Power,
+    Factorial,
+    Sqrt,
+    Sin,
+    Cos,
+    Tan,
+    Arcsin,
+    Arccos,
+    Arctan,
+    Log,
+    Ln,
 }
 
-/// Classifies an identifier as either an operator or a variable.
-/// 
-/// # Arguments
-/// 
-/// * `ident` - A string slice representing the identifier to be classified.
-/// 
-/// # Returns
-/// 
-/// A `TokenType` enum value:
-/// - `TokenType::Operator` if the identifier matches a known operator name.
-/// - `TokenType::Variable` if the identifier does not match any known operator name.
-/// 
-/// # Known Operators
-/// 
-/// The function recognizes the following operators:
-/// - Trigonometric functions: `"sin"`, `"cos"`, `"tan"`, `"arcsin"`, `"arccos"`, `"arctan"`
-/// - Square root: `"sqrt"`
-/// - Logarithmic functions: `"log"` (base-10 logarithm), `"ln"` (natural logarithm)
-/// - Special constants or functions: `"ans"`
-fn classify_identifier(ident: &str, history: &History) -> TokenType {
-    if ident == "ans" {
-        // Always resolve `ans` to the last result
-        if let Some(_last_result) = history.get_last_result() {
+// Every operator, in opcode order, so `OPERATORS[i]` is described by `OPERATOR_SPECS[i]`
+const OPERATORS: [Operator; OPERATOR_SPECS.len()] = [
+    Operator::Add, Operator::Subtract, Operator::Multiply, Operator::Divide, Operator::Power, Operator::Factorial,
+    Operator::Sqrt, Operator::Sin, Operator::Cos, Operator::Tan, Operator::Arcsin, Operator::Arccos,
+    Operator::Arctan, Operator::Log, Operator::Ln,
+];
+
+impl Operator {
+    /// Returns the operator with the given RPN name, or `None` if `name` is not an operator.
+    /// `"√"` is accepted as a synonym of `"sqrt"`.
+    #[inline]
+    pub fn from_name(name: &str) -> Option<Operator> {
+        lookup_operator(name, false).map(|index| OPERATORS[index])
+    }
 
-            TokenType::Operand
-        } else {
-            TokenType::Operand // Default to 0.0 if no previous result exists
-        }
-    } else {
-        // Known operators
-        const OPERATORS_NAMES: &[&str] = &[
-            "sin", "cos", "tan", "arcsin", "arccos", "arctan", "sqrt", "log", "ln",
-        ];
-        if OPERATORS_NAMES.contains(&ident) {
-            TokenType::Operator
-        } else {
-            TokenType::Variable
-        }
+    /// Returns the named operator matching `ident` regardless of case, or `None` if `ident` is a variable.
+    #[inline]
+    fn from_identifier(ident: &str) -> Option<Operator> {
+        // Identifiers are alphanumeric, so they never match a symbol
+        lookup_operator(ident, true).map(|index| OPERATORS[index])
+    }
+
+    /// Returns the name of the operator as it appears in RPN expressions passed to the C library.
+    #[inline]
+    pub fn name(self) -> &'static str {
+        OPERATOR_SPECS[self as usize].name
+    }
+
+    /// Returns the opcode of the operator in a `CToken`, matching the `Opcode` enum of calculator.c.
+    pub fn opcode(self) -> c_int {
+        // The variants are declared in opcode order
+        OP_ADD + self as c_int
+    }
+
+    /// Returns the precedence of the operator, see `get_precedence`.
+    pub fn precedence(self) -> i32 {
+        OPERATOR_SPECS[self as usize].precedence
+    }
+
+    /// Returns `true` if the operator is right-associative (`^`, `!`).
+    pub fn is_right_associative(self) -> bool {
+        OPERATOR_SPECS[self as usize].right_associative
+    }
+
+    /// Returns the number of operands the operator takes, 1 or 2.
+    pub fn arity(self) -> usize {
+        usize::from(OPERATOR_SPECS[self as usize].arity)
+    }
+
+    /// Returns `true` if the operator is written before its operand without parentheses (`sqrt`, `√`).
+    fn is_prefix_unary(self) -> bool {
+        self == Operator::Sqrt
     }
 }
 
+/// Represents a single token produced during the tokenization process.
+///
+/// Tokens borrow their text from the input, so tokenizing never allocates.
+///
+/// * `Number`: A numeric literal, including a leading `-` for negative numbers (`2`, `-3.14`, `1.23e5`).
+/// * `Variable`: An alphanumeric identifier that is not an operator (`x`, `pi`), in its original case.
+/// * `Ans`: The last result (`ans`).
+/// * `Operator`: Any operator, see `Operator`.
+/// * `LeftBracket`, `RightBracket`: Parentheses used to group expressions.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Token<'a> {
+    Number(&'a str),
+    Variable(&'a str),
+    Ans,
+    Operator(Operator),
+    LeftBracket,
+    RightBracket,
+}
+
 ///Determines if token is a valid number. 
 /// 
 /// # Fields 
@@ -438,214 +1789,205 @@ fn is_numeric(s: &str) -> bool {
     s.parse::<f64>().is_ok() //Standard rust parser that does a way better job than my implementation did :(
 }
 
-/// Tokenizes an input string into a vector of tokens.
-/// 
-/// # Arguments
-/// 
-/// * `input` - A string slice representing the input to be tokenized.
-/// 
-/// # Returns
-/// 
-/// A vector of `Token` structs, each representing a part of the input.
-/// 
-/// # Token Types
+/// An iterator over the tokens of an infix expression, created by `tokenize`.
 ///
-/// - `Operator`: Symbols representing mathematical operations (`+`, `-`, `*`, `/`, `^`, '!').
-///     - Trigonometric functions: "sin", "cos", "tan", "arcsin", "arccos", "arctan"
-///     - Square root: "sqrt"
-///     - Logarithmic functions: "log" (base-10 logarithm), "ln" (natural logarithm)
-///     - Special constants or functions: "ans"
-/// - `Operand`: Numeric values, which can include decimal points (`2`, `3`, `4`, `9.23`, `0`).
-/// - `Variable`: Alphanumeric symbols representing unknowns (`x`, `y`, `z`, `_`). (UNUSED CURRENTLY)
-/// - `Bracket`: Parentheses used in expressions (`(`, `)`).
-pub fn tokenize(input: &str, history: &History) -> Vec<Token> {
-    let mut tokens: Vec<Token> = Vec::new();
-    let binding = input.to_lowercase();
-    let mut chars = binding.chars().peekable();
-    let mut current_pos = 0; //Keeps track of where the tokenizer is in the expression
-    let _input = input.replace("√", "sqrt");
+/// # Fields
+///
+/// * `input`: The expression being tokenized.
+/// * `position`: The byte offset of the next character to read.
+/// * `count`: The number of characters read so far, used for error messages.
+/// * `unary_allowed`: Whether a `-` at `position` starts a negative number, which is the case at the start
+///   of the input and after an operator or a bracket.
+pub struct Tokenizer<'a> {
+    input: &'a str,
+    position: usize,
+    count: usize,
+    unary_allowed: bool,
+}
+
+impl<'a> Tokenizer<'a> {
+    /// Returns the next character without consuming it.
+    fn peek(&self) -> Option<char> {
+        self.input[self.position..].chars().next()
+    }
+
+    /// Consumes the next character.
+    fn bump(&mut self) {
+        if let Some(c) = self.peek() {
+            self.position += c.len_utf8();
+        }
+    }
 
-    while let Some(&c) = chars.peek() {
-        current_pos += 1; // Increment position conceptually for error messages
+    /// Consumes characters while `accept` returns `true`.
+    fn bump_while(&mut self, mut accept: impl FnMut(char) -> bool) {
+        while let Some(c) = self.peek() {
+            if !accept(c) {
+                break;
+            }
+            self.bump();
+        }
+    }
 
+    /// Reads the next token, or `None` if the character at `position` does not start one.
+    fn read_token(&mut self, c: char) -> Option<Token<'a>> {
+        let start = self.position;
         match c {
             // === Whitespace ===
             w if w.is_whitespace() => {
-                chars.next(); // Consume whitespace
+                self.bump();
+                None
             }
 
             // === Brackets ==
-            '(' | ')' => {
-                tokens.push(Token {
-                    token_value: c.to_string(),
-                    token_type: TokenType::Bracket,
-                });
-                chars.next(); // Consume bracket
+            '(' => {
+                self.bump();
+                Some(Token::LeftBracket)
+            }
+            ')' => {
+                self.bump();
+                Some(Token::RightBracket)
             }
 
             // === Operators (excluding '-') ===
-            '+' | '*' | '/' | '^' | '!' => {
-            
-                tokens.push(Token {
-                    token_value: c.to_string(),
-                    token_type: TokenType::Operator,
-                });
-                chars.next(); // Consume operator
-            }
-            '√' => {
-                // Handle square root as a 
-                tokens.push(Token {
-                    token_value: "sqrt".to_string(),
-                    token_type: TokenType::Operator,
-                });
-                chars.next(); // Consume '√'
+            '+' | '*' | '/' | '^' | '!' | '√' => {
+                self.bump();
+                Operator::from_name(&self.input[start..self.position]).map(Token::Operator)
             }
+
             // === Minus Sign or Negative Number(Operator or start of Number) ===
             '-' => {
-                let is_unary = tokens.is_empty() || matches!(tokens.last(), Some(Token { token_type: TokenType::Operator | TokenType::Bracket, ..}));
-
-                if is_unary {
-                    // Potentially start of a new negative number
-                    let mut num_string = String::new();
-                    num_string.push(chars.next().unwrap()); // Consume '-'
-
-                    //Consume rest of digits and one optional '.'
-                    while let Some(&next_c) = chars.peek() {
-                         if next_c.is_digit(10) || (next_c == '.' && !num_string.contains('.')) {
-                            // Consume the character *only if* it's part of the number
-                            num_string.push(chars.next().unwrap());
-                         } else {
-                             break; // Not part of number
-                         }
-                    }
+                self.bump();
+                if !self.unary_allowed {
+                    //Binary operator
+                    return Some(Token::Operator(Operator::Subtract));
+                }
 
-                    //Validate if a negative number was formed
-                    if is_numeric(&num_string) {
-                        tokens.push(Token {
-                            token_value: num_string, // num_string owns the value now
-                            token_type: TokenType::Operand,
-                        });
-                    } else {
-                        //If just "-". gets treated as an operator
-                        if num_string == "-" {
-                             tokens.push(Token {
-                                token_value: "-".to_string(), 
-                                token_type: TokenType::Operator,
-                             });
-                        } else {
-                            eprintln!("Warning: Invalid sequence starting with '-' ('{}') at position {}", num_string, current_pos);
-                             if num_string != "-" { // Avoid double-pushing if it was exactly "-"
-                                tokens.push(Token {
-                                    token_value: "-".to_string(),
-                                    token_type: TokenType::Operator,
-                                 });
-                                 // The non-digit/dot character after '-' will be handled in the next loop iteration.
-                             }
+                // Potentially start of a new negative number: consume digits and one optional '.'
+                let mut has_decimal = false;
+                self.bump_while(|next_c| {
+                    let accept = next_c.is_ascii_digit() || (next_c == '.' && !has_decimal);
+                    has_decimal |= next_c == '.';
+                    accept
+                });
 
-                        }
-                    }
+                let num_str = &self.input[start..self.position];
+                if is_numeric(num_str) {
+                    Some(Token::Number(num_str))
                 } else {
-                    //Binary operator
-                    tokens.push(Token {
-                        token_value: c.to_string(),
-                        token_type: TokenType::Operator,
-                    });
-                    chars.next(); // Consume '-' operator
+                    if num_str != "-" {
+                        trace!(TraceLevel::Error, "Warning: Invalid sequence starting with '-' ('{}') at position {}", num_str, self.count);
+                    }
+                    //If just "-". gets treated as an operator
+                    Some(Token::Operator(Operator::Subtract))
                 }
             }
 
             // === Numbers (starting with digit or '.') ===
-            d if d.is_digit(10) || d == '.' => {
-                let mut num_str = String::new();
+            d if d.is_ascii_digit() || d == '.' => {
                 let mut has_decimal = d == '.';
-                num_str.push(chars.next().unwrap()); // Consume first digit or '.'
-
-                while let Some(&next_c) = chars.peek() {
-                    if next_c.is_digit(10) {
-                        num_str.push(chars.next().unwrap());
-                    } else if next_c == '.' && !has_decimal {
-                        has_decimal = true;
-                        num_str.push(chars.next().unwrap());
-                    } else {
-                        break; // End of number
-                    }
-                }
+                self.bump();
+                self.bump_while(|next_c| {
+                    let accept = next_c.is_ascii_digit() || (next_c == '.' && !has_decimal);
+                    has_decimal |= next_c == '.';
+                    accept
+                });
 
                 // === Scientific Notation ===
-                if let Some(&'e') = chars.peek() {
-                    num_str.push(chars.next().unwrap()); // Consume e
-                    
+                if let Some('e' | 'E') = self.peek() {
+                    self.bump();
                     //Catch direction decimal is moving in
-                    if let Some(&next_c) = chars.peek() {
-                        if next_c == '-' || next_c == '+' {
-                            num_str.push(chars.next().unwrap());
-                        }
-
-                        //Consume the rest of the number
-                        while let Some(&next_c) = chars.peek() {
-                            if next_c.is_digit(10) {
-                                num_str.push(chars.next().unwrap());
-                            } else {
-                                break; 
-                            }
-
-                        }
+                    if let Some('-' | '+') = self.peek() {
+                        self.bump();
                     }
+                    self.bump_while(|next_c| next_c.is_ascii_digit());
                 }
 
                 // Validate if number was formed
-                if is_numeric(&num_str) {
-                    tokens.push(Token {
-                        token_value: num_str,
-                        token_type: TokenType::Operand,
-                    });
+                let num_str = &self.input[start..self.position];
+                if is_numeric(num_str) {
+                    Some(Token::Number(num_str))
                 } else {
-                    // Handle error: Invalid sequence like "." or "1.2.3"
-                    eprintln!("Warning: Invalid numeric sequence '{}' at position {}", num_str, current_pos);
-                    // How to recover? Skip? Push as unknown? For now, just warns.
+                    // Invalid sequence like "." or "1.2.3" are skipped
+                    trace!(TraceLevel::Error, "Warning: Invalid numeric sequence '{}' at position {}", num_str, self.count);
+                    None
                 }
             }
 
             // ==== Identifier (Variables or Functions) ===
-            // Original code only checked is_alphabetic(), let's add `|| a == '_'`
-             a if a.is_alphabetic() => {
-                let mut ident_str = String::new();
-                ident_str.push(chars.next().unwrap());
-
-                while let Some(&next_c) = chars.peek() {
-                    if next_c.is_alphanumeric() {
-                        ident_str.push(chars.next().unwrap());
-                    } else {
-                        break;
-                    }
-                }
+            a if a.is_alphabetic() => {
+                self.bump();
+                self.bump_while(char::is_alphanumeric);
 
-                if ident_str == "ans" {
-                    // Replace `ans` with the last result from history
-                    let last_result = history.get_last_result().unwrap_or(0.0);
-                    tokens.push(Token {
-                        token_value: last_result.to_string(),
-                        token_type: TokenType::Operand,
-                    });
+                let ident = &self.input[start..self.position];
+                if ident.eq_ignore_ascii_case("ans") {
+                    Some(Token::Ans)
                 } else {
-                    let token_type = classify_identifier(&ident_str, history);
-                    tokens.push(Token {
-                        token_value: ident_str,
-                        token_type,
-                    });
+                    Some(Operator::from_identifier(ident).map_or(Token::Variable(ident), Token::Operator))
                 }
             }
 
-
             // == Unknown Character ===
             _ => {
-                eprintln!("Warning: Skipping unknown character '{}' at position {}", c, current_pos);
-                chars.next(); // Consume the unknown character
+                trace!(TraceLevel::Error, "Warning: Skipping unknown character '{}' at position {}", c, self.count);
+                self.bump();
+                None
+            }
+        }
+    }
+}
+
+impl<'a> Tokenizer<'a> {
+    /// Reads the next token and the byte offset it starts at. It ends at `offset()`.
+    pub(crate) fn next_spanned(&mut self) -> Option<(usize, Token<'a>)> {
+        while let Some(c) = self.peek() {
+            self.count += 1; // Increment position conceptually for error messages
+            let start = self.position;
+            if let Some(token) = self.read_token(c) {
+                self.unary_allowed = matches!(token, Token::Operator(_) | Token::LeftBracket | Token::RightBracket);
+                trace!(TraceLevel::Debug, "Token: {:?}", token);
+                return Some((start, token));
             }
         }
+        None
+    }
+
+    /// Returns the byte offset of the next character to read.
+    pub(crate) fn offset(&self) -> usize {
+        self.position
+    }
+}
+
+impl<'a> Iterator for Tokenizer<'a> {
+    type Item = Token<'a>;
+
+    fn next(&mut self) -> Option<Token<'a>> {
+        self.next_spanned().map(|(_, token)| token)
+    }
+}
+
+/// Tokenizes an input string without allocating.
+/// 
+/// # Arguments
+/// 
+/// * `input` - A string slice representing the input to be tokenized.
+/// 
+/// # Returns
+/// 
+/// An iterator over the tokens of `input`, see `Token`. Operators and `ans` are matched regardless of case;
+/// numbers and variables borrow their text from `input` as written.
+pub fn tokenize(input: &str) -> Tokenizer<'_> {
+    tokenize_from(input, 0, true)
+}
+
+/// Tokenizes `input` from the byte offset `position`, where the tokenizer of the whole input would be in
+/// the state given by `unary_allowed`, see `Tokenizer`. `position` must be a character boundary.
+pub(crate) fn tokenize_from(input: &str, position: usize, unary_allowed: bool) -> Tokenizer<'_> {
+    Tokenizer {
+        input,
+        position,
+        count: 0,
+        unary_allowed,
     }
-    println!("Tokens: {:?}", tokens);
-    tokens
 }
 
 /// Determines the precedence of an operator.
@@ -659,14 +2001,7 @@ pub fn tokenize(input: &str, history: &History) -> Vec<Token> {
 /// An integer representing the precedence of the operator.
 /// Returns 0 for unsupported or invalid operators.
 pub fn get_precedence(op: &str) -> i32 {
-    match op {
-        "+" | "-" => 1,
-        "*" | "/" => 2,
-        "^" => 3,
-        "!" | "√" | "sqrt" | "log" | "ln" => 4, 
-        "sin"| "cos"| "tan" | "arctan"| "arcsin"| "arccos" => 5,
-        _ => 0
-    }
+    Operator::from_name(op).map_or(0, Operator::precedence)
 }
 
 /// Determines if operator is a right associative.
@@ -681,7 +2016,18 @@ pub fn get_precedence(op: &str) -> i32 {
 /// - `true` if the operator is right-associative (e.g., `^`, '!').
 /// - `false` otherwise.
 pub fn is_right_associative(op: &str) -> bool {
-    op == "^" || op == "!" 
+    Operator::from_name(op).is_some_and(Operator::is_right_associative)
+}
+
+/// Name of the variable `ReversePolish::write_infix` emits for `ans` when no value is given.
+/// The tokenizer never produces identifiers containing `$`, so it cannot clash with user variables.
+const ANS_VARIABLE: &str = "$ans";
+
+/// An entry of the operator stack of the shunting-yard algorithm.
+#[derive(Clone, Copy)]
+enum Pending {
+    Operator(Operator),
+    Bracket,
 }
 
 /// Takes an infix expression and converts it into a Reverse Polish Notation (RPN) expression.
@@ -701,71 +2047,10 @@ pub fn is_right_associative(op: &str) -> bool {
 ///
 /// * "Mismatched parentheses": If the input expression has an unbalanced number of opening and closing parentheses.
 /// * "Invalid token: ..." : If the tokenizer encounters an unexpected character or sequence of characters that cannot be recognized as a valid token.
-pub fn infix_to_rpn(input: &str, _history: &History) -> Result<ReversePolish, String> {
-    let tokens = tokenize(input, _history);
-    let mut output = Vec::new();
-    let mut op_stack: Vec<Token> = Vec::new();
-
-    fn is_prefix_unary(op: &str) -> bool {
-        op == "sqrt"
-    }
-
-    for token in tokens {
-        match token.token_type {
-            TokenType::Operand | TokenType::Variable => {
-                output.push(token.token_value.clone());
-                if let Some(last_op) = op_stack.last() {
-                    if is_prefix_unary(&last_op.token_value) {
-                        let op = op_stack.pop().unwrap();
-                        output.push(op.token_value);
-                    }
-                }
-            }
-            TokenType::Operator => {
-                if is_prefix_unary(&token.token_value) {
-                    // Delay adding to output until we see the operand
-                    op_stack.push(token);
-                }else {
-                    while let Some(top) = op_stack.last() {
-                    if top.token_value == "(" {
-                        break;
-                    }
-                    let curr_prec = get_precedence(&token.token_value);
-                    let top_prec = get_precedence(&top.token_value);
-
-                    if curr_prec > top_prec || (curr_prec == top_prec && is_right_associative(&token.token_value)) {
-                        break;
-                    }
-                    if let Some(op) = op_stack.pop() {
-                        output.push(op.token_value);
-                    }
-                    }
-                    op_stack.push(token);
-                }
-            }
-            TokenType::Bracket => {
-                if token.token_value == "(" {
-                    op_stack.push(token);
-                } else {
-                    while let Some(top) = op_stack.pop() {
-                        if top.token_value == "(" {
-                            break;
-                        }
-                        output.push(top.token_value);
-                    }
-                }
-            }
-            _ => {}
-        }
-    }
-
-    while let Some(op) = op_stack.pop() {
-        output.push(op.token_value);
-    }
-
-    Ok(ReversePolish {
-        rp_expression: output,
-    })
+pub fn infix_to_rpn(input: &str, history: &History) -> Result<ReversePolish, String> {
+    let mut rpn = ReversePolish::new();
+    rpn.parse_infix(input, history)?;
+    Ok(rpn)
 }
 
 /// Endpoint to process a mathematical expression and return the result as a string.
@@ -781,7 +2066,7 @@ pub fn infix_to_rpn(input: &str, _history: &History) -> Result<ReversePolish, St
 /// - `rpn_expression`: The corresponding expression in Reverse Polish Notation (RPN).
 /// - `result`: The numerical result of the calculation.
 /// - `message`: An additional message providing details about the calculation outcome, 
-///              such as errors or warnings.
+///   such as errors or warnings.
 /// 
 /// #Errors
 /// 
@@ -790,69 +2075,324 @@ pub fn infix_to_rpn(input: &str, _history: &History) -> Result<ReversePolish, St
 /// - If the conversion to C-compatible format fails, an error message is returned.
 /// - If the C function for evaluation fails, an error message with details is included in the response.
 pub fn calculate_expression(input: &str, history: &mut History) -> CalculationResult {
+    calculate_with_context(input, history, None, Precision::default())
+}
+
+/// Same as `calculate_expression`, in the given precision mode.
+/// 
+/// #Arguments
+/// * 'input': A string representation of the infix expression to be processed.
+/// * 'history': The history providing `ans` and recording the calculation.
+/// * 'precision': How the results of the evaluation are rounded, see `Precision`.
+pub fn calculate_expression_with_precision(input: &str, history: &mut History, precision: Precision) -> CalculationResult {
+    calculate_with_context(input, history, None, precision)
+}
+
+/// A reusable, caller-owned result for `calculate_expression_into`.
+///
+/// Unlike `CalculationResult`, it holds no copy of the input, the RPN expression is kept as tokens and
+/// only rendered when displayed, and C library errors are described by a static message. Once its
+/// buffers have grown to fit the expressions it is reused for, filling it does not allocate.
+///
+/// # Fields
+///
+/// * `rpn`: The RPN expression of the last input, reused between calculations.
+/// * `parsed`: Whether the last input was converted to RPN.
+/// * `value`: The result of the last calculation, `0.0` if it failed.
+/// * `error_code`: The error code returned by the C library, `SUCCESS` if the input never reached it.
+/// * `failure`: The message of an input that could not be converted to RPN, empty otherwise.
+pub struct ResultBuf {
+    rpn: ReversePolish,
+    parsed: bool,
+    value: f64,
+    error_code: c_int,
+    failure: String,
+}
+
+impl ResultBuf {
+    /// Creates an empty result.
+    pub fn new() -> Self {
+        ResultBuf {
+            rpn: ReversePolish::new(),
+            parsed: false,
+            value: 0.0,
+            error_code: SUCCESS,
+            failure: String::new(),
+        }
+    }
+
+    /// Returns `true` if the last calculation was successful.
+    pub fn success(&self) -> bool {
+        self.parsed && self.error_code == SUCCESS
+    }
+
+    /// Returns the result of the last calculation, or `None` if it failed.
+    pub fn value(&self) -> Option<f64> {
+        self.success().then_some(self.value)
+    }
+
+    /// Returns the error code of the C library, or `None` if the calculation succeeded or the input could
+    /// not be converted to RPN.
+    pub fn error_code(&self) -> Option<c_int> {
+        (self.parsed && self.error_code != SUCCESS).then_some(self.error_code)
+    }
+
+    /// Returns the message `CalculationResult::message` would hold.
+    pub fn message(&self) -> &str {
+        if self.parsed { get_error_message(self.error_code) } else { &self.failure }
+    }
+
+    /// Returns the RPN expression of the last input, empty if it could not be converted. It is rendered
+    /// as text only when displayed.
+    pub fn rpn(&self) -> Option<&ReversePolish> {
+        self.parsed.then_some(&self.rpn)
+    }
+
+    /// Builds the `CalculationResult` `calculate_expression` would have returned for `input`.
+    pub fn to_calculation_result(&self, input: &str) -> CalculationResult {
+        CalculationResult {
+            success: self.success(),
+            expression: input.trim_matches('"').to_string(),
+            rpn_expression: self.rpn().map(ReversePolish::to_string).unwrap_or_default(),
+            result: self.value,
+            message: self.message().to_string(),
+        }
+    }
+}
+
+impl Default for ResultBuf {
+    fn default() -> Self {
+        ResultBuf::new()
+    }
+}
+
+/// Same as `calculate_expression`, but writes the result into a caller-owned `ResultBuf`.
+///
+/// Reusing the same `ResultBuf` keeps evaluation free of allocations in a loop: the RPN buffers are reused,
+/// and nothing is copied or rendered unless asked for. The calculation is recorded in `history` as usual,
+/// so a `History` that stores entries still copies new inputs; `History::last_result_only` does not.
+///
+/// # Arguments
+///
+/// * `input`: A string representation of the infix expression to be processed.
+/// * `history`: The history providing `ans` and recording the calculation.
+/// * `out`: The result to overwrite.
+pub fn calculate_expression_into(input: &str, history: &mut History, out: &mut ResultBuf) {
+    let input = input.trim_matches('"');
+    out.failure.clear();
+
+    match out.rpn.parse_infix(input, history) {
+        Ok(()) => {
+            let result = out.rpn.calculate();
+            out.parsed = true;
+            out.error_code = result.error_code;
+            out.value = result.result_value;
+            history.add_entry(input, if result.error_code == SUCCESS { Ok(result.result_value) } else { Err(result.error_code) });
+        }
+        Err(e) => {
+            out.parsed = false;
+            out.error_code = SUCCESS;
+            out.value = 0.0;
+            // Writing into a `String` cannot fail
+            let _ = write!(out.failure, "Failed to parse expression: {}", e);
+            history.add_failure(input, &out.failure);
+        }
+    }
+}
+
+/// Shared implementation of `calculate_expression` and `EvalContext::calculate_expression`.
+/// Variables are looked up in `context`, or in the default variables if it is `None`. `precision` only
+/// applies without a context; a context evaluates in its own precision mode.
+fn calculate_with_context(
+    input: &str,
+    history: &mut History,
+    context: Option<&EvalContext>,
+    precision: Precision,
+) -> CalculationResult {
     let input = input.trim_matches('"');
 
     match infix_to_rpn(input, history) {
         Ok(rpn) => {
             let rpn_str = rpn.to_string();
 
-            let (_expr_cstrings, expr_ptrs) = match rpn.to_c_expr() {
-                Ok(data) => data,
-                Err(e) => {
-                    history.add_entry(
-                        input.to_string(),
-                        None,
-                        Some(format!("Failed to convert to RPN: {}", e)),
-                    );
-                    return CalculationResult {
-                        success: false,
-                        expression: input.to_string(),
-                        rpn_expression: rpn_str,
-                        result: 0.0,
-                        message: e,
+            let result = match context {
+                Some(context) => {
+                    let expr_ptrs = rpn.to_c_expr();
+                    let c_expr = CReversePolishExpression {
+                        crpn_expression: expr_ptrs.as_ptr(),
+                        length: expr_ptrs.len(),
                     };
+                    metrics::timed(Stage::Evaluate, || unsafe { calculate_rpn_in_context(context.context, &c_expr) })
                 }
+                None => rpn.calculate_with_precision(precision),
             };
 
-            let c_expr = CReversePolishExpression {
-                crpn_expression: expr_ptrs.as_ptr(),
-                length: expr_ptrs.len(),
-            };
+            finish_calculation(input, rpn_str, result, history)
+        }
+        Err(e) => parse_failure(input, e, history),
+    }
+}
+
+/// Records an evaluated expression in `history` and builds its `CalculationResult`.
+fn finish_calculation(input: &str, rpn_str: String, result: CCalculationResult, history: &mut History) -> CalculationResult {
+    let success = result.error_code == SUCCESS;
+    let message = get_error_message(result.error_code).to_string();
+
+    history.add_entry(input, if success { Ok(result.result_value) } else { Err(result.error_code) });
+
+    CalculationResult {
+        success,
+        expression: input.to_string(),
+        rpn_expression: rpn_str,
+        result: result.result_value,
+        message,
+    }
+}
 
-            let result = unsafe { calculate_rpn(&c_expr) };
+/// Records an RPN expression that could not be converted to C strings in `history` and builds its `CalculationResult`.
+fn conversion_failure(input: &str, rpn_str: String, e: String, history: &mut History) -> CalculationResult {
+    history.add_failure(input, &format!("Failed to convert to RPN: {}", e));
+    CalculationResult {
+        success: false,
+        expression: input.to_string(),
+        rpn_expression: rpn_str,
+        result: 0.0,
+        message: e,
+    }
+}
+
+/// Records an expression that could not be converted to RPN in `history` and builds its `CalculationResult`.
+fn parse_failure(input: &str, e: String, history: &mut History) -> CalculationResult {
+    history.add_failure(input, &format!("Failed to parse expression: {}", e));
+    CalculationResult {
+        success: false,
+        expression: input.to_string(),
+        rpn_expression: String::new(),
+        result: 0.0,
+        message: format!("Failed to parse expression: {}", e),
+    }
+}
 
-            let success = result.error_code == SUCCESS;
-            let message = get_error_message(result.error_code).to_string();
+/// Evaluates many infix expressions with a single call into the C library.
+/// 
+/// Every expression is converted to RPN and its tokens are packed into one flat, null-separated buffer.
+/// The C library then evaluates the whole batch at once, writing into one preallocated result array.
+/// Expressions are evaluated without history, so `ans` resolves to `0`.
+/// 
+/// #Arguments
+/// * 'inputs': The infix expressions to be evaluated.
+/// 
+/// #Returns
+/// 
+/// One 'CalculationResult' per input, in the same order, identical to what `calculate_expression`
+/// returns for that input with an empty `History`.
+pub fn calculate_batch(inputs: &[&str]) -> Vec<CalculationResult> {
+    calculate_batch_with_precision(inputs, Precision::default())
+}
 
-            history.add_entry(
-                input.to_string(),
-                if success { Some(result.result_value) } else { None },
-                if success { None } else { Some(message.clone()) },
-            );
+/// Same as `calculate_batch`, in the given precision mode.
+/// 
+/// #Returns
+/// 
+/// One 'CalculationResult' per input, identical to what `calculate_expression_with_precision` returns for
+/// that input with an empty `History`.
+pub fn calculate_batch_with_precision(inputs: &[&str], precision: Precision) -> Vec<CalculationResult> {
+    let history = History::last_result_only();
+    let mut rpn = ReversePolish::new();
+    let mut parsed = Vec::with_capacity(inputs.len());
+    let mut tokens: Vec<u8> = Vec::new();
+    let mut token_offsets: Vec<usize> = Vec::new();
+    let mut expression_offsets: Vec<usize> = Vec::with_capacity(inputs.len() + 1);
+    expression_offsets.push(0);
+
+    for input in inputs {
+        let input = input.trim_matches('"');
+        let rpn_str = match rpn.parse_infix(input, &history) {
+            Ok(()) => {
+                // The tokens are already null-terminated, so the buffer is copied as is
+                let mut offset = tokens.len();
+                for token in rpn.tokens() {
+                    token_offsets.push(offset);
+                    offset += token.len() + 1;
+                }
+                tokens.extend_from_slice(rpn.buffer.as_bytes());
+                Ok(rpn.to_string())
+            }
+            Err(e) => Err(format!("Failed to parse expression: {}", e)),
+        };
+        expression_offsets.push(token_offsets.len());
+        parsed.push((input, rpn_str));
+    }
 
-            CalculationResult {
-                success,
+    let mut c_results = vec![CCalculationResult { result_value: 0.0, error_code: SUCCESS }; inputs.len()];
+    metrics::timed(Stage::Evaluate, || unsafe {
+        calculate_rpn_batch_with_precision(
+            tokens.as_ptr() as *const c_char,
+            token_offsets.as_ptr(),
+            expression_offsets.as_ptr(),
+            inputs.len(),
+            c_results.as_mut_ptr(),
+            precision as c_int,
+        );
+    });
+
+    parsed
+        .into_iter()
+        .zip(c_results)
+        .map(|((input, rpn_str), result)| match rpn_str {
+            Ok(rpn_str) => CalculationResult {
+                success: result.error_code == SUCCESS,
                 expression: input.to_string(),
                 rpn_expression: rpn_str,
                 result: result.result_value,
-                message,
-            }
-        }
-        Err(e) => {
-            history.add_entry(
-                input.to_string(),
-                None,
-                Some(format!("Failed to parse expression: {}", e)),
-            );
-            CalculationResult {
+                message: get_error_message(result.error_code).to_string(),
+            },
+            Err(e) => CalculationResult {
                 success: false,
                 expression: input.to_string(),
                 rpn_expression: String::new(),
                 result: 0.0,
-                message: format!("Failed to parse expression: {}", e),
-            }
-        }
+                message: e,
+            },
+        })
+        .collect()
+}
+
+/// Evaluates many infix expressions in parallel, one `calculate_batch` call per core.
+/// 
+/// The C library keeps no global mutable state, so the inputs are split into one contiguous chunk per
+/// available core and each chunk is evaluated by `calculate_batch` on its own scoped thread.
+/// 
+/// #Arguments
+/// * 'inputs': The infix expressions to be evaluated.
+/// 
+/// #Returns
+/// 
+/// One 'CalculationResult' per input, in the same order as `calculate_batch` returns them.
+pub fn calculate_batch_par(inputs: &[&str]) -> Vec<CalculationResult> {
+    calculate_batch_par_with_precision(inputs, Precision::default())
+}
+
+/// Same as `calculate_batch_par`, in the given precision mode.
+pub fn calculate_batch_par_with_precision(inputs: &[&str], precision: Precision) -> Vec<CalculationResult> {
+    let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let chunk_size = inputs.len().div_ceil(threads).max(1);
+    if threads == 1 || inputs.len() <= chunk_size {
+        return calculate_batch_with_precision(inputs, precision);
     }
+
+    std::thread::scope(|scope| {
+        let handles: Vec<_> = inputs
+            .chunks(chunk_size)
+            .map(|chunk| scope.spawn(move || calculate_batch_with_precision(chunk, precision)))
+            .collect();
+
+        let mut results = Vec::with_capacity(inputs.len());
+        for handle in handles {
+            results.extend(handle.join().expect("calculate_batch panicked"));
+        }
+        results
+    })
 }
 
 /// Represents the result of a conversion between Reverse Polish Notation (RPN) and infix notation.
@@ -896,7 +2436,7 @@ impl CalculationResult {
 /// - `rpn_expression`: The corresponding expression in Reverse Polish Notation (RPN).
 /// - `result`: The numerical result of the calculation.
 /// - `message`: An additional message providing details about the calculation outcome, 
-///              such as errors or warnings.
+///   such as errors or warnings.
 /// 
 /// #Errors
 /// 
@@ -906,11 +2446,8 @@ impl CalculationResult {
 /// - If the C function for evaluation fails, an error message with details is included in the response.
 pub fn convert_rpn(input: String) -> ConversionResult {
     let input = input.trim_matches('"');
-    let tokens: Vec<String> = input.split_whitespace().map(String::from).collect();
-    let rpn = ReversePolish { rp_expression: tokens };
-
-    let (_expr_cstrings, expr_ptrs) = match rpn.to_c_expr() {
-        Ok(data) => data,
+    let rpn = match ReversePolish::from_tokens(input.split_whitespace()) {
+        Ok(rpn) => rpn,
         Err(e) => {
             return ConversionResult {
                 success: false,
@@ -921,26 +2458,39 @@ pub fn convert_rpn(input: String) -> ConversionResult {
         }
     };
 
+    let expr_ptrs = rpn.to_c_expr();
     let c_expr = CReversePolishExpression {
         crpn_expression: expr_ptrs.as_ptr(),
         length: expr_ptrs.len(),
     };
 
-    let result = unsafe {
-        let c_result = convert_rpn_to_infix(&c_expr);
-        let infix_expression = match CStr::from_ptr(c_result.result_expression.as_ptr()).to_str() {
-            Ok(s) => s.to_owned(),
-            Err(_) => return ConversionResult {
-                success: false,
-                rpn_expression: input.to_string(),
-                infix_expression: String::new(),
-                message: "Invalid UTF-8 in result".to_string()
-            }
+    // Operands and operators, plus room for the spaces and a few parentheses
+    let mut buffer: Vec<u8> = Vec::with_capacity(2 * rpn.buffer.len() + 1);
+    let mut length = 0;
+    let mut error_code = unsafe {
+        convert_rpn_to_infix_into(&c_expr, buffer.as_mut_ptr() as *mut c_char, buffer.capacity(), &mut length)
+    };
+    if error_code == SUCCESS && length >= buffer.capacity() {
+        buffer.reserve_exact(length + 1);
+        error_code = unsafe {
+            convert_rpn_to_infix_into(&c_expr, buffer.as_mut_ptr() as *mut c_char, buffer.capacity(), &mut length)
         };
-        (c_result.error_code, infix_expression)
+    }
+    if error_code == SUCCESS {
+        // The C library wrote `length` bytes and a null terminator
+        unsafe { buffer.set_len(length) };
+    }
+
+    let infix_expression = match String::from_utf8(buffer) {
+        Ok(s) => s,
+        Err(_) => return ConversionResult {
+            success: false,
+            rpn_expression: input.to_string(),
+            infix_expression: String::new(),
+            message: "Invalid UTF-8 in result".to_string()
+        }
     };
 
-    let (error_code, infix_expression) = result;
     let success = error_code == SUCCESS;
     let message = get_error_message(error_code).to_string();
 
@@ -0,0 +1,424 @@
+//! ./src/main.rs
+//! Command line front end evaluating newline-delimited expressions in bulk.
+//!
+//! Reads infix expressions (or RPN expressions with `--rpn`) from files or stdin, one per line, and writes
+//! one CSV or JSON-lines record per expression in input order. Lines are processed in chunks: every chunk
+//! goes through `calculate_batch_par` (or `convert_rpn` on scoped threads) and its records are written
+//! through one buffered writer before the next chunk is read, so memory use does not grow with the input.
+//! Regular files, including a redirected stdin, are memory-mapped and read without copying; the pages of
+//! each finished chunk are released, so even multi-gigabyte files keep a small resident set.
+//!
+//! Usage: `calculator-backend [--rpn] [--format csv|jsonl] [--chunk LINES] [FILE...]`
+//!
+//! Without a file, or with `-`, expressions are read from stdin. Blank lines are skipped. Expressions are
+//! evaluated independently, so `ans` resolves to `0`.
+
+use std::borrow::Cow;
+use std::fs::File;
+use std::io::{self, BufRead, BufReader, BufWriter, Read, Write};
+use std::os::unix::io::AsRawFd;
+use std::process::ExitCode;
+
+use calculator_backend::{calculate_batch_par, convert_rpn, CalculationResult, ConversionResult};
+
+const USAGE: &str = "Usage: calculator-backend [--rpn] [--format csv|jsonl] [--chunk LINES] [FILE...]
+
+Evaluates one expression per line from each FILE, or from stdin if no FILE or `-` is given.
+
+Options:
+  --rpn             Read RPN expressions and convert them to infix instead of evaluating infix ones
+  --format FORMAT   Write `csv` records with a header (the default) or `jsonl` objects
+  --chunk LINES     Number of lines evaluated per batch (default 16384)
+  --help            Print this message";
+
+/// Output record format.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Format {
+    Csv,
+    JsonLines,
+}
+
+/// Command line options.
+///
+/// # Fields
+///
+/// * `rpn`: Whether lines are RPN expressions to convert rather than infix expressions to evaluate.
+/// * `format`: The format of the records written to stdout.
+/// * `chunk_lines`: The maximum number of lines evaluated per batch.
+/// * `paths`: The files to read in order, `-` for stdin.
+struct Options {
+    rpn: bool,
+    format: Format,
+    chunk_lines: usize,
+    paths: Vec<String>,
+}
+
+impl Options {
+    /// Parses the arguments after the program name.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` describing the first invalid argument.
+    fn parse(mut args: impl Iterator<Item = String>) -> Result<Options, String> {
+        let mut options = Options { rpn: false, format: Format::Csv, chunk_lines: 16_384, paths: Vec::new() };
+        while let Some(arg) = args.next() {
+            match arg.as_str() {
+                "--rpn" => options.rpn = true,
+                "--format" => {
+                    options.format = match args.next().as_deref() {
+                        Some("csv") => Format::Csv,
+                        Some("jsonl") => Format::JsonLines,
+                        other => return Err(format!("Unknown format {:?}, expected csv or jsonl", other.unwrap_or(""))),
+                    }
+                }
+                "--chunk" => {
+                    options.chunk_lines = args
+                        .next()
+                        .and_then(|lines| lines.parse().ok())
+                        .filter(|&lines| lines > 0)
+                        .ok_or_else(|| "--chunk expects a positive number of lines".to_string())?;
+                }
+                _ if arg.starts_with("--") => return Err(format!("Unknown option {}", arg)),
+                _ => options.paths.push(arg),
+            }
+        }
+        if options.paths.is_empty() {
+            options.paths.push("-".to_string());
+        }
+        Ok(options)
+    }
+}
+
+/// A read-only, private memory mapping of a whole file, read front to back.
+///
+/// # Fields
+///
+/// * `ptr`: The start of the mapping, null if the file is empty.
+/// * `len`: The length of the file.
+/// * `released`: The length of the page-aligned prefix already returned to the kernel.
+struct MappedFile {
+    ptr: *mut libc::c_void,
+    len: usize,
+    released: usize,
+}
+
+impl MappedFile {
+    /// Maps `file` if it is a regular file, or returns `None` for pipes, terminals and failed mappings,
+    /// which are read as streams instead.
+    fn new(file: &File) -> Option<MappedFile> {
+        let metadata = file.metadata().ok()?;
+        if !metadata.is_file() {
+            return None;
+        }
+        let len = usize::try_from(metadata.len()).ok()?;
+        if len == 0 {
+            return Some(MappedFile { ptr: std::ptr::null_mut(), len: 0, released: 0 });
+        }
+        let ptr = unsafe {
+            libc::mmap(std::ptr::null_mut(), len, libc::PROT_READ, libc::MAP_PRIVATE, file.as_raw_fd(), 0)
+        };
+        if ptr == libc::MAP_FAILED {
+            return None;
+        }
+        // Read-ahead is more aggressive for sequential mappings; failure only costs speed
+        unsafe { libc::madvise(ptr, len, libc::MADV_SEQUENTIAL) };
+        Some(MappedFile { ptr, len, released: 0 })
+    }
+
+    fn bytes(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+        unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+
+    /// Returns the pages entirely before `offset` to the kernel. They are only read again from the file
+    /// if accessed, which never happens since the file is read front to back.
+    fn release_before(&mut self, offset: usize) {
+        let page_size = unsafe { libc::sysconf(libc::_SC_PAGESIZE) }.max(1) as usize;
+        let end = offset / page_size * page_size;
+        if end > self.released {
+            unsafe { libc::madvise((self.ptr as *mut u8).add(self.released) as *mut libc::c_void, end - self.released, libc::MADV_DONTNEED) };
+            self.released = end;
+        }
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe { libc::munmap(self.ptr, self.len) };
+        }
+    }
+}
+
+/// Returns the expression on `line`, without its line ending, or `None` if it is blank.
+/// Invalid UTF-8 is replaced, so the line is still evaluated and reported.
+fn expression(line: &[u8]) -> Option<Cow<'_, str>> {
+    let line = line.strip_suffix(b"\r").unwrap_or(line);
+    if line.iter().all(u8::is_ascii_whitespace) {
+        return None;
+    }
+    Some(String::from_utf8_lossy(line))
+}
+
+/// Evaluates chunks of expressions and writes their records.
+///
+/// # Fields
+///
+/// * `options`: The command line options.
+/// * `out`: The buffered writer every record goes through.
+struct Pipeline<W: Write> {
+    options: Options,
+    out: W,
+}
+
+impl<W: Write> Pipeline<W> {
+    fn new(options: Options, mut out: W) -> io::Result<Self> {
+        if options.format == Format::Csv {
+            let header = if options.rpn { "rpn_expression,success,infix_expression,message\n" } else { "expression,success,result,message\n" };
+            out.write_all(header.as_bytes())?;
+        }
+        Ok(Pipeline { options, out })
+    }
+
+    /// Evaluates one chunk of lines and writes one record per expression, in order.
+    fn process(&mut self, lines: &[Cow<str>]) -> io::Result<()> {
+        let inputs: Vec<&str> = lines.iter().map(|line| line.as_ref()).collect();
+        if self.options.rpn {
+            for result in convert_rpn_par(&inputs) {
+                write_conversion(&mut self.out, self.options.format, &result)?;
+            }
+        } else {
+            for result in calculate_batch_par(&inputs) {
+                write_calculation(&mut self.out, self.options.format, &result)?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Processes a memory-mapped file, one chunk of lines at a time.
+    fn process_mapped(&mut self, mut file: MappedFile) -> io::Result<()> {
+        let mut start = 0;
+        while start < file.len {
+            // The lines borrow the mapping, so they are dropped before the pages of the chunk are released
+            start = {
+                let bytes = file.bytes();
+                let mut lines = Vec::with_capacity(self.options.chunk_lines);
+                let mut position = start;
+                while position < bytes.len() && lines.len() < self.options.chunk_lines {
+                    let end = memchr_newline(&bytes[position..]).map_or(bytes.len(), |i| position + i);
+                    lines.extend(expression(&bytes[position..end]));
+                    position = end + 1;
+                }
+                self.process(&lines)?;
+                position.min(bytes.len())
+            };
+            file.release_before(start);
+        }
+        Ok(())
+    }
+
+    /// Processes a stream, reading one chunk of lines at a time into a reused buffer.
+    fn process_stream(&mut self, reader: impl Read) -> io::Result<()> {
+        let mut reader = BufReader::with_capacity(1 << 20, reader);
+        let mut buffer: Vec<u8> = Vec::new();
+        let mut ends: Vec<usize> = Vec::with_capacity(self.options.chunk_lines);
+        loop {
+            buffer.clear();
+            ends.clear();
+            while ends.len() < self.options.chunk_lines && reader.read_until(b'\n', &mut buffer)? > 0 {
+                if buffer.last() == Some(&b'\n') {
+                    buffer.pop();
+                }
+                ends.push(buffer.len());
+            }
+            if ends.is_empty() {
+                return Ok(());
+            }
+            let mut start = 0;
+            let lines: Vec<Cow<str>> = ends
+                .iter()
+                .filter_map(|&end| {
+                    let line = expression(&buffer[start..end]);
+                    start = end;
+                    line
+                })
+                .collect();
+            self.process(&lines)?;
+        }
+    }
+
+    /// Processes the file at `path`, or stdin for `-`.
+    fn process_path(&mut self, path: &str) -> io::Result<()> {
+        if path == "-" {
+            let stdin = io::stdin();
+            // A redirected file is mapped like any other file
+            let file = unsafe { std::mem::ManuallyDrop::new(<File as std::os::unix::io::FromRawFd>::from_raw_fd(stdin.as_raw_fd())) };
+            return match MappedFile::new(&file) {
+                Some(mapped) => self.process_mapped(mapped),
+                None => self.process_stream(stdin.lock()),
+            };
+        }
+        let file = File::open(path).map_err(|e| io::Error::new(e.kind(), format!("{}: {}", path, e)))?;
+        match MappedFile::new(&file) {
+            Some(mapped) => self.process_mapped(mapped),
+            None => self.process_stream(file),
+        }
+    }
+}
+
+/// Returns the position of the first newline in `bytes`, scanning a word at a time.
+fn memchr_newline(bytes: &[u8]) -> Option<usize> {
+    const LOW: u64 = u64::from_ne_bytes([0x01; 8]);
+    const HIGH: u64 = u64::from_ne_bytes([0x80; 8]);
+    const NEWLINES: u64 = u64::from_ne_bytes([b'\n'; 8]);
+
+    let mut chunks = bytes.chunks_exact(8);
+    let mut offset = 0;
+    for chunk in &mut chunks {
+        let word = u64::from_ne_bytes(chunk.try_into().unwrap()) ^ NEWLINES;
+        // Nonzero exactly when one of the bytes of `word` is zero
+        if word.wrapping_sub(LOW) & !word & HIGH != 0 {
+            break;
+        }
+        offset += 8;
+    }
+    bytes[offset..].iter().position(|&byte| byte == b'\n').map(|i| offset + i)
+}
+
+/// Converts RPN expressions with `convert_rpn`, one contiguous share of `inputs` per available core.
+fn convert_rpn_par(inputs: &[&str]) -> Vec<ConversionResult> {
+    let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let chunk_size = inputs.len().div_ceil(threads).max(1);
+    if threads == 1 || inputs.len() <= chunk_size {
+        return inputs.iter().map(|input| convert_rpn(input.to_string())).collect();
+    }
+    std::thread::scope(|scope| {
+        let handles: Vec<_> = inputs
+            .chunks(chunk_size)
+            .map(|chunk| scope.spawn(move || chunk.iter().map(|input| convert_rpn(input.to_string())).collect::<Vec<_>>()))
+            .collect();
+        handles.into_iter().flat_map(|handle| handle.join().expect("convert_rpn panicked")).collect()
+    })
+}
+
+/// Writes `value` as a CSV field, quoted if it contains a separator, a quote or a line break.
+fn write_csv_field(out: &mut impl Write, value: &str) -> io::Result<()> {
+    if value.contains([',', '"', '\n', '\r']) {
+        write!(out, "\"{}\"", value.replace('"', "\"\""))
+    } else {
+        out.write_all(value.as_bytes())
+    }
+}
+
+/// Writes `value` as a JSON string.
+fn write_json_string(out: &mut impl Write, value: &str) -> io::Result<()> {
+    out.write_all(b"\"")?;
+    let mut start = 0;
+    for (i, c) in value.char_indices() {
+        let escape = match c {
+            '"' => "\\\"",
+            '\\' => "\\\\",
+            '\n' => "\\n",
+            '\r' => "\\r",
+            '\t' => "\\t",
+            c if (c as u32) < 0x20 => "",
+            _ => continue,
+        };
+        out.write_all(&value.as_bytes()[start..i])?;
+        if escape.is_empty() {
+            write!(out, "\\u{:04x}", c as u32)?;
+        } else {
+            out.write_all(escape.as_bytes())?;
+        }
+        start = i + c.len_utf8();
+    }
+    out.write_all(&value.as_bytes()[start..])?;
+    out.write_all(b"\"")
+}
+
+fn write_calculation(out: &mut impl Write, format: Format, result: &CalculationResult) -> io::Result<()> {
+    match format {
+        Format::Csv => {
+            write_csv_field(out, &result.expression)?;
+            write!(out, ",{},", result.success)?;
+            if result.success {
+                write!(out, "{}", result.result)?;
+            }
+            out.write_all(b",")?;
+            write_csv_field(out, &result.message)?;
+            out.write_all(b"\n")
+        }
+        Format::JsonLines => {
+            out.write_all(b"{\"expression\":")?;
+            write_json_string(out, &result.expression)?;
+            write!(out, ",\"success\":{},\"result\":", result.success)?;
+            // JSON has no infinities or NaN
+            if result.success && result.result.is_finite() {
+                write!(out, "{}", result.result)?;
+            } else {
+                out.write_all(b"null")?;
+            }
+            out.write_all(b",\"message\":")?;
+            write_json_string(out, &result.message)?;
+            out.write_all(b"}\n")
+        }
+    }
+}
+
+fn write_conversion(out: &mut impl Write, format: Format, result: &ConversionResult) -> io::Result<()> {
+    match format {
+        Format::Csv => {
+            write_csv_field(out, &result.rpn_expression)?;
+            write!(out, ",{},", result.success)?;
+            write_csv_field(out, &result.infix_expression)?;
+            out.write_all(b",")?;
+            write_csv_field(out, &result.message)?;
+            out.write_all(b"\n")
+        }
+        Format::JsonLines => {
+            out.write_all(b"{\"rpn_expression\":")?;
+            write_json_string(out, &result.rpn_expression)?;
+            write!(out, ",\"success\":{},\"infix_expression\":", result.success)?;
+            write_json_string(out, &result.infix_expression)?;
+            out.write_all(b",\"message\":")?;
+            write_json_string(out, &result.message)?;
+            out.write_all(b"}\n")
+        }
+    }
+}
+
+fn run(options: Options) -> io::Result<()> {
+    let paths = options.paths.clone();
+    let stdout = io::stdout();
+    let mut pipeline = Pipeline::new(options, BufWriter::with_capacity(1 << 16, stdout.lock()))?;
+    for path in &paths {
+        pipeline.process_path(path)?;
+    }
+    pipeline.out.flush()
+}
+
+fn main() -> ExitCode {
+    let args: Vec<String> = std::env::args().skip(1).collect();
+    if args.iter().any(|arg| arg == "--help" || arg == "-h") {
+        println!("{}", USAGE);
+        return ExitCode::SUCCESS;
+    }
+    let options = match Options::parse(args.into_iter()) {
+        Ok(options) => options,
+        Err(e) => {
+            eprintln!("{}\n\n{}", e, USAGE);
+            return ExitCode::from(2);
+        }
+    };
+    match run(options) {
+        Ok(()) => ExitCode::SUCCESS,
+        // Stopping early because the reader went away, as in `| head`, is not an error
+        Err(e) if e.kind() == io::ErrorKind::BrokenPipe => ExitCode::SUCCESS,
+        Err(e) => {
+            eprintln!("calculator-backend: {}", e);
+            ExitCode::FAILURE
+        }
+    }
+}
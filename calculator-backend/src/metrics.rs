@@ -0,0 +1,554 @@
+//! ./src/metrics.rs
+//! Performance counters and per-stage timings, recorded with the `metrics` cargo feature.
+//!
+//! The wrapper times each stage of the pipeline and counts tokens, native evaluations, cache lookups and,
+//! with `CountingAllocator` installed, heap allocations. The C library counts evaluations, the instructions
+//! they run, their error codes and its own time (`metrics_read` in calculator.c). Both sides keep one set
+//! of counters per thread, up to `SHARDS` sets, so threads rarely update the same cache line, and only use
+//! relaxed atomics. `metrics_snapshot` adds the sets up.
+//!
+//! Every recording call tests `cfg!(feature = "metrics")` first. Without the feature the test folds to
+//! `false` and the call, including its reads of the clock, is removed by the compiler; the snapshot is
+//! then all zeros.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+use std::fmt::Write as _;
+use std::os::raw::c_int;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::time::{Duration, Instant};
+
+use super::operators::OPERATOR_SPECS;
+use super::SUCCESS;
+
+// Values are counted in buckets of 1/8 of a power of two, up to 2^40
+const SUB_BUCKET_BITS: u32 = 3;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+const MAX_VALUE_BITS: u32 = 40;
+const BUCKETS: usize = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) as usize * SUB_BUCKETS;
+
+/// A lock-free log-linear histogram, exact to within 1/8.
+///
+/// # Fields
+///
+/// * `buckets`: The number of values recorded in each bucket.
+/// * `count`: The number of values recorded.
+/// * `sum`: The sum of all recorded values.
+pub(crate) struct Histogram {
+    buckets: [AtomicU64; BUCKETS],
+    count: AtomicU64,
+    sum: AtomicU64,
+}
+
+impl Histogram {
+    pub(crate) const fn new() -> Self {
+        Histogram {
+            buckets: [const { AtomicU64::new(0) }; BUCKETS],
+            count: AtomicU64::new(0),
+            sum: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns the bucket counting `value`: values below 8 have their own bucket, larger values share one
+    /// with the others of the same power of two and the same next three bits.
+    fn bucket(value: u64) -> usize {
+        if value < SUB_BUCKETS as u64 {
+            return value as usize;
+        }
+        let shift = 63 - value.leading_zeros() - SUB_BUCKET_BITS;
+        (shift as usize + 1) * SUB_BUCKETS + ((value >> shift) as usize & (SUB_BUCKETS - 1))
+    }
+
+    /// Returns the largest value counted in `bucket`.
+    fn bucket_limit(bucket: usize) -> u64 {
+        if bucket < SUB_BUCKETS {
+            return bucket as u64;
+        }
+        let shift = bucket / SUB_BUCKETS - 1;
+        (((SUB_BUCKETS + bucket % SUB_BUCKETS + 1) as u64) << shift) - 1
+    }
+
+    pub(crate) fn record(&self, value: u64) {
+        let value = value.min(1 << MAX_VALUE_BITS);
+        self.buckets[Self::bucket(value)].fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(value, Ordering::Relaxed);
+    }
+
+    pub(crate) fn count(&self) -> u64 {
+        self.count.load(Ordering::Relaxed)
+    }
+
+    pub(crate) fn sum(&self) -> u64 {
+        self.sum.load(Ordering::Relaxed)
+    }
+
+    /// Returns the upper bound of the bucket holding the `quantile` (between 0 and 1) of the recorded
+    /// values, or zero if none were recorded.
+    #[cfg_attr(not(feature = "server"), allow(dead_code))] // Only read by the server
+    pub(crate) fn quantile(&self, quantile: f64) -> u64 {
+        let mut counts = [0; BUCKETS];
+        self.add_counts(&mut counts);
+        Self::quantile_of(&counts, quantile)
+    }
+
+    /// Adds the number of values of each bucket to `counts`, to merge histograms.
+    fn add_counts(&self, counts: &mut [u64; BUCKETS]) {
+        for (total, bucket) in counts.iter_mut().zip(&self.buckets) {
+            *total += bucket.load(Ordering::Relaxed);
+        }
+    }
+
+    /// Same as `quantile`, over bucket counts filled by `add_counts`.
+    fn quantile_of(counts: &[u64; BUCKETS], quantile: f64) -> u64 {
+        let total: u64 = counts.iter().sum();
+        if total == 0 {
+            return 0;
+        }
+        let rank = ((quantile * total as f64).ceil() as u64).clamp(1, total);
+        let mut seen = 0;
+        for (bucket, &count) in counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Self::bucket_limit(bucket);
+            }
+        }
+        Self::bucket_limit(BUCKETS - 1)
+    }
+
+    fn reset(&self) {
+        for bucket in &self.buckets {
+            bucket.store(0, Ordering::Relaxed);
+        }
+        self.count.store(0, Ordering::Relaxed);
+        self.sum.store(0, Ordering::Relaxed);
+    }
+}
+
+/// A stage of the pipeline, timed from the wrapper.
+///
+/// * `Parse`: Tokenizing an infix expression and ordering it into RPN (`ReversePolish::parse_infix`). The
+///   tokenizer runs inside the shunting-yard loop, one token at a time, so both are timed together.
+/// * `ToCExpr`: Building the token pointers of an RPN expression for the C library (`to_c_expr`).
+/// * `Compile`: Compiling an RPN expression into a program (`compile_rpn`, `compile_rpn_in_context`).
+/// * `Evaluate`: One call into an evaluator of the C library, from crossing into it until its result is
+///   back, with the arguments it is passed. A batch or a set of columns is one call.
+/// * `Native`: One evaluation of a compiled expression by its native code, see `set_jit_threshold`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Stage {
+    Parse = 0,
+    ToCExpr = 1,
+    Compile = 2,
+    Evaluate = 3,
+    Native = 4,
+}
+
+/// Every `Stage`, in order.
+pub const STAGES: [Stage; 5] = [Stage::Parse, Stage::ToCExpr, Stage::Compile, Stage::Evaluate, Stage::Native];
+
+impl Stage {
+    /// Returns the name of the stage in the Prometheus output.
+    pub fn name(self) -> &'static str {
+        match self {
+            Stage::Parse => "parse",
+            Stage::ToCExpr => "to_c_expr",
+            Stage::Compile => "compile",
+            Stage::Evaluate => "evaluate",
+            Stage::Native => "native",
+        }
+    }
+}
+
+/// The number of error codes of the C library, from `SUCCESS` to `INVALID_TRIG_OPERATOR`.
+pub const ERROR_CODE_COUNT: usize = 14;
+
+// Opcodes of calculator.c: the two pushes, the operators, then OP_SQUARE, OP_ADD_CONSTANT,
+// OP_INTEGER_POWER and OP_FAIL
+const OPCODE_COUNT: usize = OPERATOR_SPECS.len() + 6;
+
+// Layout of the counters copied by `metrics_read`, the METRIC_* indices of calculator.c
+const METRIC_EVALUATIONS: usize = 0;
+const METRIC_EVALUATE_NANOS: usize = 1;
+const METRIC_STACK_ALLOCATIONS: usize = 2;
+const METRIC_OPCODES: usize = 3;
+const METRIC_ERRORS: usize = METRIC_OPCODES + OPCODE_COUNT;
+const METRIC_COUNT: usize = METRIC_ERRORS + ERROR_CODE_COUNT;
+
+// ## `metrics_read`
+// Copies the counters of the C library, summed over every thread, into an array laid out as METRIC_*.
+// Returns `MEMORY_ERROR` unless `count` is METRIC_COUNT. Every counter is 0 without the `metrics` feature.
+//
+// ## `metrics_reset`
+// Sets the counters of the C library back to 0.
+extern "C" {
+    fn metrics_read(values: *mut u64, count: usize) -> c_int;
+    fn metrics_reset();
+}
+
+// Sets of counters of the wrapper; threads beyond this many share them. A single one without the feature.
+const SHARDS: usize = if cfg!(feature = "metrics") { 16 } else { 1 };
+
+/// The counters of the wrapper updated by the threads assigned to them.
+///
+/// # Fields
+///
+/// * `stages`: The time of each `Stage` in nanoseconds, indexed by `Stage`.
+/// * `tokens`: The number of tokens parsed.
+/// * `native_errors`: The number of native evaluations per error code.
+/// * `cache_hits`, `cache_misses`: The number of lookups of an `ExpressionCache` that found, or did not
+///   find, a compiled program.
+/// * `allocations`, `allocated_bytes`: The number of heap allocations through `CountingAllocator`, and
+///   their total size.
+#[repr(align(64))]
+struct Shard {
+    stages: [Histogram; STAGES.len()],
+    tokens: AtomicU64,
+    native_errors: [AtomicU64; ERROR_CODE_COUNT],
+    cache_hits: AtomicU64,
+    cache_misses: AtomicU64,
+    allocations: AtomicU64,
+    allocated_bytes: AtomicU64,
+}
+
+impl Shard {
+    const fn new() -> Self {
+        Shard {
+            stages: [const { Histogram::new() }; STAGES.len()],
+            tokens: AtomicU64::new(0),
+            native_errors: [const { AtomicU64::new(0) }; ERROR_CODE_COUNT],
+            cache_hits: AtomicU64::new(0),
+            cache_misses: AtomicU64::new(0),
+            allocations: AtomicU64::new(0),
+            allocated_bytes: AtomicU64::new(0),
+        }
+    }
+}
+
+static SHARD_SETS: [Shard; SHARDS] = [const { Shard::new() }; SHARDS];
+static NEXT_SHARD: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    // The index of the shard of this thread, `usize::MAX` until its first update. Constant-initialized
+    // without a destructor, so `CountingAllocator` can read it without allocating.
+    static SHARD: Cell<usize> = const { Cell::new(usize::MAX) };
+}
+
+/// Returns the counters of the calling thread, assigning them on its first call.
+#[inline]
+// Without the `metrics` feature there is a single shard
+#[allow(clippy::modulo_one)]
+fn shard() -> &'static Shard {
+    let index = SHARD
+        .try_with(|shard| {
+            if shard.get() == usize::MAX {
+                shard.set(NEXT_SHARD.fetch_add(1, Ordering::Relaxed) % SHARDS);
+            }
+            shard.get()
+        })
+        // Allocations while the thread exits
+        .unwrap_or(0);
+    &SHARD_SETS[index]
+}
+
+/// Runs `run` and records its time as `stage`.
+#[inline(always)]
+pub(crate) fn timed<R>(stage: Stage, run: impl FnOnce() -> R) -> R {
+    if !cfg!(feature = "metrics") {
+        return run();
+    }
+    let start = Instant::now();
+    let result = run();
+    shard().stages[stage as usize].record(start.elapsed().as_nanos() as u64);
+    result
+}
+
+/// Counts `count` parsed tokens.
+#[inline(always)]
+pub(crate) fn count_tokens(count: usize) {
+    if cfg!(feature = "metrics") {
+        shard().tokens.fetch_add(count as u64, Ordering::Relaxed);
+    }
+}
+
+/// Counts an evaluation by native code and its error code.
+#[inline(always)]
+pub(crate) fn count_native(error_code: c_int) {
+    if cfg!(feature = "metrics") {
+        if let Some(counter) = shard().native_errors.get(error_code as usize) {
+            counter.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Counts a lookup of an `ExpressionCache`.
+#[inline(always)]
+pub(crate) fn count_cache_lookup(hit: bool) {
+    if cfg!(feature = "metrics") {
+        let shard = shard();
+        let counter = if hit { &shard.cache_hits } else { &shard.cache_misses };
+        counter.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// A global allocator counting the heap allocations of the process, reported by `metrics_snapshot`.
+///
+/// A library cannot choose the allocator of a program, so allocations are only counted in programs that
+/// install this one. It forwards everything to the system allocator, and without the `metrics` feature it
+/// counts nothing.
+///
+/// ```
+/// use calculator_backend::CountingAllocator;
+///
+/// #[global_allocator]
+/// static ALLOCATOR: CountingAllocator = CountingAllocator;
+/// # fn main() {}
+/// ```
+pub struct CountingAllocator;
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        count_allocation(layout.size());
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        count_allocation(layout.size());
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        count_allocation(new_size);
+        System.realloc(ptr, layout, new_size)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[inline(always)]
+fn count_allocation(size: usize) {
+    if cfg!(feature = "metrics") {
+        let shard = shard();
+        shard.allocations.fetch_add(1, Ordering::Relaxed);
+        shard.allocated_bytes.fetch_add(size as u64, Ordering::Relaxed);
+    }
+}
+
+/// The time of one `Stage`, see `metrics_snapshot`.
+///
+/// # Fields
+///
+/// * `count`: The number of times the stage ran.
+/// * `total`: Its total time.
+/// * `p50`, `p99`: Its median and 99th percentile time, to within 1/8.
+#[derive(Debug, Clone, Copy, PartialEq, Default)]
+pub struct StageMetrics {
+    pub count: u64,
+    pub total: Duration,
+    pub p50: Duration,
+    pub p99: Duration,
+}
+
+/// A point-in-time copy of the counters of the `metrics` feature, see `metrics_snapshot`.
+///
+/// # Fields
+///
+/// * `stages`: The time of each stage, indexed by `Stage`, see `stage`.
+/// * `expressions`: The number of results evaluated: one per expression, or one per row over columns.
+/// * `native_evaluations`: How many of those were evaluated by native code.
+/// * `tokens`: The number of tokens parsed from infix expressions.
+/// * `instructions`: The name of each opcode of the C library, in opcode order, and how many times the
+///   interpreters ran it. Native code is not counted. An instruction over columns counts once per row.
+/// * `error_codes`: The number of results per error code, indexed by code as in `get_error_message`.
+/// * `evaluator_time`: The time spent inside the evaluators of the C library. The rest of
+///   `Stage::Evaluate` is the cost of calling them, see `call_overhead`.
+/// * `cache_hits`, `cache_misses`: The number of `ExpressionCache` lookups that found, or did not find,
+///   a compiled program.
+/// * `stack_allocations`: The number of evaluation stacks the C library allocated because its pool had
+///   none large enough.
+/// * `allocations`, `allocated_bytes`: The number and total size of heap allocations, only counted with
+///   `CountingAllocator` installed.
+#[derive(Debug, Clone, PartialEq, Default)]
+pub struct PipelineMetrics {
+    pub stages: [StageMetrics; STAGES.len()],
+    pub expressions: u64,
+    pub native_evaluations: u64,
+    pub tokens: u64,
+    pub instructions: Vec<(String, u64)>,
+    pub error_codes: [u64; ERROR_CODE_COUNT],
+    pub evaluator_time: Duration,
+    pub cache_hits: u64,
+    pub cache_misses: u64,
+    pub stack_allocations: u64,
+    pub allocations: u64,
+    pub allocated_bytes: u64,
+}
+
+/// Returns the names of the opcodes of calculator.c, in opcode order.
+fn opcode_names() -> Vec<String> {
+    let operators = OPERATOR_SPECS
+        .iter()
+        .map(|spec| spec.opcode.trim_start_matches("OP_").to_lowercase());
+    ["push_number", "push_variable"]
+        .into_iter()
+        .map(String::from)
+        .chain(operators)
+        .chain(["square", "add_constant", "integer_power", "fail"].into_iter().map(String::from))
+        .collect()
+}
+
+/// Returns the current pipeline metrics.
+///
+/// Counters only move with the `metrics` feature; without it every field is zero. They are read one by
+/// one while other threads may be updating them, so a snapshot taken during evaluations is only
+/// consistent to within those evaluations.
+pub fn metrics_snapshot() -> PipelineMetrics {
+    let mut c_counters = [0u64; METRIC_COUNT];
+    if unsafe { metrics_read(c_counters.as_mut_ptr(), METRIC_COUNT) } != SUCCESS {
+        c_counters = [0; METRIC_COUNT];
+    }
+
+    let mut metrics = PipelineMetrics::default();
+    for stage in STAGES {
+        let mut counts = [0; BUCKETS];
+        let (mut count, mut total) = (0, 0);
+        for shard in &SHARD_SETS {
+            let histogram = &shard.stages[stage as usize];
+            histogram.add_counts(&mut counts);
+            count += histogram.count();
+            total += histogram.sum();
+        }
+        metrics.stages[stage as usize] = StageMetrics {
+            count,
+            total: Duration::from_nanos(total),
+            p50: Duration::from_nanos(Histogram::quantile_of(&counts, 0.5)),
+            p99: Duration::from_nanos(Histogram::quantile_of(&counts, 0.99)),
+        };
+    }
+    for shard in &SHARD_SETS {
+        let load = |counter: &AtomicU64| counter.load(Ordering::Relaxed);
+        metrics.tokens += load(&shard.tokens);
+        for (total, counter) in metrics.error_codes.iter_mut().zip(&shard.native_errors) {
+            *total += load(counter);
+        }
+        metrics.cache_hits += load(&shard.cache_hits);
+        metrics.cache_misses += load(&shard.cache_misses);
+        metrics.allocations += load(&shard.allocations);
+        metrics.allocated_bytes += load(&shard.allocated_bytes);
+    }
+    metrics.native_evaluations = metrics.error_codes.iter().sum();
+
+    metrics.expressions = c_counters[METRIC_EVALUATIONS] + metrics.native_evaluations;
+    metrics.evaluator_time = Duration::from_nanos(c_counters[METRIC_EVALUATE_NANOS]);
+    metrics.stack_allocations = c_counters[METRIC_STACK_ALLOCATIONS];
+    metrics.instructions = opcode_names()
+        .into_iter()
+        .zip(&c_counters[METRIC_OPCODES..METRIC_ERRORS])
+        .map(|(name, &count)| (name, count))
+        .collect();
+    for (total, &count) in metrics.error_codes.iter_mut().zip(&c_counters[METRIC_ERRORS..]) {
+        *total += count;
+    }
+    metrics
+}
+
+/// Sets every pipeline metric back to zero, in the wrapper and in the C library.
+///
+/// Evaluations running meanwhile may be counted before or after the reset.
+pub fn reset_metrics() {
+    for shard in &SHARD_SETS {
+        for histogram in &shard.stages {
+            histogram.reset();
+        }
+        let counters = [&shard.tokens, &shard.cache_hits, &shard.cache_misses, &shard.allocations, &shard.allocated_bytes];
+        for counter in counters.into_iter().chain(&shard.native_errors) {
+            counter.store(0, Ordering::Relaxed);
+        }
+    }
+    unsafe { metrics_reset() }
+}
+
+impl PipelineMetrics {
+    /// Returns the time of a stage.
+    pub fn stage(&self, stage: Stage) -> &StageMetrics {
+        &self.stages[stage as usize]
+    }
+
+    /// Returns how many times the interpreters ran an opcode, by its name in `instructions`, or `None` if
+    /// there is no such opcode.
+    pub fn instruction_count(&self, name: &str) -> Option<u64> {
+        self.instructions.iter().find(|(opcode, _)| opcode == name).map(|&(_, count)| count)
+    }
+
+    /// Returns the share of `ExpressionCache` lookups that found a compiled program, or `0` before the first.
+    pub fn cache_hit_rate(&self) -> f64 {
+        let lookups = self.cache_hits + self.cache_misses;
+        if lookups == 0 {
+            0.0
+        } else {
+            self.cache_hits as f64 / lookups as f64
+        }
+    }
+
+    /// Returns the mean number of heap allocations per result evaluated, or `0` before the first.
+    pub fn allocations_per_expression(&self) -> f64 {
+        if self.expressions == 0 {
+            0.0
+        } else {
+            self.allocations as f64 / self.expressions as f64
+        }
+    }
+
+    /// Returns the part of `Stage::Evaluate` spent outside the evaluators of the C library: crossing into
+    /// it, checking and preparing the arguments, and acquiring stacks.
+    pub fn call_overhead(&self) -> Duration {
+        self.stage(Stage::Evaluate).total.saturating_sub(self.evaluator_time)
+    }
+
+    /// Renders the metrics in the Prometheus text exposition format.
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+        let header = |out: &mut String, name: &str, kind: &str, help: &str| {
+            writeln!(out, "# HELP calculator_{} {}\n# TYPE calculator_{} {}", name, help, name, kind).unwrap();
+        };
+
+        header(&mut out, "stage_seconds", "summary", "Time of each stage of the pipeline.");
+        for stage in STAGES {
+            let metrics = self.stage(stage);
+            let name = stage.name();
+            writeln!(out, "calculator_stage_seconds{{stage=\"{}\",quantile=\"0.5\"}} {}", name, metrics.p50.as_secs_f64()).unwrap();
+            writeln!(out, "calculator_stage_seconds{{stage=\"{}\",quantile=\"0.99\"}} {}", name, metrics.p99.as_secs_f64()).unwrap();
+            writeln!(out, "calculator_stage_seconds_sum{{stage=\"{}\"}} {}", name, metrics.total.as_secs_f64()).unwrap();
+            writeln!(out, "calculator_stage_seconds_count{{stage=\"{}\"}} {}", name, metrics.count).unwrap();
+        }
+
+        let counters: [(&str, &str, u64); 7] = [
+            ("evaluations_total", "Results evaluated, one per expression or per row over columns.", self.expressions),
+            ("native_evaluations_total", "Results evaluated by native code.", self.native_evaluations),
+            ("tokens_total", "Tokens parsed from infix expressions.", self.tokens),
+            ("expression_cache_hits_total", "ExpressionCache lookups that found a compiled program.", self.cache_hits),
+            ("expression_cache_misses_total", "ExpressionCache lookups that compiled the expression.", self.cache_misses),
+            ("stack_allocations_total", "Evaluation stacks allocated outside the stack pool.", self.stack_allocations),
+            ("allocations_total", "Heap allocations through CountingAllocator.", self.allocations),
+        ];
+        for (name, help, value) in counters {
+            header(&mut out, name, "counter", help);
+            writeln!(out, "calculator_{} {}", name, value).unwrap();
+        }
+        header(&mut out, "allocated_bytes_total", "counter", "Bytes allocated through CountingAllocator.");
+        writeln!(out, "calculator_allocated_bytes_total {}", self.allocated_bytes).unwrap();
+        header(&mut out, "evaluator_seconds_total", "counter", "Time spent inside the evaluators of the C library.");
+        writeln!(out, "calculator_evaluator_seconds_total {}", self.evaluator_time.as_secs_f64()).unwrap();
+
+        header(&mut out, "instructions_total", "counter", "Instructions run by the interpreters, by opcode.");
+        for (opcode, count) in &self.instructions {
+            writeln!(out, "calculator_instructions_total{{opcode=\"{}\"}} {}", opcode, count).unwrap();
+        }
+        header(&mut out, "results_total", "counter", "Results evaluated, by error code.");
+        for (code, count) in self.error_codes.iter().enumerate() {
+            writeln!(out, "calculator_results_total{{code=\"{}\"}} {}", code, count).unwrap();
+        }
+        out
+    }
+}
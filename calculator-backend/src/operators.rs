@@ -0,0 +1,191 @@
+//! ./src/operators.rs
+//! The operator table shared by the Rust wrapper and the C library.
+//!
+//! This file is the only place operators are listed. The wrapper includes it as a module, and build.rs
+//! includes it too to generate `operators.h` for calculator.c, which builds its `Opcode` enum, its
+//! `operator_table` and its operator lookup from that header. Names are found with a single probe of a
+//! perfect hash table computed at compile time, so adding an operator does not slow down the lookup of
+//! every other token.
+//!
+//! The file must only depend on `core`, since build.rs compiles it on its own.
+
+/// The properties of one operator.
+///
+/// # Fields
+///
+/// * `opcode`: The name of its opcode in calculator.c (`OP_...`).
+/// * `name`: Its name in RPN expressions, and in infix expressions unless it is a symbol alias.
+/// * `arity`: The number of operands it takes, 1 or 2.
+/// * `precedence`: Its precedence in infix expressions, see `Operator::precedence`.
+/// * `right_associative`: Whether it groups from the right (`^`, `!`).
+#[derive(Debug, Clone, Copy)]
+pub struct OperatorSpec {
+    pub opcode: &'static str,
+    pub name: &'static str,
+    pub arity: u8,
+    pub precedence: i32,
+    pub right_associative: bool,
+}
+
+const fn spec(opcode: &'static str, name: &'static str, arity: u8, precedence: i32, right_associative: bool) -> OperatorSpec {
+    OperatorSpec { opcode, name, arity, precedence, right_associative }
+}
+
+/// Every operator, in opcode order. `Operator` declares its variants in the same order.
+pub const OPERATOR_SPECS: [OperatorSpec; 15] = [
+    spec("OP_ADD", "+", 2, 1, false),
+    spec("OP_SUBTRACT", "-", 2, 1, false),
+    spec("OP_MULTIPLY", "*", 2, 2, false),
+    spec("OP_DIVIDE", "/", 2, 2, false),
+    spec("OP_POWER", "^", 2, 3, true),
+    spec("OP_FACTORIAL", "!", 1, 4, true),
+    spec("OP_SQRT", "sqrt", 1, 4, false),
+    spec("OP_SIN", "sin", 1, 5, false),
+    spec("OP_COS", "cos", 1, 5, false),
+    spec("OP_TAN", "tan", 1, 5, false),
+    spec("OP_ARCSIN", "arcsin", 1, 5, false),
+    spec("OP_ARCCOS", "arccos", 1, 5, false),
+    spec("OP_ARCTAN", "arctan", 1, 5, false),
+    spec("OP_LOG", "log", 1, 4, false),
+    spec("OP_LN", "ln", 1, 4, false),
+];
+
+/// Other names the tokenizer accepts for an operator, with the index of that operator in
+/// `OPERATOR_SPECS`. They are never written to RPN expressions, so the C library does not know them.
+pub const OPERATOR_ALIASES: [(&str, usize); 1] = [("√", 6)];
+
+/// The number of names in the hash table: every operator followed by every alias.
+pub const OPERATOR_NAME_COUNT: usize = OPERATOR_SPECS.len() + OPERATOR_ALIASES.len();
+
+/// The number of bits of a hash used to select a slot, so the table has `1 << OPERATOR_HASH_BITS` slots.
+pub const OPERATOR_HASH_BITS: u32 = 6;
+
+/// The length in bytes of the longest name. Longer tokens are rejected without being hashed.
+pub const OPERATOR_MAX_LENGTH: usize = {
+    let mut longest = 0;
+    let mut i = 0;
+    while i < OPERATOR_NAME_COUNT {
+        let length = operator_name(i).0.len();
+        if length > longest {
+            longest = length;
+        }
+        i += 1;
+    }
+    longest
+};
+
+/// Returns the name at `index` in the hash table and the index of its operator in `OPERATOR_SPECS`.
+pub const fn operator_name(index: usize) -> (&'static str, usize) {
+    if index < OPERATOR_SPECS.len() {
+        (OPERATOR_SPECS[index].name, index)
+    } else {
+        OPERATOR_ALIASES[index - OPERATOR_SPECS.len()]
+    }
+}
+
+/// Returns the slot of a name in the hash table: FNV-1a of the name with ASCII letters lowercased,
+/// started from `seed`, then mixed so the top bits depend on every byte. Names that only differ in case
+/// share a slot.
+///
+/// `operator_hash` in calculator.c computes the same function.
+pub const fn operator_hash(seed: u32, name: &[u8]) -> usize {
+    let mut hash = seed;
+    let mut i = 0;
+    while i < name.len() {
+        hash = (hash ^ name[i].to_ascii_lowercase() as u32).wrapping_mul(0x0100_0193);
+        i += 1;
+    }
+    hash ^= hash >> 16;
+    hash = hash.wrapping_mul(0x85eb_ca6b);
+    hash ^= hash >> 13;
+    (hash >> (32 - OPERATOR_HASH_BITS)) as usize
+}
+
+/// Builds the hash table of `seed`: the index of the name in each slot plus 1, or 0 for empty slots.
+/// Returns `None` if two names share a slot.
+const fn build_slots(seed: u32) -> Option<[u8; 1 << OPERATOR_HASH_BITS]> {
+    let mut slots = [0u8; 1 << OPERATOR_HASH_BITS];
+    let mut i = 0;
+    while i < OPERATOR_NAME_COUNT {
+        let slot = operator_hash(seed, operator_name(i).0.as_bytes());
+        if slots[slot] != 0 {
+            return None;
+        }
+        slots[slot] = i as u8 + 1;
+        i += 1;
+    }
+    Some(slots)
+}
+
+/// The first seed from the FNV offset basis on for which no two names share a slot.
+pub const OPERATOR_HASH_SEED: u32 = {
+    let mut seed: u32 = 0x811c_9dc5;
+    while build_slots(seed).is_none() {
+        seed = seed.wrapping_add(1);
+    }
+    seed
+};
+
+/// The bytes operator names start with, ASCII letters in either case, as a 256-bit set: bit `b % 64` of
+/// word `b / 64` is set for every such byte `b`. Most tokens, such as numbers, are rejected from their
+/// first byte.
+pub const OPERATOR_FIRST_BYTES: [u64; 4] = {
+    let mut set = [0u64; 4];
+    let mut i = 0;
+    while i < OPERATOR_NAME_COUNT {
+        let first = operator_name(i).0.as_bytes()[0];
+        set[(first / 64) as usize] |= 1 << (first % 64);
+        let upper = first.to_ascii_uppercase();
+        set[(upper / 64) as usize] |= 1 << (upper % 64);
+        i += 1;
+    }
+    set
+};
+
+/// Single-byte operators by their byte, as the index of the name in the hash table plus 1, 0 if none.
+/// Symbols are the most common operators, and are looked up without hashing.
+const OPERATOR_SYMBOLS: [u8; 128] = {
+    let mut symbols = [0u8; 128];
+    let mut i = 0;
+    while i < OPERATOR_NAME_COUNT {
+        let name = operator_name(i).0.as_bytes();
+        if name.len() == 1 {
+            symbols[name[0] as usize] = i as u8 + 1;
+        }
+        i += 1;
+    }
+    symbols
+};
+
+/// The perfect hash table of `OPERATOR_HASH_SEED`, see `build_slots`.
+pub const OPERATOR_SLOTS: [u8; 1 << OPERATOR_HASH_BITS] = match build_slots(OPERATOR_HASH_SEED) {
+    Some(slots) => slots,
+    None => panic!("OPERATOR_HASH_SEED has collisions"),
+};
+
+/// Looks up a name with a single probe of the hash table, or of `OPERATOR_SYMBOLS` for a single byte.
+///
+/// # Arguments
+///
+/// * `name`: The token to look up.
+/// * `ignore_case`: Whether ASCII letters match regardless of case.
+///
+/// # Returns
+///
+/// The index of the operator in `OPERATOR_SPECS`, or `None` if `name` is not an operator or alias.
+#[inline]
+pub fn lookup_operator(name: &str, ignore_case: bool) -> Option<usize> {
+    let bytes = name.as_bytes();
+    let first = *bytes.first()?;
+    if bytes.len() > OPERATOR_MAX_LENGTH || OPERATOR_FIRST_BYTES[usize::from(first / 64)] & (1 << (first % 64)) == 0 {
+        return None;
+    }
+    let entry = if bytes.len() == 1 && first < 128 {
+        OPERATOR_SYMBOLS[usize::from(first)]
+    } else {
+        OPERATOR_SLOTS[operator_hash(OPERATOR_HASH_SEED, bytes)]
+    };
+    let (candidate, index) = operator_name(usize::from(entry).checked_sub(1)?);
+    let found = if ignore_case { candidate.eq_ignore_ascii_case(name) } else { candidate == name };
+    found.then_some(index)
+}
@@ -0,0 +1,496 @@
+//! ./src/preview.rs
+//! Incremental evaluation of an expression while it is being edited, for live previews.
+//!
+//! A `LivePreview` keeps the tokens of the input it last evaluated and the value of each bracketed group.
+//! When the input changes, only the tokens around the edit are read again, and groups whose tokens did not
+//! change are replaced by their value instead of being evaluated again. A `PreviewWorker` runs a
+//! `LivePreview` on its own thread, so a user interface can request a preview on every keystroke without
+//! waiting for it.
+//!
+//! A group evaluated on its own gives the same value as inside the whole expression: the shunting-yard
+//! algorithm writes the tokens of a bracketed group as one contiguous run of RPN tokens, and a run that
+//! evaluates to a single value on its own leaves exactly that value on the stack of the whole expression.
+//! Groups that fail on their own are written out token by token, so errors are reported as usual.
+
+use std::collections::HashMap;
+use std::os::raw::c_int;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::JoinHandle;
+
+use super::{
+    get_error_message, tokenize_from, CCalculationResult, History, Operator, Precision, ReversePolish, Token,
+    SUCCESS,
+};
+
+// Marks a bracket without a matching one
+const UNMATCHED: usize = usize::MAX;
+
+/// The kind of a token, whose text is read back from the input when needed.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Lexeme {
+    Number,
+    Variable,
+    Ans,
+    Operator(Operator),
+    LeftBracket,
+    RightBracket,
+}
+
+/// A token of the current input.
+///
+/// # Fields
+///
+/// * `start`, `end`: The byte range of the token in the input.
+/// * `lexeme`: Its kind.
+#[derive(Debug, Clone, Copy)]
+struct Spanned {
+    start: usize,
+    end: usize,
+    lexeme: Lexeme,
+}
+
+impl Spanned {
+    fn new(start: usize, end: usize, token: &Token<'_>) -> Self {
+        let lexeme = match *token {
+            Token::Number(_) => Lexeme::Number,
+            Token::Variable(_) => Lexeme::Variable,
+            Token::Ans => Lexeme::Ans,
+            Token::Operator(op) => Lexeme::Operator(op),
+            Token::LeftBracket => Lexeme::LeftBracket,
+            Token::RightBracket => Lexeme::RightBracket,
+        };
+        Spanned { start, end, lexeme }
+    }
+
+    /// Returns the token, reading its text from `input`.
+    fn token<'a>(&self, input: &'a str) -> Token<'a> {
+        match self.lexeme {
+            Lexeme::Number => Token::Number(&input[self.start..self.end]),
+            Lexeme::Variable => Token::Variable(&input[self.start..self.end]),
+            Lexeme::Ans => Token::Ans,
+            Lexeme::Operator(op) => Token::Operator(op),
+            Lexeme::LeftBracket => Token::LeftBracket,
+            Lexeme::RightBracket => Token::RightBracket,
+        }
+    }
+
+    /// Returns whether a character typed right after this token could change how it reads: numbers,
+    /// identifiers and `-` go on, brackets and the other operators are a single character.
+    fn may_extend(&self, input: &str) -> bool {
+        match self.lexeme {
+            Lexeme::LeftBracket | Lexeme::RightBracket => false,
+            Lexeme::Operator(_) => input[self.start..].starts_with(|c: char| c == '-' || c.is_alphanumeric()),
+            _ => true,
+        }
+    }
+
+    /// Returns whether a `-` right after this token starts a negative number, as `Tokenizer` decides it.
+    fn allows_unary(&self) -> bool {
+        matches!(self.lexeme, Lexeme::Operator(_) | Lexeme::LeftBracket | Lexeme::RightBracket)
+    }
+}
+
+/// Evaluates an expression as it is edited, reusing the work done for the previous input.
+///
+/// Every call to `update` returns what `calculate_expression` would for the same input and history, in
+/// the precision mode of the preview, without adding to the history.
+///
+/// # Fields
+///
+/// * `input`: The input of the last update.
+/// * `tokens`: The tokens of `input`.
+/// * `partners`: For each token, the index of the matching bracket, or `UNMATCHED`.
+/// * `groups`: The value of each matched group of `tokens`, keyed by the indices of its brackets, or
+///   `None` if it does not evaluate to a single value on its own.
+/// * `ans`: The value `ans` had in the last update.
+/// * `precision`: The precision mode of the results.
+/// * `result`: The result of the last update.
+/// * `rpn`: The buffers groups are written into before being evaluated.
+/// * `retokenized`: The number of tokens read in the last update.
+/// * `evaluated_groups`: The number of groups evaluated in the last update.
+pub struct LivePreview {
+    input: String,
+    tokens: Vec<Spanned>,
+    partners: Vec<usize>,
+    groups: HashMap<(usize, usize), Option<f64>>,
+    ans: f64,
+    precision: Precision,
+    result: Option<CCalculationResult>,
+    rpn: ReversePolish,
+    retokenized: usize,
+    evaluated_groups: usize,
+}
+
+impl LivePreview {
+    /// Creates a preview of the empty input, in the default precision mode.
+    pub fn new() -> Self {
+        LivePreview {
+            input: String::new(),
+            tokens: Vec::new(),
+            partners: Vec::new(),
+            groups: HashMap::new(),
+            ans: 0.0,
+            precision: Precision::default(),
+            result: None,
+            rpn: ReversePolish::new(),
+            retokenized: 0,
+            evaluated_groups: 0,
+        }
+    }
+
+    /// Sets the precision mode of the results. The values of groups are evaluated again.
+    pub fn set_precision(&mut self, precision: Precision) {
+        if precision != self.precision {
+            self.precision = precision;
+            self.groups.clear();
+            self.result = None;
+        }
+    }
+
+    /// Returns the precision mode of the results.
+    pub fn precision(&self) -> Precision {
+        self.precision
+    }
+
+    /// Evaluates the edited input.
+    ///
+    /// # Arguments
+    ///
+    /// * `input`: The whole input, as edited since the last update.
+    /// * `history`: The history `ans` is read from. Nothing is added to it.
+    ///
+    /// # Returns
+    ///
+    /// The value and error code `calculate_expression(input, history)` would give, in the precision mode of
+    /// the preview. An empty input fails like an empty expression does.
+    pub fn update(&mut self, input: &str, history: &History) -> CCalculationResult {
+        self.evaluate(input, history.get_last_result().unwrap_or(0.0))
+    }
+
+    /// Returns the number of tokens read by the last update. The others were kept from the previous input.
+    pub fn retokenized(&self) -> usize {
+        self.retokenized
+    }
+
+    /// Returns the number of bracketed groups evaluated by the last update. The others had been evaluated
+    /// for a previous input.
+    pub fn evaluated_groups(&self) -> usize {
+        self.evaluated_groups
+    }
+
+    /// Same as `update`, with the value of `ans` given directly.
+    fn evaluate(&mut self, input: &str, ans: f64) -> CCalculationResult {
+        if ans.to_bits() != self.ans.to_bits() {
+            self.ans = ans;
+            self.groups.clear();
+            self.result = None;
+        }
+        if input == self.input {
+            self.retokenized = 0;
+            self.evaluated_groups = 0;
+            if let Some(result) = self.result {
+                return result;
+            }
+        } else {
+            self.retokenize(input);
+        }
+        self.match_brackets();
+
+        // A group closes after every group inside it, so those are known when it is evaluated
+        self.evaluated_groups = 0;
+        for close in 0..self.tokens.len() {
+            let open = self.partners[close];
+            if self.tokens[close].lexeme != Lexeme::RightBracket || open == UNMATCHED {
+                continue;
+            }
+            if !self.groups.contains_key(&(open, close)) {
+                // Round Result mode only rounds the value of the whole expression
+                let precision = match self.precision {
+                    Precision::RoundResult => Precision::Raw,
+                    precision => precision,
+                };
+                let result = self.evaluate_range(open + 1, close, precision);
+                let value = (result.error_code == SUCCESS).then_some(result.result_value);
+                self.groups.insert((open, close), value);
+                self.evaluated_groups += 1;
+            }
+        }
+
+        let result = self.evaluate_range(0, self.tokens.len(), self.precision);
+        self.result = Some(result);
+        result
+    }
+
+    /// Tokenizes `input` again from the last token the edit may have changed, and keeps the old tokens from
+    /// the first one the tokenizer reaches in the unchanged end of the input, in the same state.
+    fn retokenize(&mut self, input: &str) {
+        let old = std::mem::replace(&mut self.input, input.to_string());
+        let prefix = common_prefix(&old, input);
+        let suffix = common_suffix(&old[prefix..], &input[prefix..]);
+        let old_resume = old.len() - suffix;
+        let resume = input.len() - suffix;
+
+        // A token depends on its characters and the one after it, so those ending before the edit stay
+        let kept = self
+            .tokens
+            .partition_point(|token| token.end < prefix || (token.end == prefix && !token.may_extend(&old)));
+        let tail = self.tokens.split_off(kept);
+        let state_before_tail = self.tokens.last().is_none_or(Spanned::allows_unary);
+        let (position, unary_allowed) = self.tokens.last().map_or((0, true), |token| (token.end, token.allows_unary()));
+
+        let mut tokenizer = tokenize_from(input, position, unary_allowed);
+        let mut reused = None;
+        self.retokenized = 0;
+        while let Some((start, token)) = tokenizer.next_spanned() {
+            if start >= resume {
+                let old_start = start - resume + old_resume;
+                if let Ok(index) = tail.binary_search_by_key(&old_start, |token| token.start) {
+                    let old_state = if index == 0 { state_before_tail } else { tail[index - 1].allows_unary() };
+                    if old_state == self.tokens.last().is_none_or(Spanned::allows_unary) {
+                        reused = Some(index);
+                        break;
+                    }
+                }
+            }
+            self.tokens.push(Spanned::new(start, tokenizer.offset(), &token));
+            self.retokenized += 1;
+        }
+
+        // Keep the groups made of unchanged tokens, at their new indices
+        let inserted = self.tokens.len();
+        let groups = std::mem::take(&mut self.groups);
+        if let Some(index) = reused {
+            let old_index = kept + index;
+            self.tokens.extend(tail[index..].iter().map(|token| Spanned {
+                start: token.start - old_resume + resume,
+                end: token.end - old_resume + resume,
+                lexeme: token.lexeme,
+            }));
+            self.groups = groups
+                .into_iter()
+                .filter_map(|((open, close), value)| {
+                    if close < kept {
+                        Some(((open, close), value))
+                    } else if open >= old_index {
+                        Some(((open - old_index + inserted, close - old_index + inserted), value))
+                    } else {
+                        None
+                    }
+                })
+                .collect();
+        } else {
+            self.groups = groups.into_iter().filter(|&((_, close), _)| close < kept).collect();
+        }
+    }
+
+    /// Pairs each bracket with its matching one. Unmatched brackets are evaluated as ordinary tokens.
+    fn match_brackets(&mut self) {
+        self.partners.clear();
+        self.partners.resize(self.tokens.len(), UNMATCHED);
+        let mut open = Vec::new();
+        for (index, token) in self.tokens.iter().enumerate() {
+            match token.lexeme {
+                Lexeme::LeftBracket => open.push(index),
+                Lexeme::RightBracket => {
+                    if let Some(start) = open.pop() {
+                        self.partners[start] = index;
+                        self.partners[index] = start;
+                    }
+                }
+                _ => {}
+            }
+        }
+    }
+
+    /// Evaluates `tokens[start..end]`, writing the value of each group inside that evaluates on its own
+    /// in place of its tokens.
+    fn evaluate_range(&mut self, start: usize, end: usize, precision: Precision) -> CCalculationResult {
+        self.rpn.clear();
+        let mut index = start;
+        while index < end {
+            let token = self.tokens[index];
+            let close = self.partners[index];
+            if token.lexeme == Lexeme::LeftBracket && close != UNMATCHED {
+                if let Some(&Some(value)) = self.groups.get(&(index, close)) {
+                    // The closing bracket would not end a pending prefix operator either
+                    self.rpn.push_value(value);
+                    index = close + 1;
+                    continue;
+                }
+            }
+            self.rpn.push_infix(token.token(&self.input), Some(self.ans));
+            index += 1;
+        }
+        self.rpn.finish_infix();
+        self.rpn.calculate_with_precision(precision)
+    }
+}
+
+impl Default for LivePreview {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Returns the length in bytes of the longest common prefix of `a` and `b`, on a character boundary.
+fn common_prefix(a: &str, b: &str) -> usize {
+    let mut length = a.bytes().zip(b.bytes()).take_while(|(x, y)| x == y).count();
+    while !a.is_char_boundary(length) || !b.is_char_boundary(length) {
+        length -= 1;
+    }
+    length
+}
+
+/// Returns the length in bytes of the longest common suffix of `a` and `b`, on a character boundary.
+fn common_suffix(a: &str, b: &str) -> usize {
+    let mut length = a.bytes().rev().zip(b.bytes().rev()).take_while(|(x, y)| x == y).count();
+    while !a.is_char_boundary(a.len() - length) || !b.is_char_boundary(b.len() - length) {
+        length -= 1;
+    }
+    length
+}
+
+/// A finished preview, see `PreviewWorker::take_result`.
+///
+/// # Fields
+///
+/// * `generation`: The number `PreviewWorker::request` returned for the input.
+/// * `input`: The input that was evaluated.
+/// * `result`: Its value and error code.
+#[derive(Debug, Clone)]
+pub struct Preview {
+    generation: u64,
+    input: String,
+    result: CCalculationResult,
+}
+
+impl Preview {
+    /// Returns the number `PreviewWorker::request` returned for this input.
+    pub fn generation(&self) -> u64 {
+        self.generation
+    }
+
+    /// Returns the input that was evaluated.
+    pub fn input(&self) -> &str {
+        &self.input
+    }
+
+    /// Returns the value of the input, or `None` if it failed.
+    pub fn value(&self) -> Option<f64> {
+        (self.result.error_code == SUCCESS).then_some(self.result.result_value)
+    }
+
+    /// Returns the error code reported by the C library, or `None` if the input succeeded.
+    pub fn error_code(&self) -> Option<c_int> {
+        (self.result.error_code != SUCCESS).then_some(self.result.error_code)
+    }
+
+    /// Returns the message of the outcome, `"Success"` if the input succeeded.
+    pub fn message(&self) -> &'static str {
+        get_error_message(self.result.error_code)
+    }
+}
+
+/// State shared by a `PreviewWorker` and its thread.
+///
+/// # Fields
+///
+/// * `generation`: The number of requests made so far.
+/// * `pending`: The newest request not yet started, with its generation and the value of `ans`. Older
+///   ones are dropped unevaluated.
+/// * `finished`: The newest finished preview not yet taken.
+/// * `closed`: Whether the worker is being dropped.
+struct WorkerState {
+    generation: u64,
+    pending: Option<(u64, String, f64)>,
+    finished: Option<Preview>,
+    closed: bool,
+}
+
+/// Evaluates live previews on a background thread.
+///
+/// Requests never wait for an evaluation. Only the newest one is evaluated when several arrive while the
+/// thread is busy, and the thread reuses the work done for the previous input, see `LivePreview`.
+///
+/// # Fields
+///
+/// * `shared`: The state shared with the thread, and the condition it waits on for requests.
+/// * `thread`: The thread, joined when the worker is dropped.
+pub struct PreviewWorker {
+    shared: Arc<(Mutex<WorkerState>, Condvar)>,
+    thread: Option<JoinHandle<()>>,
+}
+
+impl PreviewWorker {
+    /// Starts the thread.
+    ///
+    /// # Arguments
+    ///
+    /// * `precision`: The precision mode of the previews.
+    /// * `notify`: Called on the thread after each preview is finished, e.g. to request a repaint.
+    pub fn spawn(precision: Precision, notify: impl Fn() + Send + 'static) -> Self {
+        let shared = Arc::new((
+            Mutex::new(WorkerState { generation: 0, pending: None, finished: None, closed: false }),
+            Condvar::new(),
+        ));
+        let thread_shared = Arc::clone(&shared);
+        let thread = std::thread::spawn(move || {
+            let (state, requested) = &*thread_shared;
+            let mut preview = LivePreview::new();
+            preview.set_precision(precision);
+            loop {
+                let (generation, input, ans) = {
+                    let mut state = state.lock().unwrap_or_else(|e| e.into_inner());
+                    loop {
+                        if state.closed {
+                            return;
+                        }
+                        if let Some(request) = state.pending.take() {
+                            break request;
+                        }
+                        state = requested.wait(state).unwrap_or_else(|e| e.into_inner());
+                    }
+                };
+                let result = preview.evaluate(&input, ans);
+                state.lock().unwrap_or_else(|e| e.into_inner()).finished = Some(Preview { generation, input, result });
+                notify();
+            }
+        });
+        PreviewWorker { shared, thread: Some(thread) }
+    }
+
+    /// Requests a preview of `input`, replacing any request not started yet.
+    ///
+    /// # Arguments
+    ///
+    /// * `input`: The whole input.
+    /// * `history`: The history `ans` is read from.
+    ///
+    /// # Returns
+    ///
+    /// The generation of the request, which increases with every request.
+    pub fn request(&self, input: &str, history: &History) -> u64 {
+        let (state, requested) = &*self.shared;
+        let mut state = state.lock().unwrap_or_else(|e| e.into_inner());
+        state.generation += 1;
+        state.pending = Some((state.generation, input.to_string(), history.get_last_result().unwrap_or(0.0)));
+        requested.notify_one();
+        state.generation
+    }
+
+    /// Returns the newest finished preview, or `None` if none finished since the last call.
+    pub fn take_result(&self) -> Option<Preview> {
+        self.shared.0.lock().unwrap_or_else(|e| e.into_inner()).finished.take()
+    }
+}
+
+impl Drop for PreviewWorker {
+    fn drop(&mut self) {
+        let (state, requested) = &*self.shared;
+        state.lock().unwrap_or_else(|e| e.into_inner()).closed = true;
+        requested.notify_one();
+        if let Some(thread) = self.thread.take() {
+            let _ = thread.join();
+        }
+    }
+}
@@ -0,0 +1,468 @@
+//! ./src/programs.rs
+//! Compiled programs saved ahead of time, one by one or as libraries of named formulas.
+//!
+//! `CompiledExpression::save` serializes a program with the C library's `save_compiled`: its instructions,
+//! literals, variable names and stack depth, in a versioned little-endian format. Loading it back checks the
+//! instructions instead of tokenizing and parsing the expression again. A `ProgramLibrary` holds many named
+//! programs in one file, written by `ProgramLibraryBuilder` or the `calculator-precompile` tool. The file is
+//! read once, or memory-mapped with `ProgramLibrary::open_mapped`, and its programs evaluate their
+//! instructions straight from those bytes.
+//!
+//! A library file starts with a header of `LIBRARY_HEADER_SIZE` bytes: `LIBRARY_MAGIC`, the number of
+//! entries, the offset of the string table and the size of the file, each a little-endian `u64`. One entry of
+//! `ENTRY_SIZE` bytes per formula follows, sorted by name: the offset and size of its program, the offset of
+//! its name and source expression in the string table (`u64` each), and their lengths (`u32` each). The
+//! programs come next, each at a multiple of 8 bytes, then the string table.
+
+use std::fs::File;
+use std::os::raw::c_int;
+use std::path::Path;
+
+use super::{
+    get_error_message, infix_to_rpn, CCompiledExpression, CEvalContext, CompiledExpression, EvalContext, History,
+    MEMORY_ERROR, SUCCESS,
+};
+
+const LIBRARY_MAGIC: &[u8; 8] = b"CALCLIB1";
+const LIBRARY_HEADER_SIZE: usize = 32;
+const ENTRY_SIZE: usize = 32;
+
+// Results of `load_compiled`, matching `LOAD_*` in calculator.c
+const LOAD_SUCCESS: c_int = 0;
+const LOAD_NOT_A_PROGRAM: c_int = 1;
+const LOAD_UNSUPPORTED: c_int = 2;
+const LOAD_CORRUPT: c_int = 3;
+
+// ## `save_compiled`
+// Serializes a compiled program into `buffer` if its `capacity` is large enough, and always reports the size
+// in `length`. Returns `SUCCESS` or `MEMORY_ERROR`.
+//
+// ## `load_compiled`
+// Checks and loads a serialized program of at most `size` bytes, with its variables resolved in `context`
+// (null if none). With `in_place`, the program may evaluate `data` directly, which must then outlive it.
+// Returns one of the `LOAD_*` results.
+//
+// ## `compiled_is_borrowed`
+// Returns `1` if a program points into the data it was loaded from, `0` otherwise.
+extern "C" {
+    fn save_compiled(program: *const CCompiledExpression, buffer: *mut u8, capacity: usize, length: *mut usize) -> c_int;
+    fn load_compiled(
+        data: *const u8,
+        size: usize,
+        context: *mut CEvalContext,
+        in_place: bool,
+        program: *mut *mut CCompiledExpression,
+    ) -> c_int;
+    fn compiled_is_borrowed(program: *const CCompiledExpression) -> c_int;
+}
+
+/// Returns the message of a `LOAD_*` result other than `LOAD_SUCCESS`.
+fn load_error(status: c_int) -> String {
+    match status {
+        LOAD_NOT_A_PROGRAM => "Not a compiled program".to_string(),
+        LOAD_UNSUPPORTED => "Compiled program of another format version or operator table".to_string(),
+        LOAD_CORRUPT => "Corrupt compiled program".to_string(),
+        _ => get_error_message(MEMORY_ERROR).to_string(),
+    }
+}
+
+/// Loads a serialized program with the C library, see `CompiledExpression::load`.
+fn load(bytes: &[u8], context: *mut CEvalContext, in_place: bool) -> Result<CompiledExpression, String> {
+    let mut program = std::ptr::null_mut();
+    let status = unsafe { load_compiled(bytes.as_ptr(), bytes.len(), context, in_place, &mut program) };
+    if status != LOAD_SUCCESS {
+        return Err(load_error(status));
+    }
+    Ok(CompiledExpression::new(program, context))
+}
+
+impl CompiledExpression {
+    /// Serializes the program for `load`, `EvalContext::load` or a `ProgramLibrary`.
+    ///
+    /// The bytes hold the instructions after constant folding, the literals with their unrounded values, the
+    /// names of the free variables and the stack depth, so a loaded program gives the same values and error
+    /// codes in every precision mode. The context a program was compiled in is not saved; such a program
+    /// keeps `pi` and `e` as variables.
+    pub fn save(&self) -> Vec<u8> {
+        let mut length = 0;
+        unsafe { save_compiled(self.program, std::ptr::null_mut(), 0, &mut length) };
+        let mut bytes = vec![0; length];
+        let error_code = unsafe { save_compiled(self.program, bytes.as_mut_ptr(), bytes.len(), &mut length) };
+        // Only programs with more than `u32::MAX` bytes of variable names cannot be saved
+        assert_eq!(error_code, SUCCESS, "Program too large to save");
+        bytes
+    }
+
+    /// Loads a program serialized by `save`, evaluated like one returned by `ReversePolish::compile`.
+    ///
+    /// The instructions are checked but no expression is parsed. The program is copied out of `bytes`.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if `bytes` do not start with a saved program, the program was saved by a build
+    /// with another format version or operator table, it is truncated or its instructions are not a valid
+    /// program, or memory allocation fails.
+    pub fn load(bytes: &[u8]) -> Result<CompiledExpression, String> {
+        load(bytes, std::ptr::null_mut(), false)
+    }
+
+    /// Returns `true` if the program evaluates its instructions in place from a `ProgramLibrary`.
+    pub fn is_in_place(&self) -> bool {
+        unsafe { compiled_is_borrowed(self.program) != 0 }
+    }
+}
+
+impl EvalContext {
+    /// Loads a program serialized by `CompiledExpression::save`, with its variables resolved to slots of this
+    /// context, like `compile`.
+    ///
+    /// # Errors
+    ///
+    /// See `CompiledExpression::load`.
+    pub fn load(&mut self, bytes: &[u8]) -> Result<CompiledExpression, String> {
+        load(bytes, self.context, false)
+    }
+}
+
+/// Reads a little-endian `u64` at `at`, or `None` past the end of `bytes`.
+fn u64_at(bytes: &[u8], at: usize) -> Option<usize> {
+    let field = bytes.get(at..at.checked_add(8)?)?;
+    usize::try_from(u64::from_le_bytes(field.try_into().unwrap())).ok()
+}
+
+/// Reads a little-endian `u32` at `at`, or `None` past the end of `bytes`.
+fn u32_at(bytes: &[u8], at: usize) -> Option<usize> {
+    let field = bytes.get(at..at.checked_add(4)?)?;
+    Some(u32::from_le_bytes(field.try_into().unwrap()) as usize)
+}
+
+/// The bytes of a library file.
+enum Storage {
+    /// A read-only private mapping of the file, never empty.
+    #[cfg(unix)]
+    Mapped { ptr: *mut libc::c_void, len: usize },
+    /// A copy, in words so that programs stay aligned to 8 bytes.
+    Owned { words: Vec<u64>, len: usize },
+}
+
+impl Storage {
+    /// Copies `bytes` into aligned storage.
+    fn copy(bytes: &[u8]) -> Storage {
+        let mut words = vec![0u64; bytes.len().div_ceil(8)];
+        unsafe { std::ptr::copy_nonoverlapping(bytes.as_ptr(), words.as_mut_ptr() as *mut u8, bytes.len()) };
+        Storage::Owned { words, len: bytes.len() }
+    }
+
+    /// Reads the file at `path` into aligned storage.
+    fn read(path: &Path) -> Result<Storage, String> {
+        let error = |e: std::io::Error| format!("Failed to read program library {}: {}", path.display(), e);
+        let mut file = File::open(path).map_err(error)?;
+        let len = file.metadata().map_err(error)?.len() as usize;
+        let mut words = vec![0u64; len.div_ceil(8)];
+        let bytes = unsafe { std::slice::from_raw_parts_mut(words.as_mut_ptr() as *mut u8, len) };
+        std::io::Read::read_exact(&mut file, bytes).map_err(error)?;
+        Ok(Storage::Owned { words, len })
+    }
+
+    /// Maps the file at `path` on Unix, and reads it elsewhere or if it is empty.
+    ///
+    /// # Safety
+    ///
+    /// See `ProgramLibrary::open_mapped`.
+    unsafe fn map(path: &Path) -> Result<Storage, String> {
+        let error = |e: std::io::Error| format!("Failed to read program library {}: {}", path.display(), e);
+        let file = File::open(path).map_err(error)?;
+        let len = file.metadata().map_err(error)?.len() as usize;
+        #[cfg(unix)]
+        if len != 0 {
+            use std::os::unix::io::AsRawFd;
+            let ptr = unsafe {
+                libc::mmap(std::ptr::null_mut(), len, libc::PROT_READ, libc::MAP_PRIVATE, file.as_raw_fd(), 0)
+            };
+            if ptr == libc::MAP_FAILED {
+                return Err(error(std::io::Error::last_os_error()));
+            }
+            return Ok(Storage::Mapped { ptr, len });
+        }
+        drop(file);
+        Storage::read(path)
+    }
+
+    fn bytes(&self) -> &[u8] {
+        match self {
+            #[cfg(unix)]
+            Storage::Mapped { ptr, len } => unsafe { std::slice::from_raw_parts(*ptr as *const u8, *len) },
+            Storage::Owned { words, len } => unsafe { std::slice::from_raw_parts(words.as_ptr() as *const u8, *len) },
+        }
+    }
+}
+
+impl Drop for Storage {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        if let Storage::Mapped { ptr, len } = self {
+            unsafe { libc::munmap(*ptr, *len) };
+        }
+    }
+}
+
+/// One formula of a library: where its name and source expression are in the string table of the storage.
+struct Entry {
+    name: (usize, usize),
+    source: (usize, usize),
+}
+
+/// Named compiled programs read from a file written by `ProgramLibraryBuilder`.
+///
+/// Opening a library checks every program but parses no expression. The programs evaluate their
+/// instructions and read their names from the bytes of the file, read once by `open`, or memory-mapped by
+/// `open_mapped` and released with the library. Lookups by name are binary searches over the sorted entries
+/// of the file.
+///
+/// # Fields
+///
+/// * `programs`: The program of each entry, in name order. Declared first, so dropped before `storage`.
+/// * `entries`: The name and source of each entry, in the same order.
+/// * `storage`: The bytes of the file.
+pub struct ProgramLibrary {
+    programs: Vec<CompiledExpression>,
+    entries: Vec<Entry>,
+    storage: Storage,
+}
+
+impl ProgramLibrary {
+    /// Opens a library file, with programs evaluated like the ones of `ReversePolish::compile`.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if the file cannot be read, is not a library, or holds an invalid program
+    /// (see `CompiledExpression::load`).
+    pub fn open(path: impl AsRef<Path>) -> Result<ProgramLibrary, String> {
+        ProgramLibrary::new(Storage::read(path.as_ref())?, std::ptr::null_mut())
+    }
+
+    /// Same as `open`, with the file memory-mapped on Unix instead of read, so that only the pages the
+    /// programs and names use are loaded.
+    ///
+    /// # Safety
+    ///
+    /// The file must not be modified or truncated while the library is alive, including by replacing its
+    /// contents in place as `ProgramLibraryBuilder::write` and `calculator-precompile` do. The programs are
+    /// checked once, when the library is opened, and then evaluated from the mapping without any check, so a
+    /// change to the file is undefined behavior, such as a `SIGBUS` or reads out of bounds. Replacing the file
+    /// by renaming another over it is safe.
+    ///
+    /// # Errors
+    ///
+    /// See `open`.
+    pub unsafe fn open_mapped(path: impl AsRef<Path>) -> Result<ProgramLibrary, String> {
+        ProgramLibrary::new(Storage::map(path.as_ref())?, std::ptr::null_mut())
+    }
+
+    /// Opens a library file, with the variables of every program resolved to slots of `context`, like
+    /// `EvalContext::compile`. Its programs are evaluated with `EvalContext::evaluate`.
+    ///
+    /// # Errors
+    ///
+    /// See `open`.
+    pub fn open_in_context(path: impl AsRef<Path>, context: &mut EvalContext) -> Result<ProgramLibrary, String> {
+        ProgramLibrary::new(Storage::read(path.as_ref())?, context.context)
+    }
+
+    /// Reads a library from the bytes of a file, which are copied.
+    ///
+    /// # Errors
+    ///
+    /// See `open`.
+    pub fn from_bytes(bytes: &[u8]) -> Result<ProgramLibrary, String> {
+        ProgramLibrary::new(Storage::copy(bytes), std::ptr::null_mut())
+    }
+
+    /// Checks the entries of `storage` and loads every program in place.
+    fn new(storage: Storage, context: *mut CEvalContext) -> Result<ProgramLibrary, String> {
+        let bytes = storage.bytes();
+        let corrupt = || "Corrupt program library".to_string();
+        if bytes.len() < LIBRARY_HEADER_SIZE || &bytes[..8] != LIBRARY_MAGIC {
+            return Err("Not a program library".to_string());
+        }
+        let count = u64_at(bytes, 8).ok_or_else(corrupt)?;
+        let strings = u64_at(bytes, 16).ok_or_else(corrupt)?;
+        if u64_at(bytes, 24) != Some(bytes.len()) || strings > bytes.len() || count > bytes.len() / ENTRY_SIZE {
+            return Err(corrupt());
+        }
+        let text = std::str::from_utf8(&bytes[strings..]).map_err(|_| corrupt())?;
+
+        let mut programs = Vec::with_capacity(count);
+        let mut entries: Vec<Entry> = Vec::with_capacity(count);
+        for i in 0..count {
+            let at = LIBRARY_HEADER_SIZE + i * ENTRY_SIZE;
+            let field = |offset: usize| u64_at(bytes, at + offset).ok_or_else(corrupt);
+            let (offset, size, string) = (field(0)?, field(8)?, field(16)?);
+            let name_length = u32_at(bytes, at + 24).ok_or_else(corrupt)?;
+            let source_length = u32_at(bytes, at + 28).ok_or_else(corrupt)?;
+            let program = offset.checked_add(size).and_then(|end| bytes.get(offset..end)).ok_or_else(corrupt)?;
+            let source = string.checked_add(name_length).ok_or_else(corrupt)?;
+            let entry = Entry { name: (string, name_length), source: (source, source_length) };
+            let name = text.get(string..source).ok_or_else(corrupt)?;
+            source.checked_add(source_length).and_then(|end| text.get(source..end)).ok_or_else(corrupt)?;
+            // Strictly increasing names keep the binary search of `get` valid
+            if offset % 8 != 0 || entries.last().is_some_and(|last| slice(text, last.name) >= name) {
+                return Err(corrupt());
+            }
+            programs.push(load(program, context, true)?);
+            entries.push(entry);
+        }
+        Ok(ProgramLibrary { programs, entries, storage })
+    }
+
+    /// Returns the string table of the file.
+    fn text(&self) -> &str {
+        let bytes = self.storage.bytes();
+        let strings = u64_at(bytes, 16).unwrap();
+        // Checked in `new`
+        unsafe { std::str::from_utf8_unchecked(&bytes[strings..]) }
+    }
+
+    /// Returns the number of formulas of the library.
+    pub fn len(&self) -> usize {
+        self.programs.len()
+    }
+
+    /// Returns `true` if the library has no formula.
+    pub fn is_empty(&self) -> bool {
+        self.programs.is_empty()
+    }
+
+    /// Returns the names of the formulas, sorted.
+    pub fn names(&self) -> impl Iterator<Item = &str> {
+        self.entries.iter().map(|entry| slice(self.text(), entry.name))
+    }
+
+    /// Returns the index of a formula in name order.
+    fn position(&self, name: &str) -> Option<usize> {
+        self.entries.binary_search_by(|entry| slice(self.text(), entry.name).cmp(name)).ok()
+    }
+
+    /// Returns the compiled program of a formula, or `None` if the library has no formula of that name.
+    pub fn get(&self, name: &str) -> Option<&CompiledExpression> {
+        self.position(name).map(|i| &self.programs[i])
+    }
+
+    /// Returns the expression a formula was compiled from, or `None` if the library has no formula of that
+    /// name.
+    pub fn source(&self, name: &str) -> Option<&str> {
+        self.position(name).map(|i| slice(self.text(), self.entries[i].source))
+    }
+
+    /// Returns every formula with its program, in name order.
+    pub fn iter(&self) -> impl Iterator<Item = (&str, &CompiledExpression)> {
+        self.names().zip(&self.programs)
+    }
+}
+
+/// Returns the `(offset, length)` range of `text`.
+fn slice(text: &str, (offset, length): (usize, usize)) -> &str {
+    &text[offset..offset + length]
+}
+
+// The programs only read the storage, which is never modified (for a mapping, by the contract of
+// `open_mapped`), and released only after the programs are dropped
+unsafe impl Send for ProgramLibrary {}
+unsafe impl Sync for ProgramLibrary {}
+
+/// Compiles named formulas into the bytes of a `ProgramLibrary` file.
+///
+/// # Fields
+///
+/// * `formulas`: The name, source expression and saved program of each formula, in insertion order.
+#[derive(Default)]
+pub struct ProgramLibraryBuilder {
+    formulas: Vec<(String, String, Vec<u8>)>,
+}
+
+impl ProgramLibraryBuilder {
+    /// Creates a builder without any formula.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Returns the number of formulas added.
+    pub fn len(&self) -> usize {
+        self.formulas.len()
+    }
+
+    /// Returns `true` if no formula was added.
+    pub fn is_empty(&self) -> bool {
+        self.formulas.is_empty()
+    }
+
+    /// Compiles an infix expression and adds it to the library under a name.
+    ///
+    /// Expressions are compiled without a context and without history, so `ans` is `0`.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if the name is empty or already added, or the expression cannot be converted
+    /// or compiled.
+    pub fn add(&mut self, name: &str, expression: &str) -> Result<(), String> {
+        if name.is_empty() {
+            return Err("Empty formula name".to_string());
+        }
+        if self.formulas.iter().any(|(added, _, _)| added == name) {
+            return Err(format!("Formula '{}' is defined twice", name));
+        }
+        let program = infix_to_rpn(expression, &History::new())?.compile()?;
+        self.formulas.push((name.to_string(), expression.to_string(), program.save()));
+        Ok(())
+    }
+
+    /// Returns the bytes of the library file.
+    ///
+    /// # Panics
+    ///
+    /// Panics if a name or expression is longer than `u32::MAX` bytes.
+    pub fn to_bytes(&self) -> Vec<u8> {
+        let mut order: Vec<&(String, String, Vec<u8>)> = self.formulas.iter().collect();
+        order.sort_by(|a, b| a.0.cmp(&b.0));
+
+        let mut programs_size = 0;
+        let mut strings = String::new();
+        let mut entries = Vec::with_capacity(order.len() * ENTRY_SIZE);
+        let programs_start = LIBRARY_HEADER_SIZE + order.len() * ENTRY_SIZE;
+        for (name, source, program) in &order {
+            entries.extend_from_slice(&((programs_start + programs_size) as u64).to_le_bytes());
+            entries.extend_from_slice(&(program.len() as u64).to_le_bytes());
+            entries.extend_from_slice(&(strings.len() as u64).to_le_bytes());
+            entries.extend_from_slice(&u32::try_from(name.len()).expect("Formula name too long").to_le_bytes());
+            entries.extend_from_slice(&u32::try_from(source.len()).expect("Formula too long").to_le_bytes());
+            strings.push_str(name);
+            strings.push_str(source);
+            // Saved programs are a multiple of 8 bytes long
+            programs_size += program.len();
+        }
+
+        let strings_start = programs_start + programs_size;
+        let mut bytes = Vec::with_capacity(strings_start + strings.len());
+        bytes.extend_from_slice(LIBRARY_MAGIC);
+        bytes.extend_from_slice(&(order.len() as u64).to_le_bytes());
+        bytes.extend_from_slice(&(strings_start as u64).to_le_bytes());
+        bytes.extend_from_slice(&((strings_start + strings.len()) as u64).to_le_bytes());
+        bytes.extend_from_slice(&entries);
+        for (_, _, program) in &order {
+            bytes.extend_from_slice(program);
+        }
+        bytes.extend_from_slice(strings.as_bytes());
+        bytes
+    }
+
+    /// Writes the library file.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if the file cannot be written.
+    pub fn write(&self, path: impl AsRef<Path>) -> Result<(), String> {
+        let path = path.as_ref();
+        std::fs::write(path, self.to_bytes())
+            .map_err(|e| format!("Failed to write program library {}: {}", path.display(), e))
+    }
+}
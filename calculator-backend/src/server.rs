@@ -0,0 +1,670 @@
+//! ./src/server.rs
+//! Expression evaluation over HTTP, with concurrent requests coalesced into batches.
+//!
+//! An `Evaluator` queues every expression it is given. A dispatcher task on the Tokio runtime waits for
+//! an idle worker thread, then takes everything queued so far (up to `max_batch_size` expressions,
+//! waiting at most `max_batch_delay` for more) and hands it to that worker as one batch. While all workers
+//! are busy, requests accumulate in the queue, so batches grow with the load by themselves.
+//!
+//! Workers share one least-recently-used compile cache keyed by the input string. Expressions found in it
+//! are evaluated from their compiled program without being parsed again; the others are evaluated together
+//! with a single `calculate_batch` call and then compiled into the cache. Cached programs are compiled without an
+//! `EvalContext`, so they are valid on every worker. Like `calculate_batch`, every expression is evaluated
+//! without history and `ans` resolves to `0`.
+//!
+//! `serve` exposes an `Evaluator` over HTTP/1.1 with keep-alive:
+//!
+//! * `POST /evaluate`: The body holds one expression per line. Blank lines are skipped. The response holds
+//!   one JSON object per expression, in order, in the format of `calculator-backend --format jsonl`.
+//! * `GET /metrics`: Latency percentiles, queue depth, batch and cache statistics in the Prometheus text format,
+//!   followed by the counters of `metrics_snapshot` with the `metrics` feature.
+
+use std::collections::HashMap;
+use std::fmt::Write as _;
+use std::io;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{mpsc, Arc, Mutex};
+use std::time::{Duration, Instant};
+
+use tokio::io::{AsyncBufRead, AsyncBufReadExt, AsyncReadExt, AsyncWrite, AsyncWriteExt, BufReader};
+use tokio::net::{TcpListener, TcpStream};
+use tokio::sync::{mpsc as async_mpsc, oneshot, OwnedSemaphorePermit, Semaphore};
+
+use super::cache::LruMap;
+use super::metrics::{metrics_snapshot, Histogram};
+use super::{
+    calculate_batch_with_precision, get_error_message, infix_to_rpn, CalculationResult, CompiledExpression, History,
+    Precision, SUCCESS,
+};
+
+// Reported when the dispatcher or the workers have stopped
+const STOPPED: &str = "Evaluation service stopped";
+
+// Limits on the request line plus headers, and on the body, of one HTTP request
+const MAX_HEAD_BYTES: u64 = 16 * 1024;
+const MAX_BODY_BYTES: usize = 1 << 20;
+
+/// Settings of an `Evaluator`.
+///
+/// # Fields
+///
+/// * `max_batch_size`: The maximum number of expressions evaluated together.
+/// * `max_batch_delay`: How long a batch waits for more expressions once a worker is idle. With the default
+///   of zero, a batch holds whatever was queued, which under load is already up to `max_batch_size`.
+///   Tokio timers have millisecond granularity, so shorter delays are rounded up.
+/// * `workers`: The number of worker threads evaluating batches, one per core by default.
+/// * `queue_capacity`: The maximum number of queued expressions. Callers wait while the queue is full.
+/// * `cache_capacity`: The maximum number of compiled programs kept. A capacity of `0` disables caching.
+/// * `precision`: The precision mode every expression is evaluated in.
+#[derive(Debug, Clone)]
+pub struct ServerConfig {
+    pub max_batch_size: usize,
+    pub max_batch_delay: Duration,
+    pub workers: usize,
+    pub queue_capacity: usize,
+    pub cache_capacity: usize,
+    pub precision: Precision,
+}
+
+impl Default for ServerConfig {
+    fn default() -> Self {
+        ServerConfig {
+            max_batch_size: 256,
+            max_batch_delay: Duration::ZERO,
+            workers: std::thread::available_parallelism().map_or(1, |n| n.get()),
+            queue_capacity: 65_536,
+            cache_capacity: 4096,
+            precision: Precision::default(),
+        }
+    }
+}
+
+/// A compiled expression in the shared cache.
+///
+/// # Fields
+///
+/// * `rpn_expression`: The RPN string `calculate_batch` reports for the expression.
+/// * `program`: The expression compiled without a context.
+struct CachedProgram {
+    rpn_expression: String,
+    program: CompiledExpression,
+}
+
+impl CachedProgram {
+    /// Parses and compiles `input` as `calculate_batch` would evaluate it, or returns `None` if it does not parse.
+    fn compile(input: &str) -> Option<CachedProgram> {
+        let rpn = infix_to_rpn(input.trim_matches('"'), &History::last_result_only()).ok()?;
+        let program = rpn.compile().ok()?;
+        Some(CachedProgram { rpn_expression: rpn.to_string(), program })
+    }
+
+    /// Evaluates the program, returning the same result `calculate_batch` returns for `input`.
+    fn evaluate(&self, input: &str, precision: Precision) -> CalculationResult {
+        let result = self.program.evaluate_with_precision(precision);
+        CalculationResult {
+            success: result.error_code == SUCCESS,
+            expression: input.trim_matches('"').to_string(),
+            rpn_expression: self.rpn_expression.clone(),
+            result: result.result_value,
+            message: get_error_message(result.error_code).to_string(),
+        }
+    }
+}
+
+/// Counters shared by the dispatcher, the workers and `Evaluator::metrics`.
+struct Metrics {
+    batches: AtomicU64,
+    max_batch_size: AtomicUsize,
+    queue_depth: AtomicUsize,
+    max_queue_depth: AtomicUsize,
+    cache_hits: AtomicU64,
+    cache_misses: AtomicU64,
+    latency: Histogram,
+}
+
+impl Metrics {
+    fn new() -> Self {
+        Metrics {
+            batches: AtomicU64::new(0),
+            max_batch_size: AtomicUsize::new(0),
+            queue_depth: AtomicUsize::new(0),
+            max_queue_depth: AtomicUsize::new(0),
+            cache_hits: AtomicU64::new(0),
+            cache_misses: AtomicU64::new(0),
+            latency: Histogram::new(),
+        }
+    }
+
+    fn enqueued(&self) {
+        let depth = self.queue_depth.fetch_add(1, Ordering::Relaxed) + 1;
+        self.max_queue_depth.fetch_max(depth, Ordering::Relaxed);
+    }
+
+    fn dequeued(&self, count: usize) {
+        self.queue_depth.fetch_sub(count, Ordering::Relaxed);
+    }
+}
+
+/// A point-in-time copy of an `Evaluator`'s metrics, see `Evaluator::metrics`.
+///
+/// # Fields
+///
+/// * `expressions`: The number of expressions evaluated.
+/// * `batches`: The number of batches evaluated.
+/// * `max_batch_size`: The largest batch so far.
+/// * `queue_depth`: The number of expressions queued and not yet taken by a worker.
+/// * `max_queue_depth`: The largest queue depth so far.
+/// * `cache_hits`, `cache_misses`: The number of expressions that were, or were not, found compiled in the cache.
+/// * `cache_entries`: The number of compiled programs in the cache.
+/// * `latency_p50`, `latency_p99`: The median and 99th percentile time from queueing an expression to its
+///   result, to within 1/8.
+/// * `latency_sum`: The total time from queueing to result of all evaluated expressions.
+#[derive(Debug, Clone, PartialEq)]
+pub struct MetricsSnapshot {
+    pub expressions: u64,
+    pub batches: u64,
+    pub max_batch_size: usize,
+    pub queue_depth: usize,
+    pub max_queue_depth: usize,
+    pub cache_hits: u64,
+    pub cache_misses: u64,
+    pub cache_entries: usize,
+    pub latency_p50: Duration,
+    pub latency_p99: Duration,
+    pub latency_sum: Duration,
+}
+
+impl MetricsSnapshot {
+    /// Returns the mean number of expressions per batch, or `0` before the first batch.
+    pub fn mean_batch_size(&self) -> f64 {
+        if self.batches == 0 {
+            0.0
+        } else {
+            self.expressions as f64 / self.batches as f64
+        }
+    }
+
+    /// Renders the metrics in the Prometheus text exposition format.
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+        let mut metric = |name: &str, kind: &str, help: &str, value: &dyn std::fmt::Display| {
+            writeln!(out, "# HELP calculator_{} {}\n# TYPE calculator_{} {}", name, help, name, kind).unwrap();
+            writeln!(out, "calculator_{} {}", name, value).unwrap();
+        };
+        metric("batches_total", "counter", "Batches evaluated.", &self.batches);
+        metric("batch_size_max", "gauge", "Largest batch evaluated.", &self.max_batch_size);
+        metric("queue_depth", "gauge", "Expressions waiting for a worker.", &self.queue_depth);
+        metric("queue_depth_max", "gauge", "Largest number of expressions waiting for a worker.", &self.max_queue_depth);
+        metric("cache_hits_total", "counter", "Expressions evaluated from a cached program.", &self.cache_hits);
+        metric("cache_misses_total", "counter", "Expressions parsed before evaluation.", &self.cache_misses);
+        metric("cache_entries", "gauge", "Compiled programs in the cache.", &self.cache_entries);
+
+        out.push_str("# HELP calculator_latency_seconds Time from queueing an expression to its result.\n");
+        out.push_str("# TYPE calculator_latency_seconds summary\n");
+        writeln!(out, "calculator_latency_seconds{{quantile=\"0.5\"}} {}", self.latency_p50.as_secs_f64()).unwrap();
+        writeln!(out, "calculator_latency_seconds{{quantile=\"0.99\"}} {}", self.latency_p99.as_secs_f64()).unwrap();
+        writeln!(out, "calculator_latency_seconds_sum {}", self.latency_sum.as_secs_f64()).unwrap();
+        writeln!(out, "calculator_latency_seconds_count {}", self.expressions).unwrap();
+        out
+    }
+}
+
+/// A queued expression.
+///
+/// # Fields
+///
+/// * `input`: The expression.
+/// * `queued`: When the expression was queued, the start of its latency.
+/// * `reply`: Receives the result.
+struct Job {
+    input: String,
+    queued: Instant,
+    reply: oneshot::Sender<CalculationResult>,
+}
+
+/// State shared by the `Evaluator` and its workers.
+///
+/// # Fields
+///
+/// * `config`: The settings the evaluator was started with.
+/// * `cache`: The compiled programs, keyed by input string, the least recently used evicted first.
+/// * `metrics`: The counters behind `Evaluator::metrics`.
+struct Shared {
+    config: ServerConfig,
+    cache: Mutex<LruMap<Arc<CachedProgram>>>,
+    metrics: Metrics,
+}
+
+/// Evaluates queued expressions in coalesced batches on a pool of worker threads.
+///
+/// # Fields
+///
+/// * `jobs`: The queue read by the dispatcher.
+/// * `shared`: The cache, metrics and settings shared with the workers.
+pub struct Evaluator {
+    jobs: async_mpsc::Sender<Job>,
+    shared: Arc<Shared>,
+}
+
+impl Evaluator {
+    /// Starts the dispatcher and the worker threads.
+    ///
+    /// Both stop once the returned `Evaluator` is dropped and the expressions queued so far are evaluated.
+    ///
+    /// # Panics
+    ///
+    /// Panics if called outside a Tokio runtime, which the dispatcher is spawned on.
+    pub fn start(config: ServerConfig) -> Arc<Evaluator> {
+        let workers = config.workers.max(1);
+        let max_batch_size = config.max_batch_size.max(1);
+        let max_batch_delay = config.max_batch_delay;
+        let (jobs, queue) = async_mpsc::channel(config.queue_capacity.max(1));
+        let shared = Arc::new(Shared {
+            cache: Mutex::new(LruMap::new(config.cache_capacity)),
+            config,
+            metrics: Metrics::new(),
+        });
+
+        // At most one batch per worker is handed out, so a permit stands for an idle worker
+        let idle_workers = Arc::new(Semaphore::new(workers));
+        let (batches, batch_queue) = mpsc::channel::<(Vec<Job>, OwnedSemaphorePermit)>();
+        let batch_queue = Arc::new(Mutex::new(batch_queue));
+        for i in 0..workers {
+            let batch_queue = Arc::clone(&batch_queue);
+            let shared = Arc::clone(&shared);
+            std::thread::Builder::new()
+                .name(format!("calculator-worker-{}", i))
+                .spawn(move || loop {
+                    let next = batch_queue.lock().unwrap().recv();
+                    match next {
+                        Ok((batch, _permit)) => evaluate_batch(&shared, batch),
+                        Err(_) => break,
+                    }
+                })
+                .expect("Failed to spawn worker thread");
+        }
+        tokio::spawn(dispatch(queue, batches, idle_workers, max_batch_size, max_batch_delay));
+
+        Arc::new(Evaluator { jobs, shared })
+    }
+
+    /// Returns the settings the evaluator was started with.
+    pub fn config(&self) -> &ServerConfig {
+        &self.shared.config
+    }
+
+    /// Queues `input` and waits for its result.
+    ///
+    /// # Returns
+    ///
+    /// The same `CalculationResult` `calculate_batch` returns for `input`.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if the evaluator has stopped.
+    pub async fn evaluate(&self, input: &str) -> Result<CalculationResult, String> {
+        let result = self.enqueue(input).await?;
+        result.await.map_err(|_| STOPPED.to_string())
+    }
+
+    /// Queues all of `inputs` at once and waits for their results, so they can share batches.
+    ///
+    /// # Returns
+    ///
+    /// One `CalculationResult` per input, in the same order.
+    ///
+    /// # Errors
+    ///
+    /// Returns an `Err(String)` if the evaluator has stopped.
+    pub async fn evaluate_all(&self, inputs: &[&str]) -> Result<Vec<CalculationResult>, String> {
+        let mut pending = Vec::with_capacity(inputs.len());
+        for input in inputs {
+            pending.push(self.enqueue(input).await?);
+        }
+        let mut results = Vec::with_capacity(inputs.len());
+        for result in pending {
+            results.push(result.await.map_err(|_| STOPPED.to_string())?);
+        }
+        Ok(results)
+    }
+
+    /// Returns the current metrics.
+    pub fn metrics(&self) -> MetricsSnapshot {
+        let metrics = &self.shared.metrics;
+        let latency = &metrics.latency;
+        MetricsSnapshot {
+            expressions: latency.count(),
+            batches: metrics.batches.load(Ordering::Relaxed),
+            max_batch_size: metrics.max_batch_size.load(Ordering::Relaxed),
+            queue_depth: metrics.queue_depth.load(Ordering::Relaxed),
+            max_queue_depth: metrics.max_queue_depth.load(Ordering::Relaxed),
+            cache_hits: metrics.cache_hits.load(Ordering::Relaxed),
+            cache_misses: metrics.cache_misses.load(Ordering::Relaxed),
+            cache_entries: self.shared.cache.lock().unwrap().len(),
+            latency_p50: Duration::from_micros(latency.quantile(0.5)),
+            latency_p99: Duration::from_micros(latency.quantile(0.99)),
+            latency_sum: Duration::from_micros(latency.sum()),
+        }
+    }
+
+    /// Queues `input`, waiting while the queue is full, and returns the receiver of its result.
+    async fn enqueue(&self, input: &str) -> Result<oneshot::Receiver<CalculationResult>, String> {
+        let (reply, result) = oneshot::channel();
+        let job = Job { input: input.to_string(), queued: Instant::now(), reply };
+        self.shared.metrics.enqueued();
+        if self.jobs.send(job).await.is_err() {
+            self.shared.metrics.dequeued(1);
+            return Err(STOPPED.to_string());
+        }
+        Ok(result)
+    }
+}
+
+/// Hands the queued expressions to the workers in batches, one batch whenever a worker is idle.
+async fn dispatch(
+    mut queue: async_mpsc::Receiver<Job>,
+    batches: mpsc::Sender<(Vec<Job>, OwnedSemaphorePermit)>,
+    idle_workers: Arc<Semaphore>,
+    max_batch_size: usize,
+    max_batch_delay: Duration,
+) {
+    loop {
+        let Ok(permit) = Arc::clone(&idle_workers).acquire_owned().await else { return };
+        let mut batch = Vec::new();
+        if queue.recv_many(&mut batch, max_batch_size).await == 0 {
+            return;
+        }
+        if !max_batch_delay.is_zero() {
+            let deadline = tokio::time::Instant::now() + max_batch_delay;
+            while batch.len() < max_batch_size {
+                let limit = max_batch_size - batch.len();
+                match tokio::time::timeout_at(deadline, queue.recv_many(&mut batch, limit)).await {
+                    Ok(0) | Err(_) => break,
+                    Ok(_) => {}
+                }
+            }
+        }
+        if batches.send((batch, permit)).is_err() {
+            return;
+        }
+    }
+}
+
+/// Evaluates one batch on a worker thread and sends every result to its caller.
+///
+/// Cached expressions are evaluated from their programs. The others are evaluated with one
+/// `calculate_batch` call, and those that parse are compiled into the cache, evicting the least recently
+/// used entries while it is full.
+fn evaluate_batch(shared: &Shared, batch: Vec<Job>) {
+    let metrics = &shared.metrics;
+    let precision = shared.config.precision;
+    metrics.dequeued(batch.len());
+    metrics.batches.fetch_add(1, Ordering::Relaxed);
+    metrics.max_batch_size.fetch_max(batch.len(), Ordering::Relaxed);
+
+    // Lookups update the recency list, so the programs are taken under the lock and evaluated after it
+    let cached: Vec<Option<Arc<CachedProgram>>> = {
+        let mut cache = shared.cache.lock().unwrap();
+        batch.iter().map(|job| cache.find(&job.input).map(|position| Arc::clone(cache.at(position)))).collect()
+    };
+    let mut results: Vec<Option<CalculationResult>> = Vec::with_capacity(batch.len());
+    let mut misses: Vec<usize> = Vec::new();
+    for (i, (job, program)) in batch.iter().zip(cached).enumerate() {
+        match program {
+            Some(program) => results.push(Some(program.evaluate(&job.input, precision))),
+            None => {
+                results.push(None);
+                misses.push(i);
+            }
+        }
+    }
+    metrics.cache_hits.fetch_add((batch.len() - misses.len()) as u64, Ordering::Relaxed);
+    metrics.cache_misses.fetch_add(misses.len() as u64, Ordering::Relaxed);
+
+    if !misses.is_empty() {
+        let inputs: Vec<&str> = misses.iter().map(|&i| batch[i].input.as_str()).collect();
+        let evaluated = calculate_batch_with_precision(&inputs, precision);
+
+        // Expressions that failed to parse, or are empty, have no RPN and are not cached
+        let capacity = shared.config.cache_capacity;
+        let mut compiled: HashMap<&str, Arc<CachedProgram>> = HashMap::new();
+        for (&input, result) in inputs.iter().zip(&evaluated) {
+            if capacity > 0 && !result.rpn_expression.is_empty() && !compiled.contains_key(input) {
+                if let Some(program) = CachedProgram::compile(input) {
+                    compiled.insert(input, Arc::new(program));
+                }
+            }
+        }
+        if !compiled.is_empty() {
+            let mut cache = shared.cache.lock().unwrap();
+            for (input, program) in compiled {
+                cache.insert(input, program);
+            }
+        }
+
+        for (&i, result) in misses.iter().zip(evaluated) {
+            results[i] = Some(result);
+        }
+    }
+
+    for (job, result) in batch.into_iter().zip(results) {
+        metrics.latency.record(job.queued.elapsed().as_micros() as u64);
+        if let Some(result) = result {
+            // The caller may have gone away, e.g. with its connection
+            let _ = job.reply.send(result);
+        }
+    }
+}
+
+/// An HTTP request with its body.
+///
+/// # Fields
+///
+/// * `method`: The request method, e.g. `POST`.
+/// * `path`: The request target without its query string.
+/// * `body`: The request body, empty without a `Content-Length`.
+/// * `keep_alive`: Whether the connection stays open after the response.
+struct Request {
+    method: String,
+    path: String,
+    body: Vec<u8>,
+    keep_alive: bool,
+}
+
+/// Why a request could not be read: the connection failed, or the request is answered with an error status.
+enum RequestError {
+    Io(io::Error),
+    Status(u16, &'static str),
+}
+
+impl From<io::Error> for RequestError {
+    fn from(e: io::Error) -> Self {
+        RequestError::Io(e)
+    }
+}
+
+/// Reads the next request from `reader`, or returns `None` once the client has closed the connection.
+async fn read_request<R: AsyncBufRead + Unpin>(reader: &mut R) -> Result<Option<Request>, RequestError> {
+    let mut head = (&mut *reader).take(MAX_HEAD_BYTES);
+    let mut line = String::new();
+    if head.read_line(&mut line).await? == 0 {
+        return Ok(None);
+    }
+    let mut parts = line.trim_end().split(' ');
+    let (Some(method), Some(target), Some(version), None) = (parts.next(), parts.next(), parts.next(), parts.next())
+    else {
+        return Err(RequestError::Status(400, "Bad Request"));
+    };
+    let path = target.split('?').next().unwrap_or(target).to_string();
+    let method = method.to_string();
+    let mut keep_alive = version == "HTTP/1.1";
+
+    let mut content_length = 0;
+    loop {
+        line.clear();
+        if head.read_line(&mut line).await? == 0 || !line.ends_with('\n') {
+            return Err(RequestError::Status(431, "Request Header Fields Too Large"));
+        }
+        let header = line.trim_end();
+        if header.is_empty() {
+            break;
+        }
+        let Some((name, value)) = header.split_once(':') else {
+            return Err(RequestError::Status(400, "Bad Request"));
+        };
+        let value = value.trim();
+        if name.eq_ignore_ascii_case("content-length") {
+            content_length = value.parse().map_err(|_| RequestError::Status(400, "Bad Request"))?;
+        } else if name.eq_ignore_ascii_case("transfer-encoding") {
+            return Err(RequestError::Status(411, "Length Required"));
+        } else if name.eq_ignore_ascii_case("connection") {
+            if value.eq_ignore_ascii_case("close") {
+                keep_alive = false;
+            } else if value.eq_ignore_ascii_case("keep-alive") {
+                keep_alive = true;
+            }
+        }
+    }
+    if content_length > MAX_BODY_BYTES {
+        return Err(RequestError::Status(413, "Payload Too Large"));
+    }
+
+    let mut body = vec![0; content_length];
+    reader.read_exact(&mut body).await?;
+    Ok(Some(Request { method, path, body, keep_alive }))
+}
+
+/// Appends `value` to `out` as a JSON string.
+fn push_json_string(out: &mut String, value: &str) {
+    out.push('"');
+    for c in value.chars() {
+        match c {
+            '"' => out.push_str("\\\""),
+            '\\' => out.push_str("\\\\"),
+            '\n' => out.push_str("\\n"),
+            '\r' => out.push_str("\\r"),
+            '\t' => out.push_str("\\t"),
+            c if (c as u32) < 0x20 => write!(out, "\\u{:04x}", c as u32).unwrap(),
+            c => out.push(c),
+        }
+    }
+    out.push('"');
+}
+
+/// Appends the JSON line for `result` to `out`, with a `null` result for failures and non-finite values.
+fn push_json_record(out: &mut String, result: &CalculationResult) {
+    out.push_str("{\"expression\":");
+    push_json_string(out, &result.expression);
+    write!(out, ",\"success\":{},\"result\":", result.success).unwrap();
+    if result.success && result.result.is_finite() {
+        write!(out, "{}", result.result).unwrap();
+    } else {
+        out.push_str("null");
+    }
+    out.push_str(",\"message\":");
+    push_json_string(out, &result.message);
+    out.push_str("}\n");
+}
+
+/// A response status, content type and body.
+struct Response {
+    status: u16,
+    reason: &'static str,
+    content_type: &'static str,
+    body: String,
+}
+
+impl Response {
+    fn text(status: u16, reason: &'static str, body: &str) -> Self {
+        Response { status, reason, content_type: "text/plain; charset=utf-8", body: format!("{}\n", body) }
+    }
+}
+
+/// Answers one request.
+async fn respond(evaluator: &Evaluator, request: &Request) -> Response {
+    match (request.method.as_str(), request.path.as_str()) {
+        ("POST", "/evaluate") => {
+            let Ok(body) = std::str::from_utf8(&request.body) else {
+                return Response::text(400, "Bad Request", "Request body is not valid UTF-8");
+            };
+            let inputs: Vec<&str> = body.lines().filter(|line| !line.trim().is_empty()).collect();
+            match evaluator.evaluate_all(&inputs).await {
+                Ok(results) => {
+                    let mut out = String::with_capacity(results.len() * 80);
+                    for result in &results {
+                        push_json_record(&mut out, result);
+                    }
+                    Response { status: 200, reason: "OK", content_type: "application/x-ndjson", body: out }
+                }
+                Err(e) => Response::text(503, "Service Unavailable", &e),
+            }
+        }
+        ("GET", "/metrics") => {
+            let mut body = evaluator.metrics().to_prometheus();
+            // The pipeline counters are all zero unless they are compiled in
+            if cfg!(feature = "metrics") {
+                body.push_str(&metrics_snapshot().to_prometheus());
+            }
+            Response { status: 200, reason: "OK", content_type: "text/plain; version=0.0.4", body }
+        }
+        (_, "/evaluate") | (_, "/metrics") => Response::text(405, "Method Not Allowed", "Method Not Allowed"),
+        _ => Response::text(404, "Not Found", "Not Found"),
+    }
+}
+
+async fn write_response<W: AsyncWrite + Unpin>(writer: &mut W, response: &Response, keep_alive: bool) -> io::Result<()> {
+    let mut out = String::with_capacity(128 + response.body.len());
+    write!(
+        out,
+        "HTTP/1.1 {} {}\r\nContent-Type: {}\r\nContent-Length: {}\r\n{}\r\n",
+        response.status,
+        response.reason,
+        response.content_type,
+        response.body.len(),
+        if keep_alive { "" } else { "Connection: close\r\n" }
+    )
+    .unwrap();
+    out.push_str(&response.body);
+    writer.write_all(out.as_bytes()).await?;
+    writer.flush().await
+}
+
+/// Answers requests on one connection until the client closes it or asks to.
+async fn handle_connection(stream: TcpStream, evaluator: &Evaluator) -> io::Result<()> {
+    stream.set_nodelay(true)?;
+    let (reader, mut writer) = stream.into_split();
+    let mut reader = BufReader::new(reader);
+    loop {
+        let request = match read_request(&mut reader).await {
+            Ok(Some(request)) => request,
+            Ok(None) => return Ok(()),
+            Err(RequestError::Io(e)) => return Err(e),
+            Err(RequestError::Status(status, reason)) => {
+                return write_response(&mut writer, &Response::text(status, reason, reason), false).await;
+            }
+        };
+        let response = respond(evaluator, &request).await;
+        write_response(&mut writer, &response, request.keep_alive).await?;
+        if !request.keep_alive {
+            return Ok(());
+        }
+    }
+}
+
+/// Serves `evaluator` over HTTP on `listener`, one task per connection, until the future is dropped.
+///
+/// Failing connections only end their own task. Errors accepting a connection, such as running out of
+/// file descriptors, pause accepting for a moment.
+pub async fn serve(listener: TcpListener, evaluator: Arc<Evaluator>) {
+    loop {
+        match listener.accept().await {
+            Ok((stream, _)) => {
+                let evaluator = Arc::clone(&evaluator);
+                tokio::spawn(async move {
+                    let _ = handle_connection(stream, &evaluator).await;
+                });
+            }
+            Err(_) => tokio::time::sleep(Duration::from_millis(10)).await,
+        }
+    }
+}
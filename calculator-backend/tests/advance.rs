@@ -124,6 +124,20 @@ mod tests {
                   4.48);
     }
 
+    #[test]
+    fn test_number_parsing() {
+        // A lone literal is pushed without rounding, so its value is exactly the parsed one
+        let literals = [
+            "0.1", "3.14159", "9007199254740992", "9007199254740993", "123456789012345678901",
+            "1e22", "1e23", "2.2250738585072014e-308", "4.9e-324", "1.7976931348623157e308", "0.000001234",
+        ];
+        for literal in literals {
+            let result = calculate_expression(literal, &mut History::new());
+            assert!(result.success, "Literal: {}", literal);
+            assert_eq!(result.result.to_bits(), literal.parse::<f64>().unwrap().to_bits(), "Literal: {}", literal);
+        }
+    }
+
     #[test]
     fn test_scientific_notation() {
         // Scientific notation with small positive exponent
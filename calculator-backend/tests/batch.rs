@@ -0,0 +1,46 @@
+use calculator_backend::{calculate_batch, calculate_expression, History};
+
+#[test]
+fn test_batch_matches_single_calls() {
+    let inputs = [
+        "1 + 2",
+        "(1 + 2) * (3 + 4)",
+        "1 / 0",
+        "sin(pi / 2) + sqrt(5)",
+        "-5 !",
+        "x + 2",
+        "5 ! +",
+        "1.23e5 + 4.56e-7",
+        "",
+    ];
+
+    let results = calculate_batch(&inputs);
+    assert_eq!(results.len(), inputs.len());
+
+    for (input, result) in inputs.iter().zip(&results) {
+        let mut history = History::new();
+        let expected = calculate_expression(input, &mut history);
+        assert_eq!(result.expression, expected.expression);
+        assert_eq!(result.rpn_expression, expected.rpn_expression);
+        assert_eq!(result.success, expected.success, "Expression: {}", input);
+        assert_eq!(result.result, expected.result, "Expression: {}", input);
+        assert_eq!(result.message, expected.message, "Expression: {}", input);
+    }
+}
+
+#[test]
+fn test_batch_empty() {
+    assert!(calculate_batch(&[]).is_empty());
+}
+
+#[test]
+fn test_batch_large() {
+    let inputs: Vec<String> = (0..1000).map(|i| format!("{} * 2 + 1", i)).collect();
+    let refs: Vec<&str> = inputs.iter().map(String::as_str).collect();
+
+    let results = calculate_batch(&refs);
+    for (i, result) in results.iter().enumerate() {
+        assert!(result.success);
+        assert_eq!(result.result, (i * 2 + 1) as f64);
+    }
+}
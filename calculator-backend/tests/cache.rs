@@ -0,0 +1,134 @@
+use calculator_backend::{calculate_expression, ExpressionCache, History};
+
+// Runs the same inputs through `calculate_expression` and a cache and compares every result
+fn assert_matches_uncached(cache: &mut ExpressionCache, inputs: &[&str]) {
+    let mut expected_history = History::new();
+    let mut history = History::new();
+
+    for input in inputs {
+        let expected = calculate_expression(input, &mut expected_history);
+        let result = cache.calculate_expression(input, &mut history);
+
+        assert_eq!(result.success, expected.success, "Expression: {}", input);
+        assert_eq!(result.result, expected.result, "Expression: {}", input);
+        assert_eq!(result.message, expected.message, "Expression: {}", input);
+        assert_eq!(result.rpn_expression, expected.rpn_expression, "Expression: {}", input);
+    }
+
+    assert_eq!(history.get_history().len(), expected_history.get_history().len());
+    for (entry, expected) in history.get_history().iter().zip(expected_history.get_history()) {
+        assert_eq!(entry.input(), expected.input());
+        assert_eq!(entry.result(), expected.result());
+        assert_eq!(entry.error_message(), expected.error_message());
+    }
+}
+
+#[test]
+fn test_cache_matches_uncached() {
+    let inputs = [
+        "1 + 2",
+        "(1 + 2) * (3 + 4)",
+        "√ 36 + 5! / 2",
+        "sin(pi / 2) + cos(0)",
+        "1 + 2",
+        "1 / 0",
+        "x + 2",
+        "5 ! +",
+        "(1 + 2) * (3 + 4)",
+        "1 / 0",
+    ];
+    assert_matches_uncached(&mut ExpressionCache::new(16), &inputs);
+    assert_matches_uncached(&mut ExpressionCache::new(0), &inputs);
+}
+
+#[test]
+fn test_cache_ans() {
+    let inputs = [
+        "ans + 1",
+        "ans + 1",
+        "ans * 2",
+        "ans * 2",
+        "ans - 100",
+        "ans * ans",
+        "1 / 0",
+        "ans * ans",
+        "-ans",
+        "2 ^ ans",
+    ];
+    assert_matches_uncached(&mut ExpressionCache::new(16), &inputs);
+    assert_matches_uncached(&mut ExpressionCache::new(1), &inputs);
+}
+
+#[test]
+fn test_cache_variables() {
+    let mut cache = ExpressionCache::new(16);
+    let mut history = History::new();
+
+    let result = cache.calculate_expression("x * 2", &mut history);
+    assert!(!result.success);
+    assert_eq!(result.message, "Undefined variable in expression");
+
+    cache.set_variable("x", 21.0).unwrap();
+    let result = cache.calculate_expression("x * 2", &mut history);
+    assert!(result.success);
+    assert_eq!(result.result, 42.0);
+
+    cache.set_variable("x", 5.0).unwrap();
+    let result = cache.calculate_expression("x * 2", &mut history);
+    assert_eq!(result.result, 10.0);
+    assert_eq!(cache.get_variable("x"), Some(5.0));
+    assert_eq!(cache.hits(), 2);
+}
+
+#[test]
+fn test_cache_hits_and_misses() {
+    let mut cache = ExpressionCache::new(16);
+    let mut history = History::new();
+
+    for _ in 0..10 {
+        cache.calculate_expression("1 + 2", &mut history);
+        cache.calculate_expression("3 * 4", &mut history);
+    }
+    assert_eq!(cache.misses(), 2);
+    assert_eq!(cache.hits(), 18);
+    assert_eq!(cache.len(), 2);
+
+    cache.clear();
+    assert!(cache.is_empty());
+    cache.calculate_expression("1 + 2", &mut history);
+    assert_eq!(cache.misses(), 3);
+}
+
+#[test]
+fn test_cache_eviction() {
+    let mut cache = ExpressionCache::new(2);
+    let mut history = History::new();
+
+    cache.calculate_expression("1 + 1", &mut history);
+    cache.calculate_expression("2 + 2", &mut history);
+    cache.calculate_expression("1 + 1", &mut history); // "2 + 2" is now the least recently used
+    cache.calculate_expression("3 + 3", &mut history); // Evicts "2 + 2"
+    assert_eq!(cache.len(), 2);
+    assert_eq!(cache.capacity(), 2);
+
+    let misses = cache.misses();
+    let result = cache.calculate_expression("1 + 1", &mut history);
+    assert_eq!(result.result, 2.0);
+    assert_eq!(cache.misses(), misses);
+
+    let result = cache.calculate_expression("2 + 2", &mut history);
+    assert_eq!(result.result, 4.0);
+    assert_eq!(cache.misses(), misses + 1);
+}
+
+#[test]
+fn test_cache_disabled() {
+    let mut cache = ExpressionCache::new(0);
+    let mut history = History::new();
+
+    let result = cache.calculate_expression("1 + 2", &mut history);
+    assert_eq!(result.result, 3.0);
+    cache.calculate_expression("1 + 2", &mut history);
+    assert_eq!(cache.len(), 0);
+    assert_eq!(cache.hits(), 0);
+}
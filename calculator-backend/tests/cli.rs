@@ -0,0 +1,91 @@
+use std::io::Write;
+use std::process::{Command, Output, Stdio};
+
+use calculator_backend::{calculate_expression, History};
+
+// Runs the binary with `args`, feeding `stdin` through a pipe
+fn run(args: &[&str], stdin: &str) -> Output {
+    let mut child = Command::new(env!("CARGO_BIN_EXE_calculator-backend"))
+        .args(args)
+        .stdin(Stdio::piped())
+        .stdout(Stdio::piped())
+        .stderr(Stdio::piped())
+        .spawn()
+        .unwrap();
+    child.stdin.take().unwrap().write_all(stdin.as_bytes()).unwrap();
+    child.wait_with_output().unwrap()
+}
+
+fn stdout_lines(output: &Output) -> Vec<String> {
+    assert!(output.status.success(), "{}", String::from_utf8_lossy(&output.stderr));
+    String::from_utf8(output.stdout.clone()).unwrap().lines().map(str::to_string).collect()
+}
+
+fn temp_file(name: &str, contents: &str) -> std::path::PathBuf {
+    let path = std::env::temp_dir().join(format!("calculator-cli-{}-{}", std::process::id(), name));
+    std::fs::write(&path, contents).unwrap();
+    path
+}
+
+#[test]
+fn test_cli_csv_from_stdin() {
+    let output = run(&["--chunk", "2"], "1 + 2\n\n2 ^ 10\r\n1 / 0\n   \nsin(pi / 2), 3\n(1 + 2");
+    assert_eq!(stdout_lines(&output), vec![
+        "expression,success,result,message",
+        "1 + 2,true,3,Success",
+        "2 ^ 10,true,1024,Success",
+        "1 / 0,false,,Division by zero",
+        "\"sin(pi / 2), 3\",false,,Stack underflow - invalid expression",
+        "(1 + 2,false,,Undefined variable in expression",
+    ]);
+}
+
+#[test]
+fn test_cli_jsonl_from_files() {
+    // Enough lines for several chunks, split over two mapped files
+    let inputs: Vec<String> = (0..1000).map(|i| format!("{} * 0.5 + sqrt({})", i, i)).collect();
+    let first = temp_file("first", &inputs[..600].join("\n"));
+    let second = temp_file("second", &format!("{}\n", inputs[600..].join("\n")));
+    let output = run(&["--format", "jsonl", "--chunk", "64", first.to_str().unwrap(), second.to_str().unwrap()], "");
+    let lines = stdout_lines(&output);
+    std::fs::remove_file(first).unwrap();
+    std::fs::remove_file(second).unwrap();
+
+    assert_eq!(lines.len(), inputs.len());
+    for (input, line) in inputs.iter().zip(&lines) {
+        let expected = calculate_expression(input, &mut History::new());
+        let record = format!(
+            "{{\"expression\":\"{}\",\"success\":true,\"result\":{},\"message\":\"Success\"}}",
+            input, expected.result
+        );
+        assert_eq!(line, &record);
+    }
+
+    // Failures and non-finite results have no JSON value
+    let lines = stdout_lines(&run(&["--format", "jsonl", "-"], "1 / 0\n\"2\"\n"));
+    assert_eq!(lines, vec![
+        "{\"expression\":\"1 / 0\",\"success\":false,\"result\":null,\"message\":\"Division by zero\"}",
+        "{\"expression\":\"2\",\"success\":true,\"result\":2,\"message\":\"Success\"}",
+    ]);
+}
+
+#[test]
+fn test_cli_rpn() {
+    let output = run(&["--rpn"], "3 4 + 2 *\n1 +\n");
+    assert_eq!(stdout_lines(&output), vec![
+        "rpn_expression,success,infix_expression,message",
+        "3 4 + 2 *,true,(3 + 4) * 2,Success",
+        "1 +,false,,Stack underflow - invalid expression",
+    ]);
+}
+
+#[test]
+fn test_cli_usage_errors() {
+    let output = run(&["--format", "xml"], "");
+    assert_eq!(output.status.code(), Some(2));
+    assert!(String::from_utf8_lossy(&output.stderr).contains("Unknown format"));
+
+    let output = run(&["/nonexistent/expressions.txt"], "");
+    assert_eq!(output.status.code(), Some(1));
+    assert!(String::from_utf8_lossy(&output.stderr).contains("/nonexistent/expressions.txt"));
+}
@@ -0,0 +1,55 @@
+use calculator_backend::{calculate_expression, infix_to_rpn, History};
+
+// Evaluates an expression with its variables substituted, as callers did before columnar mode
+fn substituted(input: &str, x: f64, y: f64) -> (bool, f64) {
+    let input = input.replace('x', &format!("({})", x)).replace('y', &format!("({})", y));
+    let mut history = History::new();
+    let result = calculate_expression(&input, &mut history);
+    (result.success, result.result)
+}
+
+#[test]
+fn test_columns_match_row_evaluation() {
+    let input = "sin(x) * x ^ 2 + ln(y)";
+    let history = History::new();
+    let program = infix_to_rpn(input, &history).unwrap().compile().unwrap();
+    assert_eq!(program.variable_names(), vec!["x", "y"]);
+
+    // More rows than one block, with some rows hitting LN_ERROR
+    let xs: Vec<f64> = (0..1000).map(|i| i as f64 * 0.01).collect();
+    let ys: Vec<f64> = (0..1000).map(|i| (i % 50) as f64 - 5.0).collect();
+
+    let result = program.evaluate_columns(&[("x", &xs), ("y", &ys)]).unwrap();
+    assert_eq!(result.values.len(), 1000);
+
+    for i in 0..1000 {
+        let (success, value) = substituted(input, xs[i], ys[i]);
+        assert_eq!(result.error_codes[i] == 0, success, "Row {}", i);
+        if success {
+            assert_eq!(result.values[i], value, "Row {}", i);
+        } else {
+            assert_eq!(result.error_codes[i], 11); // LN_ERROR
+            assert_eq!(result.values[i], 0.0);
+        }
+    }
+}
+
+#[test]
+fn test_columns_errors() {
+    let history = History::new();
+
+    // Division by zero only fails the affected rows
+    let program = infix_to_rpn("1 / x", &history).unwrap().compile().unwrap();
+    let result = program.evaluate_columns(&[("x", &[2.0, 0.0, 4.0])]).unwrap();
+    assert_eq!(result.values, vec![0.5, 0.0, 0.25]);
+    assert_eq!(result.error_codes, vec![0, 1, 0]);
+
+    // Unbound variables are undefined
+    let program = infix_to_rpn("x + y", &history).unwrap().compile().unwrap();
+    let result = program.evaluate_columns(&[("x", &[1.0, 2.0])]).unwrap();
+    assert_eq!(result.error_codes, vec![5, 5]);
+
+    // Columns must have the same length
+    assert!(program.evaluate_columns(&[("x", &[1.0]), ("y", &[1.0, 2.0])]).is_err());
+    assert!(program.evaluate_columns(&[]).is_err());
+}
@@ -0,0 +1,81 @@
+use calculator_backend::{calculate_expression, infix_to_rpn, History};
+
+// Compiles an expression and checks it against the string-based evaluator
+fn assert_matches_interpreter(input: &str) {
+    let mut history = History::new();
+    let expected = calculate_expression(input, &mut history);
+
+    let history = History::new();
+    let program = infix_to_rpn(input, &history).unwrap().compile().unwrap();
+    let result = program.evaluate();
+
+    assert_eq!(result.error_code == 0, expected.success, "Expression: {}", input);
+    if expected.success {
+        assert_eq!(result.result_value, expected.result, "Expression: {}", input);
+    }
+}
+
+#[test]
+fn test_compiled_matches_interpreter() {
+    let expressions = [
+        "1 + 2",
+        "(1 + 2) * (3 + 4)",
+        "2 ^ 3 ^ 2",
+        "1 + 2 * 3 ^ 4 / 5 - 6",
+        "-3 * -4",
+        "5! + 2",
+        "√ 36 + 5! / 2",
+        "sin(pi / 2) + cos(0) * tan(0)",
+        "arcsin(1) + arccos(1) + arctan(1)",
+        "log(100) + ln(e)",
+        "1.23e5 + 4.56e-7",
+    ];
+    for input in expressions {
+        assert_matches_interpreter(input);
+    }
+}
+
+#[test]
+fn test_compiled_errors() {
+    let expressions = [
+        "1 / 0",
+        "-5 !",
+        "5.5!",
+        "√ -16",
+        "log(0)",
+        "ln(-1)",
+        "arcsin(2)",
+        "√",
+        "5 ! +",
+        "x + 2",
+    ];
+    for input in expressions {
+        assert_matches_interpreter(input);
+    }
+}
+
+#[test]
+fn test_compiled_error_codes() {
+    let history = History::new();
+
+    let program = infix_to_rpn("1 / 0", &history).unwrap().compile().unwrap();
+    assert_eq!(program.evaluate().error_code, 1); // DIVISION_BY_ZERO
+
+    let program = infix_to_rpn("5 ! +", &history).unwrap().compile().unwrap();
+    assert_eq!(program.evaluate().error_code, 3); // STACK_UNDERFLOW
+
+    let program = infix_to_rpn("banana", &history).unwrap().compile().unwrap();
+    assert_eq!(program.evaluate().error_code, 5); // UNDEFINED_VARIABLE
+}
+
+#[test]
+fn test_compiled_reuse() {
+    let history = History::new();
+    let program = infix_to_rpn("(((((1 + 2) * 3) + 4) * 5) / 6)", &history).unwrap().compile().unwrap();
+
+    for _ in 0..1000 {
+        let result = program.evaluate();
+        assert_eq!(result.error_code, 0);
+        assert_eq!(result.result_value, 10.833333333);
+    }
+}
@@ -0,0 +1,111 @@
+use calculator_backend::{infix_to_rpn, CompiledBatch, CompiledExpression, EvalContext, History, Precision};
+
+const PRECISIONS: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+fn compile(input: &str) -> CompiledExpression {
+    infix_to_rpn(input, &History::new()).unwrap().compile().unwrap()
+}
+
+// Formulas built from a few shared subterms, some failing on some rows
+fn formulas() -> Vec<String> {
+    let terms = ["sin(x) * cos(y)", "sqrt(x)", "ln(y - 1)", "1 / (x - y)", "x ^ 2", "tan(z)", "(x + y) * 2", "pi"];
+    let mut seed: u64 = 0x9E3779B97F4A7C15;
+    let mut next = |bound: usize| {
+        seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+        (seed >> 33) as usize % bound
+    };
+    let mut formulas: Vec<String> = terms.iter().map(|term| term.to_string()).collect();
+    for i in 0..120 {
+        let a = terms[next(terms.len())];
+        let b = terms[next(terms.len())];
+        formulas.push(match i % 4 {
+            0 => format!("{} + {}", a, b),
+            1 => format!("({}) / ({}) - {}", a, b, i),
+            2 => format!("arcsin({} / 10) * {}", a, b),
+            _ => format!("{} ! + {}", a, a),
+        });
+    }
+    // Constant errors, which fail every row after the errors of what comes before them
+    formulas.extend(["x + 1 / 0", "ln(y - 1) + sqrt(-1) * x", "y / 0 + z"].map(String::from));
+    formulas
+}
+
+#[test]
+fn test_batch_matches_programs() {
+    let programs: Vec<CompiledExpression> = formulas().iter().map(|input| compile(input)).collect();
+    let batch = CompiledBatch::new(&programs.iter().collect::<Vec<_>>()).unwrap();
+    assert_eq!(batch.len(), programs.len());
+    assert_eq!(batch.variable_names(), vec!["x", "y", "z"]);
+    assert_eq!(batch.source_instruction_count(), programs.iter().map(|program| program.instruction_count()).sum::<usize>());
+    assert!(batch.instruction_count() * 2 < batch.source_instruction_count());
+
+    // More rows than one block, and `z` bound or not
+    let xs: Vec<f64> = (0..700).map(|i| (i % 37) as f64 * 0.25).collect();
+    let ys: Vec<f64> = (0..700).map(|i| (i % 23) as f64 * 0.5 - 2.0).collect();
+    let zs: Vec<f64> = (0..700).map(|i| i as f64 * std::f64::consts::FRAC_PI_4).collect();
+    for bindings in [vec![("x", &xs[..]), ("y", &ys[..]), ("z", &zs[..])], vec![("y", &ys[..]), ("x", &xs[..])]] {
+        for precision in PRECISIONS {
+            let results = batch.evaluate_columns_with_precision(&bindings, precision).unwrap();
+            for (program, result) in programs.iter().zip(&results) {
+                let expected = program.evaluate_columns_with_precision(&bindings, precision).unwrap();
+                assert_eq!(result.error_codes, expected.error_codes);
+                let bits = |values: &[f64]| values.iter().map(|value| value.to_bits()).collect::<Vec<u64>>();
+                assert_eq!(bits(&result.values), bits(&expected.values));
+            }
+        }
+    }
+}
+
+#[test]
+fn test_batch_shares_subexpressions() {
+    // Every formula starts with the same product
+    let programs: Vec<CompiledExpression> = (0..100).map(|k| compile(&format!("sin(x) * cos(y) + {}", k))).collect();
+    let batch = CompiledBatch::new(&programs.iter().collect::<Vec<_>>()).unwrap();
+    assert_eq!(batch.source_instruction_count(), 600);
+    // x, y, sin, cos and the product once, then one addition each
+    assert_eq!(batch.instruction_count(), 105);
+
+    // The same program twice is one program
+    let program = compile("sqrt(x) * 2");
+    let batch = CompiledBatch::new(&[&program, &program]).unwrap();
+    assert_eq!(batch.instruction_count(), program.instruction_count());
+    let results = batch.evaluate_columns(&[("x", &[4.0, -1.0])]).unwrap();
+    assert_eq!(results[0], results[1]);
+    assert_eq!(results[0].values, vec![4.0, 0.0]);
+    assert_eq!(results[0].error_codes, vec![0, 9]);
+
+    // Errors of the arguments
+    assert!(batch.evaluate_columns(&[]).is_err());
+    assert!(batch.evaluate_columns(&[("x", &[1.0]), ("y", &[1.0, 2.0])]).is_err());
+    let empty = CompiledBatch::new(&[]).unwrap();
+    assert!(empty.is_empty());
+    assert_eq!(empty.evaluate_columns(&[("x", &[1.0])]).unwrap(), vec![]);
+}
+
+#[test]
+fn test_batch_in_context() {
+    let mut context = EvalContext::new();
+    let history = History::new();
+    let inputs = ["a * b + pi", "sqrt(a * b) - c", "1 / (a - 2)", "ln(a * b)", "a * b"];
+    let programs: Vec<CompiledExpression> =
+        inputs.iter().map(|input| context.compile(&infix_to_rpn(input, &history).unwrap()).unwrap()).collect();
+    let batch = CompiledBatch::new(&programs.iter().collect::<Vec<_>>()).unwrap();
+
+    for (a, b, c) in [(-1.0, 3.0, None), (2.0, 3.0, Some(1.0)), (4.0, 0.1, Some(0.5))] {
+        context.set_variable("a", a).unwrap();
+        context.set_variable("b", b).unwrap();
+        match c {
+            Some(c) => context.set_variable("c", c).unwrap(),
+            None => assert!(context.get_variable("c").is_none()),
+        }
+        for precision in PRECISIONS {
+            context.set_precision(precision);
+            let results = context.evaluate_batch(&batch);
+            for (program, result) in programs.iter().zip(results) {
+                let expected = context.evaluate(program);
+                assert_eq!(result.error_code, expected.error_code);
+                assert_eq!(result.result_value.to_bits(), expected.result_value.to_bits());
+            }
+        }
+    }
+}
@@ -0,0 +1,106 @@
+use calculator_backend::{infix_to_rpn, EvalContext, History};
+
+#[test]
+fn test_context_defaults() {
+    let context = EvalContext::new();
+    assert_eq!(context.get_variable("pi"), Some(std::f64::consts::PI));
+    assert_eq!(context.get_variable("e"), Some(std::f64::consts::E));
+    assert_eq!(context.get_variable("x"), None);
+}
+
+#[test]
+fn test_context_variables() {
+    let history = History::new();
+    let mut context = EvalContext::new();
+    let program = context.compile(&infix_to_rpn("x * 2 + y", &history).unwrap()).unwrap();
+
+    // Variables referenced before they are assigned are undefined
+    assert_eq!(context.evaluate(&program).error_code, 5);
+
+    context.set_variable("x", 3.0).unwrap();
+    context.set_variable("y", 1.5).unwrap();
+    let result = context.evaluate(&program);
+    assert_eq!(result.error_code, 0);
+    assert_eq!(result.result_value, 7.5);
+
+    // The same program picks up new values without recompiling
+    for i in 0..100 {
+        context.set_variable("x", i as f64).unwrap();
+        assert_eq!(context.evaluate(&program).result_value, i as f64 * 2.0 + 1.5);
+    }
+}
+
+#[test]
+fn test_context_defaults_in_expressions() {
+    let history = History::new();
+    let mut context = EvalContext::new();
+    let program = context.compile(&infix_to_rpn("sin(pi / 2) + ln(e)", &history).unwrap()).unwrap();
+    let result = context.evaluate(&program);
+    assert_eq!(result.error_code, 0);
+    assert_eq!(result.result_value, 2.0);
+}
+
+#[test]
+fn test_context_variable_case() {
+    let history = History::new();
+    let mut context = EvalContext::new();
+
+    // Identifiers in expressions are lowercased, so names are read the same way
+    context.set_variable("X", 2.0).unwrap();
+    assert_eq!(context.get_variable("x"), Some(2.0));
+    assert_eq!(context.get_variable("X"), Some(2.0));
+    let program = context.compile(&infix_to_rpn("X + 1", &history).unwrap()).unwrap();
+    assert_eq!(context.evaluate(&program).result_value, 3.0);
+
+    // Assigning through a formula context recomputes the formulas reading the name
+    context.define_formula("y", "x * 10", &history).unwrap();
+    context.set_variables(&[("X", 4.0)]).unwrap();
+    assert_eq!(context.get_variable("y"), Some(40.0));
+    assert!(context.set_variable("Y", 1.0).is_err());
+}
+
+#[test]
+fn test_context_many_variables() {
+    let history = History::new();
+    let mut context = EvalContext::new();
+
+    // Enough names to grow the hash table several times
+    let names: Vec<String> = (0..500).map(|i| format!("var{}", i)).collect();
+    for (i, name) in names.iter().enumerate() {
+        context.set_variable(name, i as f64).unwrap();
+    }
+    for (i, name) in names.iter().enumerate() {
+        assert_eq!(context.get_variable(name), Some(i as f64));
+    }
+
+    let program = context.compile(&infix_to_rpn("var10 + var499", &history).unwrap()).unwrap();
+    assert_eq!(context.evaluate(&program).result_value, 509.0);
+}
+
+#[test]
+fn test_context_mismatch() {
+    let history = History::new();
+    let mut context = EvalContext::new();
+    let other = EvalContext::new();
+    let program = context.compile(&infix_to_rpn("pi", &history).unwrap()).unwrap();
+
+    assert_eq!(other.evaluate(&program).error_code, 4); // MEMORY_ERROR
+    assert_eq!(program.evaluate().error_code, 4);
+}
+
+#[test]
+fn test_context_reallocated() {
+    let history = History::new();
+    let rpn = infix_to_rpn("pi", &history).unwrap();
+    let mut contexts: Vec<EvalContext> = (0..16).map(|_| EvalContext::new()).collect();
+    let programs: Vec<_> = contexts.iter_mut().map(|context| context.compile(&rpn).unwrap()).collect();
+
+    // New contexts are usually allocated at the addresses of the freed ones
+    drop(contexts);
+    for _ in 0..16 {
+        let other = EvalContext::new();
+        for program in &programs {
+            assert_eq!(other.evaluate(program).error_code, 4); // MEMORY_ERROR
+        }
+    }
+}
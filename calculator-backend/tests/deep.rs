@@ -0,0 +1,93 @@
+use calculator_backend::{
+    calculate_batch, calculate_expression, calculate_rpn, infix_to_rpn, CReversePolishExpression, EvalContext,
+    ExpressionCache, History,
+};
+
+// A machine-written sum of `terms` terms, computed left to right
+fn flat_sum(terms: usize) -> String {
+    (1..=terms).map(|i| (i % 10).to_string()).collect::<Vec<String>>().join(" + ")
+}
+
+// `1 + (1 + (... + 1))`, whose RPN pushes every literal before the first addition
+fn nested_sum(depth: usize) -> String {
+    format!("{}1{}", "1 + (".repeat(depth), ")".repeat(depth))
+}
+
+// Evaluates `input` through every path into the C library and checks each returns `expected`
+fn assert_every_path(input: &str, expected: f64) {
+    let rpn = infix_to_rpn(input, &History::new()).unwrap();
+
+    let expr_ptrs = rpn.to_c_expr();
+    let c_expr = CReversePolishExpression {
+        crpn_expression: expr_ptrs.as_ptr(),
+        length: expr_ptrs.len(),
+    };
+    let result = unsafe { calculate_rpn(&c_expr) };
+    assert_eq!((result.error_code, result.result_value), (0, expected), "calculate_rpn");
+
+    let result = rpn.calculate();
+    assert_eq!((result.error_code, result.result_value), (0, expected), "calculate_rpn_typed");
+
+    let result = rpn.compile().unwrap().evaluate();
+    assert_eq!((result.error_code, result.result_value), (0, expected), "evaluate_compiled");
+
+    let mut context = EvalContext::new();
+    let program = context.compile(&rpn).unwrap();
+    let result = context.evaluate(&program);
+    assert_eq!((result.error_code, result.result_value), (0, expected), "evaluate_compiled_in_context");
+
+    let result = context.calculate_expression(input, &mut History::new());
+    assert_eq!(result.result, expected, "calculate_rpn_in_context");
+
+    let result = ExpressionCache::new(4).calculate_expression(input, &mut History::new());
+    assert_eq!(result.result, expected, "cache");
+
+    let results = calculate_batch(&[input, "1 + 1", input]);
+    assert_eq!(results.iter().map(|result| result.result).collect::<Vec<f64>>(), [expected, 2.0, expected]);
+
+    assert_eq!(calculate_expression(input, &mut History::new()).result, expected);
+}
+
+#[test]
+fn test_long_flat_expression() {
+    let input = flat_sum(40_000);
+    let expected = (1..=40_000).map(|i| (i % 10) as f64).sum();
+    assert_every_path(&input, expected);
+}
+
+#[test]
+fn test_deep_stack() {
+    for depth in [99, 100, 255, 256, 257, 20_000] {
+        assert_every_path(&nested_sum(depth), depth as f64 + 1.0);
+    }
+}
+
+#[test]
+fn test_deep_stack_errors() {
+    // Errors deep inside the stack are still found, pooled stacks are reused afterwards
+    let input = format!("{}1 / 0{}", "1 + (".repeat(5_000), ")".repeat(5_000));
+    for _ in 0..3 {
+        assert_eq!(calculate_expression(&input, &mut History::new()).message, "Division by zero");
+        let missing = format!("{} x", nested_sum(5_000));
+        assert!(!calculate_expression(&missing, &mut History::new()).success);
+        assert_eq!(calculate_expression(&nested_sum(5_000), &mut History::new()).result, 5_001.0);
+    }
+}
+
+#[test]
+fn test_deep_columns() {
+    let input = format!("{}x{}", "1 + (".repeat(3_000), ")".repeat(3_000));
+    let program = infix_to_rpn(&input, &History::new()).unwrap().compile().unwrap();
+    let xs: Vec<f64> = (0..1_000).map(f64::from).collect();
+    let columns = program.evaluate_columns(&[("x", &xs)]).unwrap();
+    assert!(columns.error_codes.iter().all(|&code| code == 0));
+    assert_eq!(columns.values, xs.iter().map(|x| x + 3_000.0).collect::<Vec<f64>>());
+}
+
+#[test]
+fn test_deep_to_infix() {
+    // Subtraction is not associative, so every parenthesis is kept
+    let input = format!("{}1 - 1{}", "1 - (".repeat(10_000), ")".repeat(10_000));
+    let rpn = infix_to_rpn(&input, &History::new()).unwrap();
+    assert_eq!(rpn.to_infix().unwrap(), input);
+}
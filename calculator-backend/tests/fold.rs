@@ -0,0 +1,66 @@
+use calculator_backend::{calculate_expression, infix_to_rpn, History};
+
+fn compile(input: &str) -> calculator_backend::CompiledExpression {
+    infix_to_rpn(input, &History::new()).unwrap().compile().unwrap()
+}
+
+// Values where rounding to 9 decimals twice is not the same as rounding once, plus signed zeros
+const VALUES: [f64; 8] = [0.0, -0.0, 1.5, -2.25, 0.1234567891234, 4201282.537170352, -4378512.808763661, 1e300];
+
+// Evaluates `input` over `VALUES` for `x` and compares every row bit for bit with the interpreter,
+// which evaluates the unoptimized expression with the value of `x` written in
+fn assert_matches_interpreter(input: &str) {
+    let program = compile(input);
+    let columns = program.evaluate_columns(&[("x", &VALUES)]).unwrap();
+
+    for (row, value) in VALUES.iter().enumerate() {
+        let substituted = input.replace('x', &format!("({})", value));
+        let expected = calculate_expression(&substituted, &mut History::new());
+        assert_eq!(columns.error_codes[row] == 0, expected.success, "{} with x = {}", input, value);
+        assert_eq!(columns.values[row].to_bits(), expected.result.to_bits(), "{} with x = {}", input, value);
+    }
+}
+
+#[test]
+fn test_fold_constants() {
+    // Everything folds into a single literal
+    for input in ["2 * pi", "√ 2 / 2", "ln(e)", "(1 + 2) * 3 ^ 2 - 4!", "sin(pi / 6) + cos(pi / 3)"] {
+        let program = compile(input);
+        assert_eq!(program.instruction_count(), 1, "Expression: {}", input);
+        let expected = calculate_expression(input, &mut History::new());
+        assert_eq!(program.evaluate().result_value, expected.result, "Expression: {}", input);
+    }
+
+    // x * (2 * pi) keeps one push of x, one literal and the multiplication
+    assert_eq!(compile("x * (2 * pi)").instruction_count(), 3);
+}
+
+#[test]
+fn test_fold_identities() {
+    for input in ["x * 1", "1 * x", "x / 1", "x ^ 1", "x + 0", "0 + x", "x - 0", "x ^ 2", "x + 2.5", "x - 2.5"] {
+        assert_eq!(compile(input).instruction_count(), 2, "Expression: {}", input);
+        assert_matches_interpreter(input);
+    }
+    assert_matches_interpreter("(x * 3 + 1) ^ 2 - (x - 0) * 1 + (2 ^ 10 - 1000) * x");
+    assert_matches_interpreter("sin(x * 1) ^ 2 + cos(x) ^ 2");
+}
+
+#[test]
+fn test_fold_errors() {
+    // Same error codes `apply_operator` reports
+    let cases = [("1 / 0", 1), ("ln(0)", 11), ("log(-1)", 10), ("√ -4", 9), ("(-3)!", 8), ("arcsin(2)", 13)];
+    for (input, error_code) in cases {
+        let program = compile(input);
+        assert_eq!(program.evaluate().error_code, error_code, "Expression: {}", input);
+        assert_eq!(program.instruction_count(), 1, "Expression: {}", input);
+    }
+
+    // An undefined variable before the folded error is still reported first
+    assert_eq!(compile("y + 1 / 0").evaluate().error_code, 5);
+    assert_eq!(compile("1 / 0 + y").evaluate().error_code, 1);
+    assert_eq!(compile("y / (2 - 2)").evaluate().error_code, 5);
+
+    assert_matches_interpreter("x / (1 - 1)");
+    assert_matches_interpreter("x + ln(1 - 1)");
+    assert_matches_interpreter("ln(x)");
+}
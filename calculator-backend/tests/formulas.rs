@@ -0,0 +1,156 @@
+use calculator_backend::{EvalContext, History, Precision};
+
+// Error codes matching C
+const DIVISION_BY_ZERO: i32 = 1;
+const UNDEFINED_VARIABLE: i32 = 5;
+
+// A history whose last result, read by `ans`, is 1
+fn history() -> History {
+    let mut history = History::last_result_only();
+    history.add_entry("1", Ok(1.0));
+    history
+}
+
+// The value of `input` computed from scratch in `context`
+fn expected(context: &EvalContext, input: &str) -> f64 {
+    let result = context.calculate_expression(input, &mut history());
+    assert!(result.success, "{}: {}", input, result.message);
+    result.result
+}
+
+#[test]
+fn test_formulas_follow_their_inputs() {
+    let history = history();
+    let mut context = EvalContext::new();
+    context.set_variable("x", 3.0).unwrap();
+
+    assert_eq!(context.define_formula("a", "x * 2", &history).unwrap().result_value, 6.0);
+    let b = context.define_formula("B", "sqrt(a) + ans", &history).unwrap();
+    assert_eq!(b.result_value, expected(&context, "sqrt(x * 2) + 1"));
+    assert_eq!(context.get_variable("a"), Some(6.0));
+    assert_eq!(context.formula_result("b").unwrap().result_value, b.result_value);
+    assert_eq!(context.calculate_expression("a + b", &mut History::new()).result, 6.0 + b.result_value);
+
+    // A change recomputes what is downstream of it, and nothing else
+    context.define_formula("c", "y + 1", &history).unwrap();
+    context.set_variable("x", 8.0).unwrap();
+    assert_eq!(context.recomputed_formulas(), 2);
+    assert_eq!(context.get_variable("b"), Some(5.0));
+    assert_eq!(context.formula_result("c").unwrap().error_code, UNDEFINED_VARIABLE);
+    context.set_variables(&[("x", 2.0), ("y", 1.0)]).unwrap();
+    assert_eq!(context.recomputed_formulas(), 3);
+    assert_eq!((context.get_variable("b"), context.get_variable("c")), (Some(3.0), Some(2.0)));
+
+    // Formulas may be defined before the formulas they read
+    context.define_formula("d", "e2 * 10", &history).unwrap();
+    assert_eq!(context.formula_result("d").unwrap().error_code, UNDEFINED_VARIABLE);
+    context.define_formula("e2", "b - c", &history).unwrap();
+    assert_eq!(context.recomputed_formulas(), 2);
+    assert_eq!(context.get_variable("d"), Some(10.0));
+
+    // Replacing a formula rewires it
+    context.define_formula("e2", "c", &history).unwrap();
+    context.set_variable("x", 50.0).unwrap();
+    assert_eq!(context.recomputed_formulas(), 2);
+    assert_eq!(context.get_variable("d"), Some(20.0));
+
+    // Changing the precision mode recomputes every formula
+    context.define_formula("third", "1 / 3 * 3", &history).unwrap();
+    assert_eq!(context.get_variable("third"), Some(0.999999999));
+    context.set_precision(Precision::Raw);
+    assert_eq!(context.recomputed_formulas(), 6);
+    assert_eq!(context.get_variable("third"), Some(1.0 / 3.0 * 3.0));
+}
+
+#[test]
+fn test_formula_errors() {
+    let history = history();
+    let mut context = EvalContext::new();
+    context.set_variable("x", 0.0).unwrap();
+    context.define_formula("a", "1 / x", &history).unwrap();
+    context.define_formula("b", "a + 1", &history).unwrap();
+    context.define_formula("c", "b * y", &history).unwrap();
+
+    // Failures propagate, and leave the variables undefined
+    assert_eq!(context.formula_result("a").unwrap().error_code, DIVISION_BY_ZERO);
+    assert_eq!(context.formula_result("b").unwrap().error_code, DIVISION_BY_ZERO);
+    assert_eq!(context.formula_result("c").unwrap().error_code, DIVISION_BY_ZERO);
+    assert_eq!(context.get_variable("a"), None);
+    context.set_variables(&[("x", 4.0), ("y", 2.0)]).unwrap();
+    assert_eq!(context.get_variable("c"), Some(2.5));
+    context.set_variable("x", 0.0).unwrap();
+    assert_eq!(context.get_variable("b"), None);
+    assert!(!context.calculate_expression("b", &mut History::new()).success);
+    context.set_variable("x", 4.0).unwrap();
+
+    // Cycles and invalid names are refused, leaving every formula as it was
+    for (name, input) in [("a", "c + 1"), ("a", "a"), ("b", "sqrt(b)")] {
+        let e = context.define_formula(name, input, &history).unwrap_err();
+        assert!(e.starts_with("Circular reference"), "{}", e);
+    }
+    for name in ["", "2a", "a b", "sin", "ans", "a+b", "-a"] {
+        assert_eq!(context.define_formula(name, "1", &history).unwrap_err(), format!("Invalid formula name '{}'", name));
+    }
+    assert_eq!(context.get_variable("c"), Some(2.5));
+    context.set_variable("x", 1.0).unwrap();
+    assert_eq!(context.recomputed_formulas(), 3);
+    assert_eq!(context.get_variable("c"), Some(4.0));
+
+    // Formulas are not assigned directly
+    assert!(context.set_variable("a", 1.0).is_err());
+    assert!(context.set_variables(&[("x", 5.0), ("b", 1.0)]).is_err());
+    assert_eq!(context.get_variable("x"), Some(1.0));
+
+    // A removed formula leaves an undefined variable, which can then be assigned
+    assert!(context.remove_formula("b"));
+    assert!(!context.remove_formula("b"));
+    assert_eq!(context.formula_result("b").map(|result| result.error_code), None);
+    assert_eq!(context.formula_result("c").unwrap().error_code, UNDEFINED_VARIABLE);
+    context.set_variable("b", 10.0).unwrap();
+    assert_eq!(context.get_variable("c"), Some(20.0));
+    context.define_formula("b", "a", &history).unwrap();
+    assert_eq!(context.get_variable("c"), Some(2.0));
+}
+
+#[test]
+fn test_formula_grid() {
+    // Rows of formulas, each reading two cells of the row above, over columns of inputs
+    const COLUMNS: usize = 300;
+    const ROWS: usize = 8;
+    let define = |context: &mut EvalContext| {
+        for row in 1..ROWS {
+            for column in 0..COLUMNS {
+                let above = |c: usize| if row == 1 { format!("x{}", c) } else { format!("c{}x{}", row - 1, c) };
+                let input = format!("{} * 0.5 + {} / 4 + sqrt(x{})", above(column), above((column + 1) % COLUMNS), column);
+                context.define_formula(&format!("c{}x{}", row, column), &input, &History::new()).unwrap();
+            }
+        }
+    };
+    let mut context = EvalContext::new();
+    for column in 0..COLUMNS {
+        context.set_variable(&format!("x{}", column), column as f64).unwrap();
+    }
+    define(&mut context);
+
+    // One input reaches a cone of cells: two columns wider each row up
+    context.set_variable("x10", 100.0).unwrap();
+    assert_eq!(context.recomputed_formulas(), (1..ROWS).map(|row| row.min(COLUMNS)).sum::<usize>() + ROWS - 1);
+
+    // Every input at once reaches every cell, one whole row per parallel level
+    let inputs: Vec<(String, f64)> = (0..COLUMNS).map(|column| (format!("x{}", column), (column * 7 % 13) as f64)).collect();
+    let assignments: Vec<(&str, f64)> = inputs.iter().map(|(name, value)| (name.as_str(), *value)).collect();
+    context.set_variables(&assignments).unwrap();
+    assert_eq!(context.recomputed_formulas(), (ROWS - 1) * COLUMNS);
+
+    // The same values as defining the grid after the inputs
+    let mut fresh = EvalContext::new();
+    fresh.set_variables(&assignments).unwrap();
+    define(&mut fresh);
+    for row in 1..ROWS {
+        for column in 0..COLUMNS {
+            let name = format!("c{}x{}", row, column);
+            let value = context.get_variable(&name).unwrap();
+            assert_eq!(value.to_bits(), fresh.get_variable(&name).unwrap().to_bits(), "{}", name);
+        }
+    }
+}
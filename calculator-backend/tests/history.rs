@@ -20,13 +20,13 @@ mod tests {
         let entries = history.get_history();
         assert_eq!(entries.len(), 2);
 
-        assert_eq!(entries[0].input, "1 + 2");
-        assert_eq!(entries[0].result, Some(3.0));
-        assert!(entries[0].error_message.is_none());
+        assert_eq!(entries[0].input(), "1 + 2");
+        assert_eq!(entries[0].result(), Some(3.0));
+        assert!(entries[0].error_message().is_none());
 
-        assert_eq!(entries[1].input, "1 / 0");
-        assert!(entries[1].result.is_none());
-        assert_eq!(entries[1].error_message.as_ref().unwrap(), "Division by zero");
+        assert_eq!(entries[1].input(), "1 / 0");
+        assert!(entries[1].result().is_none());
+        assert_eq!(entries[1].error_message().unwrap(), "Division by zero");
     }
 
     #[test]
@@ -48,4 +48,52 @@ mod tests {
         assert!(result.success);
         assert_eq!(result.result, 30.0);
     }
-}
\ No newline at end of file
+
+    #[test]
+    fn test_history_ring_buffer() {
+        let mut history = History::with_capacity(3);
+        for i in 1..=5 {
+            calculate_expression(&format!("{} + 0", i), &mut history);
+        }
+        calculate_expression("1 / 0", &mut history);
+
+        let entries = history.get_history();
+        assert_eq!(entries.len(), 3);
+        assert_eq!(entries[0].input(), "4 + 0");
+        assert_eq!(entries[1].input(), "5 + 0");
+        assert_eq!(entries[2].input(), "1 / 0");
+        assert_eq!(entries[2].error_code(), Some(1));
+        assert_eq!(entries[2].error_message(), Some("Division by zero"));
+
+        // The failed calculation does not change the last result
+        assert_eq!(history.get_last_result(), Some(5.0));
+        let result = calculate_expression("ans * 2", &mut history);
+        assert_eq!(result.result, 10.0);
+        assert_eq!(history.len(), 3);
+    }
+
+    #[test]
+    fn test_history_last_result_only() {
+        let mut history = History::last_result_only();
+        calculate_expression("5 + 5", &mut history);
+        let result = calculate_expression("ans + 5", &mut history);
+
+        assert_eq!(result.result, 15.0);
+        assert!(history.is_empty());
+        assert_eq!(history.get_last_result(), Some(15.0));
+    }
+
+    #[test]
+    fn test_history_clear() {
+        let mut history = History::new();
+        for _ in 0..10 {
+            calculate_expression("2 * 3", &mut history);
+        }
+        assert_eq!(history.len(), 10);
+        assert!(history.get_history().iter().all(|entry| entry.input() == "2 * 3"));
+
+        history.clear();
+        assert!(history.is_empty());
+        assert_eq!(history.get_last_result(), Some(6.0));
+    }
+}
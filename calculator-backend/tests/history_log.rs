@@ -0,0 +1,161 @@
+#![cfg(unix)]
+
+use std::fs::OpenOptions;
+use std::io::Write;
+use std::path::PathBuf;
+
+use calculator_backend::{calculate_expression, History, HistoryLog};
+
+// Returns a path in the temporary directory that no other test uses, with no log left from a previous run
+fn log_path(name: &str) -> PathBuf {
+    let path = std::env::temp_dir().join(format!("calculator-history-{}-{}.log", name, std::process::id()));
+    let _ = std::fs::remove_file(&path);
+    let _ = std::fs::remove_file(path.with_extension("log.blob"));
+    path
+}
+
+#[test]
+fn test_log_persists_entries() {
+    let path = log_path("persist");
+    {
+        let mut log = HistoryLog::open(&path).unwrap();
+        log.append("1 + 2", Ok(3.0)).unwrap();
+        log.append("1 / 0", Err(1)).unwrap();
+        log.append_failure("5 ! +", "Stack underflow").unwrap();
+        assert_eq!(log.len(), 3);
+    }
+
+    let log = HistoryLog::open(&path).unwrap();
+    assert_eq!(log.len(), 3);
+    assert_eq!(log.pending(), 0);
+
+    let entry = log.get(0).unwrap();
+    assert_eq!(entry.input, "1 + 2");
+    assert_eq!(entry.result, Some(3.0));
+    assert_eq!(entry.error_message, None);
+
+    let entry = log.get(1).unwrap();
+    assert_eq!(entry.result, None);
+    assert_eq!(entry.error_code, Some(1));
+    assert_eq!(entry.error_message, Some("Division by zero"));
+
+    let entry = log.get(2).unwrap();
+    assert_eq!(entry.input, "5 ! +");
+    assert_eq!(entry.error_code, None);
+    assert_eq!(entry.error_message, Some("Stack underflow"));
+    assert!(log.get(3).is_none());
+}
+
+#[test]
+fn test_log_queries() {
+    let path = log_path("queries");
+    let mut log = HistoryLog::open(&path).unwrap();
+    log.set_group_size(7);
+    for i in 0..50 {
+        let input = format!("{} * 2", i % 5);
+        log.append(&input, Ok((i % 5) as f64 * 2.0)).unwrap();
+    }
+    // 49 entries are committed in 7 groups, one is still pending
+    assert_eq!(log.pending(), 1);
+
+    let last: Vec<u64> = log.last(3).map(|entry| entry.index).collect();
+    assert_eq!(last, [47, 48, 49]);
+    assert_eq!(log.last(100).count(), 50);
+
+    let matching: Vec<u64> = log.matching("3 * 2").map(|entry| entry.index).collect();
+    assert_eq!(matching, [3, 8, 13, 18, 23, 28, 33, 38, 43, 48]);
+    assert!(log.matching("3 * 3").next().is_none());
+
+    let range: Vec<&str> = log.range(10..13).map(|entry| entry.input).collect();
+    assert_eq!(range, ["0 * 2", "1 * 2", "2 * 2"]);
+    assert_eq!(log.range(45..100).count(), 5);
+    assert_eq!(log.range(60..70).count(), 0);
+
+    let first = log.get(0).unwrap().timestamp_ms;
+    let last = log.get(49).unwrap().timestamp_ms;
+    assert_eq!(log.between(first, last + 1).count(), 50);
+    assert_eq!(log.between(last + 1, u64::MAX).count(), 0);
+    assert_eq!(log.between(0, first).count(), 0);
+}
+
+#[test]
+fn test_log_discards_torn_writes() {
+    let path = log_path("torn");
+    {
+        let mut log = HistoryLog::open(&path).unwrap();
+        log.append("1 + 1", Ok(2.0)).unwrap();
+        log.append("2 + 2", Ok(4.0)).unwrap();
+    }
+
+    // A crash in the middle of writing a record
+    OpenOptions::new().append(true).open(&path).unwrap().write_all(&[0xff; 20]).unwrap();
+
+    let mut log = HistoryLog::open(&path).unwrap();
+    assert_eq!(log.len(), 2);
+    log.append("3 + 3", Ok(6.0)).unwrap();
+    log.commit().unwrap();
+    drop(log);
+
+    let log = HistoryLog::open(&path).unwrap();
+    let inputs: Vec<&str> = log.last(3).map(|entry| entry.input).collect();
+    assert_eq!(inputs, ["1 + 1", "2 + 2", "3 + 3"]);
+}
+
+#[test]
+fn test_log_rejects_other_files() {
+    let path = log_path("invalid");
+    std::fs::write(&path, "not a history log at all").unwrap();
+    assert!(HistoryLog::open(&path).is_err());
+}
+
+#[test]
+fn test_log_rejects_corrupt_records() {
+    let path = log_path("corrupt");
+    let blob_path = path.with_extension("log.blob");
+    let write = || {
+        let mut log = HistoryLog::open(&path).unwrap();
+        log.append("1 + 1", Ok(2.0)).unwrap();
+        log.append("2 + 2", Ok(4.0)).unwrap();
+    };
+    write();
+    let (records, blob) = (std::fs::read(&path).unwrap(), std::fs::read(&blob_path).unwrap());
+
+    // The text of the first record past the end of the blob file, with a valid last record
+    let mut corrupt = records.clone();
+    corrupt[32..40].copy_from_slice(&u64::MAX.to_le_bytes());
+    std::fs::write(&path, &corrupt).unwrap();
+    assert!(HistoryLog::open(&path).unwrap_err().starts_with("Corrupt history log"));
+
+    // Text that is not UTF-8
+    std::fs::write(&path, &records).unwrap();
+    let mut corrupt = blob.clone();
+    corrupt[0] = 0xff;
+    std::fs::write(&blob_path, &corrupt).unwrap();
+    assert!(HistoryLog::open(&path).unwrap_err().starts_with("Corrupt history log"));
+
+    std::fs::write(&blob_path, &blob).unwrap();
+    assert_eq!(HistoryLog::open(&path).unwrap().get(1).unwrap().input, "2 + 2");
+}
+
+#[test]
+fn test_history_with_log() {
+    let path = log_path("history");
+    {
+        let mut history = History::last_result_only().with_log(HistoryLog::open(&path).unwrap());
+        calculate_expression("6 * 7", &mut history);
+        calculate_expression("1 / 0", &mut history);
+        calculate_expression("x + 1", &mut history);
+        assert!(history.is_empty());
+        assert_eq!(history.log().unwrap().len(), 3);
+    }
+
+    let mut history = History::new().with_log(HistoryLog::open(&path).unwrap());
+    assert_eq!(history.get_last_result(), Some(42.0));
+    let result = calculate_expression("ans + 1", &mut history);
+    assert_eq!(result.result, 43.0);
+
+    let log = history.log().unwrap();
+    assert_eq!(log.len(), 4);
+    assert_eq!(log.matching("6 * 7").count(), 1);
+    assert_eq!(log.get(2).unwrap().error_message, Some("Undefined variable in expression"));
+}
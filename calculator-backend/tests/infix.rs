@@ -0,0 +1,86 @@
+use calculator_backend::{calculate_expression, convert_rpn, History};
+
+fn infix(rpn: &str) -> String {
+    let result = convert_rpn(rpn.to_string());
+    assert!(result.success, "RPN: {} ({})", rpn, result.message);
+    result.infix_expression
+}
+
+#[test]
+fn test_infix_precedence() {
+    assert_eq!(infix("1 2 + 3 ^"), "(1 + 2) ^ 3");
+    assert_eq!(infix("1 2 * 3 ^"), "(1 * 2) ^ 3");
+    assert_eq!(infix("1 2 3 * +"), "1 + 2 * 3");
+    assert_eq!(infix("1 2 + 3 4 - /"), "(1 + 2) / (3 - 4)");
+    assert_eq!(infix("-1 2 *"), "-1 * 2");
+    assert_eq!(infix("x -2 *"), "x * (-2)");
+    assert_eq!(infix("-2 3.5 ^ x /"), "(-2) ^ 3.5 / x");
+    assert_eq!(infix("2 -2 ^"), "2 ^ (-2)");
+    assert_eq!(infix("-3 !"), "(-3)!");
+    assert_eq!(infix("9 ln !"), "(ln(9))!");
+    assert_eq!(infix("1 -2 -"), "1 - -2");
+}
+
+#[test]
+fn test_infix_associativity() {
+    assert_eq!(infix("1 2 - 3 -"), "1 - 2 - 3");
+    assert_eq!(infix("1 2 3 - -"), "1 - (2 - 3)");
+    assert_eq!(infix("1 2 3 + -"), "1 - (2 + 3)");
+    assert_eq!(infix("1 2 3 / /"), "1 / (2 / 3)");
+    assert_eq!(infix("1 2 3 * *"), "1 * 2 * 3");
+    assert_eq!(infix("2 3 2 ^ ^"), "2 ^ 3 ^ 2");
+    assert_eq!(infix("2 3 ^ 2 ^"), "(2 ^ 3) ^ 2");
+}
+
+#[test]
+fn test_infix_unary_operators() {
+    assert_eq!(infix("5 !"), "5!");
+    assert_eq!(infix("2 3 + !"), "(2 + 3)!");
+    assert_eq!(infix("16 sqrt"), "sqrt(16)");
+    assert_eq!(infix("pi 2 / sin 1 +"), "sin(pi / 2) + 1");
+    assert!(!convert_rpn("sqrt".to_string()).success);
+}
+
+#[test]
+fn test_infix_long_expression() {
+    let mut rpn = "1".to_string();
+    for i in 2..=1000 {
+        rpn.push_str(&format!(" {} +", i));
+    }
+    let result = infix(&rpn);
+    assert!(result.len() > 1000);
+    assert!(result.starts_with("1 + 2 + 3"));
+    assert!(result.ends_with("+ 999 + 1000"));
+}
+
+#[test]
+fn test_infix_round_trip() {
+    let expressions = [
+        "1 - (2 - 3)",
+        "(1 + 2) ^ 3",
+        "2 ^ 3 ^ 2",
+        "8 / (4 / 2)",
+        "(2 + 3)! - √(16) * 2",
+        "sin(pi / 2) + ln(e) * log(100)",
+        "(-2) ^ 2",
+        "(-2) ^ 3 * 2",
+        "3 / (-2) ^ 2",
+    ];
+    for input in expressions {
+        let mut history = History::new();
+        let expected = calculate_expression(input, &mut history);
+        let converted = infix(&expected.rpn_expression);
+        let result = calculate_expression(&converted, &mut history);
+
+        assert!(expected.success, "Expression: {}", input);
+        assert_eq!(infix(&result.rpn_expression), converted, "Expression: {}", input);
+        assert_eq!(result.result, expected.result, "Expression: {} -> {}", input, converted);
+    }
+
+    // Converted RPN parses back to the same RPN, including expressions that fail to evaluate
+    for rpn in ["9 ln !", "5 sqrt !", "3 ! sqrt", "-2 3.5 ^ x /", "x -2 *"] {
+        let converted = infix(rpn);
+        let result = calculate_expression(&converted, &mut History::new());
+        assert_eq!(result.rpn_expression, rpn, "RPN: {} -> {}", rpn, converted);
+    }
+}
@@ -1,4 +1,4 @@
-use calculator_backend::{calculate_expression, History};
+use calculator_backend::{calculate_expression, tokenize, History, Operator, ReversePolish, Token};
 
 #[test]
 fn test_tokenize_lowercase() {
@@ -15,4 +15,36 @@ fn test_tokenize_case_insensitivity() {
     // Test with uppercase input
     let result = calculate_expression("COS(PI/2)", &mut history);
     assert_eq!(result.result, 0.0);
-}
\ No newline at end of file
+}
+#[test]
+fn test_tokenize_borrowed_tokens() {
+    let input = "SQRT(X) - -2.5 * 1E3 ^ Ans";
+    let tokens: Vec<Token> = tokenize(input).collect();
+
+    assert_eq!(tokens, vec![
+        Token::Operator(Operator::Sqrt),
+        Token::LeftBracket,
+        Token::Variable("X"),
+        Token::RightBracket,
+        Token::Operator(Operator::Subtract),
+        Token::Number("-2.5"),
+        Token::Operator(Operator::Multiply),
+        Token::Number("1E3"),
+        Token::Operator(Operator::Power),
+        Token::Ans,
+    ]);
+}
+
+#[test]
+fn test_rpn_buffer_reuse() {
+    let history = History::new();
+    let mut rpn = ReversePolish::new();
+
+    rpn.parse_infix("SIN(PI / 2) + X", &history).unwrap();
+    assert_eq!(rpn.to_string(), "pi 2 / sin x +");
+    assert_eq!(rpn.len(), 6);
+
+    rpn.parse_infix("1 + 2", &history).unwrap();
+    assert_eq!(rpn.to_string(), "1 2 +");
+    assert_eq!(rpn.tokens().collect::<Vec<&str>>(), vec!["1", "2", "+"]);
+}
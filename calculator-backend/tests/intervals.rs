@@ -0,0 +1,211 @@
+use std::ops::RangeInclusive;
+
+use calculator_backend::{infix_to_rpn, CompiledExpression, History, IntervalResult, IntervalStatus, Precision};
+
+const PRECISIONS: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+// Error codes matching C
+const DIVISION_BY_ZERO: i32 = 1;
+const UNDEFINED_VARIABLE: i32 = 5;
+const FACTORIAL_ERROR: i32 = 8;
+const SQUARE_ROOT_INVALID_OPERATOR: i32 = 9;
+const LN_ERROR: i32 = 11;
+const TAN_INVALID_OPERATOR: i32 = 12;
+const INVALID_TRIG_OPERATOR: i32 = 13;
+
+fn compile(input: &str) -> CompiledExpression {
+    infix_to_rpn(input, &History::new()).unwrap().compile().unwrap()
+}
+
+fn interval(input: &str, bindings: &[(&str, RangeInclusive<f64>)]) -> IntervalResult {
+    compile(input).evaluate_interval(bindings).unwrap()
+}
+
+// Bounds and whether they are exactly the given ones
+fn assert_bounds(result: IntervalResult, low: f64, high: f64) {
+    assert_eq!(result.status, IntervalStatus::Succeeds, "{:?}", result);
+    assert!(result.low <= low && high <= result.high, "{:?} does not hold [{}, {}]", result, low, high);
+    assert!(low - result.low < 1e-12 && result.high - high < 1e-12, "{:?} is wider than [{}, {}]", result, low, high);
+}
+
+// Evenly spaced points of the ranges, their bounds and the corners included, evaluated one by one over columns
+fn sample(program: &CompiledExpression, x: &RangeInclusive<f64>, y: &RangeInclusive<f64>, precision: Precision) -> (Vec<f64>, Vec<i32>) {
+    let steps = 40;
+    let at = |range: &RangeInclusive<f64>, i: usize| {
+        if i == steps { *range.end() } else { range.start() + (range.end() - range.start()) * i as f64 / steps as f64 }
+    };
+    let (mut xs, mut ys) = (Vec::new(), Vec::new());
+    for i in 0..=steps {
+        for j in 0..=steps {
+            xs.push(at(x, i));
+            ys.push(at(y, j));
+        }
+    }
+    let result = program.evaluate_columns_with_precision(&[("x", &xs), ("y", &ys)], precision).unwrap();
+    (result.values, result.error_codes)
+}
+
+#[test]
+fn test_bounds_hold_every_point() {
+    let inputs = [
+        "x + y * 2", "x - y", "x * y", "x / y", "x ^ 2", "x ^ 3 - y ^ 4", "x ^ y", "y ^ x", "x ^ (-1)", "x ^ (-2)",
+        "x ^ 0.5", "sqrt(x)", "sin(x)", "cos(x * y)", "tan(x)", "arcsin(x / 4)", "arccos(y / 3)", "arctan(x * 100)",
+        "log(x)", "ln(y) * x", "x !", "(x + y) !", "sin(x) * cos(y) + x ^ 2 / (y + 1)", "sqrt(x * y) + ln(x + 3)",
+        "1 / (x - 1) + y", "e ^ x - pi", "x * x - x", "-x + 0.1 + 0.2",
+    ];
+    let ranges = [
+        -3.0..=3.0, 0.0..=2.0, 0.5..=0.5, -1e-9..=1e-9, 1.0..=1.25, -10.0..=-2.0, 3.0..=6.0, -0.1..=7.3, 0.0..=0.0,
+    ];
+    for input in inputs {
+        let program = compile(input);
+        for x in &ranges {
+            for y in &ranges {
+                for precision in PRECISIONS {
+                    let result =
+                        program.evaluate_interval_with_precision(&[("x", x.clone()), ("y", y.clone())], precision).unwrap();
+                    let (values, codes) = sample(&program, x, y, precision);
+                    let context = format!("{} over x in {:?}, y in {:?}, {:?}: {:?}", input, x, y, precision, result);
+                    match result.status {
+                        IntervalStatus::Succeeds => assert!(codes.iter().all(|&code| code == 0), "{}", context),
+                        IntervalStatus::Fails => assert!(codes.iter().all(|&code| code != 0), "{}", context),
+                        IntervalStatus::MayFail => assert_ne!(result.error_code, 0, "{}", context),
+                    }
+                    for (value, code) in values.iter().zip(&codes) {
+                        if *code == 0 && !value.is_nan() {
+                            assert!(result.low <= *value && *value <= result.high, "{} misses {}", context, value);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[test]
+// Results are rounded to 9 decimals, so some only approximate the constants of `std::f64::consts`
+#[allow(clippy::approx_constant)]
+fn test_monotonicity_of_operators() {
+    let pi = std::f64::consts::PI;
+    // Extrema inside the interval, and none
+    assert_bounds(interval("sin(x)", &[("x", 0.0..=pi)]), 0.0, 1.0);
+    assert_bounds(interval("sin(x)", &[("x", 0.1..=0.2)]), 0.099833417, 0.198669331);
+    assert_bounds(interval("cos(x)", &[("x", -1.0..=5.0)]), -1.0, 1.0);
+    assert_bounds(interval("cos(x)", &[("x", 4.0..=5.0)]), -0.653643621, 0.283662185);
+    assert_bounds(interval("tan(x)", &[("x", -1.0..=1.0)]), -1.557407725, 1.557407725);
+    // Powers of negative bases, even and odd
+    assert_bounds(interval("x ^ 2", &[("x", -3.0..=2.0)]), 0.0, 9.0);
+    assert_bounds(interval("x ^ 3", &[("x", -3.0..=2.0)]), -27.0, 8.0);
+    assert_bounds(interval("x ^ (-2)", &[("x", 2.0..=4.0)]), 0.0625, 0.25);
+    assert_bounds(interval("2 ^ x", &[("x", -1.0..=3.0)]), 0.5, 8.0);
+    assert_bounds(interval("0.5 ^ x", &[("x", -1.0..=3.0)]), 0.125, 2.0);
+    assert_bounds(interval("x * x", &[("x", -3.0..=2.0)]), -6.0, 9.0);
+    assert_bounds(interval("x ^ y", &[("x", 1.0..=2.0), ("y", 1.0..=3.0)]), 1.0, 8.0);
+    // Factorials of the integers of the interval
+    assert_bounds(interval("5 !", &[]), 120.0, 120.0);
+    assert_bounds(interval("x - 2 + 4 !", &[("x", 2.0..=2.0)]), 24.0, 24.0);
+    let result = interval("x !", &[("x", 2.5..=5.5)]);
+    assert_eq!((result.low, result.high, result.status), (6.0, 120.0, IntervalStatus::MayFail));
+    assert_eq!(result.error_code, FACTORIAL_ERROR);
+    // Logarithms are increasing, arc cosines decreasing
+    assert_bounds(interval("ln(x)", &[("x", 1.0..=std::f64::consts::E)]), 0.0, 1.0);
+    assert_bounds(interval("log(x)", &[("x", 10.0..=1000.0)]), 1.0, 3.0);
+    assert_bounds(interval("arccos(x)", &[("x", -1.0..=0.0)]), 1.570796327, 3.141592654);
+
+    // Single points get the value of a point evaluation, bit for bit
+    let program = compile("sin(x) * cos(y) + x ^ 2 / (y + 1) - arctan(x)");
+    for precision in PRECISIONS {
+        let result = program.evaluate_interval_with_precision(&[("x", 0.3..=0.3), ("y", 1.7..=1.7)], precision).unwrap();
+        let point = program.evaluate_columns_with_precision(&[("x", &[0.3]), ("y", &[1.7])], precision).unwrap();
+        assert_eq!((result.low.to_bits(), result.high.to_bits()), (point.values[0].to_bits(), point.values[0].to_bits()));
+    }
+}
+
+#[test]
+fn test_domain_errors() {
+    // Crossing the boundary of a domain fails for the points beyond it only
+    let result = interval("ln(x)", &[("x", -1.0..=1.0)]);
+    assert_eq!((result.status, result.error_code, result.high), (IntervalStatus::MayFail, LN_ERROR, 0.0));
+    let result = interval("sqrt(x) + 1", &[("x", -4.0..=9.0)]);
+    assert_eq!((result.status, result.error_code, result.low, result.high), (IntervalStatus::MayFail, SQUARE_ROOT_INVALID_OPERATOR, 1.0, 4.0));
+    let result = interval("1 / x", &[("x", -1.0..=2.0)]);
+    assert_eq!((result.status, result.error_code), (IntervalStatus::MayFail, DIVISION_BY_ZERO));
+    assert_eq!((result.low, result.high), (f64::NEG_INFINITY, f64::INFINITY));
+    let result = interval("1 / x", &[("x", 0.0..=2.0)]);
+    assert_eq!((result.status, result.low, result.high), (IntervalStatus::MayFail, 0.5, f64::INFINITY));
+    let result = interval("arcsin(x)", &[("x", 0.5..=3.0)]);
+    assert_eq!((result.status, result.error_code), (IntervalStatus::MayFail, INVALID_TRIG_OPERATOR));
+    let result = interval("tan(x)", &[("x", 1.0..=2.0)]);
+    assert_eq!((result.status, result.error_code), (IntervalStatus::MayFail, TAN_INVALID_OPERATOR));
+
+    // Every point fails outside of the domain, with the first error of the program
+    for (input, error_code) in [("sqrt(x)", SQUARE_ROOT_INVALID_OPERATOR), ("ln(x) + sqrt(x)", LN_ERROR), ("x / (x * 0)", DIVISION_BY_ZERO)] {
+        let result = interval(input, &[("x", -5.0..=-1.0)]);
+        assert_eq!((result.status, result.error_code), (IntervalStatus::Fails, error_code), "{}", input);
+        assert_eq!((result.low, result.high), (0.0, 0.0));
+    }
+    let result = interval("ln(x) + sqrt(ln(x) - 10)", &[("x", -1.0..=2.0)]);
+    assert_eq!((result.status, result.error_code), (IntervalStatus::Fails, LN_ERROR));
+    assert_eq!(interval("x + y", &[("x", 1.0..=2.0)]).error_code, UNDEFINED_VARIABLE);
+    assert_eq!(interval("1 / 0 + x", &[("x", 1.0..=2.0)]).status, IntervalStatus::Fails);
+
+    let program = compile("x + 1");
+    assert_eq!(program.evaluate_interval(&[("x", 2.0..=1.0)]).err().unwrap(), "Invalid range for x");
+    assert!(program.evaluate_interval(&[("x", f64::NAN..=1.0)]).is_err());
+    // Unbounded ranges are bounded too
+    let result = program.evaluate_interval(&[("x", f64::NEG_INFINITY..=0.0)]).unwrap();
+    assert_eq!((result.low, result.high, result.status), (f64::NEG_INFINITY, 1.0, IntervalStatus::Succeeds));
+}
+
+#[test]
+fn test_subdivided_bounds() {
+    // `x - x` is 0, but one interval bounds both uses of `x` independently
+    let program = compile("x * x - x");
+    let single = program.evaluate_interval(&[("x", 0.0..=1.0)]).unwrap();
+    assert_eq!((single.low, single.high), (-1.0, 1.0));
+    let mut previous = single;
+    for max_regions in [1, 4, 64, 1024] {
+        let result = program.bounds(&[("x", 0.0..=1.0)], max_regions).unwrap();
+        assert!(result.succeeds() && previous.low <= result.low && result.high <= previous.high);
+        previous = result;
+    }
+    assert_eq!(program.bounds(&[("x", 0.0..=1.0)], 1).unwrap(), single);
+    // The exact bounds are [-0.25, 0]
+    assert!(previous.low <= -0.25 && previous.low > -0.26 && previous.high >= 0.0 && previous.high < 0.01, "{:?}", previous);
+
+    // Parts where every point fails do not widen the bounds, and the others keep the error
+    let program = compile("sqrt(x) * y");
+    let result = program.bounds(&[("x", -4.0..=4.0), ("y", 1.0..=2.0)], 16).unwrap();
+    assert_eq!((result.status, result.error_code, result.low, result.high), (IntervalStatus::MayFail, SQUARE_ROOT_INVALID_OPERATOR, 0.0, 4.0));
+    let result = program.bounds(&[("x", -4.0..=-1.0), ("y", 1.0..=2.0)], 16).unwrap();
+    assert_eq!(result.status, IntervalStatus::Fails);
+
+    // Exact bounds and single points are not split further
+    let result = compile("x + 1").bounds(&[("x", 3.0..=3.0)], 100).unwrap();
+    assert_eq!((result.low, result.high), (4.0, 4.0));
+
+    // A few hundred regions bound a grid sweep of 1681 points closely
+    let program = compile("sin(x) * cos(y) + x ^ 2 / (y + 1)");
+    let bindings = [("x", -2.0..=2.0), ("y", 0.0..=3.0)];
+    let result = program.bounds(&bindings, 256).unwrap();
+    let (values, _) = sample(&program, &bindings[0].1, &bindings[1].1, Precision::Rounded);
+    let (low, high) = values.iter().fold((f64::INFINITY, f64::NEG_INFINITY), |(low, high), &v| (low.min(v), high.max(v)));
+    assert!(result.low <= low && high <= result.high);
+    assert!(low - result.low < 0.02 && result.high - high < 0.02, "{:?} against [{}, {}]", result, low, high);
+}
+
+#[test]
+fn test_nan_values_are_unbounded() {
+    // `-3 ^ pi` is the constant (-3) ^ pi, NaN, yet `NaN ^ 0` is 1
+    let program = compile("(-3 ^ pi) ^ x");
+    let (values, codes) = sample(&program, &(-1.0..=1.0), &(0.0..=0.0), Precision::Rounded);
+    assert!(codes.iter().all(|&code| code == 0) && values.contains(&1.0));
+    for max_regions in [1, 16] {
+        let result = program.bounds(&[("x", -1.0..=1.0)], max_regions).unwrap();
+        assert_eq!(result.status, IntervalStatus::MayFail);
+        assert_eq!((result.error_code, result.low, result.high), (0, f64::NEG_INFINITY, f64::INFINITY));
+    }
+
+    // Bounds after a NaN value hold too
+    let result = interval("(-3 ^ pi) * 0 + x", &[("x", 1.0..=2.0)]);
+    assert_eq!((result.status, result.low, result.high), (IntervalStatus::MayFail, f64::NEG_INFINITY, f64::INFINITY));
+}
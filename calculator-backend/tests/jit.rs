@@ -0,0 +1,164 @@
+use std::f64::consts::PI;
+
+use calculator_backend::{infix_to_rpn, set_jit_threshold, CompiledExpression, EvalContext, History, Precision};
+
+const PRECISIONS: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+// Whether this build generates native code
+const JIT_ENABLED: bool = cfg!(all(feature = "jit", target_arch = "x86_64", unix));
+
+// One formula per operator and optimized instruction, and a few mixing them
+const FORMULAS: [&str; 26] = [
+    "x + y",
+    "x - y",
+    "x * y",
+    "x / y",
+    "x ^ y",
+    "x ^ 2",
+    "x ^ 5",
+    "x * 1",
+    "x + 0.1",
+    "0.2 - x",
+    "x!",
+    "sqrt(x)",
+    "sin(x)",
+    "cos(x)",
+    "tan(x)",
+    "arcsin(x)",
+    "arccos(x)",
+    "arctan(x)",
+    "log(x)",
+    "ln(x)",
+    "(x + y) * (x - y) / (x * y + 1)",
+    "sqrt(x ^ 2 + y ^ 2) + ln(x * x + 1) - 3 * y",
+    "x / (y - y) + log(x)",
+    "1 / 3 * x + pi",
+    "sin(x) ^ 2 + cos(x) ^ 2 - 1",
+    "((x + 1) * (y + 2) + (x + 3) * (y + 4)) * ((x + 5) * (y + 6) + (x + 7) * (y + 8))",
+];
+
+const VALUES: [f64; 16] = [
+    0.0,
+    -0.0,
+    1.0,
+    -1.0,
+    0.5,
+    2.0,
+    -2.5,
+    10.0,
+    170.0,
+    171.0,
+    1e-10,
+    1e300,
+    PI / 2.0,
+    f64::NAN,
+    f64::INFINITY,
+    f64::NEG_INFINITY,
+];
+
+fn compile(input: &str) -> CompiledExpression {
+    infix_to_rpn(input, &History::new()).unwrap().compile().unwrap()
+}
+
+#[test]
+fn test_jit_matches_interpreter() {
+    let xs: Vec<f64> = VALUES.iter().flat_map(|&x| VALUES.iter().map(move |_| x)).collect();
+    let ys: Vec<f64> = VALUES.iter().flat_map(|_| VALUES.iter().copied()).collect();
+
+    for formula in FORMULAS {
+        let program = compile(formula);
+        for precision in PRECISIONS {
+            let expected = program.evaluate_columns_with_precision(&[("x", &xs), ("y", &ys)], precision).unwrap();
+            let Some(function) = program.jit(precision) else {
+                assert!(!JIT_ENABLED, "Formula: {}", formula);
+                continue;
+            };
+            assert_eq!(function.variable_count(), program.variable_names().len());
+            for row in 0..xs.len() {
+                let values: Vec<f64> = program
+                    .variable_names()
+                    .iter()
+                    .map(|name| if name == "x" { xs[row] } else { ys[row] })
+                    .collect();
+                let (value, error_code) = function.call(&values);
+                let context = format!("{} with x = {}, y = {} in {:?}", formula, xs[row], ys[row], precision);
+                assert_eq!(error_code, expected.error_codes[row], "{}", context);
+                assert_eq!(value.to_bits(), expected.values[row].to_bits(), "{}", context);
+            }
+        }
+    }
+
+    // Folded programs and compile-time failures
+    for input in ["2 * pi + 1", "1 / 0", "1 +", "0.5!", "log(0) + 1", "1 2"] {
+        let program = compile(input);
+        for precision in PRECISIONS {
+            let expected = program.evaluate_with_precision(precision);
+            if let Some(function) = program.jit(precision) {
+                let (value, error_code) = function.call(&[]);
+                let expected = (expected.result_value.to_bits(), expected.error_code);
+                assert_eq!((value.to_bits(), error_code), expected, "{}", input);
+            }
+        }
+    }
+
+    // Programs too deep for a native frame stay interpreted
+    let deep = format!("{}1{}", "(1 + ".repeat(5000), ")".repeat(5000));
+    let program = compile(&deep);
+    assert!(program.jit(Precision::Rounded).is_none());
+    assert_eq!(program.evaluate().result_value, 5001.0);
+}
+
+#[test]
+fn test_jit_promotion() {
+    set_jit_threshold(3);
+
+    // Context-free programs are promoted once evaluated more than the threshold
+    let program = compile("2 ^ 0.5 * 3");
+    let interpreted = program.evaluate();
+    for _ in 0..2 {
+        assert_eq!(program.evaluate().result_value.to_bits(), interpreted.result_value.to_bits());
+        assert!(!program.is_jit_compiled(Precision::Rounded));
+    }
+    let native = program.evaluate();
+    assert_eq!(program.is_jit_compiled(Precision::Rounded), JIT_ENABLED);
+    assert_eq!((native.result_value, native.error_code), (interpreted.result_value, interpreted.error_code));
+
+    // Each precision mode has its own code
+    assert!(!program.is_jit_compiled(Precision::Raw));
+    let raw = program.evaluate_with_precision(Precision::Raw);
+    assert_eq!(program.is_jit_compiled(Precision::Raw), JIT_ENABLED);
+    assert_eq!(raw.result_value, 2f64.powf(0.5) * 3.0);
+
+    // Programs of a context read its current variables
+    let mut context = EvalContext::new();
+    context.set_variable("x", 0.0).unwrap();
+    let rpn = infix_to_rpn("1 / x + y * pi", &History::new()).unwrap();
+    let program = context.compile(&rpn).unwrap();
+    for _ in 0..4 {
+        assert_eq!(context.evaluate(&program).error_code, 1); // DIVISION_BY_ZERO comes before undefined y
+    }
+    context.set_variable("x", 4.0).unwrap();
+    assert_eq!(context.evaluate(&program).error_code, 5); // UNDEFINED_VARIABLE
+    for y in [1.0, -2.0, 0.125] {
+        context.set_variable("y", y).unwrap();
+        let result = context.evaluate(&program);
+        assert_eq!(result.error_code, 0);
+        assert_eq!(result.result_value, ((0.25 + (y * PI * 1e9).round() / 1e9) * 1e9).round() / 1e9);
+    }
+    assert_eq!(program.is_jit_compiled(Precision::Rounded), JIT_ENABLED);
+    context.set_precision(Precision::Raw);
+    assert_eq!(context.evaluate(&program).result_value, 0.25 + 0.125 * PI);
+    context.set_variable("pi", 3.0).unwrap();
+    assert_eq!(context.evaluate(&program).result_value, 0.25 + 0.125 * 3.0);
+
+    // Programs of another context are refused by both tiers
+    let other = EvalContext::new();
+    assert_eq!(other.evaluate(&program).error_code, 4); // MEMORY_ERROR
+
+    set_jit_threshold(u64::MAX);
+    let program = compile("1 + 1");
+    for _ in 0..10 {
+        program.evaluate();
+    }
+    assert!(!program.is_jit_compiled(Precision::Rounded));
+}
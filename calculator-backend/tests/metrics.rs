@@ -0,0 +1,109 @@
+use std::sync::Mutex;
+
+use calculator_backend::{
+    calculate_expression, calculate_expression_into, infix_to_rpn, metrics_snapshot, reset_metrics, CountingAllocator,
+    ExpressionCache, History, ResultBuf, Stage, STAGES,
+};
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+// The counters are global, so the tests of this file take turns
+static COUNTERS: Mutex<()> = Mutex::new(());
+
+// Error codes matching C
+const DIVISION_BY_ZERO: usize = 1;
+const SQUARE_ROOT_INVALID_OPERATOR: usize = 9;
+
+#[test]
+fn test_metrics_count_the_pipeline() {
+    let _guard = COUNTERS.lock().unwrap();
+    reset_metrics();
+    assert!(calculate_expression("2 * (3 + 4)", &mut History::new()).success);
+    assert!(!calculate_expression("1 / 0", &mut History::new()).success);
+    let program = infix_to_rpn("sqrt(x) + 1", &History::new()).unwrap().compile().unwrap();
+    let xs: Vec<f64> = (0..300).map(|i| if i % 3 == 0 { -1.0 } else { i as f64 }).collect();
+    program.evaluate_columns(&[("x", &xs)]).unwrap();
+    let mut cache = ExpressionCache::new(4);
+    for _ in 0..4 {
+        cache.calculate_expression("3 ^ 2", &mut History::new());
+    }
+    let metrics = metrics_snapshot();
+
+    if !cfg!(feature = "metrics") {
+        assert_eq!(metrics.expressions, 0);
+        assert!(metrics.stages.iter().all(|stage| stage.count == 0));
+        assert!(metrics.instructions.iter().all(|&(_, count)| count == 0));
+        return;
+    }
+
+    // Two expressions and the first cache miss are parsed, the expression and the program compiled
+    assert_eq!(metrics.tokens, 7 + 3 + 6 + 3);
+    assert_eq!(metrics.stage(Stage::Parse).count, 4);
+    assert_eq!(metrics.stage(Stage::Compile).count, 2);
+    // Two typed evaluations, the columns, and four from the cache
+    assert_eq!(metrics.stage(Stage::Evaluate).count, 7);
+    assert_eq!(metrics.expressions, 2 + 300 + 4);
+    assert_eq!(metrics.error_codes[0], 1 + 200 + 4);
+    assert_eq!(metrics.error_codes[DIVISION_BY_ZERO], 1);
+    assert_eq!(metrics.error_codes[SQUARE_ROOT_INVALID_OPERATOR], 100);
+    assert!(metrics.evaluator_time <= metrics.stage(Stage::Evaluate).total);
+    assert_eq!(metrics.call_overhead(), metrics.stage(Stage::Evaluate).total - metrics.evaluator_time);
+    for stage in [Stage::Parse, Stage::Evaluate] {
+        let stage = metrics.stage(stage);
+        assert!(stage.p50 <= stage.p99 && stage.total > std::time::Duration::ZERO);
+    }
+
+    // Instructions over columns count once per row; `3 ^ 2` is folded into one push
+    assert_eq!(metrics.instruction_count("push_variable"), Some(300));
+    assert_eq!(metrics.instruction_count("sqrt"), Some(300));
+    assert_eq!(metrics.instruction_count("multiply"), Some(1));
+    assert_eq!(metrics.instruction_count("divide"), Some(1));
+    assert_eq!(metrics.instruction_count("push_number"), Some(3 + 2 + 4));
+    assert_eq!(metrics.instruction_count("power"), Some(0));
+    assert_eq!(metrics.instruction_count("asin"), None);
+    assert_eq!((metrics.cache_hits, metrics.cache_misses), (3, 1));
+    assert_eq!(metrics.cache_hit_rate(), 0.75);
+
+    let text = metrics.to_prometheus();
+    assert!(text.contains("# TYPE calculator_stage_seconds summary\n"));
+    assert!(text.contains("calculator_stage_seconds_count{stage=\"parse\"} 4\n"));
+    assert!(text.contains("calculator_evaluations_total 306\n"));
+    assert!(text.contains("calculator_results_total{code=\"9\"} 100\n"));
+    assert!(text.contains("calculator_instructions_total{opcode=\"sqrt\"} 300\n"));
+    for stage in STAGES {
+        assert!(text.contains(&format!("calculator_stage_seconds_sum{{stage=\"{}\"}}", stage.name())));
+    }
+
+    reset_metrics();
+    assert_eq!(metrics_snapshot().expressions, 0);
+}
+
+#[test]
+fn test_metrics_count_allocations() {
+    let _guard = COUNTERS.lock().unwrap();
+    let mut history = History::last_result_only();
+    let mut out = ResultBuf::new();
+    calculate_expression_into("sqrt(ans + 16) * 2", &mut history, &mut out);
+
+    reset_metrics();
+    for _ in 0..1000 {
+        calculate_expression_into("sqrt(ans + 16) * 2", &mut history, &mut out);
+    }
+    let reused = metrics_snapshot();
+    reset_metrics();
+    for _ in 0..1000 {
+        calculate_expression("sqrt(ans + 16) * 2", &mut history);
+    }
+    let fresh = metrics_snapshot();
+
+    if cfg!(feature = "metrics") {
+        // Every thread is counted, the test harness included, so the reused buffers are only nearly free
+        assert_eq!(reused.expressions, 1000);
+        assert!(reused.allocations_per_expression() < 0.1, "{}", reused.allocations_per_expression());
+        assert!(fresh.allocations_per_expression() >= 3.0, "{}", fresh.allocations_per_expression());
+        assert!(fresh.allocated_bytes > fresh.allocations);
+    } else {
+        assert_eq!((reused.allocations, fresh.allocations), (0, 0));
+    }
+}
@@ -0,0 +1,76 @@
+use std::ffi::CString;
+
+use calculator_backend::{
+    calculate_rpn, get_precedence, is_right_associative, tokenize, CReversePolishExpression, Operator, Token,
+};
+
+// Evaluates RPN string tokens in the C library and returns the error code
+fn c_error_code(tokens: &[&str]) -> i32 {
+    let strings: Vec<CString> = tokens.iter().map(|token| CString::new(*token).unwrap()).collect();
+    let ptrs: Vec<_> = strings.iter().map(|s| s.as_ptr()).collect();
+    let expr = CReversePolishExpression { crpn_expression: ptrs.as_ptr(), length: ptrs.len() };
+    unsafe { calculate_rpn(&expr) }.error_code
+}
+
+#[test]
+fn test_operator_table() {
+    // Name, operator, arity, precedence, right-associative
+    let table = [
+        ("+", Operator::Add, 2, 1, false),
+        ("-", Operator::Subtract, 2, 1, false),
+        ("*", Operator::Multiply, 2, 2, false),
+        ("/", Operator::Divide, 2, 2, false),
+        ("^", Operator::Power, 2, 3, true),
+        ("!", Operator::Factorial, 1, 4, true),
+        ("sqrt", Operator::Sqrt, 1, 4, false),
+        ("sin", Operator::Sin, 1, 5, false),
+        ("cos", Operator::Cos, 1, 5, false),
+        ("tan", Operator::Tan, 1, 5, false),
+        ("arcsin", Operator::Arcsin, 1, 5, false),
+        ("arccos", Operator::Arccos, 1, 5, false),
+        ("arctan", Operator::Arctan, 1, 5, false),
+        ("log", Operator::Log, 1, 4, false),
+        ("ln", Operator::Ln, 1, 4, false),
+    ];
+    for (name, op, arity, precedence, right_associative) in table {
+        assert_eq!(Operator::from_name(name), Some(op), "Operator: {}", name);
+        assert_eq!(op.name(), name);
+        assert_eq!(op.arity(), arity, "Operator: {}", name);
+        assert_eq!(get_precedence(name), precedence, "Operator: {}", name);
+        assert_eq!(is_right_associative(name), right_associative, "Operator: {}", name);
+
+        // The C library knows every operator by the same name, and only by that name
+        let operands: &[&str] = if arity == 1 { &["1", name] } else { &["2", "0.5", name] };
+        assert_eq!(c_error_code(operands), 0, "Operator: {}", name);
+        if name != name.to_uppercase() {
+            assert_eq!(Operator::from_name(&name.to_uppercase()), None);
+            let upper = name.to_uppercase();
+            assert_eq!(c_error_code(&["1", &upper]), 5, "Operator: {}", upper); // UNDEFINED_VARIABLE
+        }
+    }
+    assert_eq!(Operator::from_name("√"), Some(Operator::Sqrt));
+    assert_eq!(c_error_code(&["4", "√"]), 5);
+}
+
+#[test]
+fn test_operator_lookup_rejects() {
+    for name in ["", "s", "si", "sinh", "arcsine", "lnx", "logs", "ans", "x", "1", "++", "12345678", "√√"] {
+        assert_eq!(Operator::from_name(name), None, "Token: {}", name);
+        assert_eq!(get_precedence(name), 0, "Token: {}", name);
+    }
+
+    let tokens: Vec<Token> = tokenize("ARCCOS(Lnx) + Log(cosh) * Tan").collect();
+    assert_eq!(tokens, vec![
+        Token::Operator(Operator::Arccos),
+        Token::LeftBracket,
+        Token::Variable("Lnx"),
+        Token::RightBracket,
+        Token::Operator(Operator::Add),
+        Token::Operator(Operator::Log),
+        Token::LeftBracket,
+        Token::Variable("cosh"),
+        Token::RightBracket,
+        Token::Operator(Operator::Multiply),
+        Token::Operator(Operator::Tan),
+    ]);
+}
@@ -0,0 +1,61 @@
+use calculator_backend::{calculate_expression, infix_to_rpn, History};
+
+// Same rounding as the C library
+fn round_to_9_decimals(value: f64) -> f64 {
+    (value * 1e9).round() / 1e9
+}
+
+fn calculate(input: &str) -> f64 {
+    let result = calculate_expression(input, &mut History::new());
+    assert!(result.success, "Expression: {} ({})", input, result.message);
+    result.result
+}
+
+const BASES: [f64; 14] = [0.0, -0.0, 1.0, -1.0, 2.0, -3.0, 0.5, 1.5, 10.0, 1e-3, 0.1234567891234, -7.25, 1e10, 12345.678];
+
+#[test]
+fn test_integer_powers_match_pow() {
+    for base in BASES {
+        for exponent in 0..=60 {
+            let input = format!("({}) ^ {}", base, exponent);
+            let expected = round_to_9_decimals(base.powf(exponent as f64));
+            assert_eq!(calculate(&input).to_bits(), expected.to_bits(), "Expression: {}", input);
+        }
+    }
+    // Exponents the fast path leaves to `pow`
+    for (input, base, exponent) in [("2 ^ 0.5", 2.0f64, 0.5), ("2 ^ (-3)", 2.0, -3.0), ("2 ^ 100", 2.0, 100.0)] {
+        assert_eq!(calculate(input), round_to_9_decimals(base.powf(exponent)), "Expression: {}", input);
+    }
+}
+
+#[test]
+fn test_literal_powers_in_compiled_programs() {
+    for exponent in [0, 3, 4, 7, 10, 53] {
+        let input = format!("x ^ {}", exponent);
+        let program = infix_to_rpn(&input, &History::new()).unwrap().compile().unwrap();
+        assert_eq!(program.instruction_count(), 2, "Expression: {}", input);
+
+        let columns = program.evaluate_columns(&[("x", &BASES)]).unwrap();
+        for (row, base) in BASES.iter().enumerate() {
+            let expected = round_to_9_decimals(base.powf(exponent as f64));
+            assert_eq!(columns.values[row].to_bits(), expected.to_bits(), "{} with x = {}", input, base);
+        }
+    }
+    // Not an integer, or too large for repeated squaring: kept as a power
+    assert_eq!(infix_to_rpn("x ^ 2.5", &History::new()).unwrap().compile().unwrap().instruction_count(), 3);
+    assert_eq!(infix_to_rpn("x ^ 54", &History::new()).unwrap().compile().unwrap().instruction_count(), 3);
+}
+
+#[test]
+fn test_factorial_table() {
+    let mut product = 1.0f64;
+    for n in 0..=175 {
+        if n > 0 {
+            product *= n as f64;
+        }
+        let result = calculate_expression(&format!("{}!", n), &mut History::new());
+        assert_eq!(result.result.to_bits(), round_to_9_decimals(product).to_bits(), "{}!", n);
+    }
+    assert!(!calculate_expression("2.5!", &mut History::new()).success);
+    assert!(!calculate_expression("(-1)!", &mut History::new()).success);
+}
@@ -0,0 +1,116 @@
+use calculator_backend::{
+    calculate_batch, calculate_batch_par_with_precision, calculate_batch_with_precision, calculate_expression,
+    calculate_expression_with_precision, infix_to_rpn, EvalContext, ExpressionCache, History, Precision,
+};
+
+const MODES: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+// Rounding of the C library
+fn round9(value: f64) -> f64 {
+    (value * 1e9).round() / 1e9
+}
+
+fn calculate(input: &str, precision: Precision) -> f64 {
+    let result = calculate_expression_with_precision(input, &mut History::new(), precision);
+    assert!(result.success, "{}: {}", input, result.message);
+    result.result
+}
+
+#[test]
+fn test_precision_modes() {
+    let third = 1.0 / 3.0;
+    let cases = [
+        ("0.1 + 0.2", 0.1 + 0.2),
+        ("1 / 3 * 3", third * 3.0),
+        ("sin(pi)", std::f64::consts::PI.sin()),
+        ("√ 2 * √ 2 - 2", 2f64.sqrt() * 2f64.sqrt() - 2.0),
+        ("2 ^ 0.5 + ln(10) / 7", 2f64.powf(0.5) + 10f64.ln() / 7.0),
+    ];
+    for (input, raw) in cases {
+        assert_eq!(calculate(input, Precision::Raw).to_bits(), raw.to_bits(), "Expression: {}", input);
+        assert_eq!(calculate(input, Precision::RoundResult).to_bits(), round9(raw).to_bits(), "Expression: {}", input);
+        assert_eq!(
+            calculate(input, Precision::Rounded).to_bits(),
+            calculate_expression(input, &mut History::new()).result.to_bits(),
+            "Expression: {}",
+            input
+        );
+    }
+    assert_eq!(calculate("0.1 + 0.2", Precision::Raw), 0.30000000000000004);
+    assert_eq!(calculate("0.1 + 0.2", Precision::Rounded), 0.3);
+    assert_eq!(calculate("1 / 3 * 3", Precision::Rounded), 0.999999999);
+
+    // Only rounded operations cancel to an exact zero
+    for precision in MODES {
+        let result = calculate_expression_with_precision("1 / (0.1 + 0.2 - 0.3)", &mut History::new(), precision);
+        assert_eq!(result.success, precision != Precision::Rounded, "{:?}", precision);
+        let result = calculate_expression_with_precision("ln(0)", &mut History::new(), precision);
+        assert_eq!(result.message, "Natural logarithm error");
+    }
+}
+
+#[test]
+fn test_precision_compiled() {
+    // `1 / 3` is folded, and `x - 0.1` becomes an addition of a constant
+    let program = infix_to_rpn("x * (1 / 3) + (x - 0.1) ^ 3 + x ^ 2", &History::new()).unwrap().compile().unwrap();
+    let x = [3.0, 0.7, -1.25];
+    for precision in MODES {
+        let columns = program.evaluate_columns_with_precision(&[("x", &x)], precision).unwrap();
+        for (row, value) in x.iter().enumerate() {
+            let substituted = format!("({v}) * (1 / 3) + (({v}) - 0.1) ^ 3 + ({v}) ^ 2", v = value);
+            let expected = calculate(&substituted, precision);
+            assert_eq!(columns.values[row].to_bits(), expected.to_bits(), "{:?} with x = {}", precision, value);
+        }
+    }
+
+    let program = infix_to_rpn("(1 / 3) * 3", &History::new()).unwrap().compile().unwrap();
+    assert_eq!(program.instruction_count(), 1);
+    assert_eq!(program.evaluate().result_value, 0.999999999);
+    assert_eq!(program.evaluate_with_precision(Precision::Rounded).result_value, 0.999999999);
+    assert_eq!(program.evaluate_with_precision(Precision::Raw).result_value, 1.0 / 3.0 * 3.0);
+    assert_eq!(program.evaluate_with_precision(Precision::RoundResult).result_value, 1.0);
+}
+
+#[test]
+fn test_precision_context() {
+    let mut context = EvalContext::new();
+    assert_eq!(context.precision(), Precision::Rounded);
+    context.set_variable("x", 0.1).unwrap();
+    let program = context.compile(&infix_to_rpn("x + 0.2", &History::new()).unwrap()).unwrap();
+    assert_eq!(context.evaluate(&program).result_value, 0.3);
+
+    context.set_precision(Precision::Raw);
+    assert_eq!(context.precision(), Precision::Raw);
+    assert_eq!(context.evaluate(&program).result_value, 0.30000000000000004);
+    assert_eq!(context.calculate_expression("x + 0.2", &mut History::new()).result, 0.30000000000000004);
+    assert_eq!(context.evaluate_with_precision(&program, Precision::Rounded).result_value, 0.3);
+
+    // A program compiled in a context is only evaluated with it
+    assert_eq!(program.evaluate_with_precision(Precision::Raw).error_code, 4); // MEMORY_ERROR
+
+    let mut cache = ExpressionCache::new(4);
+    assert_eq!(cache.calculate_expression("0.1 + 0.2", &mut History::new()).result, 0.3);
+    cache.set_precision(Precision::Raw);
+    assert_eq!(cache.calculate_expression("0.1 + 0.2", &mut History::new()).result, 0.30000000000000004);
+    assert_eq!(cache.hits(), 1);
+}
+
+#[test]
+fn test_precision_batch() {
+    let inputs = ["0.1 + 0.2", "1 / 3 * 3", "sin(pi) + 2 ^ 10", "1 / 0", "(1 + 2", "x"];
+    for precision in MODES {
+        let batch = calculate_batch_with_precision(&inputs, precision);
+        let par = calculate_batch_par_with_precision(&inputs, precision);
+        for ((input, result), par) in inputs.iter().zip(&batch).zip(&par) {
+            assert_eq!(result.result.to_bits(), par.result.to_bits(), "{:?}: {}", precision, input);
+            let expected = calculate_expression_with_precision(input, &mut History::new(), precision);
+            assert_eq!(result.success, expected.success, "{:?}: {}", precision, input);
+            assert_eq!(result.result.to_bits(), expected.result.to_bits(), "{:?}: {}", precision, input);
+            assert_eq!(result.message, expected.message, "{:?}: {}", precision, input);
+        }
+    }
+    let default = calculate_batch_with_precision(&inputs, Precision::default());
+    for (result, expected) in calculate_batch(&inputs).iter().zip(&default) {
+        assert_eq!(result.result.to_bits(), expected.result.to_bits(), "Expression: {}", result.expression);
+    }
+}
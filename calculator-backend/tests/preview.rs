@@ -0,0 +1,177 @@
+use std::sync::mpsc;
+use std::time::Duration;
+
+use calculator_backend::{get_error_message, infix_to_rpn, History, LivePreview, Precision, Preview, PreviewWorker};
+
+const PRECISIONS: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+// A history whose last result, read by `ans`, is 2.5
+fn history() -> History {
+    let mut history = History::last_result_only();
+    history.add_entry("5 / 2", Ok(2.5));
+    history
+}
+
+// Feeds every input to one preview and compares each result with evaluating the input from scratch
+fn assert_matches_calculation(inputs: &[String]) {
+    let history = history();
+    for precision in PRECISIONS {
+        let mut preview = LivePreview::new();
+        preview.set_precision(precision);
+        for input in inputs {
+            let result = preview.update(input, &history);
+            let expected = infix_to_rpn(input.trim_matches('"'), &history).unwrap().calculate_with_precision(precision);
+            assert_eq!(result.error_code, expected.error_code, "Input: {:?} in {:?}", input, precision);
+            assert_eq!(result.result_value.to_bits(), expected.result_value.to_bits(), "Input: {:?} in {:?}", input, precision);
+        }
+    }
+}
+
+#[test]
+fn test_preview_matches_calculation() {
+    // Typing an expression and deleting it again, one character at a time
+    let expression = "√((1 + 2) * (3 - ans)) / (4 ^ (0.5)) - -3.25e1 + sin(pi / (2 + 0))! * (1 / (1 - 1)) + √(1e-3)";
+    let mut inputs: Vec<String> = expression.char_indices().map(|(i, _)| expression[..i].to_string()).collect();
+    inputs.push(expression.to_string());
+    inputs.extend(inputs.clone().into_iter().rev());
+    assert_matches_calculation(&inputs);
+
+    // Edits in the middle, which change how the following tokens read
+    let inputs: Vec<String> = [
+        "(1 + 2) * (3 + 4) - (5 * 6)",
+        "(1 + 2) * (3 + 4) -(5 * 6)",
+        "(1 + 2) * (3 + 4)-(5 * 6)",
+        "(1 + 2) * (3 + 4)-5 * 6)",
+        "(1 + 2) * (3 + 4 -5 * 6)",
+        "(1 + 2) * ((3 + 4 -5 * 6)",
+        "(1 + 2e) * ((3 + 4 -5 * 6)",
+        "(1 + 2e5) * ((3 + 4 -5 * 6)",
+        "(1 + 2e5) * ((3 + 4 -5 * 6))",
+        "\"(1 + 2e5) * ((3 + 4 -5 * 6))\"",
+        "(1 + 2e5) * ((3 + 4 -5 * 6))",
+        "(12 + 2e5) * ((3 + 4 -5 * 6))",
+        "(1 2 + 2e5) * ((3 + 4 -5 * 6))",
+        "(1 2 + 2e5) * √((3 + 4 -5 * 6))",
+        "(1 2 + 2e5) * √(( + 4 -5 * 6))",
+        "",
+        "ans",
+        "(ans) * -(ans)",
+    ]
+    .iter()
+    .map(|input| input.to_string())
+    .collect();
+    assert_matches_calculation(&inputs);
+
+    // Random edits of random expressions
+    const ALPHABET: [&str; 24] = [
+        "1", "2", "0.5", ".", "e", "E", "-", "+", "*", "/", "^", "!", "√", "(", "(", ")", ")", " ", "pi", "ans",
+        "sin", "ln", "x", "\"",
+    ];
+    let mut seed: u64 = 0x2545F4914F6CDD1D;
+    let mut next = |bound: usize| {
+        seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+        (seed >> 33) as usize % bound
+    };
+    let mut input = String::new();
+    let mut inputs = Vec::new();
+    for _ in 0..2000 {
+        let boundaries: Vec<usize> = input.char_indices().map(|(i, _)| i).chain([input.len()]).collect();
+        let start = boundaries[next(boundaries.len())];
+        match next(4) {
+            0 if !input.is_empty() => {
+                let end = *boundaries.iter().find(|&&i| i > start).unwrap_or(&input.len());
+                input.replace_range(start..end, "");
+            }
+            _ => input.insert_str(start, ALPHABET[next(ALPHABET.len())]),
+        }
+        if input.len() > 60 {
+            input.clear();
+        }
+        inputs.push(input.clone());
+    }
+    assert_matches_calculation(&inputs);
+}
+
+#[test]
+fn test_preview_reuses_work() {
+    let history = history();
+    let mut preview = LivePreview::new();
+    let terms: Vec<String> = (0..200).map(|i| format!("({} * (ans + {}))", i, i)).collect();
+    let mut input = terms.join(" + ");
+
+    let expected = |input: &str| infix_to_rpn(input, &history).unwrap().calculate();
+    assert_eq!(preview.update(&input, &history).result_value, expected(&input).result_value);
+    assert_eq!(preview.evaluated_groups(), 400);
+    assert_eq!(preview.retokenized(), 200 * 9 + 199);
+
+    // Typing at the end reads at most the last token again and evaluates no group
+    for c in " - 17".chars() {
+        input.push(c);
+        let result = preview.update(&input, &history);
+        assert_eq!(result.result_value.to_bits(), expected(&input).result_value.to_bits(), "Input: {}", input);
+        assert!(preview.retokenized() <= 2, "Tokens read: {}", preview.retokenized());
+        assert_eq!(preview.evaluated_groups(), 0);
+    }
+
+    // An edit in the first term only evaluates the group around it again
+    input.replace_range(1..2, "10");
+    let result = preview.update(&input, &history);
+    assert_eq!(result.result_value.to_bits(), expected(&input).result_value.to_bits());
+    assert!(preview.retokenized() <= 2, "Tokens read: {}", preview.retokenized());
+    assert_eq!(preview.evaluated_groups(), 1);
+
+    // The same input is not evaluated again
+    preview.update(&input, &history);
+    assert_eq!((preview.retokenized(), preview.evaluated_groups()), (0, 0));
+
+    // A new `ans` or precision mode invalidates every group
+    let mut other = History::last_result_only();
+    other.add_entry("1", Ok(1.0));
+    assert_eq!(preview.update(&input, &other).result_value, infix_to_rpn(&input, &other).unwrap().calculate().result_value);
+    assert_eq!((preview.retokenized(), preview.evaluated_groups()), (0, 400));
+    preview.set_precision(Precision::Raw);
+    let result = preview.update(&input, &other);
+    assert_eq!(result.result_value, infix_to_rpn(&input, &other).unwrap().calculate_with_precision(Precision::Raw).result_value);
+    assert_eq!(preview.evaluated_groups(), 400);
+}
+
+// Waits until the worker finishes the request of `generation`
+fn wait_for(worker: &PreviewWorker, finished: &mpsc::Receiver<()>, generation: u64) -> Preview {
+    loop {
+        finished.recv_timeout(Duration::from_secs(10)).unwrap();
+        if let Some(preview) = worker.take_result() {
+            if preview.generation() == generation {
+                return preview;
+            }
+        }
+    }
+}
+
+#[test]
+fn test_preview_worker() {
+    let history = history();
+    let (sender, finished) = mpsc::channel();
+    let worker = PreviewWorker::spawn(Precision::Rounded, move || {
+        let _ = sender.send(());
+    });
+    assert!(worker.take_result().is_none());
+
+    // Requests made faster than they are evaluated only leave the newest one to finish last
+    let expression = "(1 + 2) * (3 / (4 - ans)) + sqrt(16) - ln(1 - 1)";
+    let mut generation = 0;
+    for end in 1..=expression.len() {
+        generation = worker.request(&expression[..end], &history);
+    }
+    assert_eq!(generation, expression.len() as u64);
+    let preview = wait_for(&worker, &finished, generation);
+    assert_eq!(preview.input(), expression);
+    assert_eq!(preview.value(), None);
+    assert_eq!(preview.error_code(), Some(11));
+    assert_eq!(preview.message(), get_error_message(11));
+    assert!(worker.take_result().is_none());
+
+    let generation = worker.request("(1 + 2) * (3 / (4 - ans))", &history);
+    let preview = wait_for(&worker, &finished, generation);
+    assert_eq!(preview.value(), Some(6.0));
+    assert_eq!(preview.message(), "Success");
+}
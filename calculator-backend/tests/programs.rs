@@ -0,0 +1,202 @@
+use std::process::Command;
+
+use calculator_backend::{
+    infix_to_rpn, CompiledBatch, CompiledExpression, EvalContext, History, Precision, ProgramLibrary,
+    ProgramLibraryBuilder,
+};
+
+const PRECISIONS: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+// Constant, folded, failing and variable expressions, and one of each rewritten instruction
+const EXPRESSIONS: [&str; 12] = [
+    "2 * (3 + 4)",
+    "sin(pi / 6) + 0.1 + 0.2",
+    "1 / 0",
+    "sqrt(-1) + x",
+    "x ^ 2 + y ^ 3 - 1",
+    "x * 1 + (x + 0.5) / y",
+    "ln(x) * log(y) + arcsin(x / 10)",
+    "5 ! - tan(x)",
+    "x / 0 + y",
+    "-0",
+    "((x))",
+    "e ^ x - arctan(y)",
+];
+
+fn compile(input: &str) -> CompiledExpression {
+    infix_to_rpn(input, &History::new()).unwrap().compile().unwrap()
+}
+
+fn temp_path(name: &str) -> std::path::PathBuf {
+    std::env::temp_dir().join(format!("calculator-programs-{}-{}", std::process::id(), name))
+}
+
+// Same values, bit for bit, and error codes in every precision mode and over columns
+fn assert_same(loaded: &CompiledExpression, program: &CompiledExpression) {
+    assert_eq!(loaded.instruction_count(), program.instruction_count());
+    assert_eq!(loaded.variable_names(), program.variable_names());
+    let xs: Vec<f64> = (0..300).map(|i| i as f64 * 0.37 - 20.0).collect();
+    let ys: Vec<f64> = (0..300).map(|i| i as f64 * 0.11 + 0.5).collect();
+    for precision in PRECISIONS {
+        let (expected, result) = (program.evaluate_with_precision(precision), loaded.evaluate_with_precision(precision));
+        assert_eq!(result.error_code, expected.error_code);
+        assert_eq!(result.result_value.to_bits(), expected.result_value.to_bits());
+        let bindings = [("x", &xs[..]), ("y", &ys[..])];
+        let (expected, result) = (
+            program.evaluate_columns_with_precision(&bindings, precision).unwrap(),
+            loaded.evaluate_columns_with_precision(&bindings, precision).unwrap(),
+        );
+        assert_eq!(result.error_codes, expected.error_codes);
+        let bits = |values: &[f64]| values.iter().map(|value| value.to_bits()).collect::<Vec<u64>>();
+        assert_eq!(bits(&result.values), bits(&expected.values));
+    }
+}
+
+#[test]
+fn test_save_and_load() {
+    for input in EXPRESSIONS {
+        let program = compile(input);
+        let bytes = program.save();
+        assert_eq!(bytes.len() % 8, 0);
+        assert_eq!(&bytes[..4], b"CPRG");
+        let loaded = CompiledExpression::load(&bytes).unwrap();
+        assert!(!loaded.is_in_place());
+        assert_same(&loaded, &program);
+        // Saving is deterministic, so a loaded program saves to the same bytes
+        assert_eq!(loaded.save(), bytes, "{}", input);
+    }
+
+    // Programs of a context keep its slots, here loaded into another context
+    let mut source = EvalContext::new();
+    let program = source.compile(&infix_to_rpn("a * b + pi", &History::new()).unwrap()).unwrap();
+    let mut context = EvalContext::new();
+    let loaded = context.load(&program.save()).unwrap();
+    assert_eq!(loaded.variable_names(), vec!["a", "b", "pi"]);
+    assert_eq!(context.evaluate(&loaded).error_code, 5);
+    for context in [&mut source, &mut context] {
+        context.set_variable("a", 2.0).unwrap();
+        context.set_variable("b", 3.0).unwrap();
+    }
+    assert_eq!(context.evaluate(&loaded).result_value.to_bits(), source.evaluate(&program).result_value.to_bits());
+    assert_eq!(source.evaluate(&loaded).error_code, 4);
+}
+
+#[test]
+fn test_load_rejects_invalid_programs() {
+    let bytes = compile("sqrt(x) * y + 2").save();
+    let error = |bytes: &[u8]| CompiledExpression::load(bytes).err().unwrap();
+    assert_eq!(error(b""), "Not a compiled program");
+    assert_eq!(error(b"CALCLIB1"), "Not a compiled program");
+
+    let patched = |at: usize, value: &[u8]| {
+        let mut patched = bytes.clone();
+        patched[at..at + value.len()].copy_from_slice(value);
+        patched
+    };
+    // Version, instruction size and operator table
+    for at in [4, 6, 8] {
+        assert_eq!(error(&patched(at, &[0xEE])), "Compiled program of another format version or operator table");
+    }
+    // Truncated, slot out of range, unknown opcode, underflowing operator, shallower stack, bad name offset
+    assert_eq!(error(&bytes[..bytes.len() - 8]), "Corrupt compiled program");
+    assert_eq!(error(&patched(40 + 8, &[7])), "Corrupt compiled program");
+    assert_eq!(error(&patched(40, &[0xFF])), "Corrupt compiled program");
+    assert_eq!(error(&patched(40, &[2])), "Corrupt compiled program");
+    assert_eq!(error(&patched(24, &[1])), "Corrupt compiled program");
+    assert_eq!(error(&patched(40 + 24 * 5, &[0xFF])), "Corrupt compiled program");
+
+    // Any damaged byte is either rejected or still a valid program, which may only fail to allocate its stack
+    for at in 0..bytes.len() {
+        for flip in [0x01, 0x80, 0xFF] {
+            let mut damaged = bytes.clone();
+            damaged[at] ^= flip;
+            if let Ok(program) = CompiledExpression::load(&damaged) {
+                assert_eq!(program.instruction_count(), 5);
+                if let Err(e) = program.evaluate_columns(&[("x", &[4.0, -1.0]), ("y", &[1.0, 2.0])]) {
+                    assert_eq!(e, "Memory error");
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn test_program_library() {
+    let mut builder = ProgramLibraryBuilder::new();
+    for (i, input) in EXPRESSIONS.iter().enumerate() {
+        builder.add(&format!("formula_{:02}", EXPRESSIONS.len() - i), input).unwrap();
+    }
+    assert!(builder.add("formula_01", "1").is_err());
+    assert!(builder.add("", "1").is_err());
+    assert_eq!(builder.len(), EXPRESSIONS.len());
+
+    let path = temp_path("library");
+    builder.write(&path).unwrap();
+    let library = ProgramLibrary::open(&path).unwrap();
+    assert_eq!(library.len(), EXPRESSIONS.len());
+    let names: Vec<&str> = library.names().collect();
+    assert!(names.windows(2).all(|pair| pair[0] < pair[1]));
+    for (i, input) in EXPRESSIONS.iter().enumerate() {
+        let name = format!("formula_{:02}", EXPRESSIONS.len() - i);
+        let program = library.get(&name).unwrap();
+        assert!(program.is_in_place());
+        assert_eq!(library.source(&name), Some(*input));
+        assert_same(program, &compile(input));
+    }
+    assert!(library.get("formula_00").is_none());
+
+    // A mapped library reads the same programs
+    let mapped = unsafe { ProgramLibrary::open_mapped(&path) }.unwrap();
+    assert!(mapped.iter().zip(library.iter()).all(|((a, first), (b, second))| a == b && first.save() == second.save()));
+    assert!(mapped.iter().all(|(_, program)| program.is_in_place()));
+    drop(mapped);
+
+    // Library programs combine with everything else, and the library outlives the file
+    std::fs::remove_file(&path).unwrap();
+    let programs: Vec<&CompiledExpression> = library.iter().map(|(_, program)| program).collect();
+    let batch = CompiledBatch::new(&programs).unwrap();
+    assert_eq!(batch.evaluate_columns(&[("x", &[2.0]), ("y", &[3.0])]).unwrap().len(), EXPRESSIONS.len());
+
+    let mut context = EvalContext::new();
+    let path = temp_path("context");
+    builder.write(&path).unwrap();
+    let library = ProgramLibrary::open_in_context(&path, &mut context).unwrap();
+    context.set_variable("x", 2.0).unwrap();
+    context.set_variable("y", 3.0).unwrap();
+    assert_eq!(context.evaluate(library.get("formula_08").unwrap()).result_value, 30.0);
+    std::fs::remove_file(&path).unwrap();
+
+    let bytes = builder.to_bytes();
+    assert_eq!(ProgramLibrary::from_bytes(&bytes).unwrap().len(), EXPRESSIONS.len());
+    assert_eq!(ProgramLibrary::from_bytes(&bytes[..bytes.len() - 1]).err().unwrap(), "Corrupt program library");
+    // A string offset so large that the end of the name overflows
+    let mut corrupt = bytes.clone();
+    corrupt[48..56].copy_from_slice(&u64::MAX.to_le_bytes());
+    assert_eq!(ProgramLibrary::from_bytes(&corrupt).err().unwrap(), "Corrupt program library");
+    assert_eq!(ProgramLibrary::from_bytes(b"CPRG").err().unwrap(), "Not a program library");
+    assert!(ProgramLibrary::from_bytes(&ProgramLibraryBuilder::new().to_bytes()).unwrap().is_empty());
+    assert!(ProgramLibrary::open(temp_path("missing")).is_err());
+}
+
+#[test]
+fn test_precompile_tool() {
+    let formulas = temp_path("formulas.txt");
+    let output = temp_path("formulas.lib");
+    std::fs::write(&formulas, "# Areas\ncircle = pi * r ^ 2\n\nsquare = side * side\n").unwrap();
+    let run = |args: &[&std::ffi::OsStr]| Command::new(env!("CARGO_BIN_EXE_calculator-precompile")).args(args).output().unwrap();
+
+    let result = run(&["--output".as_ref(), output.as_os_str(), formulas.as_os_str()]);
+    assert!(result.status.success(), "{}", String::from_utf8_lossy(&result.stderr));
+    let library = ProgramLibrary::open(&output).unwrap();
+    assert_eq!(library.names().collect::<Vec<_>>(), vec!["circle", "square"]);
+    let area = library.get("circle").unwrap().evaluate_columns(&[("r", &[2.0])]).unwrap();
+    assert_eq!(area.values, vec![12.566370614]);
+
+    std::fs::write(&formulas, "ok = 1\nbroken\n").unwrap();
+    let result = run(&["--output".as_ref(), output.as_os_str(), formulas.as_os_str()]);
+    assert!(!result.status.success());
+    assert!(String::from_utf8_lossy(&result.stderr).contains(":2: Expected `name = expression`"));
+    assert!(!run(&[formulas.as_os_str()]).status.success());
+    std::fs::remove_file(&formulas).unwrap();
+    std::fs::remove_file(&output).unwrap();
+}
@@ -0,0 +1,110 @@
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+
+use calculator_backend::{calculate_expression, calculate_expression_into, History, ResultBuf};
+
+// Counts the allocations made by the current thread, so tests running in parallel do not interfere
+struct CountingAllocator;
+
+thread_local! {
+    static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+fn allocations() -> usize {
+    ALLOCATIONS.with(Cell::get)
+}
+
+const INPUTS: [&str; 9] = [
+    "1 + 2 * 3",
+    "\"(1 + 2) * 3\"",
+    "ans / 2",
+    "√ 16 + sin(pi / 2) + ln(e) + log(1000)",
+    "1 / 0",
+    "x * y + x",
+    "(1 + 2",
+    "1 +",
+    "",
+];
+
+#[test]
+fn test_result_buf_matches_calculation_result() {
+    let mut history = History::new();
+    let mut expected_history = History::new();
+    let mut out = ResultBuf::new();
+
+    for input in INPUTS {
+        calculate_expression_into(input, &mut history, &mut out);
+        let expected = calculate_expression(input, &mut expected_history);
+
+        assert_eq!(out.success(), expected.success, "Expression: {}", input);
+        assert_eq!(out.message(), expected.message, "Expression: {}", input);
+        assert_eq!(out.value().is_some(), expected.success, "Expression: {}", input);
+        let actual = out.to_calculation_result(input);
+        assert_eq!(actual.expression, expected.expression, "Expression: {}", input);
+        assert_eq!(actual.rpn_expression, expected.rpn_expression, "Expression: {}", input);
+        assert_eq!(actual.result.to_bits(), expected.result.to_bits(), "Expression: {}", input);
+        assert_eq!(actual.message, expected.message, "Expression: {}", input);
+    }
+    assert_eq!(history.len(), expected_history.len());
+    assert_eq!(history.get_last_result(), expected_history.get_last_result());
+}
+
+#[test]
+fn test_result_buf_fields() {
+    let mut history = History::new();
+    let mut out = ResultBuf::new();
+
+    calculate_expression_into("2 ^ 10", &mut history, &mut out);
+    assert_eq!(out.value(), Some(1024.0));
+    assert_eq!(out.error_code(), None);
+    assert_eq!(out.rpn().unwrap().to_string(), "2 10 ^");
+
+    calculate_expression_into("1 / 0", &mut history, &mut out);
+    assert_eq!(out.value(), None);
+    assert_eq!(out.error_code(), Some(1));
+    assert_eq!(out.message(), "Division by zero");
+
+    calculate_expression_into("1 +", &mut history, &mut out);
+    assert_eq!(out.error_code(), Some(3));
+    assert_eq!(out.rpn().unwrap().to_string(), "1 +");
+    assert_eq!(out.message(), "Stack underflow - invalid expression");
+    assert_eq!(history.get_last_result(), Some(1024.0));
+}
+
+#[test]
+fn test_result_buf_does_not_allocate() {
+    let mut history = History::last_result_only();
+    let mut out = ResultBuf::new();
+
+    // The first pass grows the buffers
+    for input in INPUTS {
+        calculate_expression_into(input, &mut history, &mut out);
+    }
+
+    let before = allocations();
+    for _ in 0..100 {
+        for input in INPUTS {
+            calculate_expression_into(input, &mut history, &mut out);
+        }
+    }
+    assert_eq!(allocations() - before, 0);
+}
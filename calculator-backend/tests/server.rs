@@ -0,0 +1,182 @@
+#![cfg(feature = "server")]
+
+use std::sync::Arc;
+use std::time::Duration;
+
+use calculator_backend::server::{serve, Evaluator, ServerConfig};
+use calculator_backend::{calculate_batch, CalculationResult};
+use tokio::io::{AsyncBufReadExt, AsyncReadExt, AsyncWriteExt, BufReader};
+use tokio::net::{TcpListener, TcpStream};
+
+fn runtime() -> tokio::runtime::Runtime {
+    tokio::runtime::Builder::new_multi_thread().worker_threads(2).enable_all().build().unwrap()
+}
+
+fn assert_same(actual: &CalculationResult, expected: &CalculationResult) {
+    assert_eq!(actual.success, expected.success, "Expression: {}", expected.expression);
+    assert_eq!(actual.expression, expected.expression);
+    assert_eq!(actual.rpn_expression, expected.rpn_expression, "Expression: {}", expected.expression);
+    assert_eq!(actual.message, expected.message, "Expression: {}", expected.expression);
+    if expected.success {
+        assert_eq!(actual.result.to_bits(), expected.result.to_bits(), "Expression: {}", expected.expression);
+    }
+}
+
+const EXPRESSIONS: [&str; 10] = [
+    "1 + 2 * 3",
+    "2 ^ 3 ^ 2",
+    "sin(pi / 6) + cos(0)",
+    "sqrt(2) * sqrt(2)",
+    "5! / (1 / 3)",
+    "ln(e) + log(1000)",
+    "1 / 0",
+    "\"4 - 7\"",
+    "(1 + 2",
+    ")",
+];
+
+#[test]
+fn test_server_coalesces_requests() {
+    runtime().block_on(async {
+        let config = ServerConfig {
+            workers: 1,
+            max_batch_size: 16,
+            max_batch_delay: Duration::from_millis(20),
+            ..ServerConfig::default()
+        };
+        let evaluator = Evaluator::start(config);
+        let inputs: Vec<String> = (0..200).map(|i| format!("{} * 0.5 + sqrt({})", i, i)).collect();
+
+        let tasks: Vec<_> = inputs
+            .iter()
+            .map(|input| {
+                let evaluator = Arc::clone(&evaluator);
+                let input = input.clone();
+                tokio::spawn(async move { evaluator.evaluate(&input).await.unwrap() })
+            })
+            .collect();
+        let input_refs: Vec<&str> = inputs.iter().map(String::as_str).collect();
+        for (task, expected) in tasks.into_iter().zip(calculate_batch(&input_refs)) {
+            assert_same(&task.await.unwrap(), &expected);
+        }
+
+        let metrics = evaluator.metrics();
+        assert_eq!(metrics.expressions, 200);
+        assert!(metrics.batches < 100, "Batches: {}", metrics.batches);
+        assert!(metrics.max_batch_size <= 16 && metrics.max_batch_size > 1);
+        assert!(metrics.mean_batch_size() > 2.0);
+        assert_eq!(metrics.queue_depth, 0);
+        assert!(metrics.max_queue_depth > 1);
+        assert!(metrics.latency_p50 <= metrics.latency_p99);
+        assert!(metrics.latency_p99 > Duration::ZERO);
+    });
+}
+
+#[test]
+fn test_server_shares_compiled_expressions() {
+    runtime().block_on(async {
+        let evaluator = Evaluator::start(ServerConfig { workers: 2, ..ServerConfig::default() });
+        let expected = calculate_batch(&EXPRESSIONS);
+
+        // The first round parses every expression, the second finds all but the empty one compiled
+        for round in 0..2 {
+            let results = evaluator.evaluate_all(&EXPRESSIONS).await.unwrap();
+            for (result, expected) in results.iter().zip(&expected) {
+                assert_same(result, expected);
+            }
+            let metrics = evaluator.metrics();
+            assert_eq!(metrics.cache_entries, 9, "Round: {}", round);
+        }
+        let metrics = evaluator.metrics();
+        assert_eq!(metrics.cache_misses, 11);
+        assert_eq!(metrics.cache_hits, 9);
+
+        // A full cache stays at its capacity
+        let evaluator = Evaluator::start(ServerConfig { cache_capacity: 3, ..ServerConfig::default() });
+        for input in EXPRESSIONS {
+            evaluator.evaluate(input).await.unwrap();
+        }
+        assert_eq!(evaluator.metrics().cache_entries, 3);
+
+        // The least recently used expression is evicted first
+        let evaluator = Evaluator::start(ServerConfig { cache_capacity: 2, ..ServerConfig::default() });
+        for input in ["1 + 1", "2 + 2", "1 + 1", "3 + 3", "1 + 1", "2 + 2"] {
+            evaluator.evaluate(input).await.unwrap();
+        }
+        let metrics = evaluator.metrics();
+        assert_eq!((metrics.cache_hits, metrics.cache_misses), (2, 4));
+        let evaluator = Evaluator::start(ServerConfig { cache_capacity: 0, ..ServerConfig::default() });
+        assert_same(&evaluator.evaluate("2 * 3").await.unwrap(), &calculate_batch(&["2 * 3"])[0]);
+        assert_eq!(evaluator.metrics().cache_entries, 0);
+    });
+}
+
+// Sends `request` and reads one response, returning its status line, headers and body
+async fn exchange(stream: &mut BufReader<TcpStream>, request: &str) -> (String, Vec<String>, String) {
+    stream.get_mut().write_all(request.as_bytes()).await.unwrap();
+    let mut status = String::new();
+    stream.read_line(&mut status).await.unwrap();
+    let mut headers = Vec::new();
+    let mut content_length = 0;
+    loop {
+        let mut line = String::new();
+        stream.read_line(&mut line).await.unwrap();
+        let line = line.trim_end().to_string();
+        if line.is_empty() {
+            break;
+        }
+        if let Some(length) = line.strip_prefix("Content-Length: ") {
+            content_length = length.parse().unwrap();
+        }
+        headers.push(line);
+    }
+    let mut body = vec![0; content_length];
+    stream.read_exact(&mut body).await.unwrap();
+    (status.trim_end().to_string(), headers, String::from_utf8(body).unwrap())
+}
+
+#[test]
+fn test_server_http() {
+    runtime().block_on(async {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let address = listener.local_addr().unwrap();
+        tokio::spawn(serve(listener, Evaluator::start(ServerConfig::default())));
+        let mut stream = BufReader::new(TcpStream::connect(address).await.unwrap());
+
+        // Several requests on one connection
+        let body = "1 + 2\n\n1 / 0\r\n\"say \\\"hi\\\"\"\n";
+        let request = format!("POST /evaluate HTTP/1.1\r\nHost: test\r\nContent-Length: {}\r\n\r\n{}", body.len(), body);
+        let (status, headers, body) = exchange(&mut stream, &request).await;
+        assert_eq!(status, "HTTP/1.1 200 OK");
+        assert!(headers.contains(&"Content-Type: application/x-ndjson".to_string()));
+        assert_eq!(body.lines().collect::<Vec<_>>(), vec![
+            "{\"expression\":\"1 + 2\",\"success\":true,\"result\":3,\"message\":\"Success\"}",
+            "{\"expression\":\"1 / 0\",\"success\":false,\"result\":null,\"message\":\"Division by zero\"}",
+            "{\"expression\":\"say \\\\\\\"hi\\\\\",\"success\":false,\"result\":null,\"message\":\"Undefined variable in expression\"}",
+        ]);
+
+        let (status, _, body) = exchange(&mut stream, "GET /metrics?format=text HTTP/1.1\r\n\r\n").await;
+        assert_eq!(status, "HTTP/1.1 200 OK");
+        assert!(body.contains("# TYPE calculator_latency_seconds summary\n"), "{}", body);
+        assert!(body.contains("calculator_latency_seconds_count 3\n"), "{}", body);
+        assert!(body.contains("calculator_queue_depth 0\n"), "{}", body);
+        assert!(body.contains("calculator_latency_seconds{quantile=\"0.99\"} "), "{}", body);
+
+        let (status, _, _) = exchange(&mut stream, "GET /evaluate HTTP/1.1\r\n\r\n").await;
+        assert_eq!(status, "HTTP/1.1 405 Method Not Allowed");
+        let (status, _, _) = exchange(&mut stream, "GET / HTTP/1.1\r\n\r\n").await;
+        assert_eq!(status, "HTTP/1.1 404 Not Found");
+
+        // Malformed requests are answered, then the connection is closed
+        let (status, headers, _) = exchange(&mut stream, "POST /evaluate HTTP/1.1\r\nContent-Length: x\r\n\r\n").await;
+        assert_eq!(status, "HTTP/1.1 400 Bad Request");
+        assert!(headers.contains(&"Connection: close".to_string()));
+        let mut rest = Vec::new();
+        assert_eq!(stream.read_to_end(&mut rest).await.unwrap(), 0);
+
+        let mut stream = BufReader::new(TcpStream::connect(address).await.unwrap());
+        let request = format!("POST /evaluate HTTP/1.1\r\nContent-Length: {}\r\n\r\n", 2 << 20);
+        let (status, _, _) = exchange(&mut stream, &request).await;
+        assert_eq!(status, "HTTP/1.1 413 Payload Too Large");
+    });
+}
@@ -0,0 +1,75 @@
+use std::sync::Arc;
+use std::thread;
+
+use calculator_backend::{calculate_batch, calculate_batch_par, calculate_expression, infix_to_rpn, EvalContext, History};
+
+#[test]
+fn test_concurrent_calculate_expression() {
+    let handles: Vec<_> = (0..8)
+        .map(|t| {
+            thread::spawn(move || {
+                let mut history = History::new();
+                for i in 0..200 {
+                    let result = calculate_expression(&format!("{} * {} + pi - pi", t, i), &mut history);
+                    assert!(result.success);
+                    assert_eq!(result.result, (t * i) as f64);
+                }
+            })
+        })
+        .collect();
+
+    for handle in handles {
+        handle.join().unwrap();
+    }
+}
+
+#[test]
+fn test_shared_context_and_program() {
+    let history = History::new();
+    let mut context = EvalContext::new();
+    context.set_variable("x", 4.0).unwrap();
+    let program = context.compile(&infix_to_rpn("sqrt(x) + x ^ 2", &history).unwrap()).unwrap();
+
+    let shared = Arc::new((context, program));
+    let handles: Vec<_> = (0..8)
+        .map(|_| {
+            let shared = Arc::clone(&shared);
+            thread::spawn(move || {
+                let (context, program) = &*shared;
+                let mut history = History::new();
+                for _ in 0..200 {
+                    assert_eq!(context.evaluate(program).result_value, 18.0);
+                    assert_eq!(context.calculate_expression("x * 2", &mut history).result, 8.0);
+                }
+            })
+        })
+        .collect();
+
+    for handle in handles {
+        handle.join().unwrap();
+    }
+}
+
+#[test]
+fn test_batch_par_matches_batch() {
+    let inputs: Vec<String> = (0..5000)
+        .map(|i| match i % 4 {
+            0 => format!("{} + 1", i),
+            1 => format!("sin({}) * cos({})", i, i),
+            2 => format!("{} / 0", i),
+            _ => format!("ln({}) - x", i),
+        })
+        .collect();
+    let refs: Vec<&str> = inputs.iter().map(String::as_str).collect();
+
+    let sequential = calculate_batch(&refs);
+    let parallel = calculate_batch_par(&refs);
+    assert_eq!(sequential.len(), parallel.len());
+
+    for (a, b) in sequential.iter().zip(&parallel) {
+        assert_eq!(a.expression, b.expression);
+        assert_eq!(a.success, b.success);
+        assert_eq!(a.result, b.result);
+        assert_eq!(a.message, b.message);
+    }
+}
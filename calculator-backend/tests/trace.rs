@@ -0,0 +1,26 @@
+use calculator_backend::{calculate_expression, convert_rpn, set_trace_level, trace_level, History, TraceLevel};
+
+#[test]
+fn test_trace_level() {
+    assert_eq!(trace_level(), TraceLevel::Off);
+
+    set_trace_level(TraceLevel::Debug);
+    assert_eq!(trace_level(), TraceLevel::Debug);
+
+    // Tracing must not change results or error codes
+    let mut history = History::new();
+    let result = calculate_expression("sin(pi / 2) + 5!", &mut history);
+    assert!(result.success);
+    assert_eq!(result.result, 121.0);
+
+    let result = calculate_expression("1 / 0", &mut history);
+    assert!(!result.success);
+    assert_eq!(result.message, "Division by zero");
+
+    let result = convert_rpn("1 2 + 3 *".to_string());
+    assert!(result.success);
+    assert_eq!(result.infix_expression, "(1 + 2) * 3");
+
+    set_trace_level(TraceLevel::Off);
+    assert_eq!(trace_level(), TraceLevel::Off);
+}
@@ -60,6 +60,8 @@ fn test_tan() {
 }
 
 #[test]
+// Results are rounded to 9 decimals, so some only approximate the constants of `std::f64::consts`
+#[allow(clippy::approx_constant)]
 fn test_inverse_trig() {
     let mut history = History::new();
 
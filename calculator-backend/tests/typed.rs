@@ -0,0 +1,107 @@
+use std::ptr;
+
+use calculator_backend::{
+    calculate_rpn, calculate_rpn_typed, infix_to_rpn, CReversePolishExpression, CToken, CTypedExpression, History,
+    Operator,
+};
+
+// Evaluates an expression through both ABIs and checks they agree exactly
+fn assert_typed_matches_strings(input: &str) {
+    let rpn = infix_to_rpn(input, &History::new()).unwrap();
+    let expr_ptrs = rpn.to_c_expr();
+    let c_expr = CReversePolishExpression {
+        crpn_expression: expr_ptrs.as_ptr(),
+        length: expr_ptrs.len(),
+    };
+    let expected = unsafe { calculate_rpn(&c_expr) };
+    let result = rpn.calculate();
+
+    assert_eq!(result.error_code, expected.error_code, "Expression: {}", input);
+    assert_eq!(result.result_value.to_bits(), expected.result_value.to_bits(), "Expression: {}", input);
+}
+
+#[test]
+fn test_typed_matches_strings() {
+    let long_flat = (1..=600).map(|i| i.to_string()).collect::<Vec<String>>().join(" + ");
+    let deep = format!("{}1{}", "(1 + ".repeat(120), ")".repeat(120));
+    let inputs = [
+        "1 + 2 * 3",
+        "2 ^ 3 ^ 2",
+        "-2.5 * 4",
+        "0.1 + 0.2",
+        "1.23e5 + 4.56e-7",
+        "5! / 3",
+        "√ 16 + sin(pi / 2) + ln(e) + log(1000)",
+        "arcsin(2)",
+        "1 / 0",
+        "x + 1",
+        "(1 + 2",
+        "1 +",
+        "sqrt",
+        "",
+        long_flat.as_str(),
+        deep.as_str(),
+    ];
+    for input in inputs {
+        assert_typed_matches_strings(input);
+    }
+}
+
+#[test]
+fn test_typed_tokens() {
+    let rpn = infix_to_rpn("X * 2.5 + y ^ x", &History::new()).unwrap();
+    let tokens = rpn.typed_tokens();
+
+    assert_eq!(tokens.len(), rpn.len());
+    assert_eq!(tokens[0].as_variable(), Some(0));
+    assert_eq!(tokens[1].as_number(), Some(2.5));
+    assert_eq!(tokens[2].as_operator(), Some(Operator::Multiply));
+    assert_eq!(rpn.variable_name(0), Some("x"));
+    assert_eq!(rpn.variable_name(1), Some("y"));
+    assert_eq!(rpn.variable_name(2), Some("x"));
+    assert_eq!(rpn.variable_name(3), None);
+}
+
+#[test]
+fn test_typed_raw_tokens() {
+    // (3 - 1) ^ 3, built by hand without any token text
+    let tokens = [
+        CToken::number(3.0),
+        CToken::number(1.0),
+        CToken::operator(Operator::Subtract),
+        CToken::number(3.0),
+        CToken::operator(Operator::Power),
+    ];
+    let expr = CTypedExpression {
+        tokens: tokens.as_ptr(),
+        length: tokens.len(),
+        variable_names: ptr::null(),
+        variable_count: 0,
+    };
+    let result = unsafe { calculate_rpn_typed(&expr) };
+    assert_eq!(result.error_code, 0);
+    assert_eq!(result.result_value, 8.0);
+
+    // A variable slot without names is rejected instead of read
+    let tokens = [CToken::variable(0)];
+    let expr = CTypedExpression { tokens: tokens.as_ptr(), length: 1, variable_names: ptr::null(), variable_count: 0 };
+    assert_eq!(unsafe { calculate_rpn_typed(&expr) }.error_code, 4); // MEMORY_ERROR
+}
+
+#[test]
+fn test_typed_to_infix() {
+    let cases = [
+        ("1 + 2 * 3", "1 + 2 * 3"),
+        ("(1 + 2) * 3", "(1 + 2) * 3"),
+        ("2.50 ^ (x - 1)", "2.5 ^ (x - 1)"),
+        ("sin(pi) + 5!", "sin(pi) + 5!"),
+        ("0.1 * 1e22", "0.1 * 1e+22"),
+    ];
+    for (input, expected) in cases {
+        let rpn = infix_to_rpn(input, &History::new()).unwrap();
+        assert_eq!(rpn.to_infix().unwrap(), expected, "Expression: {}", input);
+    }
+
+    let rpn = infix_to_rpn("1 +", &History::new()).unwrap();
+    assert_eq!(rpn.to_infix(), Err("Stack underflow - invalid expression".to_string()));
+}
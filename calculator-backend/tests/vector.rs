@@ -0,0 +1,113 @@
+use std::sync::Mutex;
+
+use calculator_backend::{
+    infix_to_rpn, set_vector_isa, vector_isa, CompiledBatch, CompiledExpression, History, Precision, VectorIsa,
+    VECTOR_ISAS,
+};
+
+// The instruction set is global, so the tests of this file take turns
+static ISA: Mutex<()> = Mutex::new(());
+
+const PRECISIONS: [Precision; 3] = [Precision::Rounded, Precision::Raw, Precision::RoundResult];
+
+// Values at the edges of every domain check and of rounding to 9 decimals
+fn special_values() -> Vec<f64> {
+    let mut values = vec![
+        0.0, -0.0, 1.0, -1.0, 0.5, -0.5, 2.5e-9, -2.5e-9, 1.5e-9, 0.4999999999e-9, 1.0000000005, -1.0000000005,
+        4503599.6274, 4503599627370496.0, -4503599627370497.0, 1e300, -1e300, f64::MIN_POSITIVE, 5e-324, -5e-324,
+        f64::MAX, f64::INFINITY, f64::NEG_INFINITY, f64::NAN, -f64::NAN, std::f64::consts::PI, 1.0 + f64::EPSILON,
+        -1.0 - f64::EPSILON, 123456.1234567895, -987.0000000005,
+    ];
+    // And enough pseudo-random values for several blocks with a tail
+    let mut seed: u64 = 0x2545F4914F6CDD1D;
+    for i in 0..600 {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        let scale = [1e-10, 1e-3, 1.0, 1e3, 1e9][i % 5];
+        values.push(((seed >> 11) as f64 / (1u64 << 53) as f64 - 0.5) * 4.0 * scale);
+    }
+    values
+}
+
+fn compile(input: &str) -> CompiledExpression {
+    infix_to_rpn(input, &History::new()).unwrap().compile().unwrap()
+}
+
+fn bits(values: &[f64]) -> Vec<u64> {
+    values.iter().map(|value| value.to_bits()).collect()
+}
+
+#[test]
+fn test_every_isa_matches_scalar() {
+    let _guard = ISA.lock().unwrap();
+    let initial = vector_isa();
+    assert!(initial.is_supported() && VectorIsa::Scalar.is_supported());
+
+    let inputs = [
+        "sqrt(x)", "log(x)", "ln(x)", "arcsin(x)", "arccos(x)", "x + y", "x * y - 1", "x / y", "x ^ 2 + 0.1", "x ^ 3",
+        "sqrt(x * y) + ln(y)", "arcsin(x / 3) * tan(y)", "log(x) / sqrt(y) + arccos(y)", "sin(x) + atan(y)", "x + 1 / 0",
+    ];
+    let programs: Vec<CompiledExpression> = inputs.iter().map(|input| compile(input)).collect();
+    let batch = CompiledBatch::new(&programs.iter().collect::<Vec<_>>()).unwrap();
+    let xs = special_values();
+    let ys: Vec<f64> = xs.iter().rev().copied().collect();
+    let bindings = [("x", &xs[..]), ("y", &ys[..])];
+
+    let evaluate = |isa: VectorIsa, precision: Precision| {
+        set_vector_isa(isa).unwrap();
+        assert_eq!(vector_isa(), isa);
+        let columns: Vec<_> =
+            programs.iter().map(|program| program.evaluate_columns_with_precision(&bindings, precision).unwrap()).collect();
+        (columns, batch.evaluate_columns_with_precision(&bindings, precision).unwrap())
+    };
+    for precision in PRECISIONS {
+        let (columns, batched) = evaluate(VectorIsa::Scalar, precision);
+        for isa in VECTOR_ISAS.into_iter().filter(|isa| isa.is_supported()) {
+            let (other_columns, other_batched) = evaluate(isa, precision);
+            for (i, input) in inputs.iter().enumerate() {
+                for (expected, result) in [(&columns[i], &other_columns[i]), (&batched[i], &other_batched[i])] {
+                    assert_eq!(result.error_codes, expected.error_codes, "{} with {:?}", input, isa);
+                    assert_eq!(bits(&result.values), bits(&expected.values), "{} with {:?}", input, isa);
+                }
+            }
+        }
+    }
+    set_vector_isa(initial).unwrap();
+}
+
+#[test]
+fn test_kernels_check_domains() {
+    let _guard = ISA.lock().unwrap();
+    let initial = vector_isa();
+    let xs = [4.0, -4.0, 0.0, -0.0, 1e-320, -1e-320, 0.5, 1.5, -1.0, f64::NAN];
+    for isa in VECTOR_ISAS.into_iter().filter(|isa| isa.is_supported()) {
+        set_vector_isa(isa).unwrap();
+        let codes = |input: &str| compile(input).evaluate_columns(&[("x", &xs)]).unwrap().error_codes;
+        assert_eq!(codes("sqrt(x)"), vec![0, 9, 0, 0, 0, 9, 0, 0, 9, 0]);
+        assert_eq!(codes("log(x)"), vec![0, 10, 10, 10, 0, 10, 0, 0, 10, 0]);
+        assert_eq!(codes("ln(x)"), vec![0, 11, 11, 11, 0, 11, 0, 0, 11, 0]);
+        assert_eq!(codes("arcsin(x)"), vec![13, 13, 0, 0, 0, 0, 0, 13, 0, 0]);
+        // An earlier error is kept
+        assert_eq!(codes("arccos(1 / x)")[2..4], [1, 1]);
+
+        let result = compile("sqrt(x) - 1").evaluate_columns(&[("x", &xs)]).unwrap();
+        assert_eq!(result.values[..4], [1.0, 0.0, -1.0, -1.0]);
+        assert!(result.values[9].is_nan());
+    }
+    set_vector_isa(initial).unwrap();
+}
+
+#[test]
+fn test_unsupported_isa() {
+    let _guard = ISA.lock().unwrap();
+    let initial = vector_isa();
+    if cfg!(target_arch = "x86_64") {
+        assert!(VectorIsa::Sse2.is_supported() && !VectorIsa::Neon.is_supported());
+        assert!(initial != VectorIsa::Scalar);
+    }
+    for isa in VECTOR_ISAS.into_iter().filter(|isa| !isa.is_supported()) {
+        assert!(set_vector_isa(isa).is_err());
+        assert_eq!(vector_isa(), initial);
+    }
+}
@@ -1,7 +1,7 @@
 /// ./src/gui.rs
 /// This file contains the GUI implementation for the calculator application.
 
-use calculator_backend::{calculate_expression, History};
+use calculator_backend::{calculate_expression, History, Precision, Preview, PreviewWorker};
 use eframe::egui;
 use egui::{Frame, Margin, Color32, TextEdit, Vec2, FontId, CornerRadius, RichText};
 
@@ -18,6 +18,11 @@ pub struct CalcGUI {
     //history_string: String,
     selected_mode: Mode,
     history: History,
+    live_preview: bool,
+    // Evaluates previews off the frame thread, started on the first frame that needs one
+    preview_worker: Option<PreviewWorker>,
+    previewed_input: String,
+    preview: Option<Preview>,
 }
 
 impl CalcGUI {
@@ -27,7 +32,10 @@ impl CalcGUI {
             derived_number: None,
             selected_mode: Mode::Basic,
             history: History::new(),
-
+            live_preview: true,
+            preview_worker: None,
+            previewed_input: String::new(),
+            preview: None,
         }
     }
     
@@ -37,6 +45,25 @@ impl CalcGUI {
         self.derived_number = Some(result.result as f64);
         //self.history_string = Some(result.history as String);
     }
+
+    /// Requests a preview whenever the input changed since the last one, and picks up finished previews.
+    /// The worker asks for a repaint when a preview is ready, so nothing is evaluated on this thread.
+    fn update_preview(&mut self, ctx: &egui::Context) {
+        if !self.live_preview {
+            return;
+        }
+        let worker = self.preview_worker.get_or_insert_with(|| {
+            let ctx = ctx.clone();
+            PreviewWorker::spawn(Precision::default(), move || ctx.request_repaint())
+        });
+        if self.input_value != self.previewed_input {
+            self.previewed_input.clone_from(&self.input_value);
+            worker.request(&self.input_value, &self.history);
+        }
+        if let Some(preview) = worker.take_result() {
+            self.preview = Some(preview);
+        }
+    }
 }
 
 const MENU_INDENT: i8 = 35;
@@ -66,6 +93,22 @@ impl eframe::App for CalcGUI {
                 }
             });
 
+            //Live preview of the input being typed
+            self.update_preview(ctx);
+            ui.horizontal(|ui| {
+                ui.checkbox(&mut self.live_preview, "Live");
+                let preview = self.preview.as_ref().filter(|_| self.live_preview && !self.input_value.trim().is_empty());
+                if let Some(preview) = preview {
+                    let stale = preview.input() != self.input_value;
+                    let text = match preview.value() {
+                        Some(value) => RichText::new(format!("= {}", value)),
+                        None => RichText::new(preview.message()).color(Color32::RED),
+                    };
+                    let text = if stale { text.weak() } else { text };
+                    ui.label(text.font(FontId::proportional(15.0)));
+                }
+            });
+
             ui.separator();
             
             
@@ -231,7 +274,7 @@ impl eframe::App for CalcGUI {
                             .show(ui, |ui| {
                                 ui.horizontal(|ui| {
                                     if ui.add_sized(Vec2::new(20.0, 20.0), egui::Button::new("Clear")).clicked() {
-                                        self.history.entries.clear();
+                                        self.history.clear();
                                     }
                                     
                                 });
@@ -243,15 +286,15 @@ impl eframe::App for CalcGUI {
                                     egui::ScrollArea::vertical()
                                         .auto_shrink([false; 2])
                                         .show(ui, |ui| {
-                                            for (i, entry) in self.history.entries.iter().enumerate() {
-                                                if let Some(result) = entry.result {
+                                            for (i, entry) in self.history.get_history().iter().enumerate() {
+                                                if let Some(result) = entry.result() {
                                                     ui.label(
-                                                        RichText::new(format!("{}: {} = {}", i + 1, entry.input, result))
+                                                        RichText::new(format!("{}: {} = {}", i + 1, entry.input(), result))
                                                             .font(FontId::proportional(15.0))
                                                     );
-                                                } else if let Some(error) = &entry.error_message {
+                                                } else if let Some(error) = entry.error_message() {
                                                     ui.label(
-                                                        RichText::new(format!("{}: {} = Error: {}", i + 1, entry.input, error))
+                                                        RichText::new(format!("{}: {} = Error: {}", i + 1, entry.input(), error))
                                                             .font(FontId::proportional(15.0))
                                                             .color(Color32::RED)
                                                     );